@@ -0,0 +1,161 @@
+// Multi-slicer AFSK demodulator for packetd
+// Mark and space come from two slaves of one fast convolution filter on the audio, each shifted
+// to 0 Hz and decimated, then integrated over one bit time (a matched filter for a tone burst)
+// to give the mark and space energies shared by all the slicers. The slicers then compare them with different space/mark
+// gain ratios (to cope with transmitter and receiver twist) and sample at different points in the bit,
+// each with its own clock recovery and HDLC deframer. A frame decoded by more than one slicer
+// is sent only once, recognized by its length and FCS
+// Copyright 2024, Phil Karn, KA9Q
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+
+#include "misc.h"
+#include "afsk.h"
+
+// Space/mark gain ratios in dB, and sampling offsets in fractions of a bit
+static float const Gains[AFSK_GAINS] = { -6, -3, 0, +3, +6 };
+static float const Offsets[AFSK_OFFSETS] = { -0.125, 0, +0.125 };
+static float const Pll_inertia = 0.75; // Fraction of the clock phase error kept at each transition
+static int const Samples_per_bit = 8;  // Target decimated rate
+static float const Kaiser_beta = 3.0;
+
+static void slice(struct afsk *a,struct afsk_slicer *sl,float mark,float space,int index);
+static void afsk_frame(struct afsk *a,uint8_t const *frame,int bytes,int index);
+
+// L and M as in packetd's original demodulator: 20 ms blocks at 48 kHz
+static int const AL = 960;
+static int const AM = 961;
+
+int afsk_init(struct afsk *a,int samprate,float bitrate,float mark,float space,
+	      void (*output)(void *arg,uint8_t const *frame,int bytes),void *arg){
+  assert(a != NULL && output != NULL);
+  memset(a,0,sizeof(*a));
+  a->samprate = samprate;
+  a->output = output;
+  a->arg = arg;
+  if(create_filter_input(&a->in,AL,AM,REAL,FFT_SHORT) == NULL)
+    return -1;
+
+  // Decimate to about 8 samples/bit when the block size allows; the filter can't interpolate
+  int olen = AL;
+  int const target = Samples_per_bit * bitrate;
+  if(target < samprate && ((long)AL * target) % samprate == 0)
+    olen = (long)AL * target / samprate;
+  a->out_samprate = (long)samprate * olen / AL;
+
+  create_filter_output(&a->mark,&a->in,NULL,olen,COMPLEX);
+  create_filter_output(&a->space,&a->in,NULL,olen,COMPLEX);
+  // Each tone spun down to 0 Hz; the passband only has to keep most of a one-bit burst
+  // while rejecting the other tone, as the bit integrator does the real noise filtering
+  float const bw = 0.75 * bitrate;
+  set_filter(&a->mark,-bw/a->out_samprate,bw/a->out_samprate,Kaiser_beta);
+  set_filter(&a->space,-bw/a->out_samprate,bw/a->out_samprate,Kaiser_beta);
+  // Rotations in FFT bins; any remainder just puts the tone slightly off center
+  int const N = AL + AM - 1;
+  a->mark_shift = lroundf(mark * N / samprate);
+  a->space_shift = lroundf(space * N / samprate);
+
+  a->spb = min(AFSK_MAX_SPB,(int)lroundf(a->out_samprate / bitrate));
+  a->twist = mark / space; // Scale back upper tone from FM demod, as before
+  a->step = lround(4294967296.0 * bitrate / a->out_samprate);
+  a->dedup_window = a->out_samprate / 4;
+  for(int g=0; g < AFSK_GAINS; g++){
+    for(int o=0; o < AFSK_OFFSETS; o++){
+      struct afsk_slicer * const sl = &a->slicer[g * AFSK_OFFSETS + o];
+      sl->gain = dB2power(Gains[g]);
+      sl->offset = (uint32_t)lround(4294967296.0 * Offsets[o]);
+      hdlc_init(&sl->hdlc);
+    }
+  }
+  return 0;
+}
+
+void afsk_free(struct afsk *a){
+  if(a == NULL)
+    return;
+  delete_filter_output(&a->mark);
+  delete_filter_output(&a->space);
+  delete_filter_input(&a->in);
+}
+
+// Process n audio samples; may be any length
+void afsk_process(struct afsk *a,float const *samples,int n){
+  assert(a != NULL);
+  while(n > 0){
+    int const chunk = min(n,a->in.ilen - a->in.wcnt);
+    write_rfilter(&a->in,samples,chunk);
+    samples += chunk;
+    n -= chunk;
+    if(a->in.wcnt != 0)
+      continue;
+
+    // Complete block
+    execute_filter_output(&a->mark,a->mark_shift);
+    execute_filter_output(&a->space,a->space_shift);
+    for(int i=0; i < a->mark.olen; i++){
+      // Integrate and dump over the last bit time. Summed afresh each sample rather than
+      // kept as a running sum so rounding errors can't accumulate
+      a->mark_history[a->hindex] = a->mark.output.c[i];
+      a->space_history[a->hindex] = a->space.output.c[i];
+      if(++a->hindex == a->spb)
+	a->hindex = 0;
+      complex float msum = 0, ssum = 0;
+      for(int k=0; k < a->spb; k++){
+	msum += a->mark_history[k];
+	ssum += a->space_history[k];
+      }
+      float const m = cnrmf(msum);
+      float const s = a->twist * cnrmf(ssum);
+      a->samples++;
+      for(int k=0; k < AFSK_SLICERS; k++)
+	slice(a,&a->slicer[k],m,s,k);
+    }
+  }
+}
+
+static void slice(struct afsk *a,struct afsk_slicer *sl,float mark,float space,int index){
+  float const d = mark - sl->gain * space;
+
+  // Nudge the bit clock toward zero phase at each tone transition
+  if((d > 0) != (sl->last > 0))
+    sl->pll = (uint32_t)(int32_t)(Pll_inertia * (int32_t)sl->pll);
+  sl->last = d;
+
+  int32_t const before = sl->pll - sl->offset;
+  sl->pll += a->step;
+  int32_t const after = sl->pll - sl->offset;
+  if(!(before >= 0 && after < 0))
+    return; // Not yet at the sampling point
+
+  bool const bit = d > 0;
+  sl->bits |= (bit == sl->last_bit) << sl->nbits; // No transition == NRZI one
+  sl->last_bit = bit;
+  if(++sl->nbits < 8)
+    return;
+  int const bytes = hdlc_process_bits(&sl->hdlc,sl->bits,sl->nbits);
+  sl->bits = 0;
+  sl->nbits = 0;
+  if(bytes > 0)
+    afsk_frame(a,sl->hdlc.frame,bytes,index);
+}
+
+static void afsk_frame(struct afsk *a,uint8_t const *frame,int bytes,int index){
+  uint16_t const fcs = frame[bytes-2] | frame[bytes-1] << 8;
+  for(int i=0; i < AFSK_RECENT; i++){
+    if(a->recent[i].len == bytes && a->recent[i].fcs == fcs
+       && a->samples - a->recent[i].time < (uint64_t)a->dedup_window){
+      a->dups++;
+      return;
+    }
+  }
+  a->recent[a->next_recent].fcs = fcs;
+  a->recent[a->next_recent].len = bytes;
+  a->recent[a->next_recent].time = a->samples;
+  a->next_recent = (a->next_recent + 1) % AFSK_RECENT;
+  a->frames++;
+  a->slicer_frames[index]++;
+  (*a->output)(a->arg,frame,bytes);
+}
@@ -0,0 +1,69 @@
+// Multi-slicer AFSK demodulator for packetd
+// Copyright 2024, Phil Karn, KA9Q
+#ifndef _AFSK_H
+#define _AFSK_H 1
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include "filter.h"
+#include "hdlc.h"
+
+#define AFSK_GAINS 5      // Space/mark tone gain ratios
+#define AFSK_OFFSETS 3    // Bit sampling offsets
+#define AFSK_SLICERS (AFSK_GAINS * AFSK_OFFSETS)
+#define AFSK_RECENT 8     // Recently sent frames remembered for de-duplication
+#define AFSK_MAX_SPB 64   // Longest bit integrator, in filter output samples
+
+// One slicer: tone gain ratio, bit clock recovery, NRZI decoding and its own deframer
+struct afsk_slicer {
+  float gain;          // Applied to space energy before comparing with mark
+  uint32_t offset;     // Sampling point relative to mid-bit, in bit clock phase units
+  uint32_t pll;        // Bit clock phase; transitions expected at 0, bits sampled at 2^31 + offset
+  float last;          // Previous mark - space value, for transition detection
+  bool last_bit;       // Previous sampled tone, for NRZI decoding
+  unsigned int bits;   // NRZI-decoded bits waiting for the deframer, oldest in the LSB
+  int nbits;
+  struct hdlc hdlc;
+};
+
+struct afsk {
+  int samprate;        // Input audio sample rate
+  int out_samprate;    // Decimated rate of the mark and space filters
+  struct filter_in in;
+  struct filter_out mark;
+  struct filter_out space;
+  int mark_shift;
+  int space_shift;
+  int spb;             // Filter output samples per bit, the integration length
+  complex float mark_history[AFSK_MAX_SPB]; // Last bit time of mark filter output
+  complex float space_history[AFSK_MAX_SPB];
+  int hindex;          // Next history entry to overwrite
+  float twist;         // Fixed space energy scaling, before the per-slicer gains
+  uint32_t step;       // Bit clock phase increment per filter output sample
+  struct afsk_slicer slicer[AFSK_SLICERS];
+
+  // De-duplication of frames decoded by more than one slicer
+  uint64_t samples;    // Filter output samples processed
+  int dedup_window;    // Samples within which a frame with the same length and FCS is a duplicate
+  struct {
+    uint16_t fcs;
+    int len;
+    uint64_t time;
+  } recent[AFSK_RECENT];
+  int next_recent;
+
+  void (*output)(void *arg,uint8_t const *frame,int bytes);
+  void *arg;
+
+  // Statistics
+  unsigned long frames;  // Unique good frames
+  unsigned long dups;    // Good frames suppressed as duplicates
+  unsigned long slicer_frames[AFSK_SLICERS]; // Good frames first decoded by each slicer
+};
+
+int afsk_init(struct afsk *a,int samprate,float bitrate,float mark,float space,
+	      void (*output)(void *arg,uint8_t const *frame,int bytes),void *arg);
+void afsk_process(struct afsk *a,float const *samples,int n);
+void afsk_free(struct afsk *a);
+
+#endif
@@ -1,5 +1,7 @@
 // Audio multicast routines for ka9q-radio
 // Handles linear 16-bit PCM, mono and stereo
+// Opus is encoded by a pool of encoder threads fed through a ring per channel,
+// so a burst of Opus channels doesn't make the demod threads miss their blocks
 // Copyright 2017-2024 Phil Karn, KA9Q
 
 #define _GNU_SOURCE 1
@@ -14,6 +16,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "misc.h"
 #include "multicast.h"
@@ -28,6 +31,22 @@ int Application = OPUS_APPLICATION_AUDIO; // Encoder optimization mode
 bool Fec_enable = false;                  // Use forward error correction
 int Opus_bitrate = 32000;        // Opus stream audio bandwidth; default 32 kb/s
 bool Discontinuous = false;        // Off by default
+int N_encoder_threads = 2;         // Set by encoder-threads in [global]
+
+#define ENCODER_THREADS_MAX 16
+#define OPUS_RECOVER 250           // Consecutive quick blocks (5 sec at 20 ms) before raising complexity a step
+
+// Encoder pool. The ready queue holds channels with blocks waiting in their rings
+static pthread_once_t Pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t Pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Pool_cond = PTHREAD_COND_INITIALIZER; // Ready queue no longer empty
+static pthread_cond_t Idle_cond = PTHREAD_COND_INITIALIZER; // A channel was released by its encoder thread
+static struct channel *Ready_head;
+static struct channel *Ready_tail;
+static pthread_t Encoder_thread[ENCODER_THREADS_MAX];
+
+static void send_packet(struct channel *chan,uint8_t const *packet,int len,int bytes,int samples);
+static int send_opus(struct channel * restrict chan,float const * restrict buffer,int frames);
 
 // Send PCM output on stream; # of channels implicit in chan->output.channels
 int send_output(struct channel * restrict const chan,float const * restrict buffer,int frames,bool const mute){
@@ -35,6 +54,10 @@ int send_output(struct channel * restrict const chan,float const * restrict buff
   if(frames <= 0 || chan->output.channels == 0 || chan->output.samprate == 0)
     return 0;
 
+  // After a switch from Opus, let the pool send what it has queued; it would otherwise race us on rtp.seq
+  if(chan->output.encoding != OPUS && chan->output.opus_ring != NULL)
+    close_opus(chan);
+
   if(mute){
     // Still increment timestamp
     if(chan->output.encoding == OPUS)
@@ -60,8 +83,7 @@ int send_output(struct channel * restrict const chan,float const * restrict buff
     break;
 #endif
   case OPUS:
-    max_frames_per_pkt = INT_MAX; // No limit since they get compressed to a buffer limit
-    break;
+    return send_opus(chan,buffer,frames);
   default:
     return 0; // Don't send anything
     break;
@@ -125,84 +147,294 @@ int send_output(struct channel * restrict const chan,float const * restrict buff
       }
       break;
 #endif
-    case OPUS:
-      if(chan->output.opus != NULL){
-	// See if the parameters have changed
-	// There doesn't seem to be any way to read back the channel count, so we save that explicitly
-	// If the sample rate changes we'll get restarted anyway, so this test isn't really needed. But do it anyway.
-	int s;
-	opus_encoder_ctl(chan->output.opus,OPUS_GET_SAMPLE_RATE(&s));
-	if(s != chan->output.samprate || chan->output.opus_channels != chan->output.channels){
-	  opus_encoder_destroy(chan->output.opus);
-	  chan->output.opus = NULL;
-	  chan->output.opus_channels = 0;
-	}
+    default:
+      chan->output.silent = true;
+      break;
+    }
+    if(!chan->output.silent)
+      send_packet(chan,packet,bytes + (dp - packet),bytes,chunk * chan->output.channels);
+    frames -= chunk;
+    if(chan->output.pacing && frames > 0)
+      usleep(pacing);
+  }
+  return 0;
+}
+
+static void send_packet(struct channel *chan,uint8_t const *packet,int len,int bytes,int samples){
+  int r = sendto(Output_fd,packet,len,0,(struct sockaddr *)&chan->output.dest_socket,sizeof(chan->output.dest_socket));
+  chan->output.rtp.bytes += bytes;
+  chan->output.rtp.packets++;
+  chan->output.rtp.seq++;
+  chan->output.samples += samples; // Count stereo frames
+  if(r <= 0){
+    if(errno == EAGAIN){
+      if(!TempSendFailure){
+	fprintf(stdout,"Temporary send failure, suggest increased buffering (see sysctl net.core.wmem_max, net.core.wmem_default\n");
+	fprintf(stdout,"Additional messages suppressed\n");
+	TempSendFailure = true;
       }
-      if(chan->output.opus == NULL){
-	int error = OPUS_OK;
-
-	// Opus only supports a specific set of sample rates
-	if(chan->output.samprate != 48000 && chan->output.samprate != 24000 && chan->output.samprate != 16000 && chan->output.samprate != 12000
-	   && chan->output.samprate != 8000){
-	  chan->output.silent = true;
-	  break; // Simply drop until somebody fixes it
-	}
-	chan->output.opus = opus_encoder_create(chan->output.samprate,chan->output.channels,Application,&error);
-	assert(error == OPUS_OK && chan->output.opus);
-	chan->output.opus_channels = chan->output.channels; // In case it changes
+    } else {
+      fprintf(stdout,"audio send failure: %s\n",strerror(errno));
+      abort(); // Probably more serious, like the loss of an interface or route
+    }
+  }
+}
 
-	error = opus_encoder_ctl(chan->output.opus,OPUS_SET_DTX(Discontinuous)); // Create an option to set this
-	assert(error == OPUS_OK);
+// Lower the encoder complexity a step when a block took more than half a block time to get through,
+// measured from when send_output() handed it off, and raise it a step (up to the requested setting)
+// after OPUS_RECOVER blocks in a row that took less than an eighth
+// Blocks handed off before the last cut don't count against it again
+static void adapt_complexity(struct channel *chan,struct opus_block const *bp,int64_t done){
+  int64_t const lag = done - bp->queued;
+  int64_t const block_ns = Blocktime * MILLION; // Blocktime is in ms
+  int c = chan->output.opus_complexity_now;
+  if(lag > block_ns / 2){
+    chan->output.opus_fast = 0;
+    if(bp->queued > chan->output.opus_cut_time && c > 0){
+      c--;
+      chan->output.opus_cut_time = done;
+    }
+  } else if(lag < block_ns / 8){
+    if(++chan->output.opus_fast >= OPUS_RECOVER){
+      chan->output.opus_fast = 0;
+      c++;
+    }
+  } else
+    chan->output.opus_fast = 0;
 
-	error = opus_encoder_ctl(chan->output.opus,OPUS_SET_BITRATE(chan->output.opus_bitrate));
-	assert(error == OPUS_OK);
+  c = min(c,chan->output.opus_complexity);
+  if(c < 0)
+    c = 0;
+  if(c != chan->output.opus_complexity_now){
+    opus_encoder_ctl(chan->output.opus,OPUS_SET_COMPLEXITY(c));
+    chan->output.opus_complexity_now = c;
+  }
+}
 
-	if(Fec_enable){ // Create an option to set this, but understand it first
-	  error = opus_encoder_ctl(chan->output.opus,OPUS_SET_INBAND_FEC(1));
-	  assert(error == OPUS_OK);
-	  error = opus_encoder_ctl(chan->output.opus,OPUS_SET_PACKET_LOSS_PERC(Fec_enable));
-	  assert(error == OPUS_OK);
-	}
-      }
-      bytes = opus_encode_float(chan->output.opus,buffer,chunk,dp,sizeof(packet) - (dp-packet)); // Max # bytes in compressed output buffer
-      assert(bytes >= 0);
-      if(Discontinuous && bytes < 3){
-	chan->output.silent = true;
-	bytes = 0;
-      }
-      buffer += chunk * chan->output.channels;
-      chan->output.rtp.timestamp += chunk * 48000 / chan->output.samprate; // Always increases at 48 kHz
-      break;
-    default:
-      chan->output.silent = true;
-      break;
+// Encode one block and send it
+// Runs in the encoder thread holding the channel, or in the demod thread when there's no pool
+static void encode_block(struct channel *chan,struct opus_block const *bp,float const *pcm){
+  if(chan->output.opus != NULL){
+    // See if the parameters have changed
+    // There doesn't seem to be any way to read back the channel count, so we save that explicitly
+    // If the sample rate changes we'll get restarted anyway, so this test isn't really needed. But do it anyway.
+    int s;
+    opus_encoder_ctl(chan->output.opus,OPUS_GET_SAMPLE_RATE(&s));
+    if(s != bp->samprate || chan->output.opus_channels != bp->channels){
+      opus_encoder_destroy(chan->output.opus);
+      chan->output.opus = NULL;
+      chan->output.opus_channels = 0;
     }
-    if(!chan->output.silent){
-      int r = sendto(Output_fd,&packet,bytes + (dp - packet),0,(struct sockaddr *)&chan->output.dest_socket,sizeof(chan->output.dest_socket));
-      chan->output.rtp.bytes += bytes;
-      chan->output.rtp.packets++;
-      chan->output.rtp.seq++;
-      chan->output.samples += chunk * chan->output.channels; // Count stereo frames
-      if(r <= 0){
-	if(errno == EAGAIN){
-	  if(!TempSendFailure){
-	    fprintf(stdout,"Temporary send failure, suggest increased buffering (see sysctl net.core.wmem_max, net.core.wmem_default\n");
-	    fprintf(stdout,"Additional messages suppressed\n");
-	    TempSendFailure = true;
-	  }
-	} else {
-	  fprintf(stdout,"audio send failure: %s\n",strerror(errno));
-	  abort(); // Probably more serious, like the loss of an interface or route
+  }
+  if(chan->output.opus == NULL){
+    int error = OPUS_OK;
+    chan->output.opus = opus_encoder_create(bp->samprate,bp->channels,Application,&error);
+    assert(error == OPUS_OK && chan->output.opus);
+    chan->output.opus_channels = bp->channels; // In case it changes
+
+    error = opus_encoder_ctl(chan->output.opus,OPUS_SET_DTX(Discontinuous)); // Create an option to set this
+    assert(error == OPUS_OK);
+
+    error = opus_encoder_ctl(chan->output.opus,OPUS_SET_BITRATE(chan->output.opus_bitrate));
+    assert(error == OPUS_OK);
+
+    chan->output.opus_complexity_now = chan->output.opus_complexity;
+    chan->output.opus_fast = 0;
+    error = opus_encoder_ctl(chan->output.opus,OPUS_SET_COMPLEXITY(chan->output.opus_complexity_now));
+    assert(error == OPUS_OK);
+
+    if(Fec_enable){ // Create an option to set this, but understand it first
+      error = opus_encoder_ctl(chan->output.opus,OPUS_SET_INBAND_FEC(1));
+      assert(error == OPUS_OK);
+      error = opus_encoder_ctl(chan->output.opus,OPUS_SET_PACKET_LOSS_PERC(Fec_enable));
+      assert(error == OPUS_OK);
+    }
+  }
+  struct rtp_header rtp;
+  memset(&rtp,0,sizeof(rtp));
+  rtp.version = RTP_VERS;
+  rtp.type = bp->type;
+  rtp.ssrc = chan->output.rtp.ssrc;
+  rtp.marker = bp->marker || chan->output.opus_silent;
+  rtp.timestamp = bp->timestamp;
+  rtp.seq = chan->output.rtp.seq;
+  uint8_t packet[PKTSIZE];
+  uint8_t * const dp = (uint8_t *)hton_rtp(packet,&rtp); // First byte after RTP header
+
+  int64_t const start = gps_time_ns();
+  int bytes = opus_encode_float(chan->output.opus,pcm,bp->frames,dp,sizeof(packet) - (dp-packet)); // Max # bytes in compressed output buffer
+  int64_t const done = gps_time_ns();
+  assert(bytes >= 0);
+  int bin = 0;
+  for(int64_t us = (done - start) / 1000; us > 0 && bin < OPUS_TIME_BINS-1; us >>= 1)
+    bin++;
+  chan->output.opus_time[bin]++;
+  adapt_complexity(chan,bp,done);
+
+  if(Discontinuous && bytes < 3){
+    chan->output.opus_silent = true;
+    return;
+  }
+  chan->output.opus_silent = false;
+  send_packet(chan,packet,bytes + (dp - packet),bytes,bp->frames * bp->channels);
+}
+
+// Encoder pool thread: take channels off the ready queue and encode everything in their rings
+// Only one thread holds a channel at a time, so each ring still has a single consumer
+// Not real time: when the CPU is short the demod threads come first, and the encoders fall behind
+// and lower their complexity instead
+static void *run_encoder(void *arg){
+  {
+    char name[16];
+    snprintf(name,sizeof(name),"opus enc %d",(int)(intptr_t)arg);
+    pthread_setname(name);
+  }
+  while(true){
+    pthread_mutex_lock(&Pool_mutex);
+    while(Ready_head == NULL)
+      pthread_cond_wait(&Pool_cond,&Pool_mutex);
+    struct channel * const chan = Ready_head;
+    struct opus_ring * const ring = chan->output.opus_ring;
+    Ready_head = ring->ready_next;
+    if(Ready_head == NULL)
+      Ready_tail = NULL;
+    pthread_mutex_unlock(&Pool_mutex);
+
+    while(true){
+      unsigned int const tail = ring->tail;
+      if(tail == __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE)){
+	// Last look under the lock: a block put before the demod thread saw us still scheduled is visible now
+	pthread_mutex_lock(&Pool_mutex);
+	bool const empty = tail == __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE);
+	if(empty){
+	  ring->scheduled = false; // From here on the demod thread may requeue or free it
+	  pthread_cond_broadcast(&Idle_cond);
 	}
+	pthread_mutex_unlock(&Pool_mutex);
+	if(empty)
+	  break;
       }
+      struct opus_block const * const bp = &ring->block[tail % OPUS_RING];
+      encode_block(chan,bp,bp->pcm);
+      __atomic_store_n(&ring->tail,tail + 1,__ATOMIC_RELEASE);
+    }
+  }
+  return NULL;
+}
+
+static void start_encoders(void){
+  for(int i=0; i < N_encoder_threads && i < ENCODER_THREADS_MAX; i++)
+    pthread_create(&Encoder_thread[i],NULL,run_encoder,(void *)(intptr_t)i);
+}
+
+// Wait until the pool is done with the channel's ring, then free it
+// Blocks already queued are encoded and sent first
+static void free_ring(struct channel *chan){
+  struct opus_ring *ring = chan->output.opus_ring;
+  if(ring == NULL)
+    return;
+  pthread_mutex_lock(&Pool_mutex);
+  while(ring->scheduled)
+    pthread_cond_wait(&Idle_cond,&Pool_mutex);
+  pthread_mutex_unlock(&Pool_mutex);
+  for(int i=0; i < OPUS_RING; i++)
+    FREE(ring->block[i].pcm);
+  FREE(ring);
+  chan->output.opus_ring = NULL;
+}
+
+static struct opus_ring *alloc_ring(int size){
+  struct opus_ring *ring = calloc(1,sizeof(*ring));
+  if(ring == NULL)
+    return NULL;
+  ring->size = size;
+  for(int i=0; i < OPUS_RING; i++){
+    ring->block[i].pcm = malloc(size * sizeof(float));
+    if(ring->block[i].pcm == NULL){
+      for(int j=0; j < i; j++)
+	FREE(ring->block[j].pcm);
+      FREE(ring);
+      return NULL;
     }
-    frames -= chunk;
-    if(chan->output.pacing && frames > 0)
-      usleep(pacing);
   }
+  return ring;
+}
+
+// Hand a block of Opus output to the encoder pool, or encode it here if there isn't one
+static int send_opus(struct channel * restrict const chan,float const * restrict buffer,int frames){
+  // Opus only supports a specific set of sample rates
+  int const samprate = chan->output.samprate;
+  if(samprate != 48000 && samprate != 24000 && samprate != 16000 && samprate != 12000 && samprate != 8000){
+    chan->output.silent = true;
+    return 0; // Simply drop until somebody fixes it
+  }
+  struct opus_block block = {
+    .queued = gps_time_ns(),
+    .timestamp = chan->output.rtp.timestamp,
+    .marker = chan->output.silent, // set when transitioning from silent to not silent
+    .type = chan->output.rtp.type,
+    .samprate = samprate,
+    .channels = chan->output.channels,
+    .frames = frames,
+  };
+  chan->output.rtp.timestamp += frames * 48000 / samprate; // Always increases at 48 kHz
+  chan->output.silent = false;
+
+  if(N_encoder_threads <= 0){
+    encode_block(chan,&block,buffer);
+    return 0;
+  }
+  pthread_once(&Pool_once,start_encoders);
+  int const size = frames * block.channels;
+  if(chan->output.opus_ring != NULL && chan->output.opus_ring->size < size)
+    free_ring(chan); // Block size went up; rare
+  if(chan->output.opus_ring == NULL && (chan->output.opus_ring = alloc_ring(size)) == NULL){
+    chan->output.silent = true;
+    return -1;
+  }
+  struct opus_ring * const ring = chan->output.opus_ring;
+  unsigned int const head = ring->head;
+  if(head - __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE) >= OPUS_RING){
+    // The pool is too far behind; drop this one and mark the resumption
+    chan->output.opus_drops++;
+    chan->output.silent = true;
+    return 0;
+  }
+  struct opus_block * const bp = &ring->block[head % OPUS_RING];
+  block.pcm = bp->pcm;
+  memcpy(block.pcm,buffer,size * sizeof(float));
+  *bp = block;
+  __atomic_store_n(&ring->head,head + 1,__ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&Pool_mutex);
+  if(!ring->scheduled){
+    ring->scheduled = true;
+    ring->ready_next = NULL;
+    if(Ready_tail != NULL)
+      Ready_tail->output.opus_ring->ready_next = chan;
+    else
+      Ready_head = chan;
+    Ready_tail = chan;
+    pthread_cond_signal(&Pool_cond);
+  }
+  pthread_mutex_unlock(&Pool_mutex);
   return 0;
 }
 
+// Release a channel's Opus encoder and ring, e.g., when its demod thread starts or exits
+// Called only by the channel's own demod thread
+void close_opus(struct channel *chan){
+  if(chan == NULL)
+    return;
+  free_ring(chan);
+  if(chan->output.opus != NULL){
+    opus_encoder_destroy(chan->output.opus);
+    chan->output.opus = NULL;
+  }
+  chan->output.opus_channels = 0;
+  chan->output.opus_silent = false;
+}
+
 #if 0 // Not currently used
 void output_cleanup(void *p){
   struct channel * const chan = p;
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "ax25.h"
 
@@ -135,24 +136,45 @@ int dump_frame(FILE *stream,uint8_t *frame,int bytes){
   return 0;
 }
 
-// Check 16-bit AX.25 standard CRC-CCITT on frame
-// return 1 if good, 0 otherwise
-int crc_good(uint8_t *frame,int length){
+// 16-bit AX.25 standard CRC-CCITT (CRC-16/X.25), bit-reversed polynomial 0x8408
+// Slice-by-8: Crc_table[k][i] is the CRC register contribution of byte i followed by k zero bytes
+static uint16_t Crc_table[8][256];
+static pthread_once_t Crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void){
   unsigned int const crc_poly = 0x8408;
-	
-  uint16_t crc = 0xffff;
-  while(length-- > 0){
-    uint8_t byte = *frame++;
-    for(int i=0; i < 8; i++){
-      uint16_t feedback = 0;
-      if((crc ^ byte) & 1)
-	feedback = crc_poly;
-
-      crc = (crc >> 1) ^ feedback;
-      byte >>= 1;
-    }
+  for(int i=0; i < 256; i++){
+    uint16_t crc = i;
+    for(int j=0; j < 8; j++)
+      crc = (crc >> 1) ^ ((crc & 1) ? crc_poly : 0);
+    Crc_table[0][i] = crc;
+  }
+  for(int i=0; i < 256; i++)
+    for(int k=1; k < 8; k++)
+      Crc_table[k][i] = (Crc_table[k-1][i] >> 8) ^ Crc_table[0][Crc_table[k-1][i] & 0xff];
+}
+
+// Run the CRC register over a buffer, 8 bytes per step
+// Start with crc = 0xffff; the transmitted FCS is the complement of the result
+uint16_t crc16_update(uint16_t crc,uint8_t const *data,int length){
+  pthread_once(&Crc_once,crc_init);
+  while(length >= 8){
+    uint32_t const lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+    uint32_t const hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+    crc = Crc_table[7][lo & 0xff] ^ Crc_table[6][(lo >> 8) & 0xff] ^ Crc_table[5][(lo >> 16) & 0xff] ^ Crc_table[4][lo >> 24]
+      ^ Crc_table[3][hi & 0xff] ^ Crc_table[2][(hi >> 8) & 0xff] ^ Crc_table[1][(hi >> 16) & 0xff] ^ Crc_table[0][hi >> 24];
+    data += 8;
+    length -= 8;
   }
-  return(crc == 0xf0b8); // Note comparison
+  while(length-- > 0)
+    crc = (crc >> 8) ^ Crc_table[0][(crc ^ *data++) & 0xff];
+  return crc;
+}
+
+// Check 16-bit AX.25 standard CRC-CCITT on frame
+// return 1 if good, 0 otherwise
+int crc_good(uint8_t const *frame,int length){
+  return crc16_update(0xffff,frame,length) == 0xf0b8; // Note comparison
 }
 
 // Base 91 encoding used by APRS
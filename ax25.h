@@ -5,6 +5,7 @@
 #define _AX25_H 1
 
 #include <stdio.h>
+#include <stdint.h>
 
 // AX.25 frame, broken down
 #define MAX_DIGI 10
@@ -30,7 +31,8 @@ struct ax25_frame {
 
 int ax25_parse(struct ax25_frame *out,uint8_t const *in,int len);
 int dump_frame(FILE *stream,uint8_t *frame,int bytes);
-int crc_good(uint8_t *frame,int length);
+int crc_good(uint8_t const *frame,int length);
+uint16_t crc16_update(uint16_t crc,uint8_t const *data,int length);
 char *get_callsign(char *result,uint8_t const *in);
 int decode_base91(char *in);
 
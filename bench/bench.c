@@ -0,0 +1,3620 @@
+// Offline benchmark harness for the ka9q-radio filter engine and demodulators
+// Drives synthetic signals through the same code radiod uses, with no hardware and no network
+// Results are written to stdout as CSV (default) or JSON so they can be tracked over time
+// Copyright 2024, Phil Karn, KA9Q
+//
+// Tests:
+//  frontend  - forward FFT of the input (master) filter only, via create_filter_input()/execute_filter_input()
+//  filter    - channel (slave) filters via create_filter_output()/execute_filter_output(), run in-line
+//  realout   - as 'filter' but with real (c2r) output, checked against the complex output for USB, LSB and CW
+//  discrim   - FM discriminator fm_discriminate() alone; checks fast_atan2pif() against cargf() and
+//              compares SINAD with the old cargf() phase-differencing discriminator on a noisy FM tone
+//  iir       - biquad cascade (iir.c) as used for de-emphasis, DC removal and PL notching; checks the
+//              measured frequency response against the coefficients and the old per-sample recurrences
+//  tones     - PL tone detection with the decimating Goertzel bank (as in monitor) and the complex bank (as in pl),
+//              checked against the per-tone detectors they replaced; 'tones' timing is for the monitor case
+//  rds       - RDS subcarrier slave of a wfm-style composite filter plus the rds.c decoder, on a synthetic
+//              stereo composite signal carrying PS and radiotext groups; checks the decoded PI, PS and RT
+//  hdlc      - table-driven HDLC deframer and slice-by-8 CRC (hdlc.c, ax25.c) as used by packetd, fuzzed against
+//              the bit-at-a-time versions they replaced; timing is per received bit
+//  afsk      - packetd's multi-slicer AFSK1200 demodulator (afsk.c) against the single correlator it replaced,
+//              on synthetic packets with random twist, noise and baud rate error, or on a recording given
+//              with -a (raw 16-bit host order mono at 48 kHz); reports decode counts for both. On synthetic packets
+//              (from a fixed seed) also checks that strong ones are each decoded exactly once across the slicers
+//  resample  - polyphase sample rate converter (resample.c) used by monitor, at each quality on several ratios:
+//              passband gain, images and alias rejection of tones; timing is 12 kHz mono to 48 kHz at medium
+//              quality, fed 20 ms at a time, per output sample. channels_per_core is sessions per core
+//  jitter    - lock-free jitter ring (multicast.c) between a receive and a decode thread, as in monitor, stereod
+//              and rdsd, on a stream with reordered, duplicated and lost packets; checks delivery order and
+//              accounting and compares the receive thread's cost with the malloc'ed sorted list it replaced in monitor.
+//              Timing is per packet
+//  recv      - batched receive and hashed session lookup (rtp_recv.c) used by monitor, opusd, pcmrecord and the other
+//              stream consumers, on loopback UDP from 1000 SSRCs, against per-packet recvfrom() and a session list
+//              scan; checks every packet reaches its session and that the sender's port is part of the key.
+//              Timing is per packet
+//  rtpfilter - kernel SSRC and payload type socket filters (multicast.c) on loopback multicast carrying 500 channels:
+//              checks only the selected packets arrive as the filter is changed and removed, and compares the
+//              receiving thread's CPU with one channel selected and with none. Timing is per received packet
+//  wav       - block-converted .wav writing (wav.c) used by wd-record and jt-decoded, checked byte for byte against
+//              the fseeko()/fputc() code it replaced on mono and stereo streams with lost, late and duplicated
+//              packets, including over a file left by an earlier run. Timing is per sample on a 12 kHz mono stream
+//  pcmrecord - pcmrecord's writer threads, O_DIRECT and fallocate(), run as a child process (-P path, default ./pcmrecord)
+//              on loopback multicast: 3 streams at 48 kHz with a gap, a duplicate and a short last packet, plus one too short
+//              to keep. Checks every file after pcmrecord closes it, byte for byte and by size and .wav header.
+//              Timing is pcmrecord's CPU per sample
+//  opus      - Opus output (audio.c) from 'channels' 48 kHz stereo channels, encoded in the sending thread and then by
+//              the encoder pool (-e threads) fed in real time. Checks each stream's sequence numbers, timestamps and
+//              marker bits, including across blocks dropped when the pool falls behind, and reports the lowest
+//              complexity it fell back to, and that a switch to PCM waits for queued Opus blocks. Timing is
+//              what remains in the sending (demod) thread, per sample
+//  status    - status in answer to polls of all channels (radio_status.c) from 'channels' channels, as BULK_STATUS
+//              packets carrying only the fields that changed since the last poll, against a STATUS packet per channel.
+//              Checks a poller's view of every channel stays current, and reports bytes and CPU per channel.
+//              Timing is per channel per poll, for bulk status
+//  tlv       - table-driven status decoding (decode_status.c) against the switch statement it replaced, on status packets
+//              from channels in every mode: checks both decode the same, including with random values, and fuzzes the
+//              decoder and the other TLV scanners with damaged packets (build with -fsanitize=address to catch overreads).
+//              Timing is per packet decoded
+//  linear, fm, wfm, spectrum - complete demodulator threads as started by radiod, fed in lock step
+//
+// Metrics:
+//  ns_per_sample     - CPU time per sample. Front end samples for 'frontend', channel output samples otherwise
+//  blocks_per_sec    - blocks that could be processed per CPU-second (per channel for channel tests)
+//  realtime_factor   - signal time / CPU time; > 1 means faster than real time
+//  channels_per_core - channels one core could sustain in real time (not meaningful for 'frontend')
+//
+// Demodulator squelches are forced open and output encoding is disabled so every block is fully processed
+// but nothing is transmitted. Per-channel CPU is measured with the demod threads' own CPU clocks;
+// the cost of the shared front end FFT is measured separately by the 'frontend' test and subtracted
+// from process CPU time when computing channels_per_core.
+
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#undef I
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <locale.h>
+#include <time.h>
+#include <getopt.h>
+#include <sysexits.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <fftw3.h>
+#include <iniparser/iniparser.h>
+
+#include "../misc.h"
+#include "../multicast.h"
+#include "../radio.h"
+#include "../filter.h"
+#include "../iir.h"
+#include "../ax25.h"
+#include "../hdlc.h"
+#include "../afsk.h"
+#include "../resample.h"
+#include "../rtp_recv.h"
+#include "../wav.h"
+
+// Globals normally owned by main.c
+int IP_tos;
+int Mcast_ttl;
+float Blocktime = 20.0;
+struct channel Template;
+int Channel_idle_timeout;
+int Ctl_fd = -1;
+int Output_fd = -1;
+struct sockaddr_storage Metadata_dest_socket;
+dictionary *Preset_table;
+const char *App_path;
+int Verbose;
+volatile bool Stop_transfers;
+extern int N_worker_threads; // owned by filter.c
+
+static int Samprate = 1620000;    // Front end sample rate
+static bool Isreal = false;       // Real (e.g., RX888) or complex (e.g., Airspy, RTL-SDR) front end
+static int Overlap = 5;
+static int Nchannels = 10;
+static int Chan_samprate = 12000; // Linear & FM channel output sample rate; WFM forces its own
+static float Duration = 5.0;      // Seconds of simulated signal per test
+static bool Json = false;
+static bool First_result = true;
+static FILE *Results;              // Original stdout; everything else logged by the library goes to stderr
+static char const *Afsk_file;      // Recorded AFSK audio for the 'afsk' test
+static char const *Pcmrecord_path = "./pcmrecord"; // For the 'pcmrecord' test; make bench runs from the top directory
+static char **Tests;               // Tests named on the command line, if any
+static int Ntests;
+
+static struct {
+  char const *name;
+  enum demod_type type;
+} const Demods[] = {
+  { "linear", LINEAR_DEMOD },
+  { "fm", FM_DEMOD },
+  { "wfm", WFM_DEMOD },
+  { "spectrum", SPECT_DEMOD },
+};
+#define NDEMODS (sizeof(Demods)/sizeof(Demods[0]))
+
+struct result {
+  char const *test;
+  int channels;
+  int chan_samprate;
+  long blocks;
+  double wall;      // seconds
+  double cpu;       // seconds, attributable to the test
+  long long samples;
+};
+
+static double Frontend_cpu_per_block = 0; // From 'frontend' test, subtracted from later tests
+
+static complex float *Complex_signal;
+static float *Real_signal;
+static int Signal_length;
+
+static double ts2sec(struct timespec const *ts){
+  return ts->tv_sec + 1e-9 * ts->tv_nsec;
+}
+static double clock_sec(clockid_t id){
+  struct timespec ts;
+  clock_gettime(id,&ts);
+  return ts2sec(&ts);
+}
+
+// Channel frequencies are spread evenly over the middle 80% of the front end passband
+static double chan_freq(int i,int n){
+  double const span = 0.8 * (Isreal ? Samprate / 2.0 : (double)Samprate);
+  double const low = Isreal ? 0.1 * Samprate / 2.0 : -span / 2;
+  double f = low + span * (i + 0.5) / n;
+  return Frontend.frequency + round(f / 1000) * 1000; // Keep on a 1 kHz raster
+}
+
+// Generate a few blocks worth of gaussian noise plus an unmodulated carrier at each channel frequency
+// Blocks are played back from random offsets, as in sig_gen.c
+static void make_signal(int L){
+  Signal_length = 4 * L;
+  double carriers[Nchannels > 0 ? Nchannels : 1];
+  for(int i=0; i < Nchannels; i++)
+    carriers[i] = (chan_freq(i,Nchannels) - Frontend.frequency) / Samprate;
+
+  float const noise_amp = 100;
+  float const carrier_amp = 1000;
+  if(Isreal){
+    Real_signal = malloc(sizeof(*Real_signal) * (Signal_length + L));
+    for(int n=0; n < Signal_length + L; n++){
+      // Box-Muller
+      float u1 = (random() + 1.0f) / (RAND_MAX + 1.0f);
+      float u2 = (float)random() / RAND_MAX;
+      Real_signal[n] = noise_amp * sqrtf(-2 * logf(u1)) * cosf(2 * M_PIf * u2);
+    }
+    for(int i=0; i < Nchannels; i++)
+      for(int n=0; n < Signal_length + L; n++)
+	Real_signal[n] += carrier_amp * cos(2 * M_PI * fmod(carriers[i] * n,1.0));
+  } else {
+    Complex_signal = malloc(sizeof(*Complex_signal) * (Signal_length + L));
+    for(int n=0; n < Signal_length + L; n++){
+      float u1 = (random() + 1.0f) / (RAND_MAX + 1.0f);
+      float u2 = (float)random() / RAND_MAX;
+      Complex_signal[n] = noise_amp * sqrtf(-2 * logf(u1)) * csincosf(2 * M_PIf * u2);
+    }
+    for(int i=0; i < Nchannels; i++)
+      for(int n=0; n < Signal_length + L; n++)
+	Complex_signal[n] += carrier_amp * csincos(2 * M_PI * fmod(carriers[i] * n,1.0));
+  }
+}
+
+// Copy one block of synthetic signal into the input filter and execute it
+static void feed_block(struct filter_in *f){
+  int const offset = random() % (Signal_length - f->ilen);
+  if(f->in_type == REAL){
+    memcpy(f->input_write_pointer.r,Real_signal + offset,f->ilen * sizeof(float));
+    write_rfilter(f,NULL,f->ilen);
+  } else {
+    memcpy(f->input_write_pointer.c,Complex_signal + offset,f->ilen * sizeof(complex float));
+    write_cfilter(f,NULL,f->ilen);
+  }
+}
+
+// Wait for the FFT worker pool to finish the most recently queued block
+static void wait_input(struct filter_in *f){
+  unsigned int const jobnum = f->next_jobnum - 1;
+  pthread_mutex_lock(&f->filter_mutex);
+  while((int)(jobnum - f->completed_jobs[jobnum % ND]) > 0)
+    pthread_cond_wait(&f->filter_cond,&f->filter_mutex);
+  pthread_mutex_unlock(&f->filter_mutex);
+}
+
+// Run everything if no tests were named
+static bool selected(char const *name){
+  if(Ntests == 0)
+    return true;
+  for(int i=0; i < Ntests; i++){
+    if(strcasecmp(Tests[i],name) == 0)
+      return true;
+  }
+  return false;
+}
+
+// JSON has no NaN, so undefined metrics are null
+static void json_number(char const *name,char const *format,double x){
+  fprintf(Results,",\"%s\":",name);
+  if(isfinite(x))
+    fprintf(Results,format,x);
+  else
+    fprintf(Results,"null");
+}
+
+static void report(struct result const *r){
+  double const blocktime = Blocktime * .001;
+  double const signal_time = r->blocks * blocktime;
+  double const ns_per_sample = r->samples > 0 ? 1e9 * r->cpu / r->samples : NAN;
+  double const blocks_per_sec = r->cpu > 0 ? r->blocks * (r->channels > 0 ? r->channels : 1) / r->cpu : NAN;
+  double const realtime_factor = r->cpu > 0 ? signal_time / r->cpu : NAN;
+  double const channels_per_core = (r->channels > 0 && r->cpu > 0) ? r->channels * signal_time / r->cpu : NAN;
+
+  if(Json){
+    fprintf(Results,"%s{\"test\":\"%s\",\"samprate\":%d,\"real\":%s,\"blocktime_ms\":%.3f,\"overlap\":%d,\"fft_threads\":%d,\"internal_threads\":%d,\"inline_max\":%d,"
+	    "\"channels\":%d,\"chan_samprate\":%d,\"blocks\":%ld,\"wall_s\":%.6f,\"cpu_s\":%.6f",
+	    First_result ? "[\n" : ",\n",
+	    r->test,Samprate,Isreal ? "true" : "false",Blocktime,Overlap,N_worker_threads,N_internal_threads,Filter_inline_max,
+	    r->channels,r->chan_samprate,r->blocks,r->wall,r->cpu);
+    json_number("ns_per_sample","%.3f",ns_per_sample);
+    json_number("blocks_per_sec","%.1f",blocks_per_sec);
+    json_number("realtime_factor","%.3f",realtime_factor);
+    json_number("channels_per_core","%.1f",channels_per_core);
+    fprintf(Results,"}");
+  } else {
+    if(First_result)
+      fprintf(Results,"test,samprate,real,blocktime_ms,overlap,fft_threads,internal_threads,inline_max,channels,chan_samprate,blocks,wall_s,cpu_s,ns_per_sample,blocks_per_sec,realtime_factor,channels_per_core\n");
+    fprintf(Results,"%s,%d,%d,%.3f,%d,%d,%d,%d,%d,%d,%ld,%.6f,%.6f,%.3f,%.1f,%.3f,%.1f\n",
+	    r->test,Samprate,Isreal,Blocktime,Overlap,N_worker_threads,N_internal_threads,Filter_inline_max,
+	    r->channels,r->chan_samprate,r->blocks,r->wall,r->cpu,
+	    ns_per_sample,blocks_per_sec,realtime_factor,channels_per_core);
+  }
+  First_result = false;
+  fflush(Results);
+}
+
+// Forward FFT of the front end filter through the worker pool, one block at a time
+static void bench_frontend(long const blocks){
+  // Warm up caches and the worker threads
+  for(int i=0; i < ND; i++){
+    feed_block(&Frontend.in);
+    wait_input(&Frontend.in);
+  }
+  double const cpu_start = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  for(long b=0; b < blocks; b++){
+    feed_block(&Frontend.in);
+    wait_input(&Frontend.in);
+  }
+  struct result r = {
+    .test = "frontend",
+    .channels = 0,
+    .chan_samprate = 0,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID) - cpu_start,
+    .samples = blocks * (long long)Frontend.L,
+  };
+  Frontend_cpu_per_block = r.cpu / blocks;
+  report(&r);
+}
+
+// Channel filters executed in-line on this thread
+// Measures only the slave side: bin copy, response multiply and IFFT
+static void bench_filter(long const blocks){
+  int const olen = Chan_samprate * Blocktime / 1000;
+  struct filter_out *slaves = calloc(Nchannels,sizeof(*slaves));
+  int shifts[Nchannels];
+  int const N = Frontend.L + Frontend.M - 1;
+  for(int i=0; i < Nchannels; i++){
+    create_filter_output(&slaves[i],&Frontend.in,NULL,olen,COMPLEX);
+    set_filter(&slaves[i],-5000.0/Chan_samprate,+5000.0/Chan_samprate,11.0);
+    compute_tuning(N,Frontend.M,Samprate,&shifts[i],NULL,Frontend.frequency - chan_freq(i,Nchannels));
+  }
+  double cpu = 0;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  for(long b=0; b < blocks; b++){
+    feed_block(&Frontend.in);
+    wait_input(&Frontend.in);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(int i=0; i < Nchannels; i++)
+      execute_filter_output(&slaves[i],-shifts[i]);
+    cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  struct result r = {
+    .test = "filter",
+    .channels = Nchannels,
+    .chan_samprate = Chan_samprate,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = cpu,
+    .samples = blocks * (long long)olen * Nchannels,
+  };
+  report(&r);
+  for(int i=0; i < Nchannels; i++)
+    delete_filter_output(&slaves[i]);
+  FREE(slaves);
+}
+
+// Real (c2r) channel filters as used by mono linear channels, executed in-line like 'filter'
+// Each is checked against a complex filter with the same response: the real output
+// must equal sqrt(2) (complex front end) or 1/sqrt(2) (real front end) times the real part of the complex output
+// Channels rotate through USB, LSB and CW passbands
+static void bench_realout(long const blocks){
+  static struct {
+    char const *name;
+    float low,high;
+  } const Passbands[] = {
+    { "usb", +50, +3000 },
+    { "lsb", -3000, -50 },
+    { "cw", -250, +250 },
+  };
+  int const npass = sizeof(Passbands)/sizeof(Passbands[0]);
+  float const tolerance = 1e-3; // rms error relative to rms signal; -60 dB
+
+  int const olen = Chan_samprate * Blocktime / 1000;
+  struct filter_out *slaves = calloc(Nchannels,sizeof(*slaves));
+  struct filter_out *refs = calloc(Nchannels,sizeof(*refs));
+  int shifts[Nchannels];
+  int const N = Frontend.L + Frontend.M - 1;
+  for(int i=0; i < Nchannels; i++){
+    float const low = Passbands[i % npass].low / Chan_samprate;
+    float const high = Passbands[i % npass].high / Chan_samprate;
+    create_filter_output(&slaves[i],&Frontend.in,NULL,olen,REAL);
+    set_filter(&slaves[i],low,high,11.0);
+    create_filter_output(&refs[i],&Frontend.in,NULL,olen,COMPLEX);
+    set_filter(&refs[i],low,high,11.0);
+    compute_tuning(N,Frontend.M,Samprate,&shifts[i],NULL,Frontend.frequency - chan_freq(i,Nchannels));
+  }
+  double const unscale = Frontend.in.in_type == REAL ? M_SQRT2 : M_SQRT1_2;
+  double err[npass],sig[npass];
+  memset(err,0,sizeof(err));
+  memset(sig,0,sizeof(sig));
+  double cpu = 0;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  for(long b=0; b < blocks; b++){
+    feed_block(&Frontend.in);
+    wait_input(&Frontend.in);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(int i=0; i < Nchannels; i++)
+      execute_filter_output(&slaves[i],-shifts[i]);
+    cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+
+    for(int i=0; i < Nchannels; i++){
+      execute_filter_output(&refs[i],-shifts[i]);
+      for(int n=0; n < olen; n++){
+	double const ref = crealf(refs[i].output.c[n]);
+	double const diff = unscale * slaves[i].output.r[n] - ref;
+	err[i % npass] += diff * diff;
+	sig[i % npass] += ref * ref;
+      }
+    }
+  }
+  struct result r = {
+    .test = "realout",
+    .channels = Nchannels,
+    .chan_samprate = Chan_samprate,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = cpu,
+    .samples = blocks * (long long)olen * Nchannels,
+  };
+  report(&r);
+  bool failed = false;
+  for(int i=0; i < npass && i < Nchannels; i++){
+    double const rel = sig[i] > 0 ? sqrt(err[i] / sig[i]) : 0;
+    if(Verbose || !(rel <= tolerance))
+      fprintf(stderr,"realout %s: rms error relative to complex path %.1f dB\n",Passbands[i].name,20*log10(rel));
+    if(!(rel <= tolerance))
+      failed = true;
+  }
+  for(int i=0; i < Nchannels; i++){
+    delete_filter_output(&slaves[i]);
+    delete_filter_output(&refs[i]);
+  }
+  FREE(slaves);
+  FREE(refs);
+  if(failed){
+    fprintf(stderr,"realout: real output doesn't match complex output\n");
+    exit(EX_SOFTWARE);
+  }
+}
+
+// Reference FM discriminator, as fm.c did it before fm_discriminate(): differences of cargf()
+static void cargf_discriminate(float *out,complex float const *in,int N,float *memory){
+  for(int n=0; n < N; n++){
+    float const np = M_1_PIf * cargf(in[n]);
+    float const x = np - *memory;
+    *memory = np;
+    out[n] = x > 1 ? x - 2 : x < -1 ? x + 2 : x;
+  }
+}
+
+// SINAD of a demodulated tone at frequency f (cycles/sample): fit DC and the tone by least squares,
+// everything left over is noise + distortion
+static double sinad(float const *x,int N,double f){
+  double dc = 0,c = 0,s = 0;
+  for(int n=0; n < N; n++){
+    dc += x[n];
+    c += x[n] * cos(2 * M_PI * f * n);
+    s += x[n] * sin(2 * M_PI * f * n);
+  }
+  dc /= N; c *= 2.0 / N; s *= 2.0 / N; // N is a whole number of tone cycles
+  double total = 0,resid = 0;
+  for(int n=0; n < N; n++){
+    double const ac = x[n] - dc;
+    double const e = ac - c * cos(2 * M_PI * f * n) - s * sin(2 * M_PI * f * n);
+    total += ac * ac;
+    resid += e * e;
+  }
+  return 10 * log10(total / resid);
+}
+
+static void bench_discrim(long const blocks){
+  bool failed = false;
+  // Accuracy of fast_atan2pif() over the whole circle and a wide range of magnitudes
+  float const tolerance = 1e-5; // radians
+  double max_err = 0;
+  for(int i=0; i < 1000000; i++){
+    float const angle = 2 * M_PIf * i / 1000000 - M_PIf;
+    float const mag = ldexpf(1.0f,(i % 61) - 30);
+    complex float const x = mag * csincosf(angle);
+    double err = fabs(M_PI * fast_atan2pif(cimagf(x),crealf(x)) - cargf(x));
+    if(err > M_PI)
+      err = fabs(err - 2 * M_PI); // +/- pi are the same angle
+    if(err > max_err)
+      max_err = err;
+  }
+  if(Verbose || !(max_err <= tolerance))
+    fprintf(stderr,"discrim: fast_atan2pif max error vs cargf %.2g radians\n",max_err);
+  if(!(max_err <= tolerance))
+    failed = true;
+
+  // Noisy FM signal: 1 kHz tone, 5 kHz deviation, 25 dB CNR in a 16 kHz bandwidth, at 48 kHz
+  int const samprate = 48000;
+  int const N = samprate * Blocktime / 1000;
+  int const L = samprate; // one second; a whole number of tone cycles
+  complex float *signal = malloc(L * sizeof(*signal));
+  float const noise_amp = sqrtf(samprate / 16000.0f / powf(10,2.5f));
+  double phase = 0;
+  for(int n=0; n < L; n++){
+    phase += 5000.0 / samprate * sin(2 * M_PI * 1000.0 / samprate * n);
+    float u1 = (random() + 1.0f) / (RAND_MAX + 1.0f);
+    float u2 = (float)random() / RAND_MAX;
+    signal[n] = csincospi(2 * fmod(phase,1.0)) + noise_amp * sqrtf(-2 * logf(u1)) * csincosf(2 * M_PIf * u2);
+  }
+  float *fast = malloc(L * sizeof(*fast));
+  float *ref = malloc(L * sizeof(*ref));
+  {
+    complex float mem = signal[0];
+    float rmem = M_1_PIf * cargf(signal[0]);
+    for(int n=0; n + N <= L; n += N){
+      fm_discriminate(fast + n,signal + n,N,&mem);
+      cargf_discriminate(ref + n,signal + n,N,&rmem);
+    }
+  }
+  int const used = (L / N) * N;
+  double const sinad_fast = sinad(fast,used,1000.0 / samprate);
+  double const sinad_ref = sinad(ref,used,1000.0 / samprate);
+  if(Verbose || !(sinad_fast >= sinad_ref - 0.1))
+    fprintf(stderr,"discrim: SINAD %.2f dB, cargf() reference %.2f dB\n",sinad_fast,sinad_ref);
+  if(!(sinad_fast >= sinad_ref - 0.1))
+    failed = true;
+
+  // Speed, per channel block
+  complex float mem = 0;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  for(long b=0; b < blocks; b++){
+    int const offset = (b * N) % (L - N);
+    fm_discriminate(fast,signal + offset,N,&mem);
+  }
+  struct result r = {
+    .test = "discrim",
+    .channels = 1,
+    .chan_samprate = samprate,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start,
+    .samples = blocks * (long long)N,
+  };
+  report(&r);
+  FREE(signal);
+  FREE(fast);
+  FREE(ref);
+  if(failed){
+    fprintf(stderr,"discrim: fast discriminator is not accurate enough\n");
+    exit(EX_SOFTWARE);
+  }
+}
+
+// Response of a biquad cascade computed from its coefficients at frequency f (cycles/sample)
+static complex double iir_response(struct iir const *iir,double f){
+  complex double const z1 = cispi(-2 * f); // z^-1
+  complex double h = 1;
+  for(int k=0; k < iir->sections; k++){
+    struct biquad const *c = &iir->c[k];
+    h *= (c->b0 + z1 * (c->b1 + z1 * c->b2)) / (1 + z1 * (c->a1 + z1 * c->a2));
+  }
+  return h;
+}
+
+static void bench_iir(long const blocks){
+  bool failed = false;
+  int const samprate = 48000;
+  float const dc_rate = -expm1f(-1.0f / (0.1 * samprate));
+  float const deemph_rate = -expm1f(-1.0f / (75e-6 * samprate));
+
+  // Same output as the recurrences fm.c used before: de-emphasis with gain, then DC removal
+  {
+    int const L = samprate;
+    float *x = malloc(L * sizeof(*x));
+    for(int n=0; n < L; n++)
+      x[n] = (float)random() / RAND_MAX - 0.5f + 0.1f; // with some DC
+    float deemph_state = 0,dc = 0;
+    double max_err = 0;
+    struct iir iir = {0};
+    iir_lowpass1(&iir,0,deemph_rate,4.0f);
+    iir_dcblock(&iir,1,dc_rate);
+    float y[L];
+    memcpy(y,x,L * sizeof(*y));
+    iir_filter(&iir,y,L,1);
+    for(int n=0; n < L; n++){
+      float const s = deemph_state += deemph_rate * (4.0f * x[n] - deemph_state);
+      float const ref = s - (dc += dc_rate * (s - dc));
+      if(fabs(y[n] - ref) > max_err)
+	max_err = fabs(y[n] - ref);
+    }
+    if(Verbose || !(max_err < 1e-4))
+      fprintf(stderr,"iir: de-emphasis + DC removal max difference from old recurrence %.2g\n",max_err);
+    if(!(max_err < 1e-4))
+      failed = true;
+    FREE(x);
+  }
+  // Measured frequency response of a stereo PL notch + de-emphasis, driven with a tone in each channel
+  struct iir iir = {0};
+  iir_notch(&iir,0,100.0 / samprate,0.997);
+  iir_lowpass1(&iir,1,deemph_rate,1.0f);
+  double max_err = 0;
+  static float const Tones[] = { 67, 99, 100, 101, 150, 300, 1000, 3000, 10000 };
+  for(unsigned int t=0; t < sizeof(Tones)/sizeof(Tones[0]); t++){
+    double const f = Tones[t] / samprate;
+    int const L = samprate; // one second, whole number of cycles
+    float *buf = malloc(2 * L * sizeof(*buf));
+    iir_reset(&iir);
+    for(int pass=0; pass < 2; pass++){ // first pass lets the filter settle
+      for(int n=0; n < L; n++){
+	buf[2*n] = cos(2 * M_PI * f * n);
+	buf[2*n+1] = sin(2 * M_PI * f * n);
+      }
+      iir_filter(&iir,buf,L,2);
+    }
+    complex double const h = iir_response(&iir,f);
+    for(int ch=0; ch < 2; ch++){
+      complex double m = 0; // Correlate with the input tone, as a complex exponential
+      for(int n=0; n < L; n++)
+	m += buf[2*n+ch] * cispi(-2 * f * n);
+      m *= ch == 0 ? 2.0 / L : CMPLX(0,2.0 / L); // sin = cos delayed 90 degrees
+      double const err = cabs(m - h);
+      if(Verbose)
+	fprintf(stderr,"iir: %s %.0f Hz response %.2f dB, expected %.2f dB\n",ch == 0 ? "left" : "right",Tones[t],20*log10(cabs(m)),20*log10(cabs(h)));
+      if(err > max_err)
+	max_err = err;
+    }
+    FREE(buf);
+  }
+  if(Verbose || !(max_err < 1e-3))
+    fprintf(stderr,"iir: max response error %.2g\n",max_err);
+  if(!(max_err < 1e-3))
+    failed = true;
+
+  // Throughput of the same stereo cascade, per block
+  int const N = samprate * Blocktime / 1000;
+  float buf[2 * N];
+  for(int n=0; n < 2*N; n++)
+    buf[n] = (float)random() / RAND_MAX - 0.5f;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  for(long b=0; b < blocks; b++)
+    iir_filter(&iir,buf,N,2);
+  struct result r = {
+    .test = "iir",
+    .channels = 1,
+    .chan_samprate = samprate,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start,
+    .samples = blocks * (long long)N,
+  };
+  report(&r);
+  if(failed){
+    fprintf(stderr,"iir: filter doesn't match its design\n");
+    exit(EX_SOFTWARE);
+  }
+}
+
+// All the PL tones, as in monitor and pl
+static float const PL_tones[] = {
+     67.0,  69.3,  71.9,  74.4,  77.0,  79.7,  82.5,  85.4,  88.5,  91.5,
+     94.8,  97.4, 100.0, 103.5, 107.2, 110.9, 114.8, 118.8, 123.0, 127.3,
+    131.8, 136.5, 141.3, 146.2, 150.0, 151.4, 156.7, 159.8, 162.2, 165.5,
+    167.9, 171.3, 173.8, 177.3, 179.9, 183.5, 186.2, 189.9, 192.8, 196.6,
+    199.5, 203.5, 206.5, 210.7, 213.8, 218.1, 221.3, 225.7, 229.1, 233.6,
+    237.1, 241.8, 245.5, 250.3, 254.1
+};
+#define N_PL_TONES (int)(sizeof(PL_tones)/sizeof(PL_tones[0]))
+
+// Index of the detected tone by monitor's rule (> -3 dB relative to all tones), or -1
+static int strongest_tone(float const *energies){
+  int index = -1;
+  float strongest = 0,total = 0;
+  for(int j=0; j < N_PL_TONES; j++){
+    total += energies[j];
+    if(energies[j] > strongest){
+      strongest = energies[j];
+      index = j;
+    }
+  }
+  return 2 * strongest > total ? index : -1;
+}
+
+static void bench_tones(long const blocks){
+  bool failed = false;
+  int const samprate = 48000;
+  int const L = 0.24 * samprate; // monitor's Tone_period
+  float *audio = malloc(L * sizeof(*audio));
+
+  // Each tone at -22 dB (nominal PL deviation) under full scale speech-band noise and a 1 kHz whistle
+  int misses = 0;
+  double max_ratio_err = 0;
+  for(int t=0; t < N_PL_TONES; t++){
+    float const f = PL_tones[t];
+    for(int n=0; n < L; n++){
+      float const noise = ((float)random() / RAND_MAX - 0.5f); // white, flat to 24 kHz
+      audio[n] = 0.08f * cosf(2 * M_PIf * f * n / samprate) + 0.3f * cosf(2 * M_PIf * 1000 * n / samprate) + 0.5f * noise;
+    }
+    // Old monitor code: one goertzel per tone, every sample
+    struct goertzel old[N_PL_TONES];
+    for(int j=0; j < N_PL_TONES; j++)
+      init_goertzel(&old[j],PL_tones[j] / samprate);
+    for(int n=0; n < L; n++)
+      for(int j=0; j < N_PL_TONES; j++)
+	update_goertzel(&old[j],audio[n]);
+    float old_energies[N_PL_TONES];
+    for(int j=0; j < N_PL_TONES; j++)
+      old_energies[j] = cnrmf(output_goertzel(&old[j]));
+
+    struct goertzel_bank bank;
+    init_goertzel_bank(&bank,PL_tones,N_PL_TONES,samprate,true);
+    float energies[N_PL_TONES];
+    // Feed in 20 ms packets as monitor does
+    for(int n=0; n < L; n += samprate / 50)
+      update_goertzel_bank(&bank,audio + n,min(samprate / 50,L - n),1);
+    int const samples = output_goertzel_bank(&bank,energies);
+    int const old_index = strongest_tone(old_energies);
+    int const new_index = strongest_tone(energies);
+    if(new_index != t || old_index != t){
+      misses++;
+      fprintf(stderr,"tones: %.1f Hz detected as %.1f Hz, before %.1f Hz\n",f,
+	      new_index >= 0 ? PL_tones[new_index] : 0,old_index >= 0 ? PL_tones[old_index] : 0);
+    }
+    // Tone power relative to the rest should be about the same; scale differs by the decimation ratio
+    double const scale = (double)L * L / ((double)samples * samples);
+    double const ratio_err = fabs(10 * log10(scale * energies[t] / old_energies[t]));
+    if(ratio_err > max_ratio_err)
+      max_ratio_err = ratio_err;
+  }
+  if(Verbose || misses != 0 || !(max_ratio_err < 0.5))
+    fprintf(stderr,"tones: decimated bank %d misses, max tone energy difference %.2f dB\n",misses,max_ratio_err);
+  if(misses != 0 || !(max_ratio_err < 0.5))
+    failed = true;
+
+  // Complex input, as in pl: must match the per-tone phasor integrators exactly
+  {
+    int const rate = 500;
+    float const shift = 150;
+    int const N = rate / 5;
+    complex float x[N];
+    for(int n=0; n < N; n++)
+      x[n] = csincosf(2 * M_PIf * (123.0f - shift) * n / rate) + 0.3f * csincosf(2 * M_PIf * (float)random() / RAND_MAX);
+    float shifted[N_PL_TONES];
+    for(int j=0; j < N_PL_TONES; j++)
+      shifted[j] = PL_tones[j] - shift;
+    struct goertzel_bank bank;
+    init_goertzel_bank(&bank,shifted,N_PL_TONES,rate,false);
+    update_goertzel_bank_complex(&bank,x,N);
+    float energies[N_PL_TONES];
+    output_goertzel_bank(&bank,energies);
+    double max_err = 0;
+    for(int j=0; j < N_PL_TONES; j++){
+      complex double integrator = 0;
+      for(int n=0; n < N; n++)
+	integrator += conj(x[n]) * cispi(2 * shifted[j] * n / rate);
+      double const err = fabs(energies[j] - cnrm(integrator)) / (N * N);
+      if(err > max_err)
+	max_err = err;
+    }
+    if(Verbose || !(max_err < 1e-4))
+      fprintf(stderr,"tones: complex bank max energy error %.2g relative to full scale\n",max_err);
+    if(!(max_err < 1e-4))
+      failed = true;
+  }
+  // Speed, per 20 ms packet of 48 kHz mono audio
+  int const N = samprate / 50;
+  struct goertzel_bank bank;
+  init_goertzel_bank(&bank,PL_tones,N_PL_TONES,samprate,true);
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  for(long b=0; b < blocks; b++){
+    update_goertzel_bank(&bank,audio + (b % 10) * N,N,1);
+    if(bank.samples >= 240)
+      output_goertzel_bank(&bank,(float [N_PL_TONES]){0});
+  }
+  struct result r = {
+    .test = "tones",
+    .channels = 1,
+    .chan_samprate = samprate,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start,
+    .samples = blocks * (long long)N,
+  };
+  report(&r);
+  if(Verbose){
+    struct goertzel old[N_PL_TONES];
+    for(int j=0; j < N_PL_TONES; j++)
+      init_goertzel(&old[j],PL_tones[j] / samprate);
+    long const old_blocks = max(1L,blocks / 10);
+    double const old_start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(long b=0; b < old_blocks; b++){
+      float const *a = audio + (b % 10) * N;
+      for(int n=0; n < N; n++)
+	for(int j=0; j < N_PL_TONES; j++)
+	  update_goertzel(&old[j],a[n]);
+    }
+    double const old_cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - old_start;
+    fprintf(stderr,"tones: per-tone goertzels %.3f ns/sample, bank %.3f ns/sample\n",
+	    1e9 * old_cpu / (old_blocks * N),1e9 * r.cpu / r.samples);
+  }
+  FREE(audio);
+  if(failed){
+    fprintf(stderr,"tones: tone bank doesn't match the old detectors\n");
+    exit(EX_SOFTWARE);
+  }
+}
+
+// RDS check word, computed independently of rds.c: x^10 times the information word mod
+// x^10 + x^8 + x^7 + x^5 + x^4 + x^3 + 1
+static unsigned int rds_checkword(unsigned int info){
+  unsigned int r = 0;
+  for(int i=15; i >= 0; i--){
+    bool const fb = ((info >> i) ^ (r >> 9)) & 1;
+    r = (r << 1) & 0x3ff;
+    if(fb)
+      r ^= 0x1b9; // Generator without the x^10 term
+  }
+  return r;
+}
+
+// Append one RDS group (four 26-bit blocks) to a bit array
+static int rds_group(bool *bits,uint16_t const blocks[4]){
+  static uint16_t const offsets[4] = { 0x0fc, 0x198, 0x168, 0x1b4 }; // A, B, C, D
+  int n = 0;
+  for(int b=0; b < 4; b++){
+    uint32_t const word = ((uint32_t)blocks[b] << 10) | (rds_checkword(blocks[b]) ^ offsets[b]);
+    for(int i=25; i >= 0; i--)
+      bits[n++] = (word >> i) & 1;
+  }
+  return n;
+}
+
+static void bench_rds(long const blocks){
+  int const composite_samprate = 384000; // as forced by wfm.c
+  int const composite_L = composite_samprate * Blocktime / 1000;
+  int const rds_L = lroundf(RDS_SAMPRATE * Blocktime * .001);
+  if((long)rds_L * composite_samprate != (long)RDS_SAMPRATE * composite_L){
+    fprintf(stderr,"rds: block time %.3f ms doesn't allow an RDS filter, skipped\n",Blocktime);
+    return;
+  }
+  uint16_t const pi = 0x1234;
+  char const ps[] = "KA9Q FM ";
+  char const rt[] = "KA9Q radiod RDS test\r";
+
+  // One cycle: 4 type 0A groups carrying the PS name, then enough type 2A groups for the radiotext
+  int const rt_groups = (strlen(rt) + 3) / 4;
+  int const cycle_groups = 4 + rt_groups;
+  bool cycle[cycle_groups * 104];
+  int nbits = 0;
+  for(int a=0; a < 4; a++){
+    uint16_t const g[4] = { pi, 0x0000 | a, pi, (uint16_t)((ps[2*a] << 8) | ps[2*a+1]) };
+    nbits += rds_group(cycle + nbits,g);
+  }
+  for(int a=0; a < rt_groups; a++){
+    char c[4];
+    for(int i=0; i < 4; i++)
+      c[i] = (4*a + i < (int)strlen(rt)) ? rt[4*a+i] : ' ';
+    uint16_t const g[4] = { pi, 0x2000 | a, (uint16_t)((c[0] << 8) | c[1]), (uint16_t)((c[2] << 8) | c[3]) };
+    nbits += rds_group(cycle + nbits,g);
+  }
+
+  struct filter_in composite;
+  struct filter_out rds_filter;
+  create_filter_input(&composite,composite_L,composite_L+1,REAL,FFT_SHORT);
+  create_filter_output(&rds_filter,&composite,NULL,rds_L,COMPLEX);
+  set_filter(&rds_filter,-2400./RDS_SAMPRATE,2400./RDS_SAMPRATE,11.0);
+  int shift;
+  compute_tuning(composite.ilen + composite.impulse_length - 1,composite.impulse_length,composite_samprate,&shift,NULL,RDS_CARRIER);
+
+  struct rds rds;
+  rds_init(&rds);
+  // Mono 1 kHz tone, 19 kHz pilot, RDS at about 2 kHz deviation, noise ~20 dB below RDS in its bandwidth
+  // Composite units are as from fm_discriminate(): half-cycles per sample, so 1.0 = 192 kHz
+  long n = 0;
+  int bitnum = -1;
+  bool d = false; // Differentially encoded bit
+  double cpu = 0;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  for(long b=0; b < blocks; b++){
+    float * const in = composite.input_write_pointer.r;
+    for(int i=0; i < composite_L; i++,n++){
+      double const t = (double)n / composite_samprate;
+      double const bitpos = t * RDS_BITRATE;
+      int const k = bitpos;
+      if(k != bitnum){
+	bitnum = k;
+	d ^= cycle[k % nbits];
+      }
+      float const symbol = ((d ? 1 : -1) * (bitpos - k < 0.5 ? 1 : -1));
+      float u1 = (random() + 1.0f) / (RAND_MAX + 1.0f);
+      float u2 = (float)random() / RAND_MAX;
+      in[i] = 0.1 * sin(2 * M_PI * fmod(1000 * t,1.0))
+	+ 0.04 * sin(2 * M_PI * fmod(19000 * t,1.0))
+	+ 0.0104 * symbol * sin(2 * M_PI * fmod(57000 * t,1.0))
+	+ 0.01 * sqrtf(-2 * logf(u1)) * cosf(2 * M_PIf * u2);
+    }
+    write_rfilter(&composite,NULL,composite_L);
+    execute_filter_output(&rds_filter,shift);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    rds_process(&rds,rds_filter.output.c,rds_L);
+    cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  struct result r = {
+    .test = "rds",
+    .channels = 1,
+    .chan_samprate = RDS_SAMPRATE,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = cpu,
+    .samples = blocks * (long long)rds_L,
+  };
+  report(&r);
+  delete_filter_output(&rds_filter);
+  delete_filter_input(&composite);
+
+  char want_ps[9],want_rt[65];
+  strlcpy(want_ps,ps,sizeof(want_ps));
+  while(strlen(want_ps) > 0 && want_ps[strlen(want_ps)-1] == ' ')
+    want_ps[strlen(want_ps)-1] = '\0';
+  strlcpy(want_rt,rt,sizeof(want_rt));
+  want_rt[strcspn(want_rt,"\r")] = '\0';
+  bool const failed = rds.pi != pi || strcmp(rds.ps,want_ps) != 0 || strcmp(rds.rt,want_rt) != 0;
+  if(Verbose || failed)
+    fprintf(stderr,"rds: %llu groups of %.0f sent; PI %04X PS \"%s\" RT \"%s\"\n",
+	    (unsigned long long)rds.groups,blocks * Blocktime * .001 * RDS_BITRATE / 104,rds.pi,rds.ps,rds.rt);
+  if(failed){
+    fprintf(stderr,"rds: decoded PI %04X PS \"%s\" RT \"%s\" expected PI %04X PS \"%s\" RT \"%s\"\n",
+	    rds.pi,rds.ps,rds.rt,pi,want_ps,want_rt);
+    exit(EX_SOFTWARE);
+  }
+}
+
+// Bit-at-a-time AX.25 CRC and HDLC deframer, as in ax25.c and packetd.c before the table-driven versions
+static uint16_t ref_crc(uint8_t const *frame,int length){
+  uint16_t crc = 0xffff;
+  while(length-- > 0){
+    uint8_t byte = *frame++;
+    for(int i=0; i < 8; i++){
+      crc = (crc >> 1) ^ (((crc ^ byte) & 1) ? 0x8408 : 0);
+      byte >>= 1;
+    }
+  }
+  return crc;
+}
+
+struct ref_hdlc {
+  uint8_t frame[HDLC_MAX_FRAME];
+  int frame_bits;
+  int flag_seen;
+  int last_bits;
+};
+
+static int ref_hdlc_process(struct ref_hdlc *hp,int bit){
+  bit &= 1;
+  hp->last_bits <<= 1;
+  hp->last_bits |= bit;
+  if((hp->last_bits & 0xff) == 0x7e){
+    int const bytes = (hp->frame_bits - 7) >> 3;
+    if(hp->flag_seen && bytes > 2){
+      hp->frame_bits = 0;
+      return ref_crc(hp->frame,bytes) == 0xf0b8 ? bytes : -1;
+    }
+    hp->frame_bits = 0;
+    hp->flag_seen = 1;
+    return 0;
+  }
+  if(!hp->flag_seen)
+    return 0;
+  if((hp->last_bits & 0x7f) == 0x7f){
+    hp->frame_bits = 0;
+    hp->flag_seen = 0;
+    return 0;
+  } else if((hp->last_bits & 0x3f) == 0x3e)
+    return 0;
+  if(hp->frame_bits >= HDLC_MAX_FRAME << 3){
+    hp->frame_bits = 0;
+    hp->flag_seen = 0;
+    return 0;
+  }
+  if((hp->frame_bits & 7) == 0)
+    hp->frame[hp->frame_bits >> 3] = 0;
+  hp->frame[hp->frame_bits >> 3] |= bit << (hp->frame_bits & 7);
+  hp->frame_bits++;
+  return 0;
+}
+
+// Append a flag, a random frame with a good FCS (zero-bit stuffed), and sometimes damage or junk
+static int hdlc_test_frame(uint8_t *bits,int maxbits,bool damage){
+  int n = 0;
+  for(int i=0; i < 8; i++)
+    bits[n++] = (0x7e >> i) & 1;
+  int const len = 3 + random() % 330;
+  uint8_t frame[len + 2];
+  for(int i=0; i < len; i++)
+    frame[i] = random();
+  uint16_t const fcs = ~crc16_update(0xffff,frame,len);
+  frame[len] = fcs;
+  frame[len+1] = fcs >> 8;
+  int ones = 0;
+  int const start = n;
+  for(int i=0; i < len + 2; i++){
+    for(int j=0; j < 8; j++){
+      int const b = (frame[i] >> j) & 1;
+      bits[n++] = b;
+      if(b && ++ones == 5){
+	bits[n++] = 0;
+	ones = 0;
+      } else if(!b)
+	ones = 0;
+    }
+  }
+  if(damage){
+    switch(random() % 4){
+    case 0: // Bit errors
+      for(int i = random() % 3; i >= 0; i--)
+	bits[start + random() % (n - start)] ^= 1;
+      break;
+    case 1: // Abort part way through
+      n = start + random() % (n - start);
+      for(int i = 7 + random() % 10; i > 0; i--)
+	bits[n++] = 1;
+      break;
+    default: // Noise
+      for(int i = random() % 200; i > 0; i--)
+	bits[n++] = random() & 1;
+      break;
+    }
+  }
+  assert(n < maxbits);
+  return n;
+}
+
+static void bench_hdlc(long const blocks){
+  bool failed = false;
+
+  // CRC: a standard check value, then random lengths and alignments against the bitwise version
+  if((uint16_t)~crc16_update(0xffff,(uint8_t const *)"123456789",9) != 0x906e){
+    fprintf(stderr,"hdlc: CRC-16/X.25 check value wrong\n");
+    failed = true;
+  }
+  {
+    uint8_t buf[1024];
+    for(int i=0; i < (int)sizeof(buf); i++)
+      buf[i] = random();
+    for(int t=0; t < 10000; t++){
+      int const off = random() % 16;
+      int const len = random() % (sizeof(buf) - 16);
+      if(crc16_update(0xffff,buf + off,len) != ref_crc(buf + off,len)){
+	fprintf(stderr,"hdlc: slice-by-8 CRC mismatch, offset %d length %d\n",off,len);
+	failed = true;
+	break;
+      }
+    }
+  }
+  // Deframer: the same bit stream through both, fed in random-sized pieces to the new one
+  // Frames are compared in order of completion; the new one may finish up to 7 bits later
+  int const maxbits = 8 * 1024 * 1024;
+  uint8_t *bits = malloc(maxbits);
+  int nbits = 0;
+  int frames = 0;
+  while(nbits < maxbits - 4000){
+    nbits += hdlc_test_frame(bits + nbits,maxbits - nbits,(random() % 4) == 0);
+    frames++;
+  }
+  for(int i=0; i < 8; i++)
+    bits[nbits++] = (0x7e >> i) & 1;
+
+  struct ref_hdlc *ref = calloc(1,sizeof(*ref));
+  struct hdlc *hp = malloc(sizeof(*hp));
+  hdlc_init(hp);
+  int ref_good = 0,ref_bad = 0,new_good = 0,new_bad = 0;
+  int const maxframes = frames + 1;
+  int *ref_len = calloc(maxframes,sizeof(int));
+  uint32_t *ref_sum = calloc(maxframes,sizeof(uint32_t));
+  for(int i=0; i < nbits; i++){
+    int const r = ref_hdlc_process(ref,bits[i]);
+    if(r < 0)
+      ref_bad++;
+    else if(r > 0 && ref_good < maxframes){
+      ref_len[ref_good] = r;
+      ref_sum[ref_good++] = crc16_update(0,ref->frame,r) | (uint32_t)ref->frame[r/2] << 16;
+    }
+  }
+  for(int i=0; i < nbits;){
+    int const chunk = min(nbits - i,1 + (int)(random() % 8));
+    unsigned int word = 0;
+    for(int j=0; j < chunk; j++)
+      word |= bits[i + j] << j;
+    i += chunk;
+    int const r = hdlc_process_bits(hp,word,chunk);
+    if(r < 0)
+      new_bad++;
+    else if(r > 0){
+      if(new_good >= ref_good || r != ref_len[new_good]
+	 || (crc16_update(0,hp->frame,r) | (uint32_t)hp->frame[r/2] << 16) != ref_sum[new_good]){
+	if(!failed)
+	  fprintf(stderr,"hdlc: frame %d differs from bitwise deframer\n",new_good);
+	failed = true;
+      }
+      new_good++;
+    }
+  }
+  if(new_good != ref_good || new_bad != ref_bad){
+    fprintf(stderr,"hdlc: %d good %d bad frames, bitwise deframer %d good %d bad\n",new_good,new_bad,ref_good,ref_bad);
+    failed = true;
+  }
+  if(Verbose)
+    fprintf(stderr,"hdlc: %d frames sent, %d good %d bad CRC\n",frames,new_good,new_bad);
+
+  // Speed, bytes at a time as packetd feeds it
+  // Blocks are Blocktime's worth of bits at 1200 bps so realtime_factor is the number of channels per core
+  uint8_t *packed = malloc(nbits / 8 + 1);
+  for(int i=0; i < nbits / 8; i++){
+    packed[i] = 0;
+    for(int j=0; j < 8; j++)
+      packed[i] |= bits[8*i + j] << j;
+  }
+  long long const total_bits = (long long)blocks * 8 * (nbits / 8);
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  for(long b=0; b < blocks; b++)
+    for(int i=0; i < nbits / 8; i++)
+      hdlc_process_bits(hp,packed[i],8);
+  struct result r = {
+    .test = "hdlc",
+    .channels = 1,
+    .chan_samprate = 1200,
+    .blocks = total_bits / (1200 * Blocktime * .001),
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start,
+    .samples = total_bits,
+  };
+  report(&r);
+  if(Verbose){
+    double const ref_start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(int i=0; i < nbits; i++)
+      ref_hdlc_process(ref,bits[i]);
+    double const ref_cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - ref_start;
+    fprintf(stderr,"hdlc: bitwise deframer %.3f ns/bit, table-driven %.3f ns/bit\n",
+	    1e9 * ref_cpu / nbits,1e9 * r.cpu / r.samples);
+    uint8_t buf[256];
+    for(int i=0; i < (int)sizeof(buf); i++)
+      buf[i] = random();
+    long const reps = 100000;
+    double const c0 = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    uint16_t x = 0;
+    for(long i=0; i < reps; i++)
+      x ^= ref_crc(buf,sizeof(buf));
+    double const c1 = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(long i=0; i < reps; i++)
+      x ^= crc16_update(0xffff,buf,sizeof(buf));
+    double const c2 = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    fprintf(stderr,"hdlc: CRC bitwise %.3f ns/byte, slice-by-8 %.3f ns/byte (%x)\n",
+	    1e9 * (c1 - c0) / (reps * sizeof(buf)),1e9 * (c2 - c1) / (reps * sizeof(buf)),x);
+  }
+  FREE(packed);
+  FREE(ref_len);
+  FREE(ref_sum);
+  FREE(ref);
+  FREE(hp);
+  FREE(bits);
+  if(failed){
+    fprintf(stderr,"hdlc: table-driven deframer or CRC doesn't match the bitwise versions\n");
+    exit(EX_SOFTWARE);
+  }
+}
+
+// Frames sent in the 'afsk' test, for matching decodes, and decode counts
+struct afsk_count {
+  int nframes;
+  uint16_t *fcs;
+  int *len;
+  bool *found;
+  int decoded;  // Unique sent frames decoded
+  int repeats;  // Sent frames output again, i.e., missed by de-duplication
+  int other;    // Good frames not in the sent list (all of them for a recording)
+};
+
+static void afsk_count(struct afsk_count *c,uint8_t const *frame,int bytes){
+  uint16_t const fcs = frame[bytes-2] | frame[bytes-1] << 8;
+  for(int i=0; i < c->nframes; i++){
+    if(c->len[i] == bytes && c->fcs[i] == fcs){
+      if(!c->found[i])
+	c->decoded++;
+      else
+	c->repeats++;
+      c->found[i] = true;
+      return;
+    }
+  }
+  c->other++;
+}
+
+static void afsk_output(void *arg,uint8_t const *frame,int bytes){
+  afsk_count(arg,frame,bytes);
+}
+
+// packetd's AFSK demodulator before afsk.c: one analytic filter, mark and space oscillators,
+// boxcar integrators and a single Gardner-style slicer feeding the bitwise deframer
+static void ref_afsk(struct afsk_count *c,float const *audio,long n,int samprate){
+  float const mark_tone = 1200,space_tone = 2200,bitrate = 1200;
+  float const twist = mark_tone/space_tone;
+  int const AL = 960,AM = 961;
+  struct filter_in filter_in;
+  create_filter_input(&filter_in,AL,AM,REAL,FFT_SHORT);
+  struct filter_out filter_out;
+  create_filter_output(&filter_out,&filter_in,NULL,AL,COMPLEX);
+  set_filter(&filter_out,(mark_tone - bitrate/4)/samprate,(space_tone + bitrate/4)/samprate,3.0);
+  struct osc mark,space;
+  memset(&mark,0,sizeof(mark));
+  set_osc(&mark,-mark_tone/samprate,0.0);
+  memset(&space,0,sizeof(space));
+  set_osc(&space,-space_tone/samprate,0.0);
+  int const samppbit = samprate / bitrate;
+  int symphase = 0;
+  complex float mark_accum = 0,space_accum = 0,mark_offset_accum = 0,space_offset_accum = 0;
+  float last_val = 0,mid_val = 0;
+  struct ref_hdlc *hdlc = calloc(1,sizeof(*hdlc));
+
+  for(long i=0; i < n; i++){
+    if(put_rfilter(&filter_in,audio[i]) == 0)
+      continue;
+    execute_filter_output(&filter_out,0);
+    for(int k=0; k < filter_out.olen; k++){
+      complex float s = filter_out.output.c[k] * step_osc(&mark);
+      mark_accum += s;
+      mark_offset_accum += s;
+      s = filter_out.output.c[k] * step_osc(&space);
+      space_accum += s;
+      space_offset_accum += s;
+      if(++symphase == samppbit/2){
+	mid_val = cnrmf(mark_offset_accum) - twist * cnrmf(space_offset_accum);
+	mark_offset_accum = space_offset_accum = 0;
+      }
+      if(symphase < samppbit)
+	continue;
+      float const cur_val = cnrmf(mark_accum) - twist * cnrmf(space_accum);
+      mark_accum = space_accum = 0;
+      int bytes;
+      if(cur_val * last_val >= 0){
+	symphase = 0;
+	bytes = ref_hdlc_process(hdlc,1);
+      } else {
+	symphase = ((cur_val - last_val) * mid_val) > 0 ? +1 : -1;
+	bytes = ref_hdlc_process(hdlc,0);
+      }
+      if(bytes > 0)
+	afsk_count(c,hdlc->frame,bytes);
+      last_val = cur_val;
+    }
+  }
+  FREE(hdlc);
+  delete_filter_output(&filter_out);
+  delete_filter_input(&filter_in);
+}
+
+// Append one AX.25-like packet as AFSK: flags, a random frame with a good FCS, more flags
+static long afsk_packet(float *audio,long maxn,uint16_t *fcs_out,int *len_out,double *phase,
+			float samprate,float baud,float space_gain,float amp){
+  uint8_t bits[8 * 400];
+  int n = 0;
+  for(int f=0; f < 30; f++)
+    for(int i=0; i < 8; i++)
+      bits[n++] = (0x7e >> i) & 1;
+  int const len = 20 + random() % 150;
+  uint8_t frame[len + 2];
+  for(int i=0; i < len; i++)
+    frame[i] = random();
+  uint16_t const fcs = ~crc16_update(0xffff,frame,len);
+  frame[len] = fcs;
+  frame[len+1] = fcs >> 8;
+  *fcs_out = fcs;
+  *len_out = len + 2;
+  int ones = 0;
+  for(int i=0; i < len + 2; i++){
+    for(int j=0; j < 8; j++){
+      int const b = (frame[i] >> j) & 1;
+      bits[n++] = b;
+      if(b && ++ones == 5){
+	bits[n++] = 0;
+	ones = 0;
+      } else if(!b)
+	ones = 0;
+    }
+  }
+  for(int f=0; f < 3; f++)
+    for(int i=0; i < 8; i++)
+      bits[n++] = (0x7e >> i) & 1;
+
+  // NRZI: a 0 changes tones, a 1 doesn't. Continuous phase
+  bool tone = false; // false = mark
+  long k = 0;
+  double const samples_per_bit = samprate / baud;
+  for(int i=0; i < n; i++){
+    if(bits[i] == 0)
+      tone = !tone;
+    long const end = lround((i + 1) * samples_per_bit);
+    for(; k < end && k < maxn; k++){
+      *phase += (tone ? 2200. : 1200.) / samprate;
+      *phase -= floor(*phase);
+      audio[k] = amp * (tone ? space_gain : 1) * sin(2 * M_PI * *phase);
+    }
+  }
+  return k;
+}
+
+// Synthetic packets with random SNR (in a 2.4 kHz bandwidth), twist and baud rate error (+/-1%),
+// each followed by a little noise alone. Fills in the sent frames in new and old
+#define AFSK_SEED 1200 // The signal doesn't depend on which tests ran first
+static float *afsk_synth(int npackets,float min_snr,float max_snr,float max_twist,int samprate,
+			 struct afsk_count *new,struct afsk_count *old,long *np){
+  long const maxn = npackets * 3L * samprate;
+  float *audio = calloc(maxn,sizeof(*audio));
+  new->nframes = old->nframes = npackets;
+  new->fcs = old->fcs = calloc(npackets,sizeof(uint16_t));
+  new->len = old->len = calloc(npackets,sizeof(int));
+  new->found = calloc(npackets,sizeof(bool));
+  old->found = calloc(npackets,sizeof(bool));
+  long n = 0;
+  double phase = 0;
+  float const noise_sigma = 0.1;
+  for(int p=0; p < npackets; p++){
+    float const snr = min_snr + (max_snr - min_snr) * (random() / (float)RAND_MAX);
+    float const twist = max_twist * (2 * (random() / (float)RAND_MAX) - 1);
+    float const baud = 1200 * (0.99 + 0.02 * (random() / (float)RAND_MAX));
+    // Noise power in 2.4 kHz is sigma^2 * 2400 / (samprate/2); tone power is amp^2/2
+    float const amp = noise_sigma * sqrtf(2 * dB2power(snr) * 2400 / (samprate / 2));
+    long const start = n;
+    n += afsk_packet(audio + n,maxn - n,&new->fcs[p],&new->len[p],&phase,samprate,baud,dB2voltage(twist),amp);
+    n += samprate / 10;
+    for(long i=start; i < n && i < maxn; i++){
+      float u1 = (random() + 1.0f) / (RAND_MAX + 1.0f);
+      float u2 = (float)random() / RAND_MAX;
+      audio[i] += noise_sigma * sqrtf(-2 * logf(u1)) * cosf(2 * M_PIf * u2);
+    }
+  }
+  *np = n;
+  return audio;
+}
+
+static void afsk_count_free(struct afsk_count *new,struct afsk_count *old){
+  FREE(new->fcs);
+  FREE(new->len);
+  FREE(new->found);
+  FREE(old->found);
+}
+
+// Strong packets with the full range of twist and baud rate error: every slicer setting that can
+// decode one must agree, and each must come out exactly once
+// Returns false if any is missed, repeated or wrong
+static bool afsk_clean(int samprate){
+  struct afsk_count new = {0},old = {0};
+  long n;
+  float *audio = afsk_synth(20,20,30,9,samprate,&new,&old,&n);
+  struct afsk *a = calloc(1,sizeof(*a));
+  afsk_init(a,samprate,1200,1200,2200,afsk_output,&new);
+  for(long i=0; i < n; i += 960)
+    afsk_process(a,audio + i,min(960L,n - i));
+  bool const ok = new.decoded == new.nframes && new.repeats == 0 && new.other == 0
+    && a->frames == (unsigned long)new.nframes && a->dups > 0; // More than one slicer got them
+  if(Verbose || !ok)
+    fprintf(stderr,"afsk: %d strong packets sent, %d decoded, %d repeated, %d false, %lu duplicates suppressed\n",
+	    new.nframes,new.decoded,new.repeats,new.other,a->dups);
+  afsk_free(a);
+  FREE(a);
+  FREE(audio);
+  afsk_count_free(&new,&old);
+  return ok;
+}
+
+static void bench_afsk(void){
+  int const samprate = 48000;
+  long n = 0;
+  float *audio = NULL;
+  struct afsk_count new = {0},old = {0};
+
+  if(Afsk_file != NULL){
+    FILE *fp = fopen(Afsk_file,"r");
+    if(fp == NULL){
+      fprintf(stderr,"afsk: can't read %s: %s\n",Afsk_file,strerror(errno));
+      exit(EX_NOINPUT);
+    }
+    fseek(fp,0,SEEK_END);
+    long const bytes = ftell(fp);
+    rewind(fp);
+    n = bytes / sizeof(int16_t);
+    int16_t *raw = malloc(n * sizeof(*raw));
+    audio = malloc(n * sizeof(*audio));
+    if(fread(raw,sizeof(*raw),n,fp) != (size_t)n){
+      fprintf(stderr,"afsk: short read on %s\n",Afsk_file);
+      exit(EX_IOERR);
+    }
+    fclose(fp);
+    for(long i=0; i < n; i++)
+      audio[i] = raw[i] * (1./32768);
+    FREE(raw);
+  } else {
+    // 200 packets with random twist (+/-9 dB) and noise (0 to 12 dB SNR)
+    srandom(AFSK_SEED);
+    audio = afsk_synth(200,0,12,9,samprate,&new,&old,&n);
+  }
+  struct afsk *a = calloc(1,sizeof(*a));
+  afsk_init(a,samprate,1200,1200,2200,afsk_output,&new);
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  for(long i=0; i < n; i += 960)
+    afsk_process(a,audio + i,min(960L,n - i)); // as packetd feeds it, 20 ms at a time
+  double const cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  struct result r = {
+    .test = "afsk",
+    .channels = 1,
+    .chan_samprate = samprate,
+    .blocks = n / (samprate * Blocktime * .001),
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = cpu,
+    .samples = n,
+  };
+  report(&r);
+  double const old_start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  ref_afsk(&old,audio,n,samprate);
+  double const old_cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - old_start;
+
+  if(Afsk_file != NULL)
+    fprintf(stderr,"afsk: %s: %d frames decoded, single slicer %d\n",Afsk_file,new.other,old.other);
+  else
+    fprintf(stderr,"afsk: %d packets sent, %d decoded (%d false, %d repeated), single slicer %d decoded (%d false)\n",
+	    new.nframes,new.decoded,new.other,new.repeats,old.decoded,old.other);
+  if(Verbose){
+    fprintf(stderr,"afsk: %.3f ns/sample, single slicer %.3f ns/sample; %lu duplicates suppressed\n",
+	    1e9 * cpu / n,1e9 * old_cpu / n,a->dups);
+    fprintf(stderr,"afsk: first decodes by slicer:");
+    for(int k=0; k < AFSK_SLICERS; k++)
+      fprintf(stderr," %lu",a->slicer_frames[k]);
+    fprintf(stderr,"\n");
+  }
+  bool const failed = Afsk_file == NULL
+    && (new.decoded < old.decoded || new.other != 0 || new.repeats != 0 || !afsk_clean(samprate));
+  afsk_free(a);
+  FREE(a);
+  FREE(audio);
+  afsk_count_free(&new,&old);
+  if(failed){
+    fprintf(stderr,"afsk: multi-slicer demodulator missed, repeated or invented packets\n");
+    exit(EX_SOFTWARE);
+  }
+}
+
+// Run a tone (the same in each channel) through a resampler 20 ms at a time
+// Returns the output, skipping the first 250 ms for the filter to settle
+static float *resample_tone(struct resampler *r,double freq,double seconds,int *out_frames){
+  int const channels = r->channels;
+  int const in_frames = seconds * r->in_rate;
+  int const packet = r->in_rate / 50;
+  float *in = malloc(in_frames * channels * sizeof(*in));
+  for(int i=0; i < in_frames; i++)
+    for(int ch=0; ch < channels; ch++)
+      in[i * channels + ch] = 0.5 * sin(2 * M_PI * freq * i / r->in_rate + ch);
+  int const max_out = resample_max_out(r,in_frames) + in_frames / packet;
+  float *out = malloc(max_out * channels * sizeof(*out));
+  int n = 0;
+  for(int i=0; i < in_frames; i += packet)
+    n += resample(r,in + i * channels,min(packet,in_frames - i),out + n * channels,max_out - n);
+  FREE(in);
+  int const skip = r->out_rate / 4;
+  *out_frames = n - skip;
+  memmove(out,out + skip * channels,(n - skip) * channels * sizeof(*out));
+  return out;
+}
+
+// Amplitude of the tone at freq (Hz) in one channel, and what's left over, as dB relative to 0.5 peak
+static void tone_response(float const *y,int n,int channels,int ch,double freq,int samprate,double *gain_db,double *resid_db){
+  double re = 0,im = 0,power = 0;
+  for(int k=0; k < n; k++){
+    double const v = y[k * channels + ch];
+    re += v * cos(2 * M_PI * freq * k / samprate);
+    im -= v * sin(2 * M_PI * freq * k / samprate);
+    power += v * v;
+  }
+  double const amp = 2 * hypot(re,im) / n;
+  power /= n;
+  double const resid = power - amp * amp / 2;
+  *gain_db = 20 * log10(amp / 0.5);
+  *resid_db = 10 * log10(max(resid,1e-30) / (0.5 * 0.5 / 2));
+}
+
+static void bench_resample(long const blocks){
+  bool failed = false;
+  static struct {
+    int in,out,channels;
+  } const Ratios[] = {
+    { 12000, 48000, 1 },
+    { 8000, 48000, 1 },
+    { 24000, 48000, 2 },
+    { 16000, 44100, 1 },
+    { 48000, 44100, 2 }, // Opus to a 44.1 kHz DAC
+    { 48000, 12000, 1 },
+  };
+  static char const *Names[] = { "low", "medium", "high" };
+  static float const Min_rejection[] = { 45, 70, 88 }; // dB, a little short of the design figures
+  for(enum resample_quality q = RESAMPLE_LOW; q <= RESAMPLE_HIGH; q++){
+    for(unsigned int t=0; t < sizeof(Ratios)/sizeof(Ratios[0]); t++){
+      struct resampler *r = create_resampler(Ratios[t].in,Ratios[t].out,Ratios[t].channels,q);
+      if(r == NULL){
+	fprintf(stderr,"resample: can't create %d -> %d\n",Ratios[t].in,Ratios[t].out);
+	failed = true;
+	continue;
+      }
+      // Passband tone: unity gain, and images (when interpolating) well down
+      int const low_rate = min(Ratios[t].in,Ratios[t].out);
+      double const fpass = 0.25 * low_rate;
+      int n;
+      float *y = resample_tone(r,fpass,1.5,&n);
+      n = min(n,r->out_rate); // One second, a whole number of cycles
+      double worst_gain = 0,worst_resid = -INFINITY;
+      for(int ch=0; ch < r->channels; ch++){
+	double gain,resid;
+	tone_response(y,n,r->channels,ch,fpass,r->out_rate,&gain,&resid);
+	if(fabs(gain) > fabs(worst_gain))
+	  worst_gain = gain;
+	worst_resid = max(worst_resid,resid);
+      }
+      FREE(y);
+      // Stopband tone when decimating: halfway between the two Nyquist frequencies
+      double alias = -INFINITY;
+      if(Ratios[t].in > Ratios[t].out){
+	reset_resampler(r);
+	double const fstop = (Ratios[t].in + Ratios[t].out) / 4.0;
+	y = resample_tone(r,fstop,1.5,&n);
+	double power = 0;
+	for(int k=0; k < n * r->channels; k++)
+	  power += y[k] * y[k];
+	alias = 10 * log10(max(power / (n * r->channels),1e-30) / (0.5 * 0.5 / 2));
+	FREE(y);
+      }
+      bool const bad = fabs(worst_gain) > 0.1 || worst_resid > -Min_rejection[q] || alias > -Min_rejection[q];
+      if(Verbose || bad)
+	fprintf(stderr,"resample: %s %d -> %d x%d (up %d down %d, %d taps/phase): passband %+.3f dB, images %.1f dB, aliases %.1f dB%s\n",
+		Names[q],Ratios[t].in,Ratios[t].out,Ratios[t].channels,r->up,r->down,r->taps,worst_gain,worst_resid,alias,
+		bad ? " FAILED" : "");
+      failed |= bad;
+      delete_resampler(r);
+    }
+  }
+  // Timing, as for an NBFM session at 12 kHz played at 48 kHz
+  struct resampler *r = create_resampler(12000,48000,1,RESAMPLE_MEDIUM);
+  int const packet = 240;
+  float in[packet];
+  for(int i=0; i < packet; i++)
+    in[i] = (float)random() / RAND_MAX - 0.5f;
+  int const max_out = resample_max_out(r,packet);
+  float out[max_out];
+  long long samples = 0;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+  for(long b=0; b < blocks; b++)
+    samples += resample(r,in,packet,out,max_out);
+  double const cpu = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  delete_resampler(r);
+  struct result res = {
+    .test = "resample",
+    .channels = 1,
+    .chan_samprate = 48000,
+    .blocks = blocks,
+    .wall = clock_sec(CLOCK_MONOTONIC) - wall_start,
+    .cpu = cpu,
+    .samples = samples,
+  };
+  report(&res);
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// Monitor's original receive queue: a malloc'ed packet inserted into a list sorted by sequence number,
+// popped by the decode thread under the same mutex
+struct ref_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct packet *queue;
+  bool done;
+  long delivered;
+};
+static void ref_queue_put(struct ref_queue *q,struct rtp_header const *rtp,uint8_t const *data,int len){
+  struct packet *pkt = malloc(sizeof(*pkt));
+  pkt->rtp = *rtp;
+  memcpy(pkt->content,data,len);
+  pkt->data = pkt->content;
+  pkt->len = len;
+  pthread_mutex_lock(&q->mutex);
+  struct packet *q_prev = NULL;
+  struct packet *qe = q->queue;
+  int qlen = 0;
+  for(; qe != NULL && qlen < 500 && pkt->rtp.seq >= qe->rtp.seq; q_prev = qe,qe = qe->next,qlen++)
+    ;
+  pkt->next = qe;
+  if(q_prev)
+    q_prev->next = pkt;
+  else
+    q->queue = pkt;
+  pthread_cond_signal(&q->cond);
+  pthread_mutex_unlock(&q->mutex);
+}
+static void *ref_queue_reader(void *arg){
+  struct ref_queue *q = arg;
+  long count = 0;
+  pthread_mutex_lock(&q->mutex);
+  while(true){
+    while(q->queue == NULL && !q->done)
+      pthread_cond_wait(&q->cond,&q->mutex);
+    if(q->queue == NULL)
+      break;
+    struct packet *pkt = q->queue;
+    q->queue = pkt->next;
+    pthread_mutex_unlock(&q->mutex);
+    count++;
+    __atomic_store_n(&q->delivered,count,__ATOMIC_RELEASE);
+    FREE(pkt);
+    pthread_mutex_lock(&q->mutex);
+  }
+  pthread_mutex_unlock(&q->mutex);
+  return (void *)count;
+}
+
+struct jitter_reader {
+  struct jitter_ring *jr;
+  long delivered;
+  bool order_error;
+  bool data_error;
+};
+static void *jitter_reader(void *arg){
+  struct jitter_reader *r = arg;
+  bool first = true;
+  uint16_t last = 0;
+  while(true){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    ts.tv_sec += 1; // Long after the writer finishes
+    // Look first, as monitor does, so the writer also meets a decoder that is only looking
+    if(jitter_wait(r->jr,&ts) < 0)
+      break;
+    struct jitter_slot *s = jitter_get(r->jr,&ts);
+    if(s == NULL)
+      break;
+    if(!first && (int16_t)(s->rtp.seq - last) <= 0)
+      r->order_error = true;
+    uint16_t tag;
+    memcpy(&tag,s->data,sizeof(tag));
+    if(tag != s->rtp.seq || s->len != 512)
+      r->data_error = true;
+    first = false;
+    last = s->rtp.seq;
+    __atomic_store_n(&r->delivered,r->delivered + 1,__ATOMIC_RELEASE);
+    jitter_release(r->jr,s);
+  }
+  return NULL;
+}
+
+static void bench_jitter(long const npackets){
+  // Arrival order: 5% swapped with the next packet, 1% sent twice, 1% lost
+  uint16_t *order = malloc(2 * npackets * sizeof(*order));
+  long n = 0;
+  for(long i=0; i < npackets; i++){
+    long const r = random() % 100;
+    if(r == 0)
+      continue;
+    if(r < 6 && i + 1 < npackets){
+      order[n++] = i + 1;
+      order[n++] = i++;
+      continue;
+    }
+    order[n++] = i;
+    if(r == 6)
+      order[n++] = i;
+  }
+  uint8_t payload[512];
+  memset(payload,0,sizeof(payload));
+  struct rtp_header rtp;
+  memset(&rtp,0,sizeof(rtp));
+  rtp.version = RTP_VERS;
+  rtp.type = 10;
+
+  struct jitter_ring *jr = calloc(1,sizeof(*jr));
+  jitter_init(jr);
+  struct jitter_reader reader = { .jr = jr };
+  pthread_t thread;
+  pthread_create(&thread,NULL,jitter_reader,&reader);
+  // Packets are written in bursts of half the ring, as from a busy socket; between bursts the
+  // writer waits for the reader to catch up. Only the bursts are timed
+  int const burst = JITTER_SLOTS / 2;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  double cpu = 0;
+  for(long i=0; i < n; i += burst){
+    while(i - __atomic_load_n(&reader.delivered,__ATOMIC_ACQUIRE) - (long)__atomic_load_n(&jr->drops,__ATOMIC_RELAXED) > 0)
+      ;
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(long j=i; j < n && j < i + burst; j++){
+      rtp.seq = order[j];
+      rtp.timestamp = 240 * (uint32_t)order[j];
+      memcpy(payload,&rtp.seq,sizeof(rtp.seq));
+      jitter_put(jr,&rtp,payload,sizeof(payload));
+    }
+    cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  double const wall = clock_sec(CLOCK_MONOTONIC) - wall_start;
+  pthread_join(thread,NULL);
+
+  struct ref_queue q = { .queue = NULL, .done = false, .delivered = 0 };
+  pthread_mutex_init(&q.mutex,NULL);
+  pthread_cond_init(&q.cond,NULL);
+  pthread_create(&thread,NULL,ref_queue_reader,&q);
+  double ref_cpu = 0;
+  for(long i=0; i < n; i += burst){
+    while(i - __atomic_load_n(&q.delivered,__ATOMIC_ACQUIRE) > 0)
+      ;
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(long j=i; j < n && j < i + burst; j++){
+      rtp.seq = order[j];
+      ref_queue_put(&q,&rtp,payload,sizeof(payload));
+    }
+    ref_cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  pthread_mutex_lock(&q.mutex);
+  q.done = true;
+  pthread_cond_signal(&q.cond);
+  pthread_mutex_unlock(&q.mutex);
+  void *ref_count;
+  pthread_join(thread,&ref_count);
+  pthread_mutex_destroy(&q.mutex);
+  pthread_cond_destroy(&q.cond);
+
+  struct result r = {
+    .test = "jitter",
+    .channels = 1,
+    .chan_samprate = 50, // 20 ms packets
+    .blocks = n,
+    .wall = wall,
+    .cpu = cpu,
+    .samples = n,
+  };
+  report(&r);
+  // Every packet put is delivered, counted as a drop, or (if it lost a race with the reader
+  // passing its sequence number) left behind until its slot is reused
+  long left = 0;
+  for(int i=0; i < JITTER_SLOTS; i++)
+    left += jr->slot[i].state == JITTER_FULL;
+  bool const failed = reader.order_error || reader.data_error || reader.delivered == 0
+    || reader.delivered + (long)jr->drops + left != n;
+  if(Verbose || failed)
+    fprintf(stderr,"jitter: %ld puts, %ld delivered, %llu dropped, %llu resequenced%s%s; %.1f ns/put, sorted list %.1f ns/put (%ld delivered)\n",
+	    n,reader.delivered,(unsigned long long)jr->drops,(unsigned long long)jr->reseqs,
+	    reader.order_error ? ", OUT OF ORDER" : "",reader.data_error ? ", BAD DATA" : "",
+	    1e9 * cpu / n,1e9 * ref_cpu / n,(long)ref_count);
+  jitter_free(jr);
+  FREE(jr);
+  FREE(order);
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// Receive side of the RTP consumers: rtp_recv() and session_lookup() (rtp_recv.c) against the
+// per-packet recvfrom() and linear session list scan they replaced, on loopback UDP from many SSRCs
+#define RECV_SESSIONS 1000
+#define RECV_BURST 48 // Small enough that a burst fits in a default socket receive buffer
+
+struct recv_session {
+  struct recv_session *next;
+  struct sockaddr_storage sender;
+  uint32_t ssrc;
+  long packets;
+};
+
+// Send one burst of packets, round robin over the SSRCs
+static void recv_send_burst(int fd,long first,int count){
+  uint8_t packet[12 + 512];
+  memset(packet,0,sizeof(packet));
+  for(long i = first; i < first + count; i++){
+    struct rtp_header rtp;
+    memset(&rtp,0,sizeof(rtp));
+    rtp.version = RTP_VERS;
+    rtp.type = 10;
+    rtp.ssrc = 1 + (i % RECV_SESSIONS);
+    rtp.seq = i / RECV_SESSIONS;
+    rtp.timestamp = 240 * rtp.seq;
+    hton_rtp(packet,&rtp);
+    if(send(fd,packet,sizeof(packet),0) != sizeof(packet)){
+      perror("recv: send");
+      exit(EX_OSERR);
+    }
+  }
+}
+
+static void bench_recv(long const npackets){
+  int const rx = socket(AF_INET,SOCK_DGRAM,0);
+  int const tx = socket(AF_INET,SOCK_DGRAM,0);
+  struct sockaddr_in sin;
+  memset(&sin,0,sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sin);
+  struct timeval tv = { .tv_sec = 1, .tv_usec = 0 }; // A lost packet fails the test rather than hanging it
+  if(rx == -1 || tx == -1
+     || bind(rx,(struct sockaddr *)&sin,sizeof(sin)) != 0
+     || bind(tx,(struct sockaddr *)&sin,sizeof(sin)) != 0
+     || setsockopt(rx,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)) != 0
+     || getsockname(rx,(struct sockaddr *)&sin,&len) != 0
+     || connect(tx,(struct sockaddr *)&sin,sizeof(sin)) != 0){
+    perror("recv: loopback sockets");
+    exit(EX_OSERR);
+  }
+  struct sockaddr_storage source;
+  len = sizeof(source);
+  getsockname(tx,(struct sockaddr *)&source,&len);
+
+  // The same sessions in a hash table and in a list
+  struct session_table table;
+  session_table_init(&table,SESSION_TABLE_BITS);
+  struct recv_session *sessions = calloc(RECV_SESSIONS,sizeof(*sessions));
+  struct recv_session *list = NULL;
+  for(int i=0; i < RECV_SESSIONS; i++){
+    struct recv_session * const sp = &sessions[i];
+    sp->sender = source;
+    sp->ssrc = 1 + i;
+    sp->next = list;
+    list = sp;
+    session_insert(&table,&sp->sender,sp->ssrc,sp);
+  }
+  bool failed = false;
+  {
+    // Same address and SSRC from another port is a different session
+    struct sockaddr_in other;
+    memcpy(&other,&source,sizeof(other));
+    other.sin_port = htons(ntohs(other.sin_port) + 1);
+    if(session_lookup(&table,&other,1) != NULL || session_lookup(&table,NULL,1) != NULL
+       || session_insert(&table,&source,1,&sessions[0]) != -1)
+      failed = true;
+  }
+
+  struct rtp_receiver receiver;
+  rtp_receiver_init(&receiver,0);
+  long received = 0, misses = 0;
+  double cpu = 0;
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  for(long i=0; i < npackets && !failed; i += RECV_BURST){
+    int const burst = min((long)RECV_BURST,npackets - i);
+    recv_send_burst(tx,i,burst);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(int got = 0; got < burst;){
+      int const n = rtp_recv(&receiver,rx);
+      if(n == -1){
+	perror("recv: rtp_recv");
+	failed = true;
+	break;
+      }
+      for(int j=0; j < n; j++){
+	struct rtp_packet const *pkt = &receiver.pkt[j];
+	struct recv_session * const sp = session_lookup(&table,&pkt->sender,pkt->rtp.ssrc);
+	if(sp == NULL || sp->ssrc != pkt->rtp.ssrc || pkt->len != 512)
+	  misses++;
+	else
+	  sp->packets++;
+      }
+      got += n;
+      received += n;
+    }
+    cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  double const wall = clock_sec(CLOCK_MONOTONIC) - wall_start;
+  for(int i=0; i < RECV_SESSIONS; i++)
+    if(sessions[i].packets != npackets / RECV_SESSIONS + (i < npackets % RECV_SESSIONS))
+      failed = true;
+
+  // What the consumers did before
+  long ref_received = 0;
+  double ref_cpu = 0;
+  for(long i=0; i < npackets && !failed; i += RECV_BURST){
+    int const burst = min((long)RECV_BURST,npackets - i);
+    recv_send_burst(tx,i,burst);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(int got = 0; got < burst; got++){
+      uint8_t buffer[PKTSIZE];
+      struct sockaddr_storage sender;
+      socklen_t socksize = sizeof(sender);
+      int const size = recvfrom(rx,buffer,sizeof(buffer),0,(struct sockaddr *)&sender,&socksize);
+      if(size <= RTP_MIN_SIZE){
+	perror("recv: recvfrom");
+	failed = true;
+	break;
+      }
+      struct rtp_header rtp;
+      ntoh_rtp(&rtp,buffer);
+      struct recv_session *sp;
+      for(sp = list; sp != NULL; sp = sp->next)
+	if(sp->ssrc == rtp.ssrc && address_match(&sp->sender,&sender) && getportnumber(&sp->sender) == getportnumber(&sender))
+	  break;
+      if(sp != NULL)
+	ref_received++;
+    }
+    ref_cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+
+  struct result r = {
+    .test = "recv",
+    .channels = 1,
+    .chan_samprate = 50, // 20 ms packets
+    .blocks = received,
+    .wall = wall,
+    .cpu = cpu,
+    .samples = received,
+  };
+  report(&r);
+  failed = failed || misses != 0 || received != npackets || ref_received != npackets;
+  if(Verbose || failed)
+    fprintf(stderr,"recv: %ld packets from %d SSRCs, %ld received, %ld misses, %.2f packets/call; %.1f ns/packet (%.0f packets/s), recvfrom and list scan %.1f ns/packet (%.0f packets/s)\n",
+	    npackets,RECV_SESSIONS,received,misses,
+	    receiver.calls > 0 ? (double)receiver.datagrams / receiver.calls : 0.0,
+	    1e9 * cpu / max(received,1L),received / cpu,1e9 * ref_cpu / max(ref_received,1L),ref_received / ref_cpu);
+  rtp_receiver_free(&receiver);
+  session_table_free(&table);
+  FREE(sessions);
+  close(rx);
+  close(tx);
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// Kernel SSRC and payload type filters (set_ssrc_filter(), set_pt_filter() in multicast.c) on a socket from
+// listen_mcast(), fed by loopback multicast carrying FILTER_CHANNELS streams
+#define FILTER_CHANNELS 500
+#define FILTER_GROUP "239.255.42.42"
+
+// Send packets first..first+count-1, round robin over the channels; odd channels use payload type 11
+static void filter_send(int fd,long first,int count){
+  uint8_t packet[12 + 320];
+  memset(packet,0,sizeof(packet));
+  for(long i = first; i < first + count; i++){
+    struct rtp_header rtp;
+    memset(&rtp,0,sizeof(rtp));
+    rtp.version = RTP_VERS;
+    rtp.ssrc = 1 + (i % FILTER_CHANNELS);
+    rtp.type = (rtp.ssrc & 1) ? 11 : 10;
+    rtp.seq = i / FILTER_CHANNELS;
+    hton_rtp(packet,&rtp);
+    if(send(fd,packet,sizeof(packet),0) != sizeof(packet)){
+      perror("rtpfilter: send");
+      exit(EX_OSERR);
+    }
+  }
+}
+
+static bool filter_wanted(uint32_t ssrc,uint32_t const *ssrcs,int nssrc,int type){
+  if(type >= 0)
+    return ((ssrc & 1) ? 11 : 10) == type;
+  for(int k=0; k < nssrc; k++)
+    if(ssrcs[k] == ssrc)
+      return true;
+  return nssrc == 0;
+}
+
+// Send npackets in bursts, receiving what the filter lets through after each one
+// Returns false if the wrong packets arrive, or the right ones don't; *cpu is the receive time
+static bool filter_run(int rx,int tx,struct rtp_receiver *receiver,long npackets,uint32_t const *ssrcs,int nssrc,int type,
+		       double *cpu,long *received){
+  int const burst = 48; // Fits in a default socket receive buffer
+  *cpu = 0;
+  *received = 0;
+  for(long i=0; i < npackets; i += burst){
+    int const count = min((long)burst,npackets - i);
+    int expect = 0;
+    for(long j = i; j < i + count; j++)
+      expect += filter_wanted(1 + (j % FILTER_CHANNELS),ssrcs,nssrc,type);
+    filter_send(tx,i,count);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(int got = 0; got < expect;){
+      int const n = rtp_recv(receiver,rx);
+      if(n <= 0){
+	fprintf(stderr,"rtpfilter: expected packet missing: %s\n",strerror(errno));
+	return false;
+      }
+      for(int k=0; k < n; k++)
+	if(!filter_wanted(receiver->pkt[k].rtp.ssrc,ssrcs,nssrc,type))
+	  return false;
+      got += n;
+      *received += n;
+    }
+    *cpu += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  // Nothing else should be waiting
+  uint8_t buffer[PKTSIZE];
+  return recv(rx,buffer,sizeof(buffer),MSG_DONTWAIT) == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void bench_rtpfilter(long const npackets){
+  struct sockaddr_in group;
+  memset(&group,0,sizeof(group));
+  group.sin_family = AF_INET;
+  group.sin_port = htons(DEFAULT_RTP_PORT + 42);
+  inet_pton(AF_INET,FILTER_GROUP,&group.sin_addr);
+  int const rx = listen_mcast(&group,"lo");
+  int const tx = socket(AF_INET,SOCK_DGRAM,0);
+  struct ip_mreqn mreqn;
+  memset(&mreqn,0,sizeof(mreqn));
+  mreqn.imr_ifindex = if_nametoindex("lo");
+  uint8_t const loop = 1;
+  struct timeval tv = { .tv_sec = 1, .tv_usec = 0 }; // A missing packet fails the test rather than hanging it
+  if(rx == -1 || tx == -1
+     || setsockopt(tx,IPPROTO_IP,IP_MULTICAST_IF,&mreqn,sizeof(mreqn)) != 0
+     || setsockopt(tx,IPPROTO_IP,IP_MULTICAST_LOOP,&loop,sizeof(loop)) != 0
+     || setsockopt(rx,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)) != 0
+     || connect(tx,(struct sockaddr *)&group,sizeof(group)) != 0){
+    perror("rtpfilter: loopback multicast");
+    exit(EX_OSERR);
+  }
+  struct rtp_receiver receiver;
+  rtp_receiver_init(&receiver,0);
+
+  // One channel of many, as pcmcat -s or wd-record
+  uint32_t const one = FILTER_CHANNELS / 2;
+  uint32_t const some[] = { 3, 77, FILTER_CHANNELS };
+  double all_cpu = 0, one_cpu = 0, cpu;
+  long all_received = 0, one_received = 0, received;
+  bool ok = filter_run(rx,tx,&receiver,npackets,NULL,0,-1,&all_cpu,&all_received);
+  ok = ok && set_ssrc_filter(rx,&one,1) == 0;
+  // Wall time includes sending every channel's packets, which the filter discards in the kernel
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  ok = ok && filter_run(rx,tx,&receiver,npackets,&one,1,-1,&one_cpu,&one_received);
+  double const wall = clock_sec(CLOCK_MONOTONIC) - wall_start;
+  // Replaced at run time, then by a payload type filter, then removed
+  ok = ok && set_ssrc_filter(rx,some,3) == 0
+    && filter_run(rx,tx,&receiver,4 * FILTER_CHANNELS,some,3,-1,&cpu,&received) && received == 12;
+  ok = ok && set_pt_filter(rx,(uint8_t const []){ 11 },1) == 0
+    && filter_run(rx,tx,&receiver,2 * FILTER_CHANNELS,NULL,0,11,&cpu,&received) && received == FILTER_CHANNELS;
+  ok = ok && set_ssrc_filter(rx,NULL,0) == 0
+    && filter_run(rx,tx,&receiver,2 * FILTER_CHANNELS,NULL,0,-1,&cpu,&received) && received == 2 * FILTER_CHANNELS;
+
+  struct result r = {
+    .test = "rtpfilter",
+    .channels = 1,
+    .chan_samprate = 50, // 20 ms packets
+    .blocks = one_received,
+    .wall = wall,
+    .cpu = one_cpu,
+    .samples = one_received,
+  };
+  report(&r);
+  bool const failed = !ok || all_received != npackets || one_received != npackets / FILTER_CHANNELS;
+  if(Verbose || failed)
+    fprintf(stderr,"rtpfilter: %ld packets on %d channels; unfiltered %ld received, %.3f ms CPU; filtered to one SSRC %ld received, %.3f ms CPU (%.0fx less)%s\n",
+	    npackets,FILTER_CHANNELS,all_received,1e3 * all_cpu,one_received,1e3 * one_cpu,
+	    one_cpu > 0 ? all_cpu / one_cpu : 0.0,ok ? "" : ", WRONG PACKETS");
+  rtp_receiver_free(&receiver);
+  close(rx);
+  close(tx);
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// .wav writing (wav.c) as in wd-record and jt-decoded, against the fdopen()/fseeko()/fputc() code it replaced
+#define WAV_FRAMES 240   // 20 ms at 12 kHz, as from radiod to wsprd/jt9
+#define WAV_PACKETS 2000 // For the comparison runs
+
+// The old per-recorder code, kept as the reference
+struct ref_wav {
+  FILE *fp;
+  struct wav header;
+  void *iobuffer;
+};
+
+static void ref_open(struct ref_wav *rw,int fd,unsigned int samprate,int channels){
+  rw->fp = fdopen(fd,"w+");
+  assert(rw->fp != NULL);
+  rw->iobuffer = malloc(1<<16);
+  setbuffer(rw->fp,rw->iobuffer,1<<16);
+  memcpy(rw->header.ChunkID,"RIFF", 4);
+  rw->header.ChunkSize = 0xffffffff;
+  memcpy(rw->header.Format,"WAVE",4);
+  memcpy(rw->header.Subchunk1ID,"fmt ",4);
+  rw->header.Subchunk1Size = 16;
+  rw->header.AudioFormat = 1;
+  rw->header.NumChannels = channels;
+  rw->header.SampleRate = samprate;
+  rw->header.ByteRate = samprate * channels * 16/8;
+  rw->header.BlockAlign = channels * 16/8;
+  rw->header.BitsPerSample = 16;
+  memcpy(rw->header.SubChunk2ID,"data",4);
+  rw->header.Subchunk2Size = 0xffffffff;
+  fwrite(&rw->header,sizeof(rw->header),1,rw->fp);
+  fflush(rw->fp);
+}
+
+static void ref_write(struct ref_wav *rw,int32_t offset,int channels,int16_t const *samples,int count){
+  fseeko(rw->fp,offset * (off_t)sizeof(uint16_t) * channels,SEEK_CUR);
+  for(int n = 0; n < count; n++){
+    fputc(samples[n] >> 8,rw->fp);
+    fputc(samples[n],rw->fp);
+  }
+}
+
+static void ref_close(struct ref_wav *rw){
+  fflush(rw->fp);
+  struct stat statbuf;
+  fstat(fileno(rw->fp),&statbuf);
+  rw->header.ChunkSize = statbuf.st_size - 8;
+  rw->header.Subchunk2Size = statbuf.st_size - sizeof(rw->header);
+  rewind(rw->fp);
+  fwrite(&rw->header,sizeof(rw->header),1,rw->fp);
+  fflush(rw->fp);
+  fclose(rw->fp);
+  FREE(rw->iobuffer);
+}
+
+// A temporary file, optionally holding 'prefill' bytes left over from an earlier run
+static int wav_tempfile(char *name,size_t size,uint8_t const *prefill,size_t len){
+  char const *tmpdir = getenv("TMPDIR");
+  snprintf(name,size,"%s/bench-wav-XXXXXX",tmpdir != NULL ? tmpdir : "/tmp");
+  int const fd = mkstemp(name);
+  if(fd == -1 || (len > 0 && write(fd,prefill,len) != (ssize_t)len) || lseek(fd,0,SEEK_SET) != 0){
+    perror("wav: temporary file");
+    exit(EX_CANTCREAT);
+  }
+  return fd;
+}
+
+static uint8_t *read_file(char const *name,size_t *len){
+  FILE * const fp = fopen(name,"r");
+  assert(fp != NULL);
+  fseeko(fp,0,SEEK_END);
+  *len = ftello(fp);
+  rewind(fp);
+  uint8_t * const data = malloc(*len + 1);
+  assert(data != NULL);
+  size_t const r = fread(data,1,*len,fp);
+  assert(r == *len);
+  (void)r;
+  fclose(fp);
+  return data;
+}
+
+// Write one stream both ways, with lost, late and duplicated packets, and compare the files
+// Returns false if they differ
+static bool wav_compare(int channels,double loss,double late,double dup,size_t prefill){
+  int const samples_per_packet = WAV_FRAMES * channels;
+  int16_t *data = malloc(WAV_PACKETS * samples_per_packet * sizeof(*data));
+  uint8_t *old = malloc(prefill + 1);
+  assert(data != NULL && old != NULL);
+  for(int i=0; i < WAV_PACKETS * samples_per_packet; i++)
+    data[i] = random();
+  for(size_t i=0; i < prefill; i++)
+    old[i] = random();
+
+  // Arrival order: packet numbers, with some dropped, delayed by one or repeated
+  int order[2 * WAV_PACKETS];
+  int n = 0;
+  for(int i=0; i < WAV_PACKETS; i++){
+    double const r = (double)random() / RAND_MAX;
+    if(i > 0 && r < loss)
+      continue;
+    if(r < loss + late && i + 1 < WAV_PACKETS){
+      order[n++] = i + 1;
+      order[n++] = i++;
+      continue;
+    }
+    order[n++] = i;
+    if(r < loss + late + dup)
+      order[n++] = i;
+  }
+  char ref_name[PATH_MAX],new_name[PATH_MAX];
+  struct ref_wav rw;
+  struct wav_file wf;
+  ref_open(&rw,wav_tempfile(ref_name,sizeof(ref_name),old,prefill),12000,channels);
+  wav_open(&wf,wav_tempfile(new_name,sizeof(new_name),old,prefill),12000,channels);
+  uint32_t next_timestamp = 0;
+  for(int k=0; k < n; k++){
+    uint32_t const timestamp = order[k] * WAV_FRAMES;
+    int32_t const offset = timestamp - next_timestamp;
+    int16_t const * const samples = data + order[k] * samples_per_packet;
+    ref_write(&rw,offset,channels,samples,samples_per_packet);
+    wav_write(&wf,offset,samples,samples_per_packet);
+    next_timestamp = timestamp + WAV_FRAMES;
+  }
+  ref_close(&rw);
+  wav_close(&wf);
+  size_t ref_len,new_len;
+  uint8_t *ref_data = read_file(ref_name,&ref_len);
+  uint8_t *new_data = read_file(new_name,&new_len);
+  bool const same = ref_len == new_len && memcmp(ref_data,new_data,ref_len) == 0;
+  if(Verbose > 1 || !same)
+    fprintf(stderr,"wav: %d channel(s), %d packets arriving, %zu bytes left from before: %zu bytes, %s\n",
+	    channels,n,prefill,new_len,same ? "identical" : "DIFFERENT");
+  unlink(ref_name);
+  unlink(new_name);
+  FREE(ref_data);
+  FREE(new_data);
+  FREE(old);
+  FREE(data);
+  return same;
+}
+
+static void bench_wav(long const npackets){
+  bool ok = wav_compare(1,0,0,0,0);
+  ok = wav_compare(2,0,0,0,0) && ok;
+  ok = wav_compare(1,.02,.02,.01,0) && ok;
+  ok = wav_compare(2,.02,.02,.01,0) && ok;
+  ok = wav_compare(1,.2,0,0,0) && ok; // Gaps longer than a packet
+  // Killed and restarted within a cycle: the old file is overwritten but not truncated
+  ok = wav_compare(1,.02,.02,.01,WAV_PACKETS * WAV_FRAMES) && ok;
+  ok = wav_compare(1,.02,.02,.01,10 * WAV_PACKETS * WAV_FRAMES) && ok;
+
+  // Timing: one in-order mono stream, as from radiod to a decoder
+  int16_t samples[WAV_FRAMES];
+  for(int i=0; i < WAV_FRAMES; i++)
+    samples[i] = random();
+  char name[PATH_MAX];
+  double cpu[2];
+  for(int pass=0; pass < 2; pass++){
+    struct ref_wav rw;
+    struct wav_file wf;
+    int const fd = wav_tempfile(name,sizeof(name),NULL,0);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    if(pass == 0)
+      ref_open(&rw,fd,12000,1);
+    else
+      wav_open(&wf,fd,12000,1);
+    for(long i=0; i < npackets; i++){
+      if(pass == 0)
+	ref_write(&rw,0,1,samples,WAV_FRAMES);
+      else
+	wav_write(&wf,0,samples,WAV_FRAMES);
+    }
+    if(pass == 0)
+      ref_close(&rw);
+    else
+      wav_close(&wf);
+    cpu[pass] = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+    unlink(name);
+  }
+  struct result r = {
+    .test = "wav",
+    .channels = 1,
+    .chan_samprate = 12000,
+    .blocks = lround(npackets * 20 / Blocktime), // 20 ms packets
+    .wall = cpu[1],
+    .cpu = cpu[1],
+    .samples = npackets * WAV_FRAMES,
+  };
+  report(&r);
+  if(Verbose || !ok)
+    fprintf(stderr,"wav: %ld packets of %d samples; fputc %.2f ns/sample, wav_write %.2f ns/sample (%.1fx)%s\n",
+	    npackets,WAV_FRAMES,1e9 * cpu[0] / (npackets * WAV_FRAMES),1e9 * cpu[1] / (npackets * WAV_FRAMES),
+	    cpu[1] > 0 ? cpu[0] / cpu[1] : 0.0,ok ? "" : ", OUTPUT DIFFERS");
+  if(!ok)
+    exit(EX_SOFTWARE);
+}
+
+// pcmrecord's writer threads, run as a separate process on loopback multicast: streams with a gap, a duplicate
+// and a short tail are recorded with O_DIRECT, fallocate() and several writers, then each file closed by
+// finish_file() is checked byte for byte against what was sent, including its size and .wav header
+// The files go in the current directory, since /tmp is often tmpfs, which doesn't support O_DIRECT
+#define PCMREC_GROUP "239.255.42.43"
+#define PCMREC_STREAMS 3
+#define PCMREC_FRAMES 960   // 20 ms at 48 kHz
+#define PCMREC_TAIL 333     // Frames in each stream's last packet, so the file doesn't end on a block boundary
+#define PCMREC_GAP 40       // Packets PCMREC_GAP to PCMREC_GAP+4 of stream 1 are lost
+#define PCMREC_DUP 60       // and packet PCMREC_DUP of stream 2 is sent twice
+
+static int16_t pcmrec_sample(int stream,long frame){
+  return (int16_t)(frame * 37 + stream * 1000 + 1);
+}
+
+// .wav files are little endian
+static uint16_t le16(uint8_t const *dp){
+  return dp[0] | dp[1] << 8;
+}
+static uint32_t le32(uint8_t const *dp){
+  return le16(dp) | (uint32_t)le16(dp + 2) << 16;
+}
+
+static bool pcmrec_lost(int stream,long p){
+  return stream == 1 && p >= PCMREC_GAP && p < PCMREC_GAP + 5;
+}
+
+static void pcmrec_send(int fd,uint32_t ssrc,int stream,long p,int frames){
+  uint8_t packet[12 + 2 * PCMREC_FRAMES];
+  struct rtp_header rtp;
+  memset(&rtp,0,sizeof(rtp));
+  rtp.version = RTP_VERS;
+  rtp.type = 10; // Overridden by -c and -r
+  rtp.ssrc = ssrc;
+  rtp.seq = p;
+  rtp.timestamp = p * PCMREC_FRAMES;
+  uint8_t *dp = hton_rtp(packet,&rtp);
+  for(int k=0; k < frames; k++)
+    dp = put16(dp,(uint16_t)pcmrec_sample(stream,p * PCMREC_FRAMES + k));
+  if(send(fd,packet,dp - packet,0) != dp - packet){
+    perror("pcmrecord: send");
+    exit(EX_OSERR);
+  }
+}
+
+// Check one recording; returns false if it isn't exactly what was sent
+static bool pcmrec_check(char const *name,int stream,long npackets){
+  size_t len;
+  uint8_t *file = read_file(name,&len);
+  bool ok = len >= 12 && memcmp(file,"RIFF",4) == 0 && memcmp(file + 8,"WAVE",4) == 0
+    && (size_t)le32(file + 4) == len - 8;
+  // Walk the chunks: fmt, pcmrecord's auxi, then data
+  size_t data = 0;
+  for(size_t off = 12; ok && data == 0 && off + 8 <= len; off += 8 + le32(file + off + 4)){
+    if(memcmp(file + off,"fmt ",4) == 0)
+      ok = le16(file + off + 8) == 1 && le16(file + off + 10) == 1 && le32(file + off + 12) == 48000;
+    else if(memcmp(file + off,"data",4) == 0){
+      data = off + 8;
+      ok = (size_t)le32(file + off + 4) == len - data;
+    }
+  }
+  long const frames = (npackets - 1) * PCMREC_FRAMES + PCMREC_TAIL;
+  ok = ok && data != 0 && len - data == (size_t)frames * 2;
+  for(long k=0; ok && k < frames; k++){
+    int16_t const expect = pcmrec_lost(stream,k / PCMREC_FRAMES) ? 0 : pcmrec_sample(stream,k); // Gaps are silence
+    ok = (int16_t)le16(file + data + 2 * k) == expect;
+  }
+  FREE(file);
+  return ok;
+}
+
+static void bench_pcmrecord(long const npackets){
+  if(access(Pcmrecord_path,X_OK) != 0){
+    fprintf(stderr,"pcmrecord: %s: %s; skipped (build it, or give its path with -P)\n",Pcmrecord_path,strerror(errno));
+    return;
+  }
+  char dir[] = "bench-pcmrecord-XXXXXX";
+  if(mkdtemp(dir) == NULL){
+    perror("pcmrecord: mkdtemp");
+    exit(EX_CANTCREAT);
+  }
+  struct sockaddr_in group;
+  memset(&group,0,sizeof(group));
+  group.sin_family = AF_INET;
+  group.sin_port = htons(DEFAULT_RTP_PORT + 43);
+  inet_pton(AF_INET,PCMREC_GROUP,&group.sin_addr);
+  int const tx = socket(AF_INET,SOCK_DGRAM,0);
+  struct ip_mreqn mreqn;
+  memset(&mreqn,0,sizeof(mreqn));
+  mreqn.imr_ifindex = if_nametoindex("lo");
+  uint8_t const loop = 1;
+  if(tx == -1
+     || setsockopt(tx,IPPROTO_IP,IP_MULTICAST_IF,&mreqn,sizeof(mreqn)) != 0
+     || setsockopt(tx,IPPROTO_IP,IP_MULTICAST_LOOP,&loop,sizeof(loop)) != 0
+     || connect(tx,(struct sockaddr *)&group,sizeof(group)) != 0){
+    perror("pcmrecord: loopback multicast");
+    exit(EX_OSERR);
+  }
+  char address[64];
+  snprintf(address,sizeof(address),"%s:%d,lo",PCMREC_GROUP,DEFAULT_RTP_PORT + 43);
+  char *path = realpath(dir,NULL); // It changes to the directory for every new file
+  assert(path != NULL);
+  char *argv[] = { (char *)Pcmrecord_path,"-d",path,"-c","1","-r","48000","-D","-w","2",address,NULL,NULL };
+  if(Verbose){
+    argv[10] = "-v";
+    argv[11] = address;
+  }
+  pid_t pid;
+  int const e = posix_spawn(&pid,Pcmrecord_path,NULL,NULL,argv,environ);
+  if(e != 0){
+    fprintf(stderr,"pcmrecord: spawn %s: %s\n",Pcmrecord_path,strerror(e));
+    exit(EX_OSERR);
+  }
+  usleep(300000); // Let it join the group
+
+  // The streams are interleaved a packet at a time, as from radiod; one more is too short to keep
+  uint32_t const ssrc0 = 10000 + (getpid() % 1000) * 10;
+  double const start = clock_sec(CLOCK_MONOTONIC);
+  long sent = 0;
+  for(long p=0; p < npackets; p++){
+    for(int s=0; s < PCMREC_STREAMS; s++){
+      if(pcmrec_lost(s,p))
+	continue;
+      int const frames = p == npackets - 1 ? PCMREC_TAIL : PCMREC_FRAMES;
+      pcmrec_send(tx,ssrc0 + s,s,p,frames);
+      if(s == 2 && p == PCMREC_DUP)
+	pcmrec_send(tx,ssrc0 + s,s,p,frames);
+      sent += frames;
+    }
+    if(p < 5)
+      pcmrec_send(tx,ssrc0 + PCMREC_STREAMS,PCMREC_STREAMS,p,PCMREC_FRAMES);
+    usleep(1000); // Don't overrun its socket buffer
+  }
+  usleep(500000); // Let it take everything from the socket
+  // On SIGTERM pcmrecord closes every file and waits for the writers to finish them
+  kill(pid,SIGTERM);
+  int status;
+  struct rusage usage;
+  wait4(pid,&status,0,&usage);
+  double const wall = clock_sec(CLOCK_MONOTONIC) - start;
+  close(tx);
+
+  // Exactly one file for each stream, named for its SSRC
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == EX_OK;
+  int found[PCMREC_STREAMS + 1] = {0};
+  DIR * const dp = opendir(dir);
+  assert(dp != NULL);
+  struct dirent const *de;
+  while((de = readdir(dp)) != NULL){
+    if(de->d_name[0] == '.')
+      continue;
+    char name[PATH_MAX];
+    snprintf(name,sizeof(name),"%s/%s",dir,de->d_name);
+    unsigned long const ssrc = strtoul(de->d_name,NULL,10);
+    int const s = ssrc - ssrc0;
+    if(s < 0 || s >= PCMREC_STREAMS || found[s]++ != 0 || !pcmrec_check(name,s,npackets)){
+      if(Verbose)
+	fprintf(stderr,"pcmrecord: %s unexpected or wrong\n",name);
+      ok = false;
+    }
+    unlink(name);
+  }
+  closedir(dp);
+  rmdir(dir);
+  FREE(path);
+  for(int s=0; s < PCMREC_STREAMS; s++)
+    ok = ok && found[s] == 1;
+
+  double const cpu = usage.ru_utime.tv_sec + 1e-6 * usage.ru_utime.tv_usec + usage.ru_stime.tv_sec + 1e-6 * usage.ru_stime.tv_usec;
+  struct result r = {
+    .test = "pcmrecord",
+    .channels = PCMREC_STREAMS,
+    .chan_samprate = 48000,
+    .blocks = lround(npackets * 20 / Blocktime), // 20 ms packets
+    .wall = wall,
+    .cpu = cpu,
+    .samples = sent,
+  };
+  report(&r);
+  if(Verbose || !ok)
+    fprintf(stderr,"pcmrecord: %d streams of %ld packets, %ld samples recorded, %.3f s CPU%s\n",
+	    PCMREC_STREAMS,npackets,sent,cpu,ok ? "" : ", RECORDINGS WRONG");
+  if(!ok)
+    exit(EX_SOFTWARE);
+}
+
+// Opus output through send_output() as from radiod's demod threads, encoded inline and by the encoder pool
+// (audio.c), sent to a loopback socket. One thread produces every channel's blocks, as fast as it can
+// for the inline pass and in real time for the pool, which lowers complexity and then drops blocks
+// if it can't keep up. A reader thread checks each stream:
+// contiguous sequence numbers, timestamps advancing a block at a time except across drops, and the
+// marker bit set exactly where they don't
+// The pool pass ends by switching every channel to PCM with a burst of Opus blocks still queued; the PCM
+// packets must follow the last Opus packet in sequence
+struct opus_check {
+  int fd;
+  int nchan;
+  int step;          // Timestamp increment per block
+  int opus_type;     // Anything else is PCM sent after a switch from Opus
+  volatile bool done;
+  struct {
+    bool started;
+    bool pcm;
+    uint16_t next_seq;
+    uint32_t next_ts;
+    long packets;
+    long pcm_packets;
+    long errors;
+  } chan[];
+};
+
+static void *opus_reader(void *arg){
+  struct opus_check * const oc = arg;
+  struct rtp_receiver receiver;
+  rtp_receiver_init(&receiver,0);
+  while(true){
+    int const n = rtp_recv(&receiver,oc->fd);
+    if(n == -1){
+      if(oc->done && (errno == EAGAIN || errno == EWOULDBLOCK))
+	break; // Quiet for the receive timeout after the last block
+      continue;
+    }
+    for(int i=0; i < n; i++){
+      struct rtp_packet const *pkt = &receiver.pkt[i];
+      if(pkt->rtp.ssrc < 1 || pkt->rtp.ssrc > (uint32_t)oc->nchan)
+	continue;
+      typeof(oc->chan[0]) * const cp = &oc->chan[pkt->rtp.ssrc - 1];
+      cp->packets++;
+      if(pkt->rtp.type != oc->opus_type){
+	// The sequence must carry straight on from the Opus packets, with none of them after
+	cp->pcm_packets++;
+	if(pkt->rtp.seq != cp->next_seq)
+	  cp->errors++;
+	cp->pcm = true;
+	cp->next_seq = pkt->rtp.seq + 1;
+	continue;
+      }
+      if(cp->pcm)
+	cp->errors++;
+      if(!cp->started){
+	if(!pkt->rtp.marker || pkt->rtp.timestamp != 0)
+	  cp->errors++;
+	cp->started = true;
+      } else {
+	int32_t const gap = pkt->rtp.timestamp - cp->next_ts;
+	if(pkt->rtp.seq != cp->next_seq || gap < 0 || gap % oc->step != 0 || pkt->rtp.marker != (gap != 0))
+	  cp->errors++;
+      }
+      cp->next_seq = pkt->rtp.seq + 1;
+      cp->next_ts = pkt->rtp.timestamp + oc->step;
+    }
+  }
+  rtp_receiver_free(&receiver);
+  return NULL;
+}
+
+#define OPUS_BURST (OPUS_RING/2) // Blocks queued unpaced just before the switch to PCM
+
+static void bench_opus(long const blocks){
+  int const samprate = 48000;
+  int const frames = lround(samprate * Blocktime / 1000.0);
+  int const rx = socket(AF_INET,SOCK_DGRAM,0);
+  int const tx = socket(AF_INET,SOCK_DGRAM,0);
+  struct sockaddr_in sin;
+  memset(&sin,0,sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sin);
+  struct timeval tv = { .tv_sec = 0, .tv_usec = 200000 };
+  int const bufsize = 8 << 20;
+  if(rx == -1 || tx == -1
+     || bind(rx,(struct sockaddr *)&sin,sizeof(sin)) != 0
+     || setsockopt(rx,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)) != 0
+     || getsockname(rx,(struct sockaddr *)&sin,&len) != 0){
+    perror("opus: loopback sockets");
+    exit(EX_OSERR);
+  }
+  setsockopt(rx,SOL_SOCKET,SO_RCVBUF,&bufsize,sizeof(bufsize)); // Best effort; capped by net.core.rmem_max
+  Output_fd = tx;
+
+  // 1 kHz stereo tone
+  float *pcm = malloc(2 * frames * sizeof(*pcm));
+  for(int i=0; i < frames; i++)
+    pcm[2*i] = pcm[2*i+1] = 0.5 * sinf(2 * M_PI * 1000 * i / samprate);
+
+  struct channel *chans = calloc(Nchannels,sizeof(*chans));
+  struct opus_check *oc = calloc(1,sizeof(*oc) + Nchannels * sizeof(oc->chan[0]));
+  int const saved_threads = N_encoder_threads;
+  double cpu[2] = {0,0}, wall[2] = {0,0};
+  long sent[2] = {0,0}, drops[2] = {0,0}, received[2] = {0,0}, errors[2] = {0,0};
+  int min_complexity[2] = {10,10};
+  uint64_t hist[2][OPUS_TIME_BINS];
+  memset(hist,0,sizeof(hist));
+  bool failed = false;
+  for(int pass=0; pass < 2; pass++){
+    N_encoder_threads = pass == 0 ? 0 : saved_threads; // Inline, then the pool
+    for(int i=0; i < Nchannels; i++){
+      struct channel * const chan = &chans[i];
+      *chan = Template;
+      chan->inuse = true;
+      chan->output.samprate = samprate;
+      chan->output.channels = 2;
+      chan->output.encoding = OPUS;
+      chan->output.rtp.ssrc = i + 1;
+      chan->output.rtp.type = pt_from_info(samprate,2,OPUS);
+      memcpy(&chan->output.dest_socket,&sin,sizeof(sin));
+    }
+    memset(oc,0,sizeof(*oc) + Nchannels * sizeof(oc->chan[0]));
+    oc->fd = rx;
+    oc->nchan = Nchannels;
+    oc->step = frames;
+    oc->opus_type = pt_from_info(samprate,2,OPUS);
+    pthread_t reader;
+    pthread_create(&reader,NULL,opus_reader,oc);
+
+    double const wall_start = clock_sec(CLOCK_MONOTONIC);
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC,&deadline);
+    for(long b=0; b < blocks; b++){
+      for(int i=0; i < Nchannels; i++)
+	send_output(&chans[i],pcm,frames,false);
+      if(pass == 1){
+	deadline.tv_nsec += Blocktime * MILLION;
+	while(deadline.tv_nsec >= BILLION){
+	  deadline.tv_nsec -= BILLION;
+	  deadline.tv_sec++;
+	}
+	double const t = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+	clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&deadline,NULL);
+	cpu[pass] -= clock_sec(CLOCK_THREAD_CPUTIME_ID) - t; // Not the sleep call itself
+      }
+    }
+    cpu[pass] += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+    if(pass == 1){
+      // Switch to PCM with blocks still queued in the pool, as an OUTPUT_ENCODING command would
+      for(int i=0; i < Nchannels; i++){
+	struct channel * const chan = &chans[i];
+	for(int k=0; k < OPUS_BURST; k++)
+	  send_output(chan,pcm,frames,false);
+	chan->output.encoding = S16BE;
+	chan->output.rtp.type = pt_from_info(samprate,2,S16BE);
+	send_output(chan,pcm,frames,false);
+      }
+    }
+    for(int i=0; i < Nchannels; i++){
+      struct channel * const chan = &chans[i];
+      close_opus(chan); // Waits for the pool to finish the channel
+      min_complexity[pass] = min(min_complexity[pass],chan->output.opus_complexity_now);
+    }
+    wall[pass] = clock_sec(CLOCK_MONOTONIC) - wall_start;
+    oc->done = true;
+    pthread_join(reader,NULL);
+
+    for(int i=0; i < Nchannels; i++){
+      struct channel const * const chan = &chans[i];
+      sent[pass] += chan->output.rtp.packets;
+      drops[pass] += chan->output.opus_drops;
+      received[pass] += oc->chan[i].packets;
+      errors[pass] += oc->chan[i].errors;
+      for(int j=0; j < OPUS_TIME_BINS; j++)
+	hist[pass][j] += chan->output.opus_time[j];
+      if(oc->chan[i].packets - oc->chan[i].pcm_packets + (long)chan->output.opus_drops != blocks + (pass == 1 ? OPUS_BURST : 0)
+	 || oc->chan[i].packets != (long)chan->output.rtp.packets
+	 || (pass == 1 && oc->chan[i].pcm_packets == 0))
+	failed = true;
+    }
+    if(errors[pass] != 0 || (pass == 0 && drops[pass] != 0))
+      failed = true;
+  }
+  N_encoder_threads = saved_threads;
+  Output_fd = -1;
+
+  struct result r = {
+    .test = "opus",
+    .channels = Nchannels,
+    .chan_samprate = samprate,
+    .blocks = blocks,
+    .wall = wall[1],
+    .cpu = cpu[1], // What's left in the demod threads
+    .samples = (long long)blocks * Nchannels * frames,
+  };
+  report(&r);
+  if(Verbose || failed){
+    for(int pass=0; pass < 2; pass++){
+      fprintf(stderr,"opus %s: %ld blocks, %ld sent, %ld received, %ld dropped, %ld stream errors; demod thread %.1f us/block, wall %.3f s, lowest complexity %d; log2 us encode times:",
+	      pass == 0 ? "inline" : "pool",blocks * Nchannels,sent[pass],received[pass],drops[pass],errors[pass],
+	      1e6 * cpu[pass] / (blocks * Nchannels),wall[pass],min_complexity[pass]);
+      for(int j=0; j < OPUS_TIME_BINS; j++)
+	fprintf(stderr," %llu",(unsigned long long)hist[pass][j]);
+      fprintf(stderr,"\n");
+    }
+  }
+  FREE(oc);
+  FREE(chans);
+  FREE(pcm);
+  close(rx);
+  close(tx);
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// Status in answer to polls of all channels (radio_status.c): BULK_STATUS packets carrying many channels
+// with only what changed, against the STATUS packet per channel that older pollers still get
+#define STATUS_SSRC 5000    // First channel's SSRC
+#define STATUS_RETUNE 10    // One channel in 10 is retuned between polls
+#define STATUS_BLOCKS 50    // Blocks integrated between polls, one second's worth
+
+// Read everything sent so far, decoding each channel's status onto its shadow as control does
+// Returns the number of channel records
+static long status_drain(int fd,struct frontend *frontend,struct channel *shadow,long *bytes,long *datagrams){
+  uint8_t buffer[PKTSIZE];
+  int length;
+  long records = 0;
+  while((length = recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT)) > 0){
+    *bytes += length + 28; // IPv4 and UDP headers
+    (*datagrams)++;
+    bool const bulk = (enum pkt_type)buffer[0] == BULK_STATUS;
+    if(!bulk && (enum pkt_type)buffer[0] != STATUS)
+      continue;
+    int offset = 0;
+    int len = length - 1;
+    while(!bulk || (len = next_bulk_record(buffer+1,length-1,&offset)) > 0){
+      uint8_t const * const record = bulk ? buffer + 1 + offset - len : buffer + 1;
+      uint32_t const ssrc = get_ssrc(record,len);
+      if(ssrc >= STATUS_SSRC && ssrc < STATUS_SSRC + (uint32_t)Nchannels){
+	// A STATUS packet or a keyframe has every field the channel has, so a test point missing from it is unused
+	if(!bulk || get_bulk_format(record,len) == 2)
+	  shadow[ssrc - STATUS_SSRC].tp1 = NAN;
+	decode_radio_status(frontend,&shadow[ssrc - STATUS_SSRC],record,len);
+	records++;
+      }
+      if(!bulk)
+	break;
+    }
+  }
+  return records;
+}
+
+static void bench_status(long const polls){
+  int const rx = socket(AF_INET,SOCK_DGRAM,0);
+  int const tx = socket(AF_INET,SOCK_DGRAM,0);
+  struct sockaddr_in sin;
+  memset(&sin,0,sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sin);
+  int const bufsize = 8 << 20;
+  if(rx == -1 || tx == -1
+     || bind(rx,(struct sockaddr *)&sin,sizeof(sin)) != 0
+     || getsockname(rx,(struct sockaddr *)&sin,&len) != 0){
+    perror("status: loopback sockets");
+    exit(EX_OSERR);
+  }
+  setsockopt(rx,SOL_SOCKET,SO_RCVBUF,&bufsize,sizeof(bufsize));
+  struct sockaddr_storage const saved_dest = Metadata_dest_socket;
+  memset(&Metadata_dest_socket,0,sizeof(Metadata_dest_socket));
+  memcpy(&Metadata_dest_socket,&sin,sizeof(sin));
+  Output_fd = tx;
+  if(Frontend.description == NULL)
+    Frontend.description = strdup("bench");
+
+  struct channel *chans[Nchannels];
+  float power[Nchannels];
+  for(int i=0; i < Nchannels; i++){
+    chans[i] = create_chan(STATUS_SSRC + i);
+    assert(chans[i] != NULL);
+    struct channel * const chan = chans[i];
+    chan->demod_type = (i % 3 == 2) ? FM_DEMOD : LINEAR_DEMOD;
+    strlcpy(chan->preset,chan->demod_type == FM_DEMOD ? "fm" : "usb",sizeof(chan->preset));
+    chan->filter.min_IF = chan->demod_type == FM_DEMOD ? -8000 : 100;
+    chan->filter.max_IF = chan->demod_type == FM_DEMOD ? 8000 : 3000;
+    chan->output.samprate = Chan_samprate;
+    chan->tune.freq = chan_freq(i,Nchannels);
+  }
+  struct channel *shadow = calloc(Nchannels,sizeof(*shadow));
+  struct frontend *frontend = calloc(1,sizeof(*frontend));
+  double cpu[2] = {0,0}, wall[2] = {0,0};
+  long bytes[2] = {0,0}, datagrams[2] = {0,0}, records[2] = {0,0}, wrong[2] = {0,0};
+  for(int bulk=0; bulk < 2; bulk++){
+    for(int i=0; i < Nchannels; i++)
+      FREE(shadow[i].status.command);
+    memset(shadow,0,Nchannels * sizeof(*shadow));
+    for(int i=0; i < Nchannels; i++){
+      FREE(chans[i]->status.bulk_last);
+      chans[i]->status.bulk_count = 0;
+    }
+    double const wall_start = clock_sec(CLOCK_MONOTONIC);
+    for(long p=0; p < polls; p++){
+      // New signal levels everywhere and the odd retune since the last poll
+      Frontend.samples += (long long)STATUS_BLOCKS * Frontend.L;
+      for(int i=0; i < Nchannels; i++){
+	struct channel * const chan = chans[i];
+	power[i] = dB2power(-100 + 40 * (float)random() / RAND_MAX);
+	chan->sig.bb_energy = power[i] * STATUS_BLOCKS;
+	chan->status.blocks_since_poll = STATUS_BLOCKS;
+	chan->output.samples += STATUS_BLOCKS * Chan_samprate * Blocktime / 1000;
+	if((i + p) % STATUS_RETUNE == 0)
+	  chan->tune.freq += 1000;
+	if(i % STATUS_RETUNE == 1)
+	  chan->tp1 = (p & 1) ? NAN : p; // A field that comes and goes, so bulk records must switch to keyframes
+      }
+      // The first poll from a new bulk poller asks for every field
+      poll_all_status(bulk ? (p == 0 ? 2 : 1) : 0);
+
+      // Each channel's demod thread counts down its timer one block at a time, as in downconvert()
+      bool pending = true;
+      while(pending){
+	pending = false;
+	double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+	for(int i=0; i < Nchannels; i++){
+	  struct channel * const chan = chans[i];
+	  if(chan->status.global_timer != 0 && --chan->status.global_timer <= 0){
+	    if(chan->status.bulk)
+	      send_bulk_status(&Frontend,chan);
+	    else
+	      send_radio_status((struct sockaddr *)&Metadata_dest_socket,&Frontend,chan);
+	    chan->status.global_timer = 0;
+	    reset_radio_status(chan);
+	  }
+	  if(chan->status.global_timer != 0)
+	    pending = true;
+	}
+	cpu[bulk] += clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+	records[bulk] += status_drain(rx,frontend,shadow,&bytes[bulk],&datagrams[bulk]);
+      }
+      // Everybody's shadow must be up to date, whether or not a field was sent this time
+      for(int i=0; i < Nchannels; i++){
+	struct channel const * const chan = chans[i];
+	struct channel const * const sp = &shadow[i];
+	if(sp->tune.freq != chan->tune.freq || sp->demod_type != chan->demod_type
+	   || strcmp(sp->preset,chan->preset) != 0 || sp->filter.min_IF != chan->filter.min_IF
+	   || sp->filter.max_IF != chan->filter.max_IF || sp->output.samprate != chan->output.samprate
+	   || sp->output.samples != chan->output.samples || fabsf(sp->sig.bb_power / power[i] - 1) > 1e-4
+	   || (isnan(chan->tp1) ? !isnan(sp->tp1) : sp->tp1 != chan->tp1))
+	  wrong[bulk]++;
+      }
+    }
+    wall[bulk] = clock_sec(CLOCK_MONOTONIC) - wall_start;
+  }
+  for(int i=0; i < Nchannels; i++){
+    FREE(shadow[i].status.command);
+    close_chan(chans[i]);
+  }
+  FREE(frontend->description);
+  FREE(frontend);
+  FREE(shadow);
+  Output_fd = -1;
+  Metadata_dest_socket = saved_dest;
+  close(rx);
+  close(tx);
+
+  struct result r = {
+    .test = "status",
+    .channels = Nchannels,
+    .chan_samprate = 0,
+    .blocks = polls,
+    .wall = wall[1],
+    .cpu = cpu[1],
+    .samples = polls * Nchannels,
+  };
+  report(&r);
+  long const expected = polls * Nchannels;
+  bool const failed = records[0] != expected || records[1] != expected || wrong[0] != 0 || wrong[1] != 0;
+  if(Verbose || failed){
+    for(int bulk=0; bulk < 2; bulk++)
+      fprintf(stderr,"status %s: %ld polls of %d channels, %ld records, %ld stale, %ld datagrams, %.1f bytes per channel per poll (%.0f bytes/s at one poll a second), %.2f us CPU per channel\n",
+	      bulk ? "bulk" : "legacy",polls,Nchannels,records[bulk],wrong[bulk],datagrams[bulk],
+	      (double)bytes[bulk] / expected,(double)bytes[bulk] / polls,1e6 * cpu[bulk] / expected);
+  }
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// Table-driven status decoding (decode_status.c) against the switch statement it replaced, kept here as the reference
+#define TLV_PACKETS 64      // Distinct status packets, from channels in every mode
+#define TLV_FUZZ 200000     // Mutated packets
+
+static int ref_decode_status(struct frontend *frontend,struct channel *channel,uint8_t const *buffer,int length){
+  uint8_t const *cp = buffer;
+  while(cp - buffer < length){
+    enum status_type type = *cp++; // increment cp to length field
+
+    if(type == EOL)
+      break; // end of list
+
+    unsigned int optlen = *cp++;
+    if(optlen & 0x80){
+      // length is >= 128 bytes; fetch actual length from next N bytes, where N is low 7 bits of optlen
+      int length_of_length = optlen & 0x7f;
+      optlen = 0;
+      while(length_of_length > 0){
+	optlen <<= 8;
+	optlen |= *cp++;
+	length_of_length--;
+      }
+    }
+    if(cp - buffer + optlen >= length)
+      break; // invalid length; we can't continue to scan
+    switch(type){
+    case EOL:
+      break;
+    case CMD_CNT:
+      channel->status.packets_in = decode_int32(cp,optlen);
+      break;
+    case DESCRIPTION:
+      FREE(frontend->description);
+      frontend->description = decode_string(cp,optlen);
+      break;
+    case STATUS_DEST_SOCKET:
+      decode_socket(&Metadata_dest_socket,cp,optlen);
+      break;
+    case GPS_TIME:
+      frontend->timestamp = decode_int64(cp,optlen);
+      break;
+    case INPUT_SAMPRATE:
+      frontend->samprate = decode_int(cp,optlen);
+      break;
+    case INPUT_SAMPLES:
+      frontend->samples = decode_int64(cp,optlen);
+      break;
+    case AD_OVER:
+      frontend->overranges = decode_int64(cp,optlen);
+      break;
+    case SAMPLES_SINCE_OVER:
+      frontend->samp_since_over = decode_int64(cp,optlen);
+      break;
+    case OUTPUT_DATA_SOURCE_SOCKET:
+      decode_socket(&channel->output.source_socket,cp,optlen);
+      break;
+    case OUTPUT_DATA_DEST_SOCKET:
+      decode_socket(&channel->output.dest_socket,cp,optlen);
+      break;
+    case OUTPUT_SSRC:
+      channel->output.rtp.ssrc = decode_int32(cp,optlen);
+      break;
+    case OUTPUT_TTL:
+      Mcast_ttl = decode_int8(cp,optlen);
+      break;
+    case OUTPUT_SAMPRATE:
+      channel->output.samprate = decode_int(cp,optlen);
+      break;
+    case OUTPUT_DATA_PACKETS:
+      channel->output.rtp.packets = decode_int64(cp,optlen);
+      break;
+    case OUTPUT_METADATA_PACKETS:
+      channel->status.packets_out = decode_int64(cp,optlen);
+      break;
+    case FILTER_BLOCKSIZE:
+      frontend->L = decode_int(cp,optlen);
+      break;
+    case FILTER_FIR_LENGTH:
+      frontend->M = decode_int(cp,optlen);
+      break;
+    case LOW_EDGE:
+      channel->filter.min_IF = decode_float(cp,optlen);
+      break;
+    case HIGH_EDGE:
+      channel->filter.max_IF = decode_float(cp,optlen);
+      break;
+    case FE_LOW_EDGE:
+      frontend->min_IF = decode_float(cp,optlen);
+      break;
+    case FE_HIGH_EDGE:
+      frontend->max_IF = decode_float(cp,optlen);
+      break;
+    case FE_ISREAL:
+      frontend->isreal = decode_bool(cp,optlen);
+      break;
+    case AD_BITS_PER_SAMPLE:
+      frontend->bitspersample = decode_int(cp,optlen);
+      break;
+    case IF_GAIN:
+      frontend->if_gain = decode_int8(cp,optlen);
+      break;
+    case LNA_GAIN:
+      frontend->lna_gain = decode_int8(cp,optlen);
+      break;
+    case MIXER_GAIN:
+      frontend->mixer_gain = decode_int8(cp,optlen);
+      break;
+    case KAISER_BETA:
+      channel->filter.kaiser_beta = decode_float(cp,optlen);
+      break;
+    case FILTER_DROPS:
+      channel->filter.out.block_drops = decode_int(cp,optlen);
+      break;
+    case IF_POWER:
+      frontend->if_power = dB2power(decode_float(cp,optlen));
+      break;
+    case BASEBAND_POWER:
+      channel->sig.bb_power = dB2power(decode_float(cp,optlen)); // dB -> power
+      break;
+    case NOISE_DENSITY:
+      channel->sig.n0 = dB2power(decode_float(cp,optlen));
+      break;
+    case DEMOD_SNR:
+      channel->sig.snr = dB2power(decode_float(cp,optlen));
+      break;
+    case FREQ_OFFSET:
+      channel->sig.foffset = decode_float(cp,optlen);
+      break;
+    case PEAK_DEVIATION:
+      channel->fm.pdeviation = decode_float(cp,optlen);
+      break;
+    case PLL_LOCK:
+      channel->linear.pll_lock = decode_bool(cp,optlen);
+      break;
+    case PLL_BW:
+      channel->linear.loop_bw = decode_float(cp,optlen);
+      break;
+    case PLL_SQUARE:
+      channel->linear.square = decode_bool(cp,optlen);
+      break;
+    case PLL_PHASE:
+      channel->linear.cphase = decode_float(cp,optlen);
+      break;
+    case PLL_WRAPS:
+      channel->linear.rotations = (int64_t)decode_int64(cp,optlen);
+      break;
+    case ENVELOPE:
+      channel->linear.env = decode_bool(cp,optlen);
+      break;
+    case OUTPUT_LEVEL:
+      channel->output.energy = dB2power(decode_float(cp,optlen));
+      break;
+    case OUTPUT_SAMPLES:
+      channel->output.samples = decode_int64(cp,optlen);
+      break;
+    case COMMAND_TAG:
+      channel->status.tag = decode_int32(cp,optlen);
+      break;
+    case RADIO_FREQUENCY:
+      channel->tune.freq = decode_double(cp,optlen);
+      break;
+    case SECOND_LO_FREQUENCY:
+      channel->tune.second_LO = decode_double(cp,optlen);
+      break;
+    case SHIFT_FREQUENCY:
+      channel->tune.shift = decode_double(cp,optlen);
+      break;
+    case FIRST_LO_FREQUENCY:
+      frontend->frequency = decode_double(cp,optlen);
+      break;
+    case DOPPLER_FREQUENCY:
+      channel->tune.doppler = decode_double(cp,optlen);
+      break;
+    case DOPPLER_FREQUENCY_RATE:
+      channel->tune.doppler_rate = decode_double(cp,optlen);
+      break;
+    case DEMOD_TYPE:
+      channel->demod_type = decode_int(cp,optlen);
+      break;
+    case OUTPUT_CHANNELS:
+      channel->output.channels = decode_int(cp,optlen);
+      break;
+    case INDEPENDENT_SIDEBAND:
+      channel->filter.isb = decode_bool(cp,optlen);
+      break;
+    case THRESH_EXTEND:
+      channel->fm.threshold = decode_bool(cp,optlen);
+      break;
+    case RDS_ENABLE:
+      channel->fm.rds = decode_bool(cp,optlen);
+      break;
+    case RDS_PI:
+      channel->rds.pi = decode_int(cp,optlen);
+      break;
+    case RDS_PS:
+      {
+	char *p = decode_string(cp,optlen);
+	strlcpy(channel->rds.ps,p,sizeof(channel->rds.ps));
+	FREE(p);
+      }
+      break;
+    case RDS_RT:
+      {
+	char *p = decode_string(cp,optlen);
+	strlcpy(channel->rds.rt,p,sizeof(channel->rds.rt));
+	FREE(p);
+      }
+      break;
+    case PLL_ENABLE:
+      channel->linear.pll = decode_bool(cp,optlen);
+      break;
+    case GAIN:              // dB to voltage
+      channel->output.gain = dB2voltage(decode_float(cp,optlen));
+      break;
+    case AGC_ENABLE:
+      channel->linear.agc = decode_bool(cp,optlen);
+      break;
+    case HEADROOM:          // db to voltage
+      channel->output.headroom = dB2voltage(decode_float(cp,optlen));
+      break;
+    case AGC_HANGTIME:      // s to samples
+      channel->linear.hangtime = decode_float(cp,optlen);
+      break;
+    case AGC_RECOVERY_RATE: // dB/s to dB/sample to voltage/sample
+      channel->linear.recovery_rate = dB2voltage(decode_float(cp,optlen));
+      break;
+    case AGC_THRESHOLD:   // dB to voltage
+      channel->linear.threshold = dB2voltage(decode_float(cp,optlen));
+      break;
+    case TP1: // Test point
+      channel->tp1 = decode_float(cp,optlen);
+      break;
+    case TP2:
+      channel->tp2 = decode_float(cp,optlen);
+      break;
+    case SQUELCH_OPEN:
+      channel->fm.squelch_open = dB2power(decode_float(cp,optlen));
+      break;
+    case SQUELCH_CLOSE:
+      channel->fm.squelch_close = dB2power(decode_float(cp,optlen));
+      break;
+    case DEEMPH_GAIN:
+      channel->fm.gain = decode_float(cp,optlen);
+      break;
+    case DEEMPH_TC:
+      channel->fm.rate = 1e6*decode_float(cp,optlen);
+      break;
+    case PL_TONE:
+      channel->fm.tone_freq = decode_float(cp,optlen);
+      break;
+    case PL_DEVIATION:
+      channel->fm.tone_deviation = decode_float(cp,optlen);
+      break;
+    case NONCOHERENT_BIN_BW:
+      channel->spectrum.bin_bw = decode_float(cp,optlen);
+      break;
+    case BIN_COUNT:
+      channel->spectrum.bin_count = decode_int(cp,optlen);
+      break;
+    case BIN_DATA:
+      break;
+    case RF_GAIN:
+      frontend->rf_gain = decode_float(cp,optlen);
+      break;
+    case RF_ATTEN:
+      frontend->rf_atten = decode_float(cp,optlen);
+      break;
+    case BLOCKS_SINCE_POLL:
+      channel->status.blocks_since_poll = decode_int64(cp,optlen);
+      break;
+    case PRESET:
+      {
+	char *p = decode_string(cp,optlen);
+	strlcpy(channel->preset,p,sizeof(channel->preset));
+	FREE(p);
+      }
+      break;
+    case RTP_PT:
+      channel->output.rtp.type = decode_int(cp,optlen);
+      break;
+    case OUTPUT_ENCODING:
+      channel->output.encoding = decode_int(cp,optlen);
+      break;
+    case OPUS_COMPLEXITY:
+      channel->output.opus_complexity = decode_int(cp,optlen);
+      break;
+    case OPUS_COMPLEXITY_NOW:
+      channel->output.opus_complexity_now = decode_int(cp,optlen);
+      break;
+    case OPUS_DROPS:
+      channel->output.opus_drops = decode_int64(cp,optlen);
+      break;
+    case STATUS_INTERVAL:
+      channel->status.output_interval = decode_int(cp,optlen);
+      break;
+    case BULK_FORMAT: // Keyframe or delta; either way, fields not present are left alone
+      break;
+    default: // ignore others
+      break;
+    }
+    cp += optlen;
+  }
+  return 0;
+}
+
+
+// Decode with both and compare everything they wrote
+static bool tlv_same(uint8_t const *packet,int length){
+  struct frontend *fe[2];
+  struct channel *ch[2];
+  for(int i=0; i < 2; i++){
+    fe[i] = calloc(1,sizeof(*fe[i]));
+    ch[i] = calloc(1,sizeof(*ch[i]));
+  }
+  ref_decode_status(fe[0],ch[0],packet,length);
+  decode_radio_status(fe[1],ch[1],packet,length);
+  bool same = (fe[0]->description == NULL) == (fe[1]->description == NULL)
+    && (fe[0]->description == NULL || strcmp(fe[0]->description,fe[1]->description) == 0);
+  for(int i=0; i < 2; i++)
+    FREE(fe[i]->description);
+  same = same && memcmp(fe[0],fe[1],sizeof(*fe[0])) == 0 && memcmp(ch[0],ch[1],sizeof(*ch[0])) == 0;
+  for(int i=0; i < 2; i++){
+    FREE(fe[i]);
+    FREE(ch[i]);
+  }
+  return same;
+}
+
+// The new decoder and the other scanners on a copy of exactly length bytes, so a read past the end
+// is caught when built with -fsanitize=address
+static void tlv_scan(uint8_t const *packet,int length){
+  uint8_t *copy = malloc(length > 0 ? length : 1);
+  memcpy(copy,packet,length);
+  struct frontend *fe = calloc(1,sizeof(*fe));
+  struct channel *ch = calloc(1,sizeof(*ch));
+  decode_radio_status(fe,ch,copy,length);
+  get_ssrc(copy,length);
+  get_tag(copy,length);
+  get_bulk_format(copy,length);
+  int offset = 0;
+  while(next_bulk_record(copy,length,&offset) > 0)
+    ;
+  FREE(fe->description);
+  FREE(fe);
+  FREE(ch);
+  FREE(copy);
+}
+
+static void bench_tlv(long const rounds){
+  int const rx = socket(AF_INET,SOCK_DGRAM,0);
+  int const tx = socket(AF_INET,SOCK_DGRAM,0);
+  struct sockaddr_in sin;
+  memset(&sin,0,sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sin);
+  int const bufsize = 1 << 20;
+  if(rx == -1 || tx == -1
+     || bind(rx,(struct sockaddr *)&sin,sizeof(sin)) != 0
+     || getsockname(rx,(struct sockaddr *)&sin,&len) != 0){
+    perror("tlv: loopback sockets");
+    exit(EX_OSERR);
+  }
+  setsockopt(rx,SOL_SOCKET,SO_RCVBUF,&bufsize,sizeof(bufsize));
+  Output_fd = tx;
+  if(Frontend.description == NULL)
+    Frontend.description = strdup("bench");
+
+  // Status packets from channels in each mode, with the mode-specific fields set, as radiod sends them
+  static uint8_t packets[TLV_PACKETS][PKTSIZE];
+  int lengths[TLV_PACKETS];
+  struct channel *chan = calloc(1,sizeof(*chan));
+  for(int i=0; i < TLV_PACKETS; i++){
+    *chan = Template;
+    chan->output.rtp.ssrc = 3000 + i;
+    chan->status.tag = random();
+    chan->tune.freq = chan_freq(i,TLV_PACKETS);
+    chan->status.blocks_since_poll = 50;
+    chan->sig.bb_energy = 50 * dB2power(-60 - i);
+    chan->output.energy = 50 * dB2power(-20 - i);
+    chan->sig.snr = dB2power(i);
+    switch(i % 4){
+    case 0:
+      chan->demod_type = LINEAR_DEMOD;
+      strlcpy(chan->preset,"usb",sizeof(chan->preset));
+      chan->linear.agc = true;
+      break;
+    case 1:
+      chan->demod_type = LINEAR_DEMOD;
+      strlcpy(chan->preset,"am",sizeof(chan->preset));
+      chan->linear.pll = true;
+      chan->linear.rotations = -i;
+      break;
+    case 2:
+      chan->demod_type = i % 8 == 2 ? FM_DEMOD : WFM_DEMOD;
+      strlcpy(chan->preset,chan->demod_type == FM_DEMOD ? "pm" : "wfm",sizeof(chan->preset));
+      chan->fm.tone_freq = 100;
+      chan->fm.rds = true;
+      chan->rds.pi = 0x1234 + i;
+      strlcpy(chan->rds.ps,"KA9Q",sizeof(chan->rds.ps));
+      strlcpy(chan->rds.rt,"The quick brown fox jumps over the lazy dog",sizeof(chan->rds.rt));
+      break;
+    case 3:
+      chan->demod_type = SPECT_DEMOD;
+      strlcpy(chan->preset,"spectrum",sizeof(chan->preset));
+      chan->spectrum.bin_count = 64;
+      chan->spectrum.bin_bw = 1000;
+      break;
+    }
+    send_radio_status((struct sockaddr *)&sin,&Frontend,chan);
+    lengths[i] = recv(rx,packets[i],sizeof(packets[i]),0);
+    assert(lengths[i] > 1 && packets[i][0] == STATUS);
+  }
+  FREE(chan);
+  Output_fd = -1;
+  close(rx);
+  close(tx);
+
+  // The same packets through both decoders, then with random values, then with random damage
+  bool failed = false;
+  long fuzz_compared = 0;
+  for(int i=0; i < TLV_PACKETS; i++){
+    if(!tlv_same(packets[i]+1,lengths[i]-1)){
+      fprintf(stderr,"tlv: decoders differ on packet %d\n",i);
+      failed = true;
+    }
+  }
+  for(long t=0; t < TLV_FUZZ && !failed; t++){
+    int const p = random() % TLV_PACKETS;
+    uint8_t buf[PKTSIZE];
+    int length = lengths[p] - 1;
+    memcpy(buf,packets[p]+1,length);
+    if(t & 1){
+      // Random values, same structure: both must agree
+      uint8_t const *cp = buf;
+      uint8_t const * const end = buf + length;
+      enum status_type type;
+      uint8_t const *value;
+      int optlen,n;
+      while((n = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+	if(random() % 4 == 0)
+	  for(int j=0; j < optlen; j++)
+	    buf[value - buf + j] = random();
+	cp += n;
+      }
+      fuzz_compared++;
+      if(!tlv_same(buf,length)){
+	fprintf(stderr,"tlv: decoders differ on packet %d with random values\n",p);
+	failed = true;
+      }
+    } else {
+      // Random damage: types, lengths, truncation, garbage
+      switch(random() % 4){
+      case 0:
+	for(int j = random() % 8; j >= 0; j--)
+	  buf[random() % length] = random();
+	break;
+      case 1:
+	length = random() % length;
+	break;
+      case 2:
+	buf[random() % length] = 0x80 | (random() % 8); // Long length of length
+	break;
+      case 3:
+	length = random() % length;
+	for(int j=0; j < length; j++)
+	  buf[j] = random();
+	break;
+      }
+      tlv_scan(buf,length);
+    }
+  }
+  // Timing: every packet over and over onto one shadow channel, as control and monitor do
+  struct frontend *fe = calloc(1,sizeof(*fe));
+  struct channel *ch = calloc(1,sizeof(*ch));
+  double cpu[2];
+  for(int k=0; k < 2; k++){
+    double const start = clock_sec(CLOCK_THREAD_CPUTIME_ID);
+    for(long r=0; r < rounds; r++){
+      for(int i=0; i < TLV_PACKETS; i++){
+	if(k == 0)
+	  ref_decode_status(fe,ch,packets[i]+1,lengths[i]-1);
+	else
+	  decode_radio_status(fe,ch,packets[i]+1,lengths[i]-1);
+      }
+    }
+    cpu[k] = clock_sec(CLOCK_THREAD_CPUTIME_ID) - start;
+  }
+  FREE(fe->description);
+  FREE(fe);
+  FREE(ch);
+
+  long const decoded = rounds * TLV_PACKETS;
+  struct result r = {
+    .test = "tlv",
+    .channels = 1,
+    .chan_samprate = 0,
+    .blocks = rounds,
+    .wall = cpu[1],
+    .cpu = cpu[1],
+    .samples = decoded,
+  };
+  report(&r);
+  if(Verbose || failed){
+    int bytes = 0;
+    for(int i=0; i < TLV_PACKETS; i++)
+      bytes += lengths[i];
+    fprintf(stderr,"tlv: %ld packets of %d bytes average; switch %.1f ns/packet, table %.1f ns/packet (%.2fx); %ld fuzzed packets compared, %ld scanned%s\n",
+	    decoded,bytes / TLV_PACKETS,1e9 * cpu[0] / decoded,1e9 * cpu[1] / decoded,cpu[0] / cpu[1],
+	    fuzz_compared,(long)TLV_FUZZ - fuzz_compared,failed ? ", MISMATCH" : "");
+  }
+  if(failed)
+    exit(EX_SOFTWARE);
+}
+
+// Complete demodulator threads, as started by radiod
+// The front end is fed in lock step with the slowest channel so no blocks are dropped
+static void bench_demod(char const *name,enum demod_type type,long const blocks){
+  struct channel *chans[Nchannels];
+  // WFM forces its own composite rate; spectrum has no time domain output
+  int const chan_samprate = (type == WFM_DEMOD) ? 384000 : (type == SPECT_DEMOD) ? 0 : Chan_samprate;
+
+  for(int i=0; i < Nchannels; i++){
+    chans[i] = create_chan(1000 + i);
+    assert(chans[i] != NULL);
+    struct channel * const chan = chans[i];
+    set_defaults(chan);
+    chan->demod_type = type;
+    if(chan_samprate != 0)
+      chan->output.samprate = chan_samprate;
+    chan->output.encoding = NO_ENCODING; // demodulate but don't send
+    chan->status.output_interval = 0;    // no status either
+    chan->fm.squelch_open = chan->fm.squelch_close = -INFINITY; // Force squelch open
+    switch(type){
+    case FM_DEMOD:
+      chan->filter.min_IF = -8000;
+      chan->filter.max_IF = +8000;
+      chan->fm.rate = -expm1f(-1.0f / (530.5e-6f * chan_samprate)); // NBFM de-emphasis
+      break;
+    case WFM_DEMOD:
+      chan->filter.min_IF = -100000;
+      chan->filter.max_IF = +100000;
+      chan->fm.rate = -expm1f(-1.0f / (75e-6f * 48000));
+      chan->output.channels = 2;
+      break;
+    case SPECT_DEMOD:
+      chan->spectrum.bin_count = 64;
+      chan->spectrum.bin_bw = 1000;
+      break;
+    default:
+      chan->filter.min_IF = +100;
+      chan->filter.max_IF = +3000;
+      break;
+    }
+    set_freq(chan,chan_freq(i,Nchannels));
+    start_demod(chan);
+  }
+  // Let everybody start up and settle
+  struct filter_in * const master = &Frontend.in;
+  for(int i=0; i < 2 * ND; i++){
+    feed_block(master);
+    wait_input(master);
+    usleep(10000);
+  }
+  double cpu_start[Nchannels];
+  int drops = 0;
+  for(int i=0; i < Nchannels; i++){
+    drops -= chans[i]->filter.out.block_drops; // Ignore any during startup
+    clockid_t cid;
+    if(pthread_getcpuclockid(chans[i]->demod_thread,&cid) == 0)
+      cpu_start[i] = clock_sec(cid);
+    else
+      cpu_start[i] = NAN;
+  }
+  double const process_start = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+  double const wall_start = clock_sec(CLOCK_MONOTONIC);
+  for(long b=0; b < blocks; b++){
+    feed_block(master);
+    // Don't get more than ND-2 blocks ahead of any channel, or they will start dropping blocks
+    for(int i=0; i < Nchannels; i++){
+      while((int)(master->next_jobnum - __atomic_load_n(&chans[i]->filter.out.next_jobnum,__ATOMIC_ACQUIRE)) > ND - 2){
+	struct timespec const ts = { 0, 20000 };
+	nanosleep(&ts,NULL);
+      }
+    }
+  }
+  double const wall = clock_sec(CLOCK_MONOTONIC) - wall_start;
+  double const process_cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID) - process_start;
+  double demod_cpu = 0;
+  for(int i=0; i < Nchannels; i++){
+    clockid_t cid;
+    if(pthread_getcpuclockid(chans[i]->demod_thread,&cid) == 0)
+      demod_cpu += clock_sec(cid) - cpu_start[i];
+    drops += chans[i]->filter.out.block_drops;
+  }
+  // Attribute everything but the front end FFT to the channels. This includes FFT worker time
+  // spent on per-channel filters (e.g., the WFM composite filter) that doesn't show up in the demod threads
+  double const chan_cpu = max(demod_cpu,process_cpu - blocks * Frontend_cpu_per_block);
+  if(Verbose)
+    fprintf(stderr,"%s: demod thread cpu %.3f s, process cpu %.3f s, block drops %d\n",name,demod_cpu,process_cpu,drops);
+
+  struct result r = {
+    .test = name,
+    .channels = Nchannels,
+    .chan_samprate = chan_samprate,
+    .blocks = blocks,
+    .wall = wall,
+    .cpu = chan_cpu,
+    .samples = blocks * (long long)(chan_samprate * Blocktime / 1000) * Nchannels,
+  };
+  report(&r);
+
+  // Shut down: tuning to 0 Hz with a lifetime of 1 makes each demod exit at the top of its next loop
+  for(int i=0; i < Nchannels; i++){
+    chans[i]->tune.freq = 0;
+    chans[i]->lifetime = 1;
+  }
+  for(int i=0; i < Nchannels; i++){
+    while(chans[i]->inuse){
+      feed_block(master);
+      wait_input(master); // don't pile up jobs in the worker queue
+      usleep(1000);
+    }
+  }
+}
+
+static void usage(char const *name){
+  fprintf(stderr,"Usage: %s [-s samprate] [-r] [-b blocktime_ms] [-o overlap] [-c channels] [-m chan_samprate] [-t seconds] [-T fft_threads] [-B bulk_threads] [-I internal_threads] [-i inline_max] [-l fft_plan_level] [-w wisdom_file] [-a afsk_file] [-P pcmrecord_path] [-e encoder_threads] [-j] [-v] [test ...]\n",name);
+  fprintf(stderr,"Tests: frontend filter realout discrim iir tones rds hdlc afsk resample jitter recv rtpfilter wav pcmrecord opus status tlv linear fm wfm spectrum (default: all)\n");
+}
+
+int main(int argc,char *argv[]){
+  App_path = argv[0];
+  setlocale(LC_ALL,"C"); // Keep numeric output machine readable
+  FFTW_planning_level = FFTW_MEASURE;
+
+  int c;
+  while((c = getopt(argc,argv,"s:rb:o:c:m:t:T:B:I:i:l:w:a:P:e:jvh")) != -1){
+    switch(c){
+    case 's':
+      Samprate = strtol(optarg,NULL,0);
+      break;
+    case 'r':
+      Isreal = true;
+      break;
+    case 'b':
+      Blocktime = strtof(optarg,NULL);
+      break;
+    case 'o':
+      Overlap = strtol(optarg,NULL,0);
+      break;
+    case 'c':
+      Nchannels = strtol(optarg,NULL,0);
+      break;
+    case 'm':
+      Chan_samprate = strtol(optarg,NULL,0);
+      break;
+    case 't':
+      Duration = strtof(optarg,NULL);
+      break;
+    case 'T':
+      N_worker_threads = strtol(optarg,NULL,0);
+      break;
+    case 'B':
+      N_bulk_threads = strtol(optarg,NULL,0);
+      break;
+    case 'I':
+      N_internal_threads = strtol(optarg,NULL,0); // FFTW threads in the front end FFT
+      break;
+    case 'i':
+      Filter_inline_max = strtol(optarg,NULL,0); // 0 sends every FFT to the worker pool
+      break;
+    case 'l':
+      if(strcasecmp(optarg,"estimate") == 0)
+	FFTW_planning_level = FFTW_ESTIMATE;
+      else if(strcasecmp(optarg,"measure") == 0)
+	FFTW_planning_level = FFTW_MEASURE;
+      else if(strcasecmp(optarg,"patient") == 0)
+	FFTW_planning_level = FFTW_PATIENT;
+      else if(strcasecmp(optarg,"exhaustive") == 0)
+	FFTW_planning_level = FFTW_EXHAUSTIVE;
+      break;
+    case 'w':
+      Wisdom_file = optarg;
+      break;
+    case 'a':
+      Afsk_file = optarg;
+      break;
+    case 'P':
+      Pcmrecord_path = optarg;
+      break;
+    case 'e':
+      N_encoder_threads = strtol(optarg,NULL,0); // Opus encoder pool
+      break;
+    case 'j':
+      Json = true;
+      break;
+    case 'v':
+      Verbose++;
+      break;
+    default:
+    case 'h':
+      usage(argv[0]);
+      exit(EX_USAGE);
+    }
+  }
+  if(Samprate <= 0 || Blocktime <= 0 || Overlap < 2 || Nchannels < 0 || Chan_samprate <= 0 || Duration <= 0){
+    usage(argv[0]);
+    exit(EX_USAGE);
+  }
+  // The library and the demodulators log to stdout; keep it clean for the results
+  Results = fdopen(dup(fileno(stdout)),"w");
+  dup2(fileno(stderr),fileno(stdout));
+  setlinebuf(stdout);
+
+  Frontend.samprate = Samprate;
+  Frontend.isreal = Isreal;
+  Frontend.bitspersample = 16;
+  Frontend.frequency = Isreal ? 0 : 100e6;
+  Frontend.min_IF = Isreal ? 0 : -Samprate / 2;
+  Frontend.max_IF = Samprate / 2;
+  Frontend.L = lround(Samprate * Blocktime / 1000.0);
+  Frontend.M = Frontend.L / (Overlap - 1) + 1;
+  pthread_mutex_init(&Frontend.status_mutex,NULL);
+  pthread_cond_init(&Frontend.status_cond,NULL);
+  Channel_idle_timeout = 20 * 1000 / Blocktime;
+  set_defaults(&Template);
+
+  if(create_filter_input(&Frontend.in,Frontend.L,Frontend.M,Isreal ? REAL : COMPLEX,FFT_BULK) == NULL){
+    fprintf(stderr,"can't create input filter, L = %d M = %d\n",Frontend.L,Frontend.M);
+    exit(EX_SOFTWARE);
+  }
+  set_filter_exec(&Frontend.in,EXEC_POOL); // as in radiod
+  make_signal(Frontend.L);
+
+  long const blocks = lround(Duration * 1000 / Blocktime);
+  Tests = argv + optind;
+  Ntests = argc - optind;
+
+  // The front end test always runs since its result is needed by the others
+  bench_frontend(blocks);
+  if(Nchannels > 0){
+    if(selected("filter"))
+      bench_filter(blocks);
+    if(selected("realout"))
+      bench_realout(blocks);
+    if(selected("discrim"))
+      bench_discrim(blocks * 100); // Too quick to time over only a few seconds of signal
+    if(selected("iir"))
+      bench_iir(blocks * 100);
+    if(selected("tones"))
+      bench_tones(blocks * 10);
+    if(selected("rds"))
+      bench_rds(blocks);
+    if(selected("hdlc"))
+      bench_hdlc(max(1L,blocks / 50));
+    if(selected("afsk"))
+      bench_afsk();
+    if(selected("resample"))
+      bench_resample(blocks * 10);
+    if(selected("jitter"))
+      bench_jitter(blocks * 1000);
+    if(selected("recv"))
+      bench_recv(blocks * 1000);
+    if(selected("rtpfilter"))
+      bench_rtpfilter(blocks * 1000);
+    if(selected("wav"))
+      bench_wav(blocks * 100);
+    if(selected("pcmrecord"))
+      bench_pcmrecord(max(100L,lround(blocks * Blocktime / 20))); // 20 ms packets
+    if(selected("opus"))
+      bench_opus(blocks);
+    if(selected("status"))
+      bench_status(blocks);
+    if(selected("tlv"))
+      bench_tlv(blocks * 10);
+    for(unsigned int i=0; i < NDEMODS; i++){
+      if(selected(Demods[i].name))
+	bench_demod(Demods[i].name,Demods[i].type,blocks);
+    }
+  }
+  if(Json && !First_result)
+    fprintf(Results,"\n]\n");
+
+  if(Verbose){
+    // Worker pool queue waits, cumulative over all tests
+    for(enum fft_class c = 0; c < N_FFT_CLASSES; c++){
+      struct fft_stats stats;
+      if(get_fft_stats(&stats,c) != 0 || stats.jobs == 0)
+	continue;
+      fprintf(stderr,"%s fft jobs %llu, mean wait %.1f us, max wait %.1f us; log2 us histogram:",
+	      c == FFT_SHORT ? "short" : "bulk",(unsigned long long)stats.jobs,
+	      .001 * stats.wait_ns / stats.jobs,.001 * stats.max_wait_ns);
+      for(int i=0; i < FFT_WAIT_BINS; i++)
+	fprintf(stderr," %llu",(unsigned long long)stats.hist[i]);
+      fprintf(stderr,"\n");
+    }
+  }
+  fclose(Results);
+  exit(EX_OK);
+}
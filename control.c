@@ -491,31 +491,46 @@ int main(int argc,char *argv[]){
       if(length == -1 && errno == EAGAIN)
 	break; // Timeout; we're done
       // Ignore our own command packets
-      if(length < 2 || (enum pkt_type)buffer[0] != STATUS)
+      if(length < 2 || ((enum pkt_type)buffer[0] != STATUS && (enum pkt_type)buffer[0] != BULK_STATUS))
 	continue;
 
       // What to do with the source addresses?
       memcpy(&Metadata_source_socket,&source_socket,sizeof(Metadata_source_socket));
-      struct channel * const channel = calloc(1,sizeof(struct channel));
-      init_demod(channel);
-      decode_radio_status(&Frontend,channel,buffer+1,length-1);
 
-      // Do we already have it?
-      int i;
-      for(i=0; i < chan_count; i++)
-	if(channels[i]->output.rtp.ssrc == channel->output.rtp.ssrc)
+      // A STATUS packet describes one channel, a BULK_STATUS packet has a record for each of many
+      bool const bulk = (enum pkt_type)buffer[0] == BULK_STATUS;
+      bool give_up = false;
+      int offset = 0;
+      int len = length - 1;
+      while(chan_count < chan_max && (!bulk || (len = next_bulk_record(buffer+1,length-1,&offset)) > 0)){
+	uint8_t const * const record = bulk ? buffer + 1 + offset - len : buffer + 1;
+	uint32_t const ssrc = get_ssrc(record,len);
+	// Do we already have it?
+	int i;
+	for(i=0; i < chan_count; i++)
+	  if(channels[i]->output.rtp.ssrc == ssrc)
+	    break;
+	if(ssrc == 0xffffffff){
+	  // Front end status, not a channel
+	} else if(i < chan_count){
+	  // Already in table, update
+	  assert(channels[i] != NULL);
+	  decode_radio_status(&Frontend,channels[i],record,len);
+	  if(gps_time_ns() > last_new_entry + BILLION)
+	    give_up = true; // Give up after 1 sec with no new channels
+	} else if(!bulk || get_bulk_format(record,len) == 2){
+	  // New one, add. A bulk record with only changes from someone else's poll isn't enough to start with
+	  struct channel * const channel = calloc(1,sizeof(struct channel));
+	  init_demod(channel);
+	  decode_radio_status(&Frontend,channel,record,len);
+	  channels[chan_count++] = channel;
+	  last_new_entry = gps_time_ns();
+	}
+	if(!bulk)
 	  break;
-      if(i < chan_count){
-	// Already in table, replace
-	assert(channels[i] != NULL);
-	FREE(channels[i]);
-	channels[i] = channel;
-	if(gps_time_ns() > last_new_entry + BILLION)
-	  break; // Give up after 1 sec with no new channels
-      } else {
-	channels[chan_count++] = channel; // New one, add
-	last_new_entry = gps_time_ns();
       }
+      if(give_up)
+	break;
     }
     qsort(channels,chan_count,sizeof(channels[0]),chan_compare);
     fprintf(stdout,"%13s %9s %13s %5s %s\n","SSRC","preset","freq, Hz","SNR","output channel");
@@ -606,6 +621,21 @@ int main(int argc,char *argv[]){
       struct sockaddr_storage source_socket;
       socklen_t ssize = sizeof(source_socket);
       length = recvfrom(Status_fd,buffer,sizeof(buffer),0,(struct sockaddr *)&source_socket,&ssize); // should not block
+      if(length >= 2 && (enum pkt_type)buffer[0] == BULK_STATUS){
+	// Response to a poll of all channels, maybe from someone else; take ours if it's there
+	int offset = 0;
+	int len;
+	while((len = next_bulk_record(buffer+1,length-1,&offset)) > 0){
+	  uint8_t const * const record = buffer + 1 + offset - len;
+	  if(get_ssrc(record,len) == Ssrc){
+	    decode_radio_status(&Frontend,channel,record,len);
+	    gen_locals(&Frontend,channel);
+	    screen_update_needed = true;
+	    break;
+	  }
+	}
+	continue;
+      }
       // Ignore our own command packets and responses to other SSIDs
       if(length < 2 || (enum pkt_type)buffer[0] != STATUS || !for_us(channel,buffer+1,length-1,Ssrc))
 	continue; // Can include a timeout
@@ -1554,6 +1584,8 @@ static int send_poll(int ssrc){
   uint32_t tag = random();
   encode_int(&bp,COMMAND_TAG,tag);
   encode_int(&bp,OUTPUT_SSRC,ssrc); // poll specific SSRC, or request ssrc list with ssrc = 0
+  if(ssrc == 0xffffffff)
+    encode_int(&bp,BULK_FORMAT,2); // Many channels per packet, and all their fields since we're starting fresh
   encode_eol(&bp);
   int const command_len = bp - cmdbuffer;
   if(sendto(Output_fd, cmdbuffer, command_len, 0, (struct sockaddr *)&Metadata_dest_socket,sizeof(struct sockaddr)) != command_len)
@@ -1,350 +1,350 @@
+#include <stddef.h>
 #include "radio.h"
 
+// Status fields that are simply a member of struct channel or struct frontend, indexed by type
+// This one table drives both decode_radio_status() and encode_radio_field(), so each such field is described once;
+// the few that need more (strings on the heap, globals, unusual scaling) are handled by hand in decode_radio_status()
+enum tlv_kind {
+  TLV_NONE = 0,   // Not in the table
+  TLV_INT8,       // Integers and enums, by the member's size; leading zeroes suppressed on the wire
+  TLV_INT16,
+  TLV_INT32,
+  TLV_INT64,
+  TLV_BOOL,
+  TLV_FLOAT,
+  TLV_DOUBLE,
+  TLV_STRING,     // Fixed size char array, always null terminated
+  TLV_SOCKET,     // struct sockaddr_storage
+};
+
+enum tlv_conv {
+  TLV_RAW = 0,
+  TLV_DB_POWER,   // Kept as a power ratio, sent in dB
+  TLV_DB_VOLTAGE, // Kept as an amplitude ratio, sent in dB
+};
+
+struct tlv_field {
+  uint8_t kind;
+  uint8_t conv;
+  bool frontend;    // Member of struct frontend, otherwise of struct channel
+  bool decode_only; // radiod sends something derived from the member (an average, other units), not the member itself
+  uint32_t size;    // sizeof the member
+  uint32_t offset;
+};
+
+// The integer width is folded into the kind so decoding a field takes only one dispatch
+#define INT_KIND(n) ((n) == 1 ? TLV_INT8 : (n) == 2 ? TLV_INT16 : (n) == 4 ? TLV_INT32 : TLV_INT64)
+#define MEMBER_KIND(s,m) .kind = _Generic(((struct s *)0)->m, bool: TLV_BOOL, float: TLV_FLOAT, double: TLV_DOUBLE, \
+					  default: INT_KIND(sizeof(((struct s *)0)->m)))
+#define MEMBER(s,m) .size = sizeof(((struct s *)0)->m), .offset = offsetof(struct s,m)
+#define CHAN(m,...) { MEMBER_KIND(channel,m), MEMBER(channel,m), __VA_ARGS__ }
+#define FE(m,...) { MEMBER_KIND(frontend,m), MEMBER(frontend,m), .frontend = true, __VA_ARGS__ }
+#define CHAN_STRING(m) { .kind = TLV_STRING, MEMBER(channel,m) }
+#define CHAN_SOCKET(m) { .kind = TLV_SOCKET, MEMBER(channel,m) }
+
+static struct tlv_field const Status_fields[256] = {
+  [COMMAND_TAG] = CHAN(status.tag),
+  [CMD_CNT] = CHAN(status.packets_in),
+  [GPS_TIME] = FE(timestamp,.decode_only = true),
+  [INPUT_SAMPRATE] = FE(samprate),
+  [INPUT_SAMPLES] = FE(samples),
+  [OUTPUT_DATA_SOURCE_SOCKET] = CHAN_SOCKET(output.source_socket),
+  [OUTPUT_DATA_DEST_SOCKET] = CHAN_SOCKET(output.dest_socket),
+  [OUTPUT_SSRC] = CHAN(output.rtp.ssrc),
+  [OUTPUT_SAMPRATE] = CHAN(output.samprate),
+  [OUTPUT_METADATA_PACKETS] = CHAN(status.packets_out),
+  [OUTPUT_DATA_PACKETS] = CHAN(output.rtp.packets),
+  [LNA_GAIN] = FE(lna_gain),
+  [MIXER_GAIN] = FE(mixer_gain),
+  [IF_GAIN] = FE(if_gain),
+  [RADIO_FREQUENCY] = CHAN(tune.freq),
+  [FIRST_LO_FREQUENCY] = FE(frequency),
+  [SECOND_LO_FREQUENCY] = CHAN(tune.second_LO),
+  [SHIFT_FREQUENCY] = CHAN(tune.shift),
+  [DOPPLER_FREQUENCY] = CHAN(tune.doppler),
+  [DOPPLER_FREQUENCY_RATE] = CHAN(tune.doppler_rate),
+  [LOW_EDGE] = CHAN(filter.min_IF),
+  [HIGH_EDGE] = CHAN(filter.max_IF),
+  [KAISER_BETA] = CHAN(filter.kaiser_beta),
+  [FILTER_BLOCKSIZE] = FE(L,.decode_only = true), // radiod sends its input filter's sizes
+  [FILTER_FIR_LENGTH] = FE(M,.decode_only = true),
+  [IF_POWER] = FE(if_power,.conv = TLV_DB_POWER,.decode_only = true), // Relative to A/D full scale
+  [BASEBAND_POWER] = CHAN(sig.bb_power,.conv = TLV_DB_POWER,.decode_only = true), // Averages since the last poll
+  [NOISE_DENSITY] = CHAN(sig.n0,.conv = TLV_DB_POWER),
+  [DEMOD_TYPE] = CHAN(demod_type),
+  [OUTPUT_CHANNELS] = CHAN(output.channels),
+  [INDEPENDENT_SIDEBAND] = CHAN(filter.isb),
+  [PLL_ENABLE] = CHAN(linear.pll),
+  [PLL_LOCK] = CHAN(linear.pll_lock),
+  [PLL_SQUARE] = CHAN(linear.square),
+  [PLL_PHASE] = CHAN(linear.cphase),
+  [PLL_BW] = CHAN(linear.loop_bw),
+  [ENVELOPE] = CHAN(linear.env),
+  [DEMOD_SNR] = CHAN(sig.snr,.conv = TLV_DB_POWER),
+  [FREQ_OFFSET] = CHAN(sig.foffset),
+  [PEAK_DEVIATION] = CHAN(fm.pdeviation),
+  [PL_TONE] = CHAN(fm.tone_freq),
+  [AGC_ENABLE] = CHAN(linear.agc),
+  [HEADROOM] = CHAN(output.headroom,.conv = TLV_DB_VOLTAGE),
+  [AGC_HANGTIME] = CHAN(linear.hangtime,.decode_only = true), // Blocks in radiod, seconds on the wire
+  [AGC_RECOVERY_RATE] = CHAN(linear.recovery_rate,.conv = TLV_DB_VOLTAGE,.decode_only = true), // Per block in radiod, per second on the wire
+  [AGC_THRESHOLD] = CHAN(linear.threshold,.conv = TLV_DB_VOLTAGE),
+  [GAIN] = CHAN(output.gain,.conv = TLV_DB_VOLTAGE,.decode_only = true),
+  [OUTPUT_LEVEL] = CHAN(output.energy,.conv = TLV_DB_POWER,.decode_only = true),
+  [OUTPUT_SAMPLES] = CHAN(output.samples),
+  [FILTER_DROPS] = CHAN(filter.out.block_drops),
+  [TP1] = CHAN(tp1),
+  [TP2] = CHAN(tp2),
+  [AD_BITS_PER_SAMPLE] = FE(bitspersample),
+  [SQUELCH_OPEN] = CHAN(fm.squelch_open,.conv = TLV_DB_POWER),
+  [SQUELCH_CLOSE] = CHAN(fm.squelch_close,.conv = TLV_DB_POWER),
+  [PRESET] = CHAN_STRING(preset),
+  [DEEMPH_GAIN] = CHAN(fm.gain,.decode_only = true),
+  [PL_DEVIATION] = CHAN(fm.tone_deviation),
+  [THRESH_EXTEND] = CHAN(fm.threshold),
+  [NONCOHERENT_BIN_BW] = CHAN(spectrum.bin_bw),
+  [BIN_COUNT] = CHAN(spectrum.bin_count),
+  [RF_ATTEN] = FE(rf_atten),
+  [RF_GAIN] = FE(rf_gain),
+  [FE_LOW_EDGE] = FE(min_IF),
+  [FE_HIGH_EDGE] = FE(max_IF),
+  [FE_ISREAL] = FE(isreal),
+  [BLOCKS_SINCE_POLL] = CHAN(status.blocks_since_poll),
+  [AD_OVER] = FE(overranges),
+  [RTP_PT] = CHAN(output.rtp.type),
+  [STATUS_INTERVAL] = CHAN(status.output_interval),
+  [OUTPUT_ENCODING] = CHAN(output.encoding),
+  [SAMPLES_SINCE_OVER] = FE(samp_since_over),
+  [PLL_WRAPS] = CHAN(linear.rotations),
+  [RDS_ENABLE] = CHAN(fm.rds),
+  [RDS_PI] = CHAN(rds.pi),
+  [RDS_PS] = CHAN_STRING(rds.ps),
+  [RDS_RT] = CHAN_STRING(rds.rt),
+  [OPUS_COMPLEXITY] = CHAN(output.opus_complexity),
+  [OPUS_COMPLEXITY_NOW] = CHAN(output.opus_complexity_now),
+  [OPUS_DROPS] = CHAN(output.opus_drops),
+};
+
+// Decode one TLV value straight from the packet into the member described by f, within base
+// Same conversions as decode_float(), decode_double(), etc
+static inline void decode_field(struct tlv_field const *f,uint8_t *base,uint8_t const *cp,int optlen){
+  uint8_t * const p = base + f->offset;
+  switch(f->kind){
+  // Integers are truncated to the member's width, as an assignment would
+  case TLV_INT8:
+    *p = tlv_int(cp,optlen);
+    break;
+  case TLV_INT16:
+    { uint16_t const v = tlv_int(cp,optlen); memcpy(p,&v,sizeof(v)); }
+    break;
+  case TLV_INT32:
+    { uint32_t const v = tlv_int(cp,optlen); memcpy(p,&v,sizeof(v)); }
+    break;
+  case TLV_INT64:
+    { uint64_t const v = tlv_int(cp,optlen); memcpy(p,&v,sizeof(v)); }
+    break;
+  case TLV_BOOL:
+    *(bool *)p = tlv_int(cp,optlen) != 0;
+    break;
+  case TLV_FLOAT:
+    {
+      float x;
+      if(optlen == 8)
+	x = decode_double(cp,optlen);
+      else {
+	uint32_t const bits = tlv_int(cp,optlen);
+	memcpy(&x,&bits,sizeof(x));
+      }
+      if(f->conv != TLV_RAW)
+	x = f->conv == TLV_DB_POWER ? dB2power(x) : dB2voltage(x);
+      *(float *)p = x;
+    }
+    break;
+  case TLV_DOUBLE:
+    if(optlen == 4)
+      *(double *)p = decode_float(cp,optlen);
+    else {
+      uint64_t const bits = tlv_int(cp,optlen);
+      memcpy(p,&bits,sizeof(double));
+    }
+    break;
+  case TLV_STRING:
+    {
+      // Like decode_string() and strlcpy(), without the copy on the heap
+      size_t const len = strnlen((char const *)cp,min((unsigned)optlen,f->size - 1));
+      memcpy(p,cp,len);
+      p[len] = '\0';
+    }
+    break;
+  case TLV_SOCKET:
+    decode_socket(p,cp,optlen);
+    break;
+  }
+}
+
 // Decode incoming status message from the radio program, convert and fill in fields in local channel structure
 // Leave all other fields unchanged, as they may have local uses (e.g., file descriptors)
 // Note that we use some fields in channel differently than in radiod (e.g., dB vs ratios)
+// Unknown types are skipped, and the packet is only scanned as far as its TLVs stay within length
 int decode_radio_status(struct frontend *frontend,struct channel *channel,uint8_t const *buffer,int length){
   uint8_t const *cp = buffer;
-  while(cp - buffer < length){
-    enum status_type type = *cp++; // increment cp to length field
-
-    if(type == EOL)
-      break; // end of list
-
-    unsigned int optlen = *cp++;
-    if(optlen & 0x80){
-      // length is >= 128 bytes; fetch actual length from next N bytes, where N is low 7 bits of optlen
-      int length_of_length = optlen & 0x7f;
-      optlen = 0;
-      while(length_of_length > 0){
-	optlen <<= 8;
-	optlen |= *cp++;
-	length_of_length--;
-      }
+  uint8_t const * const end = buffer + length;
+  enum status_type type;
+  uint8_t const *value;
+  int optlen,len;
+  while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+    cp += len;
+    struct tlv_field const * const f = &Status_fields[type & 0xff];
+    if(f->kind != TLV_NONE){
+      decode_field(f,f->frontend ? (uint8_t *)frontend : (uint8_t *)channel,value,optlen);
+      continue;
     }
-    if(cp - buffer + optlen >= length)
-      break; // invalid length; we can't continue to scan
     switch(type){
-    case EOL:
-      break;
-    case CMD_CNT:
-      channel->status.packets_in = decode_int32(cp,optlen);
-      break;
     case DESCRIPTION:
-      FREE(frontend->description);
-      frontend->description = decode_string(cp,optlen);
+      // Rarely changes; don't churn the heap for it
+      if(frontend->description == NULL || strlen(frontend->description) != (size_t)optlen
+	 || memcmp(frontend->description,value,optlen) != 0){
+	FREE(frontend->description);
+	frontend->description = decode_string(value,optlen);
+      }
       break;
     case STATUS_DEST_SOCKET:
-      decode_socket(&Metadata_dest_socket,cp,optlen);
-      break;
-    case GPS_TIME:
-      frontend->timestamp = decode_int64(cp,optlen);
-      break;
-    case INPUT_SAMPRATE:
-      frontend->samprate = decode_int(cp,optlen);
-      break;
-    case INPUT_SAMPLES:
-      frontend->samples = decode_int64(cp,optlen);
-      break;
-    case AD_OVER:
-      frontend->overranges = decode_int64(cp,optlen);
-      break;
-    case SAMPLES_SINCE_OVER:
-      frontend->samp_since_over = decode_int64(cp,optlen);
-      break;
-    case OUTPUT_DATA_SOURCE_SOCKET:
-      decode_socket(&channel->output.source_socket,cp,optlen);
-      break;
-    case OUTPUT_DATA_DEST_SOCKET:
-      decode_socket(&channel->output.dest_socket,cp,optlen);
-      break;
-    case OUTPUT_SSRC:
-      channel->output.rtp.ssrc = decode_int32(cp,optlen);
+      decode_socket(&Metadata_dest_socket,value,optlen);
       break;
     case OUTPUT_TTL:
-      Mcast_ttl = decode_int8(cp,optlen);
-      break;
-    case OUTPUT_SAMPRATE:
-      channel->output.samprate = decode_int(cp,optlen);
-      break;
-    case OUTPUT_DATA_PACKETS:
-      channel->output.rtp.packets = decode_int64(cp,optlen);
-      break;
-    case OUTPUT_METADATA_PACKETS:
-      channel->status.packets_out = decode_int64(cp,optlen);
-      break;
-    case FILTER_BLOCKSIZE:
-      frontend->L = decode_int(cp,optlen);
-      break;
-    case FILTER_FIR_LENGTH:
-      frontend->M = decode_int(cp,optlen);
-      break;
-    case LOW_EDGE:
-      channel->filter.min_IF = decode_float(cp,optlen);
-      break;
-    case HIGH_EDGE:
-      channel->filter.max_IF = decode_float(cp,optlen);
-      break;
-    case FE_LOW_EDGE:
-      frontend->min_IF = decode_float(cp,optlen);
-      break;
-    case FE_HIGH_EDGE:
-      frontend->max_IF = decode_float(cp,optlen);
-      break;
-    case FE_ISREAL:
-      frontend->isreal = decode_bool(cp,optlen);
-      break;
-    case AD_BITS_PER_SAMPLE:
-      frontend->bitspersample = decode_int(cp,optlen);
-      break;
-    case IF_GAIN:
-      frontend->if_gain = decode_int8(cp,optlen);
-      break;
-    case LNA_GAIN:
-      frontend->lna_gain = decode_int8(cp,optlen);
-      break;
-    case MIXER_GAIN:
-      frontend->mixer_gain = decode_int8(cp,optlen);
-      break;
-    case KAISER_BETA:
-      channel->filter.kaiser_beta = decode_float(cp,optlen);
-      break;
-    case FILTER_DROPS:
-      channel->filter.out.block_drops = decode_int(cp,optlen);
-      break;
-    case IF_POWER:
-      frontend->if_power = dB2power(decode_float(cp,optlen));
-      break;
-    case BASEBAND_POWER:
-      channel->sig.bb_power = dB2power(decode_float(cp,optlen)); // dB -> power
-      break;
-    case NOISE_DENSITY:
-      channel->sig.n0 = dB2power(decode_float(cp,optlen));
-      break;
-    case DEMOD_SNR:
-      channel->sig.snr = dB2power(decode_float(cp,optlen));
-      break;
-    case FREQ_OFFSET:
-      channel->sig.foffset = decode_float(cp,optlen);
-      break;
-    case PEAK_DEVIATION:
-      channel->fm.pdeviation = decode_float(cp,optlen);
-      break;
-    case PLL_LOCK:
-      channel->linear.pll_lock = decode_bool(cp,optlen);
-      break;
-    case PLL_BW:
-      channel->linear.loop_bw = decode_float(cp,optlen);
-      break;
-    case PLL_SQUARE:
-      channel->linear.square = decode_bool(cp,optlen);
-      break;
-    case PLL_PHASE:
-      channel->linear.cphase = decode_float(cp,optlen);
-      break;
-    case PLL_WRAPS:
-      channel->linear.rotations = (int64_t)decode_int64(cp,optlen);
-      break;
-    case ENVELOPE:
-      channel->linear.env = decode_bool(cp,optlen);
-      break;
-    case OUTPUT_LEVEL:
-      channel->output.energy = dB2power(decode_float(cp,optlen));
-      break;
-    case OUTPUT_SAMPLES:
-      channel->output.samples = decode_int64(cp,optlen);
-      break;
-    case COMMAND_TAG:
-      channel->status.tag = decode_int32(cp,optlen);
-      break;
-    case RADIO_FREQUENCY:
-      channel->tune.freq = decode_double(cp,optlen);
-      break;
-    case SECOND_LO_FREQUENCY:
-      channel->tune.second_LO = decode_double(cp,optlen);
-      break;
-    case SHIFT_FREQUENCY:
-      channel->tune.shift = decode_double(cp,optlen);
-      break;
-    case FIRST_LO_FREQUENCY:
-      frontend->frequency = decode_double(cp,optlen);
-      break;
-    case DOPPLER_FREQUENCY:
-      channel->tune.doppler = decode_double(cp,optlen);
-      break;
-    case DOPPLER_FREQUENCY_RATE:
-      channel->tune.doppler_rate = decode_double(cp,optlen);
-      break;
-    case DEMOD_TYPE:
-      channel->demod_type = decode_int(cp,optlen);
-      break;
-    case OUTPUT_CHANNELS:
-      channel->output.channels = decode_int(cp,optlen);
-      break;
-    case INDEPENDENT_SIDEBAND:
-      channel->filter.isb = decode_bool(cp,optlen);
-      break;
-    case THRESH_EXTEND:
-      channel->fm.threshold = decode_bool(cp,optlen);
-      break;
-    case PLL_ENABLE:
-      channel->linear.pll = decode_bool(cp,optlen);
-      break;
-    case GAIN:              // dB to voltage
-      channel->output.gain = dB2voltage(decode_float(cp,optlen));
-      break;
-    case AGC_ENABLE:
-      channel->linear.agc = decode_bool(cp,optlen);
-      break;
-    case HEADROOM:          // db to voltage
-      channel->output.headroom = dB2voltage(decode_float(cp,optlen));
-      break;
-    case AGC_HANGTIME:      // s to samples
-      channel->linear.hangtime = decode_float(cp,optlen);
-      break;
-    case AGC_RECOVERY_RATE: // dB/s to dB/sample to voltage/sample
-      channel->linear.recovery_rate = dB2voltage(decode_float(cp,optlen));
-      break;
-    case AGC_THRESHOLD:   // dB to voltage
-      channel->linear.threshold = dB2voltage(decode_float(cp,optlen));
-      break;
-    case TP1: // Test point
-      channel->tp1 = decode_float(cp,optlen);
-      break;
-    case TP2:
-      channel->tp2 = decode_float(cp,optlen);
-      break;
-    case SQUELCH_OPEN:
-      channel->fm.squelch_open = dB2power(decode_float(cp,optlen));
-      break;
-    case SQUELCH_CLOSE:
-      channel->fm.squelch_close = dB2power(decode_float(cp,optlen));
-      break;
-    case DEEMPH_GAIN:
-      channel->fm.gain = decode_float(cp,optlen);
+      Mcast_ttl = decode_int8(value,optlen);
       break;
     case DEEMPH_TC:
-      channel->fm.rate = 1e6*decode_float(cp,optlen);
-      break;
-    case PL_TONE:
-      channel->fm.tone_freq = decode_float(cp,optlen);
-      break;
-    case PL_DEVIATION:
-      channel->fm.tone_deviation = decode_float(cp,optlen);
-      break;
-    case NONCOHERENT_BIN_BW:
-      channel->spectrum.bin_bw = decode_float(cp,optlen);
-      break;
-    case BIN_COUNT:
-      channel->spectrum.bin_count = decode_int(cp,optlen);
-      break;
-    case BIN_DATA:
-      break;
-    case RF_GAIN:
-      frontend->rf_gain = decode_float(cp,optlen);
-      break;
-    case RF_ATTEN:
-      frontend->rf_atten = decode_float(cp,optlen);
+      channel->fm.rate = 1e6*decode_float(value,optlen);
       break;
-    case BLOCKS_SINCE_POLL:
-      channel->status.blocks_since_poll = decode_int64(cp,optlen);
-      break;
-    case PRESET:
-      {
-	char *p = decode_string(cp,optlen);
-	strlcpy(channel->preset,p,sizeof(channel->preset));
-	FREE(p);
-      }
-      break;
-    case RTP_PT:
-      channel->output.rtp.type = decode_int(cp,optlen);
-      break;
-    case OUTPUT_ENCODING:
-      channel->output.encoding = decode_int(cp,optlen);
-      break;
-    case STATUS_INTERVAL:
-      channel->status.output_interval = decode_int(cp,optlen);
-      break;
-    default: // ignore others
+    default: // ignore others, e.g., BIN_DATA, BULK_FORMAT
       break;
     }
-    cp += optlen;
   }
   return 0;
 }
-// Extract SSRC; 0 means not present (reserved value)
-uint32_t get_ssrc(uint8_t const *buffer,int length){
-  uint8_t const *cp = buffer;
 
-  while(cp - buffer < length){
-    enum status_type const type = *cp++; // increment cp to length field
+// Encode a status field straight from its member of chan or frontend, as described by the same table
+// For those radiod keeps in the same form it sends; returns 0 and encodes nothing for any other type
+int encode_radio_field(uint8_t **bp,enum status_type type,struct frontend const *frontend,struct channel const *chan){
+  struct tlv_field const * const f = &Status_fields[type & 0xff];
+  if(f->kind == TLV_NONE || f->decode_only)
+    return 0;
 
-    if(type == EOL)
-      break; // end of list, no length
-
-    unsigned int optlen = *cp++;
-    if(optlen & 0x80){
-      // length is >= 128 bytes; fetch actual length from next N bytes, where N is low 7 bits of optlen
-      int length_of_length = optlen & 0x7f;
-      optlen = 0;
-      while(length_of_length > 0){
-	optlen <<= 8;
-	optlen |= *cp++;
-	length_of_length--;
-      }
+  uint8_t const * const p = (f->frontend ? (uint8_t const *)frontend : (uint8_t const *)chan) + f->offset;
+  switch(f->kind){
+  case TLV_INT8:
+    return encode_int64(bp,type,*p);
+  case TLV_INT16:
+    { uint16_t v; memcpy(&v,p,sizeof(v)); return encode_int64(bp,type,v); }
+  case TLV_INT32:
+    { uint32_t v; memcpy(&v,p,sizeof(v)); return encode_int64(bp,type,v); }
+  case TLV_INT64:
+    { uint64_t v; memcpy(&v,p,sizeof(v)); return encode_int64(bp,type,v); }
+  case TLV_BOOL:
+    return encode_byte(bp,type,*(bool const *)p);
+  case TLV_FLOAT:
+    {
+      float x = *(float const *)p;
+      if(f->conv == TLV_DB_POWER)
+	x = power2dB(x);
+      else if(f->conv == TLV_DB_VOLTAGE)
+	x = voltage2dB(x);
+      return encode_float(bp,type,x);
     }
-    if(cp - buffer + optlen >= length)
-      break; // invalid length; we can't continue to scan
-
-    switch(type){
-    case EOL: // Shouldn't get here
-      goto done;
-    case OUTPUT_SSRC:
-      return decode_int32(cp,optlen);
-      break;
-    default:
-      break; // Ignore on this pass
+  case TLV_DOUBLE:
+    return encode_double(bp,type,*(double const *)p);
+  case TLV_STRING:
+    {
+      size_t const len = strnlen((char const *)p,f->size);
+      if(len > 0 && len < f->size)
+	return encode_string(bp,type,p,len);
     }
-    cp += optlen;
+    return 0;
+  case TLV_SOCKET:
+    return encode_socket(bp,type,p);
+  }
+  return 0;
+}
+
+// Extract SSRC; 0 means not present (reserved value)
+uint32_t get_ssrc(uint8_t const *buffer,int length){
+  uint8_t const *cp = buffer;
+  uint8_t const * const end = buffer + length;
+  enum status_type type;
+  uint8_t const *value;
+  int optlen,len;
+  while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+    if(type == OUTPUT_SSRC)
+      return decode_int32(value,optlen);
+    cp += len;
   }
- done:;
   return 0;
 }
 // Extract command tag
 uint32_t get_tag(uint8_t const *buffer,int length){
   uint8_t const *cp = buffer;
+  uint8_t const * const end = buffer + length;
+  enum status_type type;
+  uint8_t const *value;
+  int optlen,len;
+  while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+    if(type == COMMAND_TAG)
+      return decode_int32(value,optlen);
+    cp += len;
+  }
+  return 0; // broadcast
+}
 
-  while(cp - buffer < length){
-    enum status_type const type = *cp++; // increment cp to length field
-
-    if(type == EOL)
-      break; // end of list, no length
-
-    unsigned int optlen = *cp++;
-    if(optlen & 0x80){
-      // length is >= 128 bytes; fetch actual length from next N bytes, where N is low 7 bits of optlen
-      int length_of_length = optlen & 0x7f;
-      optlen = 0;
-      while(length_of_length > 0){
-	optlen <<= 8;
-	optlen |= *cp++;
-	length_of_length--;
-      }
+// Extract the channel's output data socket (OUTPUT_DATA_DEST_SOCKET) into sock
+// Returns 0, or -1 if it isn't there, e.g., in a bulk record with only changed fields
+int get_dest_socket(void *sock,uint8_t const *buffer,int length){
+  uint8_t const *cp = buffer;
+  uint8_t const * const end = buffer + length;
+  enum status_type type;
+  uint8_t const *value;
+  int optlen,len;
+  while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+    if(type == OUTPUT_DATA_DEST_SOCKET){
+      decode_socket(sock,value,optlen);
+      return 0;
     }
-    if(cp - buffer + optlen >= length)
-      break; // invalid length; we can't continue to scan
+    cp += len;
+  }
+  return -1;
+}
 
-    switch(type){
-    case EOL: // Shouldn't get here
-      goto done;
-    case COMMAND_TAG:
-      return decode_int32(cp,optlen);
-      break;
-    default:
-      break; // Ignore on this pass
-    }
-    cp += optlen;
+// Split a BULK_STATUS packet (buffer and length past the type byte) into its channel records
+// Each is a TLV list ending in EOL, as in a STATUS packet, so it can be given to decode_radio_status(), get_ssrc(), etc
+// Returns the length of the record at buffer + *offset, EOL included, and advances *offset past it
+// Returns 0 at the end of the packet, or if the record runs off the end
+int next_bulk_record(uint8_t const *buffer,int length,int *offset){
+  uint8_t const * const start = buffer + *offset;
+  uint8_t const *cp = start;
+  uint8_t const * const end = buffer + length;
+  enum status_type type;
+  uint8_t const *value;
+  int optlen,len;
+  while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0)
+    cp += len;
+  if(cp >= end || *cp != EOL)
+    return 0;
+  cp++;
+  *offset = cp - buffer;
+  return cp - start;
+}
+
+// BULK_FORMAT in a bulk status record: 2 = keyframe, 1 = changed fields only, 0 if absent
+int get_bulk_format(uint8_t const *buffer,int length){
+  uint8_t const *cp = buffer;
+  uint8_t const * const end = buffer + length;
+  enum status_type type;
+  uint8_t const *value;
+  int optlen,len;
+  while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+    if(type == BULK_FORMAT)
+      return decode_int(value,optlen);
+    cp += len;
   }
- done:;
-  return 0; // broadcast
+  return 0;
 }
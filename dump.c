@@ -217,6 +217,26 @@ void dump_metadata(FILE *fp,uint8_t const * const buffer,int length,bool newline
     case THRESH_EXTEND:
       fprintf(fp,"Thr Extend %s",decode_int8(cp,optlen) ? "on" : "off");
       break;
+    case RDS_ENABLE:
+      fprintf(fp,"RDS %s",decode_int8(cp,optlen) ? "on" : "off");
+      break;
+    case RDS_PI:
+      fprintf(fp,"RDS PI %04X",decode_int(cp,optlen));
+      break;
+    case RDS_PS:
+      {
+	char *p = decode_string(cp,optlen);
+	fprintf(fp,"RDS PS \"%s\"",p);
+	FREE(p);
+      }
+      break;
+    case RDS_RT:
+      {
+	char *p = decode_string(cp,optlen);
+	fprintf(fp,"RDS RT \"%s\"",p);
+	FREE(p);
+      }
+      break;
     case PLL_ENABLE:
       fprintf(fp,"PLL %s",decode_int8(cp,optlen) ? "enable":"disable");
       break;
@@ -342,6 +362,19 @@ void dump_metadata(FILE *fp,uint8_t const * const buffer,int length,bool newline
 	}
       }
       break;
+    case FFT_WAIT_SHORT:
+    case FFT_WAIT_BULK:
+      {
+	// Bin 0 is < 1 us, bin i is 2^(i-1) to 2^i us
+	fprintf(fp,"%s fft queue waits:",type == FFT_WAIT_SHORT ? "short" : "bulk");
+	uint8_t const *vp = cp; // cp itself is advanced past the whole vector below
+	int count = optlen/sizeof(float);
+	for(int i=0; i < count; i++){
+	  fprintf(fp," %.0f",decode_float(vp,sizeof(float)));
+	  vp += sizeof(float);
+	}
+      }
+      break;
     case RTP_PT:
       fprintf(fp,"RTP PT %u",decode_int(cp,optlen));
       break;
@@ -354,6 +387,33 @@ void dump_metadata(FILE *fp,uint8_t const * const buffer,int length,bool newline
 	fprintf(fp,"encoding %d (%s)",e,encoding_string(e));
       }
       break;
+    case OPUS_COMPLEXITY:
+      fprintf(fp,"opus complexity %d",decode_int(cp,optlen));
+      break;
+    case OPUS_COMPLEXITY_NOW:
+      fprintf(fp,"opus complexity now %d",decode_int(cp,optlen));
+      break;
+    case OPUS_DROPS:
+      fprintf(fp,"opus drops %'llu",(unsigned long long)decode_int64(cp,optlen));
+      break;
+    case BULK_FORMAT:
+      {
+	int const f = decode_int(cp,optlen);
+	fprintf(fp,"bulk %s",f == 2 ? "keyframe" : f == 1 ? "delta" : "?");
+      }
+      break;
+    case OPUS_ENCODE_TIME:
+      {
+	// Bin 0 is < 1 us, bin i is 2^(i-1) to 2^i us
+	fprintf(fp,"opus encode times:");
+	uint8_t const *vp = cp; // cp itself is advanced past the whole vector below
+	int count = optlen/sizeof(float);
+	for(int i=0; i < count; i++){
+	  fprintf(fp," %.0f",decode_float(vp,sizeof(float)));
+	  vp += sizeof(float);
+	}
+      }
+      break;
     default:
       fprintf(fp,"unknown type %d length %d",type,optlen);
       break;
@@ -32,7 +32,9 @@ char const *Wisdom_file = "/var/lib/ka9q-radio/wisdom";
 char const *System_wisdom_file = "/etc/fftw/wisdomf"; // only valid for float version
 double FFTW_plan_timelimit = 30.0;
 int N_worker_threads = 2;
-int N_internal_threads = 1; // Usually most efficient
+int N_internal_threads = 1; // FFTW threads for each FFT_BULK (front end) forward FFT; 1 is usually most efficient
+int Filter_inline_max = 32768; // Largest forward FFT (in points) executed in the caller's thread by EXEC_AUTO filters
+int N_bulk_threads = 0; // Extra workers dedicated to FFT_BULK jobs
 
 // Desired FFTW planning level
 // If wisdom at this level is not present for some filter, the command to generate it will be logged and FFTW_MEASURE wisdom will be generated at runtime
@@ -46,6 +48,8 @@ static bool FFTW_init = false;
 struct fft_job {
   struct fft_job *next;
   unsigned int jobnum;
+  enum fft_class fft_class;
+  long long queued;  // Time put on queue, ns
   enum filtertype type;
   fftwf_plan plan;
   void *input;
@@ -59,12 +63,15 @@ struct fft_job {
 
 #define NTHREADS_MAX 20  // More than I'll ever need
 static struct {
-  pthread_mutex_t queue_mutex; // protects job_queue
+  pthread_mutex_t queue_mutex; // protects job_queue and stats
   pthread_cond_t queue_cond;   // signaled when job put on job_queue
-  struct fft_job *job_queue;
+  struct fft_job *job_queue[N_FFT_CLASSES];
+  struct fft_stats stats[N_FFT_CLASSES];
   pthread_t thread[NTHREADS_MAX];  // Worker threads
 } FFT;
 
+static enum fft_class const Bulk_class = FFT_BULK; // Argument to dedicated bulk workers
+
 static inline int modulo(int x,int const m){
   x = x < 0 ? x + m : x;
   return x > m ? x - m : x;
@@ -74,7 +81,8 @@ static inline int modulo(int x,int const m){
 // Custom version of malloc that aligns to a cache line
 void *lmalloc(size_t size);
 
-static void suggest(int level,int size,int dir,int clex);
+static void suggest(int level,int size,int dir,int clex,int nthreads);
+static void plan_forward(struct filter_in *master,int nthreads);
 
 // Create fast convolution filters
 // The filters are now in two parts, filter_in (the master) and filter_out (the slave)
@@ -85,14 +93,14 @@ static void suggest(int level,int size,int dir,int clex);
 // L = input data blocksize
 // M = impulse response duration
 // in_type = REAL or COMPLEX
+// fft_class = FFT_SHORT, or FFT_BULK for the front end; it picks the worker pool queue and the FFTW thread count
 
 // filter_create_output() parameters, distinct per slave
 // master - pointer to associated master (input) filter
 // response = complex frequency response; may be NULL here and set later with set_filter()
 // This is set in the slave and can be different (indeed, this is the reason to have multiple slaves)
 //            NB: response is always complex even when input and/or output is real, though it will be shorter
-//            bins = (L + M - 1)/decimate when output is complex
-//            length = (bins/2+1) when output is real
+//            length = points = (L + M - 1)/decimate, for both complex and real output
 //            Must be SIMD-aligned (e.g., allocated with fftw_alloc) and will be freed by delete_filter()
 
 // decimate = input/output sample rate ratio, only tested for powers of 2
@@ -100,7 +108,10 @@ static void suggest(int level,int size,int dir,int clex);
 
 // All demodulators taking baseband (zero IF) I/Q data require COMPLEX input
 // All but SSB require COMPLEX output, with ISB using the special CROSS_CONJ mode
-// SSB(CW) could (and did) use the REAL mode since the imaginary component is unneeded, and the c2r IFFT is faster
+// SSB(CW) can use the REAL mode since the imaginary component is unneeded, and the c2r IFFT is faster
+// REAL output from COMPLEX input is the real part of what the COMPLEX output would be (times sqrt(2), see set_filter())
+// REAL output from REAL input is scaled as before, i.e., half that, so real->real users see no change in level
+// so its response is the full complex response of 'points' bins, with the passband anywhere, e.g., for LSB
 // Baseband FM audio filtering for de-emphasis and PL separation uses REAL input and output
 
 // If you provide your own filter response, ensure that it drops to nil well below the Nyquist rate
@@ -108,7 +119,7 @@ static void suggest(int level,int size,int dir,int clex);
 // The set_filter() function uses Kaiser windowing for this purpose
 
 // Set up input (master) half of filter
-struct filter_in *create_filter_input(struct filter_in *master,int const L,int const M, enum filtertype const in_type){
+struct filter_in *create_filter_input(struct filter_in *master,int const L,int const M, enum filtertype const in_type,enum fft_class const fft_class){
   assert(L > 0);
   assert(M > 0);
   int const N = L + M - 1;
@@ -129,12 +140,18 @@ struct filter_in *create_filter_input(struct filter_in *master,int const L,int c
   master->in_type = in_type;
   master->ilen = L;
   master->impulse_length = M;
+  master->exec = EXEC_AUTO;
+  master->wcnt = 0;
+  master->next_jobnum = 0; // Callers (e.g., wfm.c) may pass uninitialized structures
+  master->fft_class = fft_class;
   pthread_mutex_init(&master->filter_mutex,NULL);
   pthread_cond_init(&master->filter_cond,NULL);
 
-  // FFTW itself always runs with a single thread since multithreading didn't seem to do much good
+  // FFTW itself usually runs with a single thread since multithreading didn't seem to do much good
   // But we have a set of worker threads operating on a job queue to allow a controlled number
   // of independent FFTs to execute at the same time
+  // For the very large front end transform (e.g., at 64.8 or 129.6 Msps) the latency of one block on one core
+  // can matter more than total throughput, so FFT_BULK filters are planned with N_internal_threads
   if(!FFTW_init){
     fftwf_init_threads();
     bool sr = fftwf_import_system_wisdom();
@@ -163,16 +180,14 @@ struct filter_in *create_filter_input(struct filter_in *master,int const L,int c
     // Start FFT worker thread(s) if not already running
     pthread_mutex_init(&FFT.queue_mutex,NULL);
     pthread_cond_init(&FFT.queue_cond,NULL);
-    for(int i=0;i < N_worker_threads;i++){
+    for(int i=0;i < N_worker_threads + N_bulk_threads && i < NTHREADS_MAX;i++){
       if(FFT.thread[i] == (pthread_t)0)
-	pthread_create(&FFT.thread[i],NULL,run_fft,NULL);
+	pthread_create(&FFT.thread[i],NULL,run_fft,i < N_worker_threads ? NULL : (void *)&Bulk_class);
     }
     FFTW_init = true;
 
   }
   pthread_mutex_lock(&FFTW_planning_mutex);
-  fftwf_plan_with_nthreads(N_internal_threads);
-
   switch(in_type){
   default:
     pthread_mutex_unlock(&FFTW_planning_mutex);
@@ -187,11 +202,6 @@ struct filter_in *create_filter_input(struct filter_in *master,int const L,int c
     master->input_write_pointer.c = master->input_read_pointer.c + L; // start writing here
     master->input_read_pointer.r = NULL;
     master->input_write_pointer.r = NULL;
-    master->fwd_plan = fftwf_plan_dft_1d(N, master->input_read_pointer.c, master->fdomain[0], FFTW_FORWARD, FFTW_WISDOM_ONLY|FFTW_planning_level);
-    if(master->fwd_plan == NULL){
-      suggest(FFTW_planning_level,N,FFTW_FORWARD,COMPLEX);
-      master->fwd_plan = fftwf_plan_dft_1d(N, master->input_read_pointer.c, master->fdomain[0], FFTW_FORWARD, FFTW_MEASURE);
-    }
     break;
   case REAL:
     master->input_buffer_size = round_to_page(ND * N * sizeof(float));
@@ -200,18 +210,37 @@ struct filter_in *create_filter_input(struct filter_in *master,int const L,int c
     master->input_write_pointer.r = master->input_read_pointer.r + L; // start writing here
     master->input_read_pointer.c = NULL;
     master->input_write_pointer.c = NULL;
+    break;
+  }
+  master->fwd_plan = NULL;
+  plan_forward(master,fft_class == FFT_BULK ? N_internal_threads : 1); // Planned once, for the class it will run in
+  pthread_mutex_unlock(&FFTW_planning_mutex);
+
+  return master;
+}
+
+// (Re)plan a filter's forward FFT with nthreads FFTW threads. Caller holds FFTW_planning_mutex
+static void plan_forward(struct filter_in * const master,int const nthreads){
+  int const N = master->ilen + master->impulse_length - 1;
+  if(master->fwd_plan != NULL)
+    fftwf_destroy_plan(master->fwd_plan);
+  fftwf_plan_with_nthreads(nthreads);
+  if(master->in_type == REAL){
     master->fwd_plan = fftwf_plan_dft_r2c_1d(N, master->input_read_pointer.r, master->fdomain[0], FFTW_WISDOM_ONLY|FFTW_planning_level);
     if(master->fwd_plan == NULL){
-      suggest(FFTW_planning_level,N,FFTW_FORWARD,REAL);
+      suggest(FFTW_planning_level,N,FFTW_FORWARD,REAL,nthreads);
       master->fwd_plan = fftwf_plan_dft_r2c_1d(N, master->input_read_pointer.r, master->fdomain[0], FFTW_MEASURE);
     }
-    break;
+  } else {
+    master->fwd_plan = fftwf_plan_dft_1d(N, master->input_read_pointer.c, master->fdomain[0], FFTW_FORWARD, FFTW_WISDOM_ONLY|FFTW_planning_level);
+    if(master->fwd_plan == NULL){
+      suggest(FFTW_planning_level,N,FFTW_FORWARD,COMPLEX,nthreads);
+      master->fwd_plan = fftwf_plan_dft_1d(N, master->input_read_pointer.c, master->fdomain[0], FFTW_FORWARD, FFTW_MEASURE);
+    }
   }
+  fftwf_plan_with_nthreads(1);
   if(fftwf_export_wisdom_to_filename(Wisdom_file) == 0)
     fprintf(stdout,"fftwf_export_wisdom_to_filename(%s) failed\n",Wisdom_file);
-  pthread_mutex_unlock(&FFTW_planning_mutex);
-
-  return master;
 }
 // Set up output (slave) side of filter (possibly one of several sharing the same input master)
 // These output filters should be deleted before their masters
@@ -235,7 +264,10 @@ struct filter_out *create_filter_output(struct filter_out *slave,struct filter_i
   // N / L = Total FFT points / time domain points
   float const overlap = (float)(master->ilen + master->impulse_length - 1) / master->ilen;
   slave->response = response;
-  slave->noise_gain = (response == NULL) ? NAN : noise_gain(slave);
+  slave->phasor = 1;
+  slave->block_drops = 0;
+  slave->rcnt = 0;
+  pthread_mutex_init(&slave->response_mutex,NULL);
 
   pthread_mutex_lock(&FFTW_planning_mutex);
   fftwf_plan_with_nthreads(1); // IFFTs are always small, use only one internal thread
@@ -250,14 +282,16 @@ struct filter_out *create_filter_output(struct filter_out *slave,struct filter_i
       // and some number of (zero, or near zero) samples need to be dropped from the end
       // This will be zero-padding in reverse
       slave->olen = len;
-      slave->bins = ceilf(len * overlap); // Total number of time-domain FFT points including overlap
+      slave->points = ceilf(len * overlap); // Total number of time-domain FFT points including overlap
+      slave->bins = slave->points;
       slave->fdomain = lmalloc(sizeof(complex float) * slave->bins);
       slave->output_buffer.c = lmalloc(sizeof(complex float) * slave->bins);
       assert(slave->output_buffer.c != NULL);
       slave->output_buffer.r = NULL; // catch erroneous references
       slave->output.c = slave->output_buffer.c + slave->bins - len;
+      slave->output.r = NULL;
       if((slave->rev_plan = fftwf_plan_dft_1d(slave->bins,slave->fdomain,slave->output_buffer.c,FFTW_BACKWARD,FFTW_WISDOM_ONLY|FFTW_planning_level)) == NULL){
-	suggest(FFTW_planning_level,slave->bins,FFTW_BACKWARD,COMPLEX);
+	suggest(FFTW_planning_level,slave->bins,FFTW_BACKWARD,COMPLEX,1);
 	slave->rev_plan = fftwf_plan_dft_1d(slave->bins,slave->fdomain,slave->output_buffer.c,FFTW_BACKWARD,FFTW_MEASURE);
       }
     }
@@ -267,7 +301,7 @@ struct filter_out *create_filter_output(struct filter_out *slave,struct filter_i
   case SPECTRUM: // Like complex, but no IFFT or output time domain buffer
     {
       slave->olen = 0;
-      slave->bins = len;
+      slave->bins = slave->points = len;
       slave->fdomain = lmalloc(sizeof(complex float) * slave->bins); // User reads this directly
       assert(slave->fdomain != NULL);
       // Note: No time domain buffer; slave->output, etc, all NULL
@@ -276,17 +310,20 @@ struct filter_out *create_filter_output(struct filter_out *slave,struct filter_i
     break;
   case REAL:
     {
+      // The c2r IFFT takes points/2+1 bins and produces 'points' real samples
       slave->olen = len;
-      slave->bins = ceilf(len * overlap) / 2 + 1;
+      slave->points = ceilf(len * overlap);
+      slave->bins = slave->points / 2 + 1;
       slave->fdomain = lmalloc(sizeof(complex float) * slave->bins);
       assert(slave->fdomain != NULL);
-      slave->output_buffer.r = lmalloc(sizeof(float) * slave->bins);
+      slave->output_buffer.r = lmalloc(sizeof(float) * slave->points);
       assert(slave->output_buffer.r != NULL);
       slave->output_buffer.c = NULL;
-      slave->output.r = slave->output_buffer.r + slave->bins - len;
-      if((slave->rev_plan = fftwf_plan_dft_c2r_1d(slave->bins,slave->fdomain,slave->output_buffer.r,FFTW_WISDOM_ONLY|FFTW_planning_level)) == NULL){
-	suggest(FFTW_planning_level,slave->bins,FFTW_BACKWARD,REAL);
-	slave->rev_plan = fftwf_plan_dft_c2r_1d(slave->bins,slave->fdomain,slave->output_buffer.r,FFTW_MEASURE);
+      slave->output.r = slave->output_buffer.r + slave->points - len;
+      slave->output.c = NULL;
+      if((slave->rev_plan = fftwf_plan_dft_c2r_1d(slave->points,slave->fdomain,slave->output_buffer.r,FFTW_WISDOM_ONLY|FFTW_planning_level)) == NULL){
+	suggest(FFTW_planning_level,slave->points,FFTW_BACKWARD,REAL,1);
+	slave->rev_plan = fftwf_plan_dft_c2r_1d(slave->points,slave->fdomain,slave->output_buffer.r,FFTW_MEASURE);
       }
     }
     if(fftwf_export_wisdom_to_filename(Wisdom_file) == 0)
@@ -295,50 +332,86 @@ struct filter_out *create_filter_output(struct filter_out *slave,struct filter_i
   }
   slave->next_jobnum = master->next_jobnum;
   pthread_mutex_unlock(&FFTW_planning_mutex);
+  slave->noise_gain = (response == NULL) ? NAN : noise_gain(slave); // needs slave->points
   return slave;
 }
 
+// Execute one forward FFT job and signal its completion to the slaves waiting on it
+// Called by the worker threads, or directly by execute_filter_input() for inline filters
+static void execute_job(struct fft_job * const job){
+  if(job->input != NULL && job->output != NULL && job->plan != NULL){
+    switch(job->type){
+    case COMPLEX:
+    case CROSS_CONJ:
+      fftwf_execute_dft(job->plan,job->input,job->output);
+      break;
+    case REAL:
+      fftwf_execute_dft_r2c(job->plan,job->input,job->output);
+      break;
+    default:
+      break;
+    }
+  }
+  // Signal we're done with this job
+  if(job->completion_mutex)
+    pthread_mutex_lock(job->completion_mutex);
+  if(job->completion_jobnum)
+    *job->completion_jobnum = job->jobnum;
+  if(job->completion_cond)
+    pthread_cond_broadcast(job->completion_cond);
+  if(job->completion_mutex)
+    pthread_mutex_unlock(job->completion_mutex);
+}
+
+// Take the next job off the highest priority queue this worker serves, or NULL if none
+// Caller must hold FFT.queue_mutex
+static struct fft_job *dequeue_job(enum fft_class const *only){
+  for(int c = 0; c < N_FFT_CLASSES; c++){
+    if(only != NULL && c != *only)
+      continue;
+    struct fft_job * const job = FFT.job_queue[c];
+    if(job == NULL)
+      continue;
+    FFT.job_queue[c] = job->next;
+
+    // Record time spent waiting in the queue
+    long long const wait = gps_time_ns() - job->queued;
+    uint64_t const w = wait > 0 ? wait : 0;
+    struct fft_stats * const st = &FFT.stats[c];
+    st->jobs++;
+    st->wait_ns += w;
+    if(w > st->max_wait_ns)
+      st->max_wait_ns = w;
+    int bin = 0;
+    for(uint64_t us = w / 1000; us != 0 && bin < FFT_WAIT_BINS-1; us >>= 1)
+      bin++;
+    st->hist[bin]++;
+    return job;
+  }
+  return NULL;
+}
+
 // Worker thread(s) that actually execute FFTs
 // Used for input FFTs since they tend to be large and CPU-consuming
 // Lets the input thread process the next input block in parallel on another core
 // Frees the input buffer and the job descriptor when done
+// p == NULL: serve all classes, short jobs first. Otherwise p points to the only class to serve
 void *run_fft(void *p){
   pthread_detach(pthread_self());
-  pthread_setname("fft");
+  enum fft_class const *only = p;
+  pthread_setname(only != NULL ? "fft-bulk" : "fft");
 
   realtime();
 
   while(true){
     // Get next job
     pthread_mutex_lock(&FFT.queue_mutex);
-    while(FFT.job_queue == NULL)
+    struct fft_job *job;
+    while((job = dequeue_job(only)) == NULL)
       pthread_cond_wait(&FFT.queue_cond,&FFT.queue_mutex);
-    struct fft_job *job = FFT.job_queue;
-    FFT.job_queue = job->next;
     pthread_mutex_unlock(&FFT.queue_mutex);
 
-    if(job->input != NULL && job->output != NULL && job->plan != NULL){
-      switch(job->type){
-      case COMPLEX:
-      case CROSS_CONJ:
-	fftwf_execute_dft(job->plan,job->input,job->output);
-	break;
-      case REAL:
-	fftwf_execute_dft_r2c(job->plan,job->input,job->output);
-	break;
-      default:
-	break;
-      }
-    }
-    // Signal we're done with this job
-    if(job->completion_mutex)
-      pthread_mutex_lock(job->completion_mutex);
-    if(job->completion_jobnum)
-      *job->completion_jobnum = job->jobnum;
-    if(job->completion_cond)
-      pthread_cond_broadcast(job->completion_cond);
-    if(job->completion_mutex)
-      pthread_mutex_unlock(job->completion_mutex);
+    execute_job(job);
     // Do NOT destroy job->completion_cond and completion_mutex here, they continue to exist
 
     bool const terminate = job->terminate; // Don't use job pointer after free
@@ -349,16 +422,57 @@ void *run_fft(void *p){
   return NULL;
 }
 
+// Choose pool or inline execution of a filter's forward FFT; may be changed at any time
+int set_filter_exec(struct filter_in * const f,enum fft_exec const exec){
+  if(f == NULL)
+    return -1;
+  f->exec = exec;
+  return 0;
+}
+
+// Choose the worker pool queue for a filter's forward FFT
+// FFT_BULK filters (the front end) get an FFTW plan with N_internal_threads threads, so changing the class
+// after create_filter_input() replans the forward FFT; call this before executing the filter
+int set_filter_class(struct filter_in * const f,enum fft_class const fft_class){
+  if(f == NULL || fft_class < 0 || fft_class >= N_FFT_CLASSES)
+    return -1;
+  int const old_threads = (f->fft_class == FFT_BULK) ? N_internal_threads : 1;
+  int const new_threads = (fft_class == FFT_BULK) ? N_internal_threads : 1;
+  f->fft_class = fft_class;
+  if(new_threads != old_threads){
+    pthread_mutex_lock(&FFTW_planning_mutex);
+    plan_forward(f,new_threads);
+    pthread_mutex_unlock(&FFTW_planning_mutex);
+  }
+  return 0;
+}
+
+// Copy out the queue wait statistics for one job class
+int get_fft_stats(struct fft_stats * const stats,enum fft_class const fft_class){
+  if(stats == NULL || fft_class < 0 || fft_class >= N_FFT_CLASSES)
+    return -1;
+  pthread_mutex_lock(&FFT.queue_mutex);
+  *stats = FFT.stats[fft_class];
+  pthread_mutex_unlock(&FFT.queue_mutex);
+  return 0;
+}
 
-// Execute the input side of a filter: set up a job for the FFT worker threads and enqueue it
+// Execute the input side of a filter
+// Pool filters: set up a job for the FFT worker threads and enqueue it
+// Inline filters: run the job here and wake only this filter's slaves
 int execute_filter_input(struct filter_in * const f){
   assert(f != NULL);
   if(f == NULL)
     return -1;
 
+  int const N = f->ilen + f->impulse_length - 1;
+  bool const inline_fft = f->exec == EXEC_INLINE || (f->exec == EXEC_AUTO && N <= Filter_inline_max);
+
   // We use the FFTW3 functions that specify the input and output arrays
-  // Execute the FFT in separate worker threads
-  struct fft_job * const job = calloc(1,sizeof(struct fft_job));
+  // Pool jobs are freed by the worker thread; an inline job lives only for this call
+  struct fft_job inline_job;
+  struct fft_job * const job = inline_fft ? &inline_job : malloc(sizeof(struct fft_job));
+  memset(job,0,sizeof(*job));
   job->jobnum = f->next_jobnum++;
   job->output = f->fdomain[job->jobnum % ND];
   job->type = f->in_type;
@@ -389,23 +503,46 @@ int execute_filter_input(struct filter_in * const f){
   }
   assert(job->input != NULL); // Should already be allocated in create_filter_input, or in our last call
 
-  // Append job to worker queue, wake FFT worker thread
+  if(inline_fft){
+    execute_job(job);
+    return 0;
+  }
+  // Append job to its class's worker queue, wake FFT worker thread
+  job->fft_class = f->fft_class;
   struct fft_job *jp_prev = NULL;
   pthread_mutex_lock(&FFT.queue_mutex);
-  for(struct fft_job *jp = FFT.job_queue; jp != NULL; jp = jp->next)
+  job->queued = gps_time_ns();
+  for(struct fft_job *jp = FFT.job_queue[job->fft_class]; jp != NULL; jp = jp->next)
     jp_prev = jp;
 
   if(jp_prev)
     jp_prev->next = job;
   else
-    FFT.job_queue = job; // Head of list
+    FFT.job_queue[job->fft_class] = job; // Head of list
 
-  pthread_cond_signal(&FFT.queue_cond); // Alert only one FFT worker
+  // Dedicated bulk workers can't take short jobs, so a single wakeup might be wasted on one of them
+  if(N_bulk_threads > 0)
+    pthread_cond_broadcast(&FFT.queue_cond);
+  else
+    pthread_cond_signal(&FFT.queue_cond); // Alert only one FFT worker
   pthread_mutex_unlock(&FFT.queue_mutex);
 
   return 0;
 }
 
+// Frequency domain sample of the master at (possibly negative) bin m; zero if out of range
+// Negative frequencies of a real input are the conjugates of the positive ones
+static inline complex float master_bin(struct filter_in const * const master,complex float const * const fdomain,int const m){
+  if(master->in_type == REAL){
+    if(m >= 0)
+      return m < master->bins ? fdomain[m] : 0;
+    return -m < master->bins ? conjf(fdomain[-m]) : 0;
+  }
+  if(m < -master->bins/2 || m >= master->bins/2)
+    return 0;
+  return fdomain[m < 0 ? m + master->bins : m];
+}
+
 // Execute the output side of a filter:
 // 1 - wait for a forward FFT job to complete
 //     frequency domain data is in a circular queue ND buffers deep to tolerate scheduling jitter
@@ -455,10 +592,40 @@ int execute_filter_output(struct filter_out * const slave,int const rotate){
   // we have to handle the four combinations of the filter input and output time domain data
   // being either real or complex.
 
-  // In ka9q-radio the input depends on the SDR front end, while the output is complex
-  // (even for SSB) because of the fine tuning frequency shift after conversion
-  // back to the time domain. So while real output is supported it is not well tested.
-  if(master->in_type != REAL && slave->out_type != REAL){    // Complex -> complex
+  // In ka9q-radio the input depends on the SDR front end, while the output is usually complex
+  // (even for SSB) because of the fine tuning frequency shift after conversion back to the time domain.
+  if(slave->out_type == REAL){
+    // Any input -> real
+    // Output is 2 * Re(phasor * y), where y is the complex output a COMPLEX slave with this response would produce
+    // With REAL input the phasor is halved, making it Re(phasor * y): with a Hermitian response this is
+    // exactly the old real->real output, so wfm, stereod, etc need no rescaling
+    // Output bin k gets output frequency +k from the positive half of y's spectrum,
+    // and the conjugate of output frequency -k from the negative half
+    // The response is applied here because it need not be Hermitian, e.g., for LSB
+    int const points = slave->points;
+    complex float const phasor = slave->phasor * (master->in_type == REAL ? 0.5f : 1.0f);
+    pthread_mutex_lock(&slave->response_mutex); // Don't let it change while we're using it
+    complex float const * const response = slave->response;
+    if(response == NULL){
+      for(int k=0; k < slave->bins; k++){
+	complex float const pos = phasor * master_bin(master,fdomain,rotate + k);
+	complex float const neg = phasor * master_bin(master,fdomain,rotate - k);
+	slave->fdomain[k] = pos + conjf(neg);
+      }
+    } else {
+      assert(malloc_usable_size((void *)response) >= points * sizeof(*response));
+      slave->fdomain[0] = 2 * crealf(phasor * response[0] * master_bin(master,fdomain,rotate));
+      for(int k=1; k < slave->bins; k++){
+	complex float const pos = phasor * response[k] * master_bin(master,fdomain,rotate + k);
+	complex float const neg = phasor * response[points - k] * master_bin(master,fdomain,rotate - k);
+	slave->fdomain[k] = pos + conjf(neg);
+      }
+    }
+    pthread_mutex_unlock(&slave->response_mutex);
+    fftwf_execute(slave->rev_plan); // Note: c2r version destroys fdomain[]
+    return 0;
+  }
+  if(master->in_type != REAL){    // Complex -> complex
     // Rewritten to avoid modulo computations and complex branches inside loops
     int si = slave->bins/2;
     int mi = rotate - si;
@@ -496,26 +663,7 @@ int execute_filter_output(struct filter_out * const slave,int const rotate){
       if(si == slave->bins)
 	si = 0;
     }
-  } else if(master->in_type != REAL && slave->out_type == REAL){
-    // Complex -> real UNTESTED!
-    for(int si=0; si < slave->bins; si++){
-      int const mi = si + rotate;
-      complex float result = 0;
-      if(mi >= -master->bins/2 && mi < master->bins/2)
-	result = (fdomain[modulo(mi,master->bins)] + conjf(fdomain[modulo(master->bins - mi, master->bins)]));
-      slave->fdomain[si] = result;
-    }
-  } else if(master->in_type == REAL && slave->out_type == REAL){
-    // Real -> real
-    for(int si=0; si < slave->bins; si++){ // All positive frequencies
-      int const mi = si + rotate;
-      complex float result = 0;
-      if(mi >= 0 && mi < master->bins)
-	result = fdomain[mi];
-
-      slave->fdomain[si] = result;
-    }
-  } else if(master->in_type == REAL && slave->out_type != REAL){
+  } else {
     // Real->complex
     // This can be tricky. We treat the input as complex with Hermitian symmetry (both positive and negative spectra)
     // We don't allow the output to span the zero input frequency range as this doesn't seem useful
@@ -619,13 +767,13 @@ static void terminate_fft(struct filter_in *f){
   // Append job to queue, wake FFT thread
   pthread_mutex_lock(&FFT.queue_mutex);
   struct fft_job *jp_prev = NULL;
-  for(struct fft_job *jp = FFT.job_queue; jp != NULL; jp = jp->next)
+  for(struct fft_job *jp = FFT.job_queue[FFT_BULK]; jp != NULL; jp = jp->next)
     jp_prev = jp;
 
   if(jp_prev)
     jp_prev->next = job;
   else
-    FFT.job_queue = job; // Head of list
+    FFT.job_queue[FFT_BULK] = job; // Head of list
 
   pthread_cond_broadcast(&FFT.queue_cond); // Alert FFT thread
   pthread_mutex_unlock(&FFT.queue_mutex);
@@ -882,7 +1030,7 @@ float const noise_gain(struct filter_out const * const slave){
   struct filter_in const * const master = slave->master;
 
   float sum = 0;
-  for(int i=0;i<slave->bins;i++)
+  for(int i=0;i<slave->points;i++)
     sum += cnrmf(slave->response[i]);
 
   // the factor N compensates for the unity gain scaling
@@ -916,16 +1064,17 @@ int set_filter(struct filter_out * const slave,float low,float high,float const
     high = (high > 0 ? +1 : -1) * 0.5;
 
  // Total number of time domain points
-  int const N = (slave->out_type == REAL) ? 2 * (slave->bins - 1) : slave->bins;
+  int const N = slave->points;
   int const L = slave->olen;
   int const M = N - L + 1; // Length of impulse response in time domain
 
   float const gain = (slave->out_type == COMPLEX ? 1.0 : M_SQRT1_2) / (float)slave->master->bins;
 
-  complex float * const response = lmalloc(sizeof(complex float) * slave->bins);
-  memset(response,0,slave->bins * sizeof(response[0]));
-  assert(malloc_usable_size(response) >= (slave->bins) * sizeof(*response));
-  for(int n=0; n < slave->bins; n++){
+  // Always a full complex response, even for real output, so the passband can be on either side of zero
+  complex float * const response = lmalloc(sizeof(complex float) * N);
+  memset(response,0,N * sizeof(response[0]));
+  assert(malloc_usable_size(response) >= N * sizeof(*response));
+  for(int n=0; n < N; n++){
     float const f = n < N/2 ? (float)n / N : (float)(n - N) / N; // neg frequency
     if(f == low || f == high)
       response[n] = gain * M_SQRT1_2; // -3dB
@@ -938,11 +1087,7 @@ int set_filter(struct filter_out * const slave,float low,float high,float const
 #endif
   }
 
-  if(slave->out_type == REAL){
-    window_rfilter(L,M,response,kaiser_beta);
-  } else {
-    window_filter(L,M,response,kaiser_beta);
-  }
+  window_filter(L,M,response,kaiser_beta);
 
   // Hot swap with existing response, if any, using mutual exclusion
   pthread_mutex_lock(&slave->response_mutex);
@@ -1009,7 +1154,7 @@ void *lmalloc(size_t size){
   return NULL;
 }
 // Suggest running fftwf-wisdom to generate some FFTW3 wisdom
-static void suggest(int level,int size,int dir,int clex){
+static void suggest(int level,int size,int dir,int clex,int nthreads){
   const char *opt = NULL;
 
   switch(level){
@@ -1026,8 +1171,9 @@ static void suggest(int level,int size,int dir,int clex){
     opt = " -x";
     break;
   }
-  fprintf(stdout,"suggest running \"fftwf-wisdom -v%s -T 1 -w %s/wisdom -o /tmp/wisdomf %co%c%d\", then \"mv /tmp/wisdomf /etc/fftw/wisdomf\" *if* larger than current file. This will take time.\n",
+  fprintf(stdout,"suggest running \"fftwf-wisdom -v%s -T %d -w %s/wisdom -o /tmp/wisdomf %co%c%d\", then \"mv /tmp/wisdomf /etc/fftw/wisdomf\" *if* larger than current file. This will take time.\n",
 	  opt,
+	  nthreads,
 	  VARDIR,
 	  clex == COMPLEX ? 'c' : 'r',
 	  dir == FFTW_FORWARD ? 'f' : 'b',
@@ -11,6 +11,7 @@
 #include <pthread.h>
 #include <complex.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <fftw3.h>
 #include "misc.h"
 
@@ -19,6 +20,9 @@ extern char const *Wisdom_file;
 extern int Nthreads;
 extern int FFTW_planning_level;
 extern double FFTW_plan_timelimit;
+extern int Filter_inline_max;
+extern int N_bulk_threads;
+extern int N_internal_threads;
 
 // Input can be REAL or COMPLEX
 // Output can be REAL, COMPLEX, CROSS_CONJ, i.e., COMPLEX with special cross conjugation for ISB, or SPECTRUM (noncoherent power)
@@ -30,6 +34,36 @@ enum filtertype {
   SPECTRUM,
 };
 
+// Where the forward FFT of a filter_in is executed
+// AUTO picks INLINE for transforms of up to Filter_inline_max points, POOL for larger ones
+// POOL queues it to the FFT worker threads so the caller can go on to the next block (e.g., the front end)
+// INLINE runs it in the caller's thread, avoiding a wait behind larger jobs in the worker queue
+enum fft_exec {
+  EXEC_AUTO,
+  EXEC_POOL,
+  EXEC_INLINE,
+};
+
+// Forward FFT jobs in the worker pool are queued by class
+// Workers always take SHORT jobs (e.g., per-channel composite filters) ahead of BULK jobs (the front end)
+// N_bulk_threads additional workers, if any, serve only the BULK queue
+enum fft_class {
+  FFT_SHORT,
+  FFT_BULK,
+  N_FFT_CLASSES,
+};
+
+// Queue wait statistics for each job class
+// hist[0] counts waits under 1 microsecond; hist[i] counts waits from 2^(i-1) to 2^i microseconds
+// The last bin also counts everything longer
+#define FFT_WAIT_BINS 16
+struct fft_stats {
+  uint64_t jobs;
+  uint64_t wait_ns;      // Total
+  uint64_t max_wait_ns;
+  uint64_t hist[FFT_WAIT_BINS];
+};
+
 // Input and output arrays can be either complex or real
 // Used to be a union, but was prone to errors
 struct rc {
@@ -49,6 +83,8 @@ struct filter_in {
   struct rc input_write_pointer;     // For incoming samples
   struct rc input_read_pointer;      // For FFT input
   fftwf_plan fwd_plan;               // FFT (time -> frequency)
+  enum fft_exec exec;                // Inline or worker pool
+  enum fft_class fft_class;          // Queue used in the worker pool
 
   pthread_mutex_t filter_mutex;      // Synchronization for sequence number
   pthread_cond_t filter_cond;
@@ -62,9 +98,11 @@ struct filter_out {
   struct filter_in * restrict master;
   enum filtertype out_type;          // REAL, COMPLEX or CROSS_CONJ
   int olen;                          // Length of user portion of output buffer (decimated L)
+  int points;                        // Size of IFFT (N) in time domain points, including overlap
   int bins;                          // Number of frequency bins; == N for complex, == N/2 + 1 for real output
   complex float * restrict fdomain;          // Filtered signal in frequency domain
-  complex float * restrict response;           // Filter response in frequency domain
+  complex float * restrict response;           // Filter response in frequency domain, always N complex bins
+  complex float phasor;              // REAL output only: carrier phase applied before taking the real part
   pthread_mutex_t response_mutex;
   struct rc output_buffer;           // Actual time-domain output buffer, length N/decimate
   struct rc output;                  // Beginning of user output area, length L/decimate
@@ -78,9 +116,12 @@ struct filter_out {
 int window_filter(int L,int M,complex float * restrict response,float beta);
 int window_rfilter(int L,int M,complex float * restrict response,float beta);
 
-struct filter_in *create_filter_input(struct filter_in *,int const L,int const M, enum filtertype const in_type);
+struct filter_in *create_filter_input(struct filter_in *,int const L,int const M, enum filtertype const in_type,enum fft_class);
 struct filter_out *create_filter_output(struct filter_out *slave,struct filter_in * restrict master,complex float * restrict response,int olen, enum filtertype out_type);
 int execute_filter_input(struct filter_in * restrict);
+int set_filter_exec(struct filter_in * restrict,enum fft_exec);
+int set_filter_class(struct filter_in * restrict,enum fft_class);
+int get_fft_stats(struct fft_stats *,enum fft_class);
 int execute_filter_output(struct filter_out * restrict ,int);
 int execute_filter_output_idle(struct filter_out * const slave);
 int delete_filter_input(struct filter_in * restrict);
@@ -31,10 +31,7 @@ void *demod_fm(void *arg){
   FREE(chan->status.command);
   FREE(chan->filter.energies);
   FREE(chan->spectrum.bin_data);
-  if(chan->output.opus != NULL){
-    opus_encoder_destroy(chan->output.opus);
-    chan->output.opus = NULL;
-  }
+  close_opus(chan);
 
   int const blocksize = chan->output.samprate * Blocktime / 1000;
   delete_filter_output(&chan->filter.out);
@@ -46,7 +43,7 @@ void *demod_fm(void *arg){
 	     chan->filter.max_IF/chan->output.samprate,
 	     chan->filter.kaiser_beta);
   
-  float phase_memory = 0;
+  complex float phase_memory = 0; // Last IF sample of previous block
   chan->output.channels = 1; // Only mono for now
   if(isnan(chan->fm.squelch_open) || chan->fm.squelch_open == 0)
     chan->fm.squelch_open = 6.3;  // open above ~ +8 dB
@@ -58,7 +55,7 @@ void *demod_fm(void *arg){
     init_goertzel(&chan->fm.tone_detect,chan->fm.tone_freq/chan->output.samprate);
   }
 
-  float deemph_state = 0;
+  struct iir deemph = {0}; // De-emphasis, then DC removal
   int squelch_state = 0; // Number of blocks for which squelch remains open
   int const N = chan->filter.out.olen;
   float const one_over_olen = 1.0f / N; // save some divides
@@ -69,8 +66,7 @@ void *demod_fm(void *arg){
   int badsamples = 0;
   chan->output.gain = (2 * chan->output.headroom *  chan->output.samprate) / fabsf(chan->filter.min_IF - chan->filter.max_IF);
 
-  float dc_rate = -expm1f(-1.0f / (0.1 * chan->output.samprate)); // experimental DC removal, 100 ms time constant (~10 Hz)
-  float dc = 0; // DC removal filter state
+  float const dc_rate = -expm1f(-1.0f / (0.1 * chan->output.samprate)); // experimental DC removal, 100 ms time constant (~10 Hz)
 
 
   realtime();
@@ -127,14 +123,8 @@ void *demod_fm(void *arg){
       continue;
     }
     float baseband[N];    // Demodulated FM baseband
-    // Actual FM demodulation
-    for(int n=0; n < N; n++){
-      float np = M_1_PIf * cargf(buffer[n]); // Scale to -1 to +1 (half rotations)
-      float x = np - phase_memory;
-      phase_memory = np;
-      x = x > 1 ? x - 2 : x < -1 ? x + 2 : x; // reduce to -1 to +1
-      baseband[n] = x;
-    }
+    // Actual FM demodulation, scaled to -1 to +1 (half rotations)
+    fm_discriminate(baseband,buffer,N,&phase_memory);
     if(chan->sig.snr < 20 && chan->fm.threshold) { // take 13 dB as "full quieting"
       // Experimental threshold reduction (popcorn/click suppression)
 #if 0
@@ -248,11 +238,11 @@ void *demod_fm(void *arg){
     }
     if(chan->fm.rate != 0){
       // Apply de-emphasis if configured
-      for(int n=0; n < N; n++){
-	float s = deemph_state += chan->fm.rate * (chan->fm.gain * baseband[n] - deemph_state);
-	// Experimental DC removal for carrier frequency offsets
-	baseband[n] = s - (dc += dc_rate * (s - dc)); // note assigment to dc
-      }
+      // Rate and gain can be changed by command, so reload them every block
+      iir_lowpass1(&deemph,0,chan->fm.rate,chan->fm.gain);
+      // Experimental DC removal for carrier frequency offsets
+      iir_dcblock(&deemph,1,dc_rate);
+      iir_filter(&deemph,baseband,N,1);
     }
     // Compute audio output level
     // Constant gain used by FM only; automatically adjusted by AGC in linear modes
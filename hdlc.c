@@ -0,0 +1,165 @@
+// Table-driven HDLC deframer for AX.25 packet
+// Flag and abort detection, zero-bit destuffing and frame assembly a byte at a time,
+// using tables generated from the same per-bit rules used for odd leftover bits
+// Copyright 2024, Phil Karn, KA9Q
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "ax25.h"
+#include "hdlc.h"
+
+// Result of one received bit
+enum hdlc_action {
+  HDLC_DATA0,
+  HDLC_DATA1,
+  HDLC_NONE,  // Stuffed zero, or anything while hunting
+  HDLC_FLAG,
+  HDLC_ABORT,
+};
+
+// Result of up to 8 bits, stopping after the first flag or abort
+struct hdlc_step {
+  uint8_t data;     // Data bits to append to the frame, oldest in the LSB
+  uint8_t ndata;    // Number of data bits
+  uint8_t ones;     // New count of consecutive ones
+  uint8_t consumed; // Input bits used
+  uint8_t event;    // HDLC_NONE, HDLC_FLAG or HDLC_ABORT
+};
+
+// Indexed by [flag_seen][ones][next 8 bits, oldest in the LSB]
+static struct hdlc_step Steps[2][8][256];
+static pthread_once_t Steps_once = PTHREAD_ONCE_INIT;
+
+// The per-bit rules, equivalent to the classic shift register tests:
+// 01111110 is a flag, 1111111 is an abort (only inside a frame), and a 0 after 11111 is stuffing
+static enum hdlc_action bit_step(int *ones,int bit,bool in_frame){
+  if(bit){
+    if(*ones < 7)
+      (*ones)++;
+    if(!in_frame)
+      return HDLC_NONE;
+    return *ones == 7 ? HDLC_ABORT : HDLC_DATA1;
+  }
+  int const n = *ones;
+  *ones = 0;
+  if(n == 6)
+    return HDLC_FLAG;
+  if(!in_frame || n == 5)
+    return HDLC_NONE;
+  return HDLC_DATA0;
+}
+
+static void make_steps(void){
+  for(int in_frame=0; in_frame < 2; in_frame++){
+    for(int o=0; o < 8; o++){
+      for(int v=0; v < 256; v++){
+	struct hdlc_step * const s = &Steps[in_frame][o][v];
+	memset(s,0,sizeof(*s));
+	s->event = HDLC_NONE;
+	int ones = o;
+	int i;
+	for(i=0; i < 8; i++){
+	  enum hdlc_action const a = bit_step(&ones,(v >> i) & 1,in_frame);
+	  if(a == HDLC_DATA0 || a == HDLC_DATA1){
+	    s->data |= (a == HDLC_DATA1) << s->ndata;
+	    s->ndata++;
+	  } else if(a == HDLC_FLAG || a == HDLC_ABORT){
+	    s->event = a;
+	    i++;
+	    break;
+	  }
+	}
+	s->consumed = i;
+	s->ones = ones;
+      }
+    }
+  }
+}
+
+void hdlc_init(struct hdlc *hp){
+  assert(hp != NULL);
+  pthread_once(&Steps_once,make_steps);
+  hp->cur = 0;
+  hp->frame = NULL;
+  hp->frame_bits = 0;
+  hp->ones = 0;
+  hp->flag_seen = false;
+}
+
+// Flag: end the current frame (if any) and start a new one
+static int end_frame(struct hdlc *hp){
+  int const bytes = (hp->frame_bits - 7) >> 3; // Don't count the flag's leading 0 and six 1's
+  int result = 0;
+  if(hp->flag_seen && bytes > 2){
+    uint8_t * const f = hp->buffer[hp->cur];
+    if(crc_good(f,bytes)){
+      hp->frame = f;
+      hp->cur ^= 1;
+      result = bytes;
+    } else
+      result = -1;
+  }
+  hp->frame_bits = 0;
+  hp->flag_seen = true;
+  return result;
+}
+
+// Append up to 8 data bits, in little-endian order
+static void append(struct hdlc *hp,unsigned int data,int n){
+  if(hp->frame_bits + n > HDLC_MAX_FRAME * 8){
+    // Too long; abort
+    hp->frame_bits = 0;
+    hp->flag_seen = false;
+    return;
+  }
+  uint8_t * const f = hp->buffer[hp->cur];
+  int const i = hp->frame_bits >> 3;
+  int const shift = hp->frame_bits & 7;
+  if(shift == 0)
+    f[i] = data;
+  else
+    f[i] |= data << shift;
+  if(shift + n > 8)
+    f[i+1] = data >> (8 - shift);
+  hp->frame_bits += n;
+}
+
+// Process nbits (up to 8) NRZI-decoded bits, oldest in the LSB of 'bits'
+// Returns the byte count (including CRC) of a frame that just completed with a good CRC,
+// now in hp->frame; -1 if a frame completed with a bad CRC; 0 otherwise
+// At most one frame can complete per call
+int hdlc_process_bits(struct hdlc *hp,unsigned int bits,int nbits){
+  assert(nbits >= 0 && nbits <= 8);
+  int result = 0;
+  while(nbits > 0){
+    struct hdlc_step s;
+    if(nbits == 8){
+      s = Steps[hp->flag_seen][hp->ones][bits & 0xff];
+    } else {
+      // Leftover bits after a flag or abort, or a short call; one at a time
+      int ones = hp->ones;
+      enum hdlc_action const a = bit_step(&ones,bits & 1,hp->flag_seen);
+      s.ones = ones;
+      s.consumed = 1;
+      s.ndata = (a == HDLC_DATA0 || a == HDLC_DATA1);
+      s.data = (a == HDLC_DATA1);
+      s.event = (a == HDLC_FLAG || a == HDLC_ABORT) ? a : HDLC_NONE;
+    }
+    hp->ones = s.ones;
+    if(s.ndata > 0)
+      append(hp,s.data,s.ndata);
+    if(s.event == HDLC_FLAG){
+      int const r = end_frame(hp);
+      if(r != 0)
+	result = r;
+    } else if(s.event == HDLC_ABORT){
+      hp->frame_bits = 0;
+      hp->flag_seen = false; // Do nothing else until we see a flag again
+    }
+    bits >>= s.consumed;
+    nbits -= s.consumed;
+  }
+  return result;
+}
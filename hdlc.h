@@ -0,0 +1,22 @@
+// Table-driven HDLC deframer for AX.25 packet
+// Copyright 2024, Phil Karn, KA9Q
+#ifndef _HDLC_H
+#define _HDLC_H 1
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HDLC_MAX_FRAME 16384
+
+struct hdlc {
+  uint8_t buffer[2][HDLC_MAX_FRAME]; // Frame being assembled and last good frame, alternately
+  int cur;                 // Index of buffer being assembled
+  uint8_t *frame;          // Last good frame (including CRC); valid until the next good frame
+  int frame_bits;          // Bits in the frame being assembled
+  int ones;                // Consecutive 1 bits just received, 0-7 (7 means 7 or more)
+  bool flag_seen;          // In a frame; false while hunting for a flag after an abort
+};
+
+void hdlc_init(struct hdlc *hp);
+int hdlc_process_bits(struct hdlc *hp,unsigned int bits,int nbits);
+
+#endif
@@ -4,6 +4,7 @@
 #include "iir.h"
 #include <string.h>
 #include <assert.h>
+#include <float.h>
 
 // Experimental IIR complex notch filter
 struct notchfilter *notch_create(double const f,float const bw){
@@ -47,48 +48,238 @@ complex float output_goertzel(struct goertzel *gp){
   return gp->s0 - gp->cf * gp->s1;
 }
 
+// Make section k active, passing through any unused sections below it
+static void add_section(struct iir * const iir,int const k){
+  assert(k >= 0 && k < IIR_MAX_SECTIONS);
+  for(int i=iir->sections; i < k; i++)
+    iir->c[i] = (struct biquad){ .b0 = 1 };
+  if(iir->sections <= k)
+    iir->sections = k+1;
+}
+
 // Simple 2-pole real IIR notch filter, useful for suppressing FM PL tones
+// r sets the positions of the poles; closer to 1 increases sharpness. MUST be < 1 for stability
+// .999 gives 3 dB bandwidth of about 8 Hz (+/-4 Hz) at 100 Hz
+// It blocks tones very well, but it's so narrow that it lets through a
+// short burst at the beginning of a transmission since it doesn't
+// block the sidebands created by the turn-on transient.
+// .997 gives a 3 dB bandwidth of +/-11.5 Hz @ 100 Hz and seems to be
+// a good compromise
+// https://eeweb.engineering.nyu.edu/iselesni/EL6113/matlab_examples/notch_filter_demo/html/notch_filter_demo.html
+void iir_notch(struct iir * const iir,int const section,float const rel_freq,float const r){
+  if(iir == NULL)
+    return;
+  assert(r < 1);
+  add_section(iir,section);
+  struct biquad * const c = &iir->c[section];
+  c->b0 = 1;
+  c->b1 = -2 * cos(2*M_PI*rel_freq); // Complex zeroes on unit circle
+  c->b2 = 1;
+  c->a1 = c->b1 * r; // Complex poles just inside unit circle, same angles as zeroes
+  c->a2 = r*r;
+}
 
-// Set notch frequency
-// Note: does not clear filter state
-void setIIRnotch(struct iir * const iir,float rel_freq){
+// Single pole lowpass, e.g., FM de-emphasis: y += rate * (gain * x - y)
+void iir_lowpass1(struct iir * const iir,int const section,float const rate,float const gain){
   if(iir == NULL)
     return;
+  add_section(iir,section);
+  iir->c[section] = (struct biquad){ .b0 = rate * gain, .a1 = -(1 - rate) };
+}
 
-  // Sets positions of poles; closer to 1 increases sharpness. MUST be < 1 for stability
-  // .999 gives 3 dB bandwidth of about 8 Hz (+/-4 Hz) at 100 Hz
-  // It blocks tones very well, but it's so narrow that it lets through a
-  // short burst at the beginning of a transmission since it doesn't
-  // block the sidebands created by the turn-on transient.
-
-  // .997 gives a 3 dB bandwidth of +/-11.5 Hz @ 100 Hz and seems to be
-  // a good compromise
-  float const r = 0.997;
-	
-  iir->a[0] = 1;
-  iir->a[1] = -2 * cos(2*M_PI*rel_freq); // Complex zeroes on unit circle
-  iir->a[2] = 1;
-  
-  iir->b[0] = 1;
-  iir->b[1] = iir->a[1] * r; // Complex poles just inside unit circle, same angles as zeroes
-  iir->b[2] = r*r;
+// Single pole DC blocker: y = x - (dc += rate * (x - dc))
+// H(z) = (1-rate)(1 - z^-1) / (1 - (1-rate)z^-1)
+void iir_dcblock(struct iir * const iir,int const section,float const rate){
+  if(iir == NULL)
+    return;
+  add_section(iir,section);
+  iir->c[section] = (struct biquad){ .b0 = 1 - rate, .b1 = -(1 - rate), .a1 = -(1 - rate) };
 }
 
-// https://eeweb.engineering.nyu.edu/iselesni/EL6113/matlab_examples/notch_filter_demo/html/notch_filter_demo.html
-float applyIIRnotch(struct iir * const iir,float v){
-  memmove(&iir->w[1],&iir->w[0],FILT_ORDER*sizeof(iir->w[0]));
-  // Update w coefficients
-  // Feedback part (poles)
-  float w0 = v;
-  for(int m=1;m <= FILT_ORDER; m++)
-    w0 -= iir->b[m] * iir->w[m];
-  iir->w[0] = w0;
+// Two-pole lowpass at rel_freq (cycles/sample) with quality factor q
+// Cascade with Butterworth q values for steeper filters
+// https://www.w3.org/TR/audio-eq-cookbook/
+void iir_lowpass2(struct iir * const iir,int const section,float const rel_freq,float const q){
+  if(iir == NULL)
+    return;
+  assert(q > 0 && rel_freq > 0 && rel_freq < 0.5);
+  add_section(iir,section);
+  double s,c;
+  sincos(2*M_PI*rel_freq,&s,&c);
+  double const alpha = s / (2 * q);
+  double const a0 = 1 + alpha;
+  iir->c[section] = (struct biquad){
+    .b0 = 0.5 * (1 - c) / a0,
+    .b1 = (1 - c) / a0,
+    .b2 = 0.5 * (1 - c) / a0,
+    .a1 = -2 * c / a0,
+    .a2 = (1 - alpha) / a0,
+  };
+}
 
-  // Feedforward part (zeroes)
-  float y = 0;
-  for(int m = 0; m <= FILT_ORDER; m++)
-    y += iir->a[m] * iir->w[m];
+// Flush state that has decayed into the denormals, which are very slow on many CPUs
+static inline float flush(float const x){
+  return fabsf(x) < FLT_MIN ? 0 : x;
+}
+
+void iir_filter(struct iir * const iir,float * const buf,int const frames,int const channels){
+  if(iir == NULL || buf == NULL)
+    return;
+  assert(channels == 1 || channels == 2);
+  int const nsec = iir->sections;
+  if(nsec == 0)
+    return;
 
-  return y;
+  // Run every section on each sample before going on to the next. Each section's recurrence
+  // is a serial chain, but the chains of different sections (and channels) are independent
+  // so the CPU can overlap them
+  struct biquad c[IIR_MAX_SECTIONS];
+  float s1[IIR_MAX_SECTIONS][IIR_MAX_CHANNELS];
+  float s2[IIR_MAX_SECTIONS][IIR_MAX_CHANNELS];
+  memcpy(c,iir->c,sizeof(c));
+  memcpy(s1,iir->s1,sizeof(s1));
+  memcpy(s2,iir->s2,sizeof(s2));
+  if(channels == 1){
+    for(int n=0; n < frames; n++){
+      float x = buf[n];
+      for(int k=0; k < nsec; k++){
+	float const y = c[k].b0 * x + s1[k][0];
+	s1[k][0] = c[k].b1 * x - c[k].a1 * y + s2[k][0];
+	s2[k][0] = c[k].b2 * x - c[k].a2 * y;
+	x = y;
+      }
+      buf[n] = x;
+    }
+  } else {
+    // Left and right side by side, so gcc can put them in one vector
+    for(int n=0; n < 2*frames; n += 2){
+      float x[2] = { buf[n], buf[n+1] };
+      for(int k=0; k < nsec; k++){
+	for(int ch=0; ch < 2; ch++){
+	  float const y = c[k].b0 * x[ch] + s1[k][ch];
+	  s1[k][ch] = c[k].b1 * x[ch] - c[k].a1 * y + s2[k][ch];
+	  s2[k][ch] = c[k].b2 * x[ch] - c[k].a2 * y;
+	  x[ch] = y;
+	}
+      }
+      buf[n] = x[0];
+      buf[n+1] = x[1];
+    }
+  }
+  for(int k=0; k < nsec; k++){
+    for(int ch=0; ch < channels; ch++){
+      iir->s1[k][ch] = flush(s1[k][ch]);
+      iir->s2[k][ch] = flush(s2[k][ch]);
+    }
+  }
 }
 
+// Goertzel bank
+// Initialize for ntones frequencies in Hz at sample rate samprate
+// If decimate is set, real input is lowpassed to 1.4x the highest tone and decimated to
+// at least 4x that cutoff; 8-pole Butterworth, so products that alias onto the tones are down 80 dB or more
+int init_goertzel_bank(struct goertzel_bank * const gb,float const *freqs,int const ntones,float const samprate,bool const decimate){
+  if(gb == NULL || freqs == NULL || ntones <= 0 || ntones > GOERTZEL_BANK_MAX || samprate <= 0)
+    return -1;
+
+  memset(gb,0,sizeof(*gb));
+  gb->ntones = ntones;
+  gb->decimate = 1;
+  float fmax = 0;
+  for(int k=0; k < ntones; k++)
+    fmax = max(fmax,fabsf(freqs[k]));
+
+  if(decimate){
+    float const cutoff = 1.4f * fmax;
+    gb->decimate = max(1,(int)(samprate / (4 * cutoff)));
+    if(gb->decimate > 1){
+      static float const Butterworth_q[] = { 0.50980, 0.60134, 0.89998, 2.56292 }; // 8th order
+      for(int i=0; i < 4; i++)
+	iir_lowpass2(&gb->lowpass,i,cutoff / samprate,Butterworth_q[i]);
+    }
+  }
+  float const rate = samprate / gb->decimate;
+  for(int k=0; k < ntones; k++){
+    float s,c;
+    sincospif(2*freqs[k]/rate,&s,&c);
+    gb->coeff[k] = 2 * c;
+    gb->cf[k] = CMPLXF(c,-s);
+  }
+  return 0;
+}
+
+void reset_goertzel_bank(struct goertzel_bank * const gb){
+  memset(gb->s0,0,sizeof(gb->s0));
+  memset(gb->s1,0,sizeof(gb->s1));
+  memset(gb->s0i,0,sizeof(gb->s0i));
+  memset(gb->s1i,0,sizeof(gb->s1i));
+  gb->samples = 0;
+}
+
+// One sample into every tone
+static inline void step_goertzel_bank(struct goertzel_bank * const gb,float const x){
+  for(int k=0; k < gb->ntones; k++){
+    float const s0 = x + gb->coeff[k] * gb->s0[k] - gb->s1[k];
+    gb->s1[k] = gb->s0[k];
+    gb->s0[k] = s0;
+  }
+}
+
+void update_goertzel_bank(struct goertzel_bank * const gb,float const *x,int frames,int const channels){
+  if(gb == NULL || x == NULL)
+    return;
+  assert(channels == 1 || channels == 2);
+  while(frames > 0){
+    float buf[256];
+    int const chunk = min(frames,(int)(sizeof(buf)/sizeof(buf[0])));
+    if(channels == 2){
+      for(int i=0; i < chunk; i++)
+	buf[i] = 0.5f * (x[2*i] + x[2*i+1]); // Mono sum
+    } else
+      memcpy(buf,x,chunk * sizeof(buf[0]));
+
+    if(gb->decimate > 1)
+      iir_filter(&gb->lowpass,buf,chunk,1);
+    // First sample due into the bank in this chunk
+    int i = (gb->decimate - gb->phase) % gb->decimate;
+    for(; i < chunk; i += gb->decimate){
+      step_goertzel_bank(gb,buf[i]);
+      gb->samples++;
+    }
+    gb->phase = (gb->phase + chunk) % gb->decimate;
+    x += chunk * channels;
+    frames -= chunk;
+  }
+}
+
+void update_goertzel_bank_complex(struct goertzel_bank * const gb,complex float const *x,int const n){
+  if(gb == NULL || x == NULL)
+    return;
+  for(int i=0; i < n; i++){
+    float const re = crealf(x[i]);
+    float const im = cimagf(x[i]);
+    for(int k=0; k < gb->ntones; k++){
+      float const s0 = re + gb->coeff[k] * gb->s0[k] - gb->s1[k];
+      float const s0i = im + gb->coeff[k] * gb->s0i[k] - gb->s1i[k];
+      gb->s1[k] = gb->s0[k];
+      gb->s0[k] = s0;
+      gb->s1i[k] = gb->s0i[k];
+      gb->s0i[k] = s0i;
+    }
+  }
+  gb->samples += n;
+}
+
+int output_goertzel_bank(struct goertzel_bank * const gb,float * const energies){
+  if(gb == NULL || energies == NULL)
+    return -1;
+  for(int k=0; k < gb->ntones; k++){
+    // As in output_goertzel(), with a final zero sample
+    complex float const s0 = CMPLXF(gb->coeff[k] * gb->s0[k] - gb->s1[k],gb->coeff[k] * gb->s0i[k] - gb->s1i[k]);
+    complex float const s1 = CMPLXF(gb->s0[k],gb->s0i[k]);
+    energies[k] = cnrmf(s0 - gb->cf[k] * s1);
+  }
+  int const samples = gb->samples;
+  reset_goertzel_bank(gb);
+  return samples;
+}
@@ -6,8 +6,9 @@
 #include <complex.h>
 #include <math.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include "misc.h"
-#include "iir.h"
 
 // Experimental complex notch filter
 struct notchfilter {
@@ -43,14 +44,62 @@ static void inline update_goertzel(struct goertzel *gp,float x){
 }
 complex float output_goertzel(struct goertzel *gp);
 
-// 2-pole IIR notch filter operating on real data
-#define FILT_ORDER 2
+// Cascaded biquad (2-pole, 2-zero) IIR sections in transposed direct form II
+// A whole block of 1 or 2 interleaved channels is filtered at once, one section at a time,
+// with the state in locals so the recurrence runs from registers
+#define IIR_MAX_SECTIONS 4
+#define IIR_MAX_CHANNELS 2
+
+struct biquad {
+  float b0,b1,b2; // Feedforward (zeroes)
+  float a1,a2;    // Feedback (poles); a0 is normalized to 1
+};
 
 struct iir {
-  float a[FILT_ORDER+1]; // test
-  float b[FILT_ORDER+1];
-  float w[FILT_ORDER+1];
+  int sections;   // Sections in use; 0 passes the signal through. A zeroed struct is ready to use
+  struct biquad c[IIR_MAX_SECTIONS];
+  float s1[IIR_MAX_SECTIONS][IIR_MAX_CHANNELS]; // Filter state for each section and channel
+  float s2[IIR_MAX_SECTIONS][IIR_MAX_CHANNELS];
+};
+
+static inline void iir_reset(struct iir *iir){
+  memset(iir->s1,0,sizeof(iir->s1));
+  memset(iir->s2,0,sizeof(iir->s2));
+}
+// Coefficient setters; they don't clear the state so they can be called on every block
+void iir_notch(struct iir *,int section,float rel_freq,float r);
+void iir_lowpass1(struct iir *,int section,float rate,float gain);
+void iir_lowpass2(struct iir *,int section,float rel_freq,float q);
+void iir_dcblock(struct iir *,int section,float rate);
+// Filter in place; with 2 channels the samples are interleaved (or complex, real = left)
+void iir_filter(struct iir *,float *buf,int frames,int channels);
+
+// Bank of Goertzel detectors sharing one input, e.g., all the PL (CTCSS) or DTMF tones
+// Kept as arrays rather than an array of struct goertzel so each input sample
+// updates every tone in one vectorizable loop
+// Real input can first be lowpassed and decimated to just above the highest tone,
+// which for PL tones cuts the work by 20-40x at typical audio rates
+#define GOERTZEL_BANK_MAX 64
+
+struct goertzel_bank {
+  int ntones;
+  int decimate;       // Feed every decimate'th sample of the lowpassed input; 1 = no decimation
+  int phase;          // Position of the next input sample in the decimation cycle; 0 is fed to the bank
+  int samples;        // Samples (after decimation) integrated since the last output
+  struct iir lowpass; // Anti-alias filter ahead of the decimator
+  float coeff[GOERTZEL_BANK_MAX];  // 2 * cos(2*pi*f/fs)
+  complex float cf[GOERTZEL_BANK_MAX]; // exp(-j*2*pi*f/fs)
+  float s0[GOERTZEL_BANK_MAX],s1[GOERTZEL_BANK_MAX];   // State, real part (or real input)
+  float s0i[GOERTZEL_BANK_MAX],s1i[GOERTZEL_BANK_MAX]; // State, imaginary part (complex input only)
 };
-float applyIIRnotch(struct iir *,float);
-void setIIRnotch(struct iir *,float);
+
+int init_goertzel_bank(struct goertzel_bank *,float const *freqs,int ntones,float samprate,bool decimate);
+void reset_goertzel_bank(struct goertzel_bank *);
+// Real input, 1 or 2 interleaved channels (summed to mono)
+void update_goertzel_bank(struct goertzel_bank *,float const *x,int frames,int channels);
+// Complex input, never decimated
+void update_goertzel_bank_complex(struct goertzel_bank *,complex float const *x,int n);
+// Energy in each tone, on the same scale as cnrmf(output_goertzel()) for the samples
+// actually integrated; returns that count and resets the bank
+int output_goertzel_bank(struct goertzel_bank *,float *energies);
 #endif
@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <locale.h>
 #include <signal.h>
+#include <spawn.h>
 #include <netdb.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -31,32 +32,9 @@
 #include "misc.h"
 #include "attr.h"
 #include "multicast.h"
+#include "wav.h"
 
 
-// size of stdio buffer for disk I/O
-// This should be large to minimize write calls, but how big?
-#define BUFFERSIZE (1<<16)
-
-// Simplified .wav file header
-// http://soundfile.sapp.org/doc/WaveFormat/
-struct wav {
-  char ChunkID[4];
-  int32_t ChunkSize;
-  char Format[4];
-
-  char Subchunk1ID[4];
-  int32_t Subchunk1Size;
-  int16_t AudioFormat;
-  int16_t NumChannels;
-  int32_t SampleRate;
-  int32_t ByteRate;
-  int16_t BlockAlign;
-  int16_t BitsPerSample;
-
-  char SubChunk2ID[4];
-  int32_t Subchunk2Size;
-};
-
 // One for each session being recorded
 struct session {
   struct session *prev;
@@ -64,7 +42,9 @@ struct session {
   struct sockaddr sender;   // Sender's IP address and source port
 
   char filename[PATH_MAX];
-  struct wav header;
+  int64_t start_time;          // UTC of the start of the cycle being recorded, ns
+  char dir[PATH_MAX];          // Where the decoder runs and leaves its own files
+  int64_t staged;              // Staging budget held by the file, 0 if it's on disk
 
   uint32_t ssrc;               // RTP stream source ID
   uint32_t next_timestamp;     // Next expected RTP timestamp
@@ -73,8 +53,7 @@ struct session {
   int channels;                // 1 (PCM_MONO) or 2 (PCM_STEREO)
   unsigned int samprate;
 
-  FILE *fp;                    // File being recorded
-  void *iobuffer;              // Big buffer to reduce write rate
+  struct wav_file wav;         // File being recorded
 
   int64_t SamplesWritten;
   int64_t TotalFileSamples;
@@ -85,6 +64,10 @@ int Verbose;
 bool Keep_wav;
 char PCM_mcast_address_text[256];
 char const *Recordings = ".";
+char const *Staging;           // Directory on a tmpfs to hold recordings until they're decoded
+int64_t Staging_budget = 100 * 1000000LL; // bytes
+int64_t Staged_bytes;
+long Staging_fallbacks;        // Files written to disk because the budget was used up
 
 struct {
   double cycle_time;
@@ -102,6 +85,39 @@ enum {
   FT4,
 } Mode;
 
+// A decode waiting for a free slot, or running
+// Decoders for every band would otherwise all start at the same instant at the end of each cycle
+struct job {
+  struct job *next;
+  char filename[PATH_MAX];
+  char dir[PATH_MAX];
+  int64_t staged;
+  uint32_t ssrc;
+  int priority;                // Lower starts first
+  int64_t queued;              // UTC ns
+  int64_t started;
+  int64_t deadline;            // When the next cycle's files are handed over
+  pid_t pid;
+};
+
+#define MAX_PRIORITY 100
+#define SETTLE_TIME (BILLION/10) // Files for every band close within a packet time; collect them all before choosing
+uint32_t Priority[MAX_PRIORITY]; // SSRCs (frequencies) decoded first, most important first
+int Npriority;
+int Max_decoders;              // Default: one per core
+struct job *Pending;           // Sorted by priority, then deadline
+int64_t Last_queued;
+struct job *Running;
+int Nrunning;
+volatile sig_atomic_t Child_exited;
+volatile sig_atomic_t Terminate;
+// Statistics
+long Decodes;
+long Late;                     // Finished after their deadlines
+long Failed;                   // Couldn't spawn, or exited abnormally
+
+extern char **environ;
+
 struct sockaddr Sender;
 struct sockaddr Input_mcast_sockaddr;
 int Input_fd;
@@ -112,9 +128,20 @@ void cleanup(void);
 struct session *init_session(struct session *sp,struct rtp_header *rtp,int size);
 void process_file(struct session *sp);
 void create_new_file(struct session *sp,time_t);
+void queue_decode(struct session *sp);
+void run_decoders(int64_t now);
+
+static void sigchld(int sig){
+  (void)sig;
+  Child_exited = 1;
+}
+static void closedown(int sig){
+  (void)sig;
+  Terminate = 1;
+}
 
 void usage(){
-  fprintf(stdout,"Usage: %s [-L locale] [-v] [-k] [-d recording_dir] [-x <PATH_TO_JT9>] [-4|-8|-w] PCM_multicast_address\n",App_path);
+  fprintf(stdout,"Usage: %s [-L locale] [-v] [-k] [-d recording_dir] [-x <PATH_TO_JT9>] [-j max_decoders] [-p ssrc[,ssrc...]] [-m staging_dir [-M staging_MB]] [-4|-8|-w] PCM_multicast_address\n",App_path);
   exit(EX_USAGE);
 }
 
@@ -126,8 +153,26 @@ int main(int argc,char *argv[]){
 
   // Defaults
   int c;
-  while((c = getopt(argc,argv,"w84d:L:vkVx:")) != EOF){
+  Max_decoders = sysconf(_SC_NPROCESSORS_ONLN);
+  while((c = getopt(argc,argv,"w84d:L:vkVx:j:p:m:M:")) != EOF){
     switch(c){
+    case 'j':
+      Max_decoders = strtol(optarg,NULL,0);
+      break;
+    case 'p':
+      {
+	// Bands to decode first, in order
+	char *saveptr = NULL;
+	for(char *tok = strtok_r(optarg,",",&saveptr); tok != NULL && Npriority < MAX_PRIORITY; tok = strtok_r(NULL,",",&saveptr))
+	  Priority[Npriority++] = strtoul(tok,NULL,0);
+      }
+      break;
+    case 'm':
+      Staging = optarg;
+      break;
+    case 'M':
+      Staging_budget = strtod(optarg,NULL) * 1000000;
+      break;
     case 'x':
       Modetab[FT4].decode  = optarg;
       Modetab[FT8].decode  = optarg;
@@ -161,6 +206,21 @@ int main(int argc,char *argv[]){
     }
   }
   setlocale(LC_ALL,locale);
+  if(Max_decoders < 1)
+    Max_decoders = 1;
+  if(Staging != NULL && Keep_wav){
+    fprintf(stdout,"-k keeps recordings, so they're written to disk, not staged in %s\n",Staging);
+    Staging = NULL;
+  }
+  if(Staging != NULL){
+    // Decoders run in Recordings/<ssrc>, so they need an absolute path to a staged file
+    char const *abs = realpath(Staging,NULL);
+    if(abs == NULL){
+      fprintf(stdout,"staging directory %s: %s, writing recordings to disk\n",Staging,strerror(errno));
+      Staging = NULL;
+    } else
+      Staging = abs;
+  }
   // Stdout should already be in append mode, just make sure
   if(fcntl(1,F_SETFL,O_APPEND) == -1)
     fprintf(stdout,"fcntl of stdout to set O_APPEND failed: %s\n",strerror(errno));
@@ -201,6 +261,21 @@ int main(int argc,char *argv[]){
 
   atexit(cleanup);
 
+  {
+    // Interrupt recvfrom() when a decoder finishes so the next one starts promptly
+    struct sigaction act;
+    memset(&act,0,sizeof(act));
+    act.sa_handler = sigchld;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_NOCLDSTOP; // No SA_RESTART
+    sigaction(SIGCHLD,&act,NULL);
+    // Leave input_loop() on a termination signal so cleanup() can deal with the decode queue
+    act.sa_handler = closedown;
+    act.sa_flags = 0;
+    sigaction(SIGINT,&act,NULL);
+    sigaction(SIGQUIT,&act,NULL);
+    sigaction(SIGTERM,&act,NULL);
+  }
   input_loop();
 
   exit(EX_OK);
@@ -210,13 +285,21 @@ int main(int argc,char *argv[]){
 // As currently written, requires data from a new frame to flush out and execute finished ones
 // This doesn't seem like a big problem
 void input_loop(){
-  while(true){
+  while(!Terminate){
     uint8_t buffer[PKTSIZE];
     socklen_t socksize = sizeof(Sender);
     int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&Sender,&socksize);
     // stash time now in case we are slowed by the code below
     int64_t const now = utc_time_ns();
 
+    if(size == -1 && errno == EINTR){
+      if(Terminate)
+	break;
+      run_decoders(now);
+      continue;
+    }
+    if(Child_exited || Pending != NULL)
+      run_decoders(now);
     if(size <= 0){    // ??
       perror("recvfrom");
       usleep(50000);
@@ -266,7 +349,7 @@ void input_loop(){
     sp->samprate = samprate_from_pt(sp->type);
     int64_t const modtime = now % (int64_t)(Modetab[Mode].cycle_time * BILLION); // where we are in the cycle
 
-    if(sp->fp == NULL){
+    if(sp->wav.fp == NULL){
       if(modtime >= Modetab[Mode].transmission_time * BILLION){
 	// In dead time and file already processed, drop data and wait for new data frame
 	continue;
@@ -276,7 +359,8 @@ void input_loop(){
       int64_t const start_time = now - modtime;
       time_t const start_time_sec = start_time / BILLION;
       create_new_file(sp,start_time_sec);
-      assert(sp->fp != NULL);
+      sp->start_time = start_time;
+      assert(sp->wav.fp != NULL);
 
       if(Verbose > 1)
 	fprintf(stdout,"creating %s, cycle start offset %'.3f sec\n",
@@ -284,58 +368,26 @@ void input_loop(){
       
       // Remember the starting RTP timestamp
       sp->next_timestamp = rtp.timestamp;
-      
-      // Write .wav header, skipping size fields
-      memcpy(sp->header.ChunkID,"RIFF", 4);
-      sp->header.ChunkSize = 0xffffffff; // Temporary
-      memcpy(sp->header.Format,"WAVE",4);
-      memcpy(sp->header.Subchunk1ID,"fmt ",4);
-      sp->header.Subchunk1Size = 16;
-      sp->header.AudioFormat = 1;
-      sp->header.NumChannels = sp->channels;
-      sp->header.SampleRate = sp->samprate;
-      
-      sp->header.ByteRate = sp->samprate * sp->channels * 16/8;
-      sp->header.BlockAlign = sp->channels * 16/8;
-      sp->header.BitsPerSample = 16;
-      memcpy(sp->header.SubChunk2ID,"data",4);
-      sp->header.Subchunk2Size = 0xffffffff; // Temporary
-      fwrite(&sp->header,sizeof(sp->header),1,sp->fp);
-      fflush(sp->fp); // get at least the header out there
     }
-    assert(sp->fp != NULL);
+    assert(sp->wav.fp != NULL);
     // File is open and ready for writing
     // Write data into current file
     // A "sample" is a single audio sample, usually 16 bits.
     // A "frame" is the same as a sample for mono. It's two audio samples for stereo
     int const samp_count = size / sizeof(*samples); // number of individual audio samples (not frames)
 
-    // Seek to the proper place based on RTP timestamp. Normally offset = 0 when packets are in order
-    off_t const offset = (int32_t)(rtp.timestamp - sp->next_timestamp) * sizeof(uint16_t) * sp->channels;
-    fseeko(sp->fp,offset,SEEK_CUR);
-
     sp->TotalFileSamples += samp_count;
     sp->SamplesWritten += samp_count;
 
-    // Packet samples are in big-endian order; write to .wav file in little-endian order
-    for(int n = 0; n < samp_count; n++){
-      fputc(samples[n] >> 8,sp->fp);
-      fputc(samples[n],sp->fp);
-    }
+    // Write at the proper place based on RTP timestamp. Normally offset = 0 when packets are in order
+    // Packet samples are in big-endian order; wav_write() puts them in little-endian order
+    wav_write(&sp->wav,(int32_t)(rtp.timestamp - sp->next_timestamp),samples,samp_count);
     sp->next_timestamp = rtp.timestamp + samp_count / sp->channels;
     if(modtime >= Modetab[Mode].transmission_time * BILLION){
       // We've reached the end of the current transmission.
       // Close current file, hand it to the decoder
       process_file(sp);
     }
-    // Continuously reap children (decoders) at any time so they won't become zombies
-    // They can take tens of seconds and finish in any order
-    int status = 0;
-    int pid;
-    while((pid = waitpid(-1,&status,WNOHANG)) > 0)
-      ;
-    if(Verbose > 1 && pid > 0)
-      fprintf(stdout,"child %d wait status %d\n",pid,status);
   }
 }
 // Set up new file on session with name derived from start_time_sec
@@ -348,13 +400,12 @@ void create_new_file(struct session *sp,time_t start_time_sec){
     fprintf(stdout,"can't create directory %s: %s\n",dir,strerror(errno));
 
   // Try to create file in directory whether or not the mkdir succeeded
-  char filename[PATH_MAX];
+  // The decoders take the date and time from the file name
+  char name[100];
   switch(Mode){
   case FT4:
   case FT8:
-    snprintf(filename,sizeof(filename),"%s/%u/%02d%02d%02d_%02d%02d%02d.wav",
-	     Recordings,
-	     sp->ssrc,
+    snprintf(name,sizeof(name),"%02d%02d%02d_%02d%02d%02d.wav",
 	     (tm->tm_year+1900) % 100,
 	     tm->tm_mon+1,
 	     tm->tm_mday,
@@ -363,9 +414,7 @@ void create_new_file(struct session *sp,time_t start_time_sec){
 	     tm->tm_sec);
     break;
   case WSPR:
-    snprintf(filename,sizeof(filename),"%s/%u/%02d%02d%02d_%02d%02d.wav",
-	     Recordings,
-	     sp->ssrc,
+    snprintf(name,sizeof(name),"%02d%02d%02d_%02d%02d.wav",
 	     (tm->tm_year+1900) % 100,
 	     tm->tm_mon+1,
 	     tm->tm_mday,
@@ -373,10 +422,38 @@ void create_new_file(struct session *sp,time_t start_time_sec){
 	     tm->tm_min);
     break;
   }    
+  char filename[PATH_MAX];
+  snprintf(filename,sizeof(filename),"%s/%u/%s",Recordings,sp->ssrc,name);
+  snprintf(sp->dir,sizeof(sp->dir),"%s/%u",Recordings,sp->ssrc);
+  sp->staged = 0;
   int fd = -1;
-  if((fd = open(filename,O_RDWR|O_CREAT,0777)) != -1){
+  if(Staging != NULL){
+    // Keep the recording in memory until it's decoded, if it fits in the budget
+    int64_t const size = sizeof(struct wav) + (int64_t)ceil(Modetab[Mode].transmission_time * sp->samprate) * sp->channels * sizeof(int16_t);
+    if(Staged_bytes + size > Staging_budget){
+      Staging_fallbacks++;
+      if(Verbose)
+	fprintf(stdout,"staging budget %'lld bytes used up, writing %s to disk; %ld times\n",
+		(long long)Staging_budget,filename,Staging_fallbacks);
+    } else {
+      char staged[PATH_MAX];
+      snprintf(staged,sizeof(staged),"%s/%u",Staging,sp->ssrc);
+      if(mkdir(staged,0777) == -1 && errno != EEXIST)
+	fprintf(stdout,"can't create directory %s: %s\n",staged,strerror(errno));
+      snprintf(staged,sizeof(staged),"%s/%u/%s",Staging,sp->ssrc,name);
+      if((fd = open(staged,O_RDWR|O_CREAT,0777)) != -1){
+	strlcpy(sp->filename,staged,sizeof(sp->filename));
+	sp->staged = size;
+	Staged_bytes += size;
+      } else
+	fprintf(stdout,"can't create/write file %s: %s, writing to disk\n",staged,strerror(errno));
+    }
+  }
+  if(fd != -1)
+    ; // Staged
+  else if((fd = open(filename,O_RDWR|O_CREAT,0777)) != -1)
     strlcpy(sp->filename,filename,sizeof(sp->filename));
-  } else {
+  else {
     // couldn't create directory or create file in directory; create in current dir
     fprintf(stdout,"can't create/write file %s: %s\n",filename,strerror(errno));
     char const *bn = basename(filename);
@@ -386,27 +463,48 @@ void create_new_file(struct session *sp,time_t start_time_sec){
       exit(EX_CANTCREAT);
     }
     strlcpy(sp->filename,bn,sizeof(sp->filename));
+    strlcpy(sp->dir,".",sizeof(sp->dir));
   }
   // Use fdopen on a file descriptor instead of fopen(,"w+") to avoid the implicit truncation
   // This allows testing where we're killed and rapidly restarted in the same cycle
   assert(fd != -1);
-  sp->fp = fdopen(fd,"w+");
-  assert(sp->fp != NULL);
-  sp->iobuffer = malloc(BUFFERSIZE);
-  setbuffer(sp->fp,sp->iobuffer,BUFFERSIZE);
+  int const r = wav_open(&sp->wav,fd,sp->samprate,sp->channels);
+  assert(r == 0);
+  (void)r;
   fcntl(fd,F_SETFL,O_NONBLOCK); // Let's see if this keeps us from losing data
 }
+static void finish_job(struct job *jp);
+
 void cleanup(void){
+  // Recordings still waiting for a decoder would otherwise be left behind, undecoded, possibly on a tmpfs
+  while(Pending != NULL){
+    struct job * const jp = Pending;
+    Pending = jp->next;
+    if(Verbose)
+      fprintf(stdout,"%s: not decoded, exiting\n",jp->filename);
+    finish_job(jp);
+  }
+  // Let running decoders finish, then remove their files as usual
+  while(Running != NULL){
+    struct job * const jp = Running;
+    Running = jp->next;
+    while(waitpid(jp->pid,NULL,0) == -1 && errno == EINTR)
+      ;
+    Nrunning--;
+    finish_job(jp);
+  }
   while(Sessions){
     // Flush and close each write stream
     // Be anal-retentive about freeing and clearing stuff even though we're about to exit
     struct session * const next_s = Sessions->next;
-    if(Sessions->fp){
-      fflush(Sessions->fp);
-      fclose(Sessions->fp);
-      Sessions->fp = NULL;
+    if(Sessions->wav.fp)
+      wav_close(&Sessions->wav);
+    if(Sessions->staged != 0){
+      // A partial recording that will never be decoded; give its share of the tmpfs back
+      unlink(Sessions->filename);
+      Staged_bytes -= Sessions->staged;
+      Sessions->staged = 0;
     }
-    FREE(Sessions->iobuffer);
     FREE(Sessions);
     Sessions = next_s;
   }
@@ -414,8 +512,8 @@ void cleanup(void){
 
 // Close and process file
 void process_file(struct session *sp){
-  assert(sp != NULL && sp->fp != NULL);
-  if(sp == NULL || sp->fp == NULL)
+  assert(sp != NULL && sp->wav.fp != NULL);
+  if(sp == NULL || sp->wav.fp == NULL)
     return;
 
   if(Verbose)
@@ -423,93 +521,161 @@ void process_file(struct session *sp){
 	    (float)sp->SamplesWritten / sp->samprate,
 	    (float)sp->TotalFileSamples / sp->samprate);
   
-  // Get final file size, write .wav header with sizes
-  fflush(sp->fp);
-  struct stat statbuf;
-  fstat(fileno(sp->fp),&statbuf);
-  sp->header.ChunkSize = statbuf.st_size - 8;
-  sp->header.Subchunk2Size = statbuf.st_size - sizeof(sp->header);
-  rewind(sp->fp);
-  fwrite(&sp->header,sizeof(sp->header),1,sp->fp);
-  fflush(sp->fp);
-  fclose(sp->fp);
-  sp->fp = NULL;
-
-  FREE(sp->iobuffer);
+  // Write final sizes into the .wav header
+  wav_close(&sp->wav);
+
   sp->TotalFileSamples = 0;
   sp->SamplesWritten = 0;
 
-  int child = fork();
-  if(child == 0){
-    // Double fork so we don't have to wait. Seems ugly, is there a better way??
-    int grandchild = fork();
-    if(grandchild == 0){
-      {
-	// set working directory to the one containing the file
-	// dirname_r() is only available on MacOS, so we can't use it here
-	char *fname_dup = strdup(sp->filename); // in case dirname modifies its arg
-	int r = chdir(dirname(fname_dup));
-	FREE(fname_dup);
-	
-	if(r != 0)
-	  perror("chdir");
-      }
-      char freq[100];
-      snprintf(freq,sizeof(freq),"%lf",(double)sp->ssrc * 1e-6);
-      
-      switch(Mode){
-      case WSPR:
-	if(Verbose)
-	  fprintf(stdout,"%s %s %s %s %s\n",Modetab[Mode].decode,"-f",freq,"-w",sp->filename);
-	
-	execlp(Modetab[Mode].decode,Modetab[Mode].decode,"-f",freq,"-w",sp->filename,(char *)NULL);
-	break;
-      case FT8:
-	// Note: requires my version of decode_ft8 that accepts -f basefreq
-	if(Verbose)
-	  fprintf(stdout,"%s -f %s %s\n",Modetab[Mode].decode,freq,sp->filename);
-	
-	execlp(Modetab[Mode].decode,Modetab[Mode].decode,"-f",freq,sp->filename,(char *)NULL);
-	break;
-      case FT4:
-	// Note: requires my version of decode_ft8 that accepts -f basefreq
-	if(Verbose)
-	  fprintf(stdout,"%s -f %s -4 %s\n",Modetab[Mode].decode,freq,sp->filename);
-	
-	execlp(Modetab[Mode].decode,Modetab[Mode].decode,"-f",freq,"-4",sp->filename,(char *)NULL);
-	break;
-      }
-      // Gets here only if exec fails
-      fprintf(stdout,"execlp(%s) returned errno %d (%s)\n",Modetab[Mode].decode,errno,strerror(errno));
-      exit(EX_SOFTWARE); // Exit from grandchild context
-    }
-    // In child context
-    if(Verbose > 1)
-      fprintf(stdout,"forked grandchild %d\n",grandchild);
-    // Wait for decoder to finish, then remove its input file
-    int status = 0;
-    if(waitpid(-1,&status,0) == -1){
-      fprintf(stdout,"error waiting for grandchild: errno %d (%s)\n",
-	      errno,strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-    if(Verbose > 1)
-      fprintf(stdout,"grandchild %d waitpid status %d\n",grandchild,status);
-    
-    if(!WIFEXITED(status)){
-      if(Verbose > 1){
-	if(WIFSIGNALED(status))
-	  fprintf(stdout,"grandchild %d terminated by signal %d\n",grandchild,WTERMSIG(status));
-      }
+  queue_decode(sp);
+}
+
+// Scheduling priority of a band: its position in the -p list, with unlisted bands after all listed ones
+static int band_priority(uint32_t ssrc){
+  for(int i=0; i < Npriority; i++)
+    if(Priority[i] == ssrc)
+      return i;
+  return Npriority;
+}
+
+// Hand a closed file to the decode scheduler
+void queue_decode(struct session *sp){
+  struct job * const jp = calloc(1,sizeof(*jp));
+  if(jp == NULL)
+    exit(EX_TEMPFAIL);
+  strlcpy(jp->filename,sp->filename,sizeof(jp->filename));
+  strlcpy(jp->dir,sp->dir,sizeof(jp->dir));
+  jp->staged = sp->staged;
+  sp->staged = 0;
+  jp->ssrc = sp->ssrc;
+  jp->priority = band_priority(sp->ssrc);
+  jp->queued = Last_queued = utc_time_ns();
+  jp->deadline = sp->start_time + (int64_t)((Modetab[Mode].cycle_time + Modetab[Mode].transmission_time) * BILLION);
+
+  // Behind everything of the same or higher priority and the same or an earlier deadline
+  struct job **pp;
+  for(pp = &Pending; *pp != NULL; pp = &(*pp)->next){
+    struct job const * const p = *pp;
+    if(p->priority > jp->priority || (p->priority == jp->priority && p->deadline > jp->deadline))
+      break;
+  }
+  jp->next = *pp;
+  *pp = jp;
+}
+
+// Start a decoder on a job, in the directory holding its file
+static int spawn_decoder(struct job *jp){
+  char freq[100];
+  snprintf(freq,sizeof(freq),"%lf",(double)jp->ssrc * 1e-6);
+  char const *argv[8];
+  int argc = 0;
+  argv[argc++] = Modetab[Mode].decode;
+  argv[argc++] = "-f";
+  argv[argc++] = freq;
+  switch(Mode){
+  case WSPR:
+    argv[argc++] = "-w";
+    break;
+  case FT8:
+    // Note: requires my version of decode_ft8 that accepts -f basefreq
+    break;
+  case FT4:
+    argv[argc++] = "-4";
+    break;
+  }
+  argv[argc++] = jp->filename;
+  argv[argc] = NULL;
+  if(Verbose){
+    for(int i=0; i < argc; i++)
+      fprintf(stdout,"%s%s",i > 0 ? " " : "",argv[i]);
+    fprintf(stdout,"\n");
+  }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addchdir_np(&actions,jp->dir);
+  int const r = posix_spawnp(&jp->pid,Modetab[Mode].decode,&actions,NULL,(char * const *)argv,environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if(r != 0){
+    fprintf(stdout,"posix_spawnp(%s) returned errno %d (%s)\n",Modetab[Mode].decode,r,strerror(r));
+    return -1;
+  }
+#else
+  // posix_spawn_file_actions_addchdir_np() is a glibc (2.29+) extension
+  jp->pid = fork();
+  if(jp->pid == -1){
+    fprintf(stdout,"fork returned errno %d (%s)\n",errno,strerror(errno));
+    return -1;
+  }
+  if(jp->pid == 0){
+    if(chdir(jp->dir) != 0)
+      perror("chdir");
+    execvp(Modetab[Mode].decode,(char * const *)argv);
+    fprintf(stdout,"execvp(%s) returned errno %d (%s)\n",Modetab[Mode].decode,errno,strerror(errno));
+    _exit(EX_SOFTWARE);
+  }
+#endif
+  if(Verbose > 1)
+    fprintf(stdout,"spawned decoder %d\n",jp->pid);
+  return 0;
+}
+
+static void finish_job(struct job *jp){
+  if(!Keep_wav){
+    if(Verbose)
+      fprintf(stdout,"unlink(%s)\n",jp->filename);
+    unlink(jp->filename);
+  }
+  Staged_bytes -= jp->staged;
+  FREE(jp);
+}
+
+// Reap finished decoders, then start waiting ones while there are free slots
+void run_decoders(int64_t now){
+  Child_exited = 0;
+  int status = 0;
+  pid_t pid;
+  while((pid = waitpid(-1,&status,WNOHANG)) > 0){
+    struct job **pp;
+    for(pp = &Running; *pp != NULL && (*pp)->pid != pid; pp = &(*pp)->next)
+      ;
+    if(*pp == NULL)
+      continue; // Not ours
+    struct job * const jp = *pp;
+    *pp = jp->next;
+    Nrunning--;
+    Decodes++;
+    bool const late = now > jp->deadline;
+    if(late)
+      Late++;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      Failed++;
+    if(Verbose){
+      fprintf(stdout,"%s: decoded in %'.3f sec after %'.3f sec queued",jp->filename,
+	      (float)(now - jp->started) / BILLION,(float)(jp->started - jp->queued) / BILLION);
+      if(WIFSIGNALED(status))
+	fprintf(stdout,", terminated by signal %d",WTERMSIG(status));
+      else if(WIFEXITED(status) && WEXITSTATUS(status) != 0)
+	fprintf(stdout,", exit status %d",WEXITSTATUS(status));
+      if(late)
+	fprintf(stdout,", %'.3f sec past deadline",(float)(now - jp->deadline) / BILLION);
+      fprintf(stdout,"; %ld decodes, %ld late, %ld failed\n",Decodes,Late,Failed);
     }
-    if(!Keep_wav){
-      if(Verbose)
-	fprintf(stdout,"unlink(%s)\n",sp->filename);
-      unlink(sp->filename);
-      sp->filename[0] = '\0';
+    finish_job(jp);
+  }
+  if(now - Last_queued < SETTLE_TIME)
+    return;
+  while(Nrunning < Max_decoders && Pending != NULL){
+    struct job * const jp = Pending;
+    Pending = jp->next;
+    jp->started = now;
+    if(spawn_decoder(jp) != 0){
+      Failed++;
+      finish_job(jp);
+      continue;
     }
-    exit(EX_OK); // child exits
+    jp->next = Running;
+    Running = jp;
+    Nrunning++;
   }
-  if(Verbose > 1)
-    fprintf(stdout,"spawned child %d\n",child);
 }
@@ -24,6 +24,23 @@
 #include "filter.h"
 #include "radio.h"
 
+// Can this channel use a real (c2r) output filter, which costs about half as much as the complex IFFT?
+// Only if the imaginary part would be discarded anyway (mono, no envelope detector, PLL or post-detection shift)
+// and the channel is tuned to an FFT bin, since real output can't be fine tuned in the time domain
+static bool real_output_ok(struct channel const *chan){
+  if(chan->output.channels != 1 || chan->linear.env || chan->linear.pll || chan->tune.shift != 0 || chan->tune.doppler_rate != 0)
+    return false;
+
+  double remainder = 0;
+  pthread_mutex_lock(&Frontend.status_mutex);
+  int const r = compute_tuning(Frontend.in.ilen + Frontend.in.impulse_length - 1,
+			       Frontend.in.impulse_length,
+			       Frontend.samprate,
+			       NULL,&remainder,chan->tune.doppler + Frontend.frequency - chan->tune.freq);
+  pthread_mutex_unlock(&Frontend.status_mutex);
+  return r == 0 && fabs(remainder) < 1e-3; // Within a millihertz
+}
+
 void *demod_linear(void *arg){
   assert(arg != NULL);
   struct channel * const chan = arg;
@@ -38,14 +55,12 @@ void *demod_linear(void *arg){
   FREE(chan->status.command);
   FREE(chan->filter.energies);
   FREE(chan->spectrum.bin_data);
-  if(chan->output.opus != NULL){
-    opus_encoder_destroy(chan->output.opus);
-    chan->output.opus = NULL;
-  }
+  close_opus(chan);
 
   int const blocksize = chan->output.samprate * Blocktime / 1000;
+  bool const real_output = real_output_ok(chan);
   delete_filter_output(&chan->filter.out);
-  create_filter_output(&chan->filter.out,&Frontend.in,NULL,blocksize,COMPLEX);
+  create_filter_output(&chan->filter.out,&Frontend.in,NULL,blocksize,real_output ? REAL : COMPLEX);
   pthread_mutex_unlock(&chan->status.lock);
 
   set_filter(&chan->filter.out,
@@ -63,6 +78,9 @@ void *demod_linear(void *arg){
   realtime();
 
   while(downconvert(chan) == 0){
+    if(real_output != real_output_ok(chan))
+      break; // Retuned or reconfigured; restart with the other filter output type
+
     int const N = chan->filter.out.olen; // Number of raw samples in filter output buffer
 
     // First pass over sample block.
@@ -70,7 +88,7 @@ void *demod_linear(void *arg){
     // Apply post-downconversion shift (if enabled, e.g. for CW)
     // Measure energy
     // Apply PLL & frequency shift, measure energy
-    complex float * const buffer = chan->filter.out.output.c; // Working buffer
+    complex float * const buffer = chan->filter.out.output.c; // Working buffer, NULL when real_output
     float signal = 0; // PLL only
     float noise = 0;  // PLL only
 
@@ -188,8 +206,15 @@ void *demod_linear(void *arg){
       // Complex input buffer is I0 Q0 I1 Q1 ...
       // Real output will be R0 R1 R2 R3 ...
       // Help cache use by overlaying output on input; ok as long as we index it from low to high
-      float *samples = (float *)buffer;
-      if(chan->linear.env){
+      float *samples = real_output ? chan->filter.out.output.r : (float *)buffer;
+      if(real_output){
+	// Already the I channel (SSB, CW, etc)
+	for(int n=0; n < N; n++){
+	  samples[n] *= chan->output.gain;
+	  output_power += samples[n] * samples[n];
+	  chan->output.gain *= gain_change;
+	}
+      } else if(chan->linear.env){
 	// AM envelope detection
 	for(int n=0; n < N; n++){
 	  samples[n] = cabsf(buffer[n]) * chan->output.gain;
@@ -235,7 +260,7 @@ void *demod_linear(void *arg){
     bool mute = (output_power == 0) || (chan->linear.pll && !chan->linear.pll_lock) || (chan->tune.freq == 0);
 
     // send_output() knows if the buffer is mono or stereo
-    if(send_output(chan,(float *)buffer,N,mute) == -1)
+    if(send_output(chan,real_output ? chan->filter.out.output.r : (float *)buffer,N,mute) == -1)
       break; // No output stream!
 
     // When the gain is allowed to vary, the average gain won't be exactly consistent with the
@@ -332,6 +332,10 @@ static int loadconfig(char const * const file){
   Channel_idle_timeout = 20 * 1000 / Blocktime;
   Overlap = abs(config_getint(Configtable,global,"overlap",Overlap));
   N_worker_threads = config_getint(Configtable,global,"fft-threads",DEFAULT_FFTW_THREADS); // variable owned by filter.c
+  Filter_inline_max = config_getint(Configtable,global,"fft-inline-max",Filter_inline_max); // also owned by filter.c
+  N_bulk_threads = config_getint(Configtable,global,"fft-bulk-threads",N_bulk_threads); // also owned by filter.c
+  N_internal_threads = config_getint(Configtable,global,"fft-internal-threads",N_internal_threads); // also owned by filter.c
+  N_encoder_threads = config_getint(Configtable,global,"encoder-threads",N_encoder_threads); // owned by audio.c
   RTCP_enable = config_getboolean(Configtable,global,"rtcp",RTCP_enable);
   SAP_enable = config_getboolean(Configtable,global,"sap",SAP_enable);
   {
@@ -661,7 +665,9 @@ static int setup_hardware(char const *sname){
   Frontend.M = Frontend.L / (Overlap - 1) + 1;
   assert(Frontend.M != 0);
   assert(Frontend.L != 0);
-  create_filter_input(&Frontend.in,Frontend.L,Frontend.M, Frontend.isreal ? REAL : COMPLEX);
+  // FFT_BULK: let channel FFTs go ahead of it
+  create_filter_input(&Frontend.in,Frontend.L,Frontend.M, Frontend.isreal ? REAL : COMPLEX,FFT_BULK);
+  set_filter_exec(&Frontend.in,EXEC_POOL); // Always overlap the front end FFT with reading the next block, however small
   pthread_mutex_init(&Frontend.status_mutex,NULL);
   pthread_cond_init(&Frontend.status_cond,NULL);
   if(Frontend.start){
@@ -213,20 +213,39 @@ void *input_thread(void *p){
     }
     if(Ssrc != 0){
       // ssrc specified, ignore others
-      uint32_t ssrc = get_ssrc(buffer+1,length-1);
-      if(ssrc != Ssrc)
+      bool wanted = false;
+      if(buffer[0] == BULK_STATUS){
+	int offset = 0;
+	int len;
+	while(!wanted && (len = next_bulk_record(buffer+1,length-1,&offset)) > 0)
+	  wanted = get_ssrc(buffer+1+offset-len,len) == Ssrc;
+      } else
+	wanted = get_ssrc(buffer+1,length-1) == Ssrc;
+      if(!wanted)
 	continue;
     }
     int64_t now = gps_time_ns();
     char temp[1024];
     fprintf(stdout,"%s %s", format_gpstime(temp,sizeof(temp),now), formatsock(&source));
     enum pkt_type const cr = buffer[0]; // Command/response byte
-    fprintf(stdout," %s", cr == STATUS ? "STAT" : "CMD");
-    if(cr == STATUS){
+    fprintf(stdout," %s", cr == STATUS ? "STAT" : cr == BULK_STATUS ? "BULK" : "CMD");
+    if(cr == STATUS || cr == BULK_STATUS){
       Status_packets++; // Don't count our own responses
       Last_status_time = now; // Reset poll timeout
     }
-    dump_metadata(stdout,buffer+1,length-1,Newline);
+    if(cr == BULK_STATUS){
+      // One line (or block, with -n) per channel record
+      int offset = 0;
+      int len;
+      while((len = next_bulk_record(buffer+1,length-1,&offset)) > 0){
+	uint8_t const * const record = buffer+1+offset-len;
+	if(Ssrc != 0 && get_ssrc(record,len) != Ssrc)
+	  continue;
+	fprintf(stdout,"\n ");
+	dump_metadata(stdout,record,len,Newline);
+      }
+    } else
+      dump_metadata(stdout,buffer+1,length-1,Newline);
     fflush(stdout);
     i++;
   }
@@ -380,6 +380,26 @@ float fm_snr(float r){
   return thetasq;
 }
 
+// FM discriminator: phase change between successive samples in half rotations (-1 to +1)
+// Uses the conjugate product in[n] * conj(in[n-1]) so no phase unwrapping is needed,
+// and fast_atan2pif() instead of cargf() so the loop vectorizes
+// *memory holds the last sample of the previous block; set it to 0 to restart (first output is then 0)
+void fm_discriminate(float * restrict out,complex float const * restrict in,int N,complex float *memory){
+  assert(out != NULL && in != NULL && memory != NULL);
+  if(N <= 0)
+    return;
+
+  complex float const d0 = in[0] * conjf(*memory);
+  out[0] = fast_atan2pif(cimagf(d0),crealf(d0));
+  for(int n=1; n < N; n++){
+    // Written out so gcc doesn't see a complex multiply with its NaN checks
+    float const re = crealf(in[n]) * crealf(in[n-1]) + cimagf(in[n]) * cimagf(in[n-1]);
+    float const im = cimagf(in[n]) * crealf(in[n-1]) - crealf(in[n]) * cimagf(in[n-1]);
+    out[n] = fast_atan2pif(im,re);
+  }
+  *memory = in[N-1];
+}
+
 // Simple non-crypto hash function
 // Adapted from https://en.wikipedia.org/wiki/PJW_hash_function
 // This needs replacing -- last 4 bits are usually 0xc because the last character of the DNS name is usually a '.'
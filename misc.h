@@ -22,6 +22,7 @@
 #include <bsd/string.h>
 #endif
 #include <assert.h>
+#include <arpa/inet.h> // ntohs()
 
 // Must be a macro so __FILE__ and __TIMESTAMP__ will substitute correctly
 #define VERSION() { fprintf(stdout,"KA9Q Multichannel SDR %s last modified %s\n",__FILE__,__TIMESTAMP__); \
@@ -138,11 +139,18 @@ float i1(float const z); // 1st kind
 
 float xi(float thetasq);
 float fm_snr(float r);
+void fm_discriminate(float * restrict out,complex float const * restrict in,int N,complex float *memory);
 
 // Convert floating point sample to 16-bit integer, with clipping
 static int16_t inline scaleclip(float const x){
   return (x >= 1.0) ? INT16_MAX : (x <= -1.0) ? -INT16_MAX : (int16_t)(INT16_MAX * x);
 }
+// Convert a block of big-endian (network order) 16-bit PCM to scaled floats
+// Kept simple so gcc vectorizes it into byte shuffles and conversions
+static inline void ntohs_float(float * restrict out,int16_t const * restrict in,int const n,float const scale){
+  for(int i=0; i < n; i++)
+    out[i] = scale * (int16_t)ntohs(in[i]);
+}
 static inline complex float const csincosf(float const x){
   float s,c;
 
@@ -184,6 +192,22 @@ static inline float approx_magf(complex float x){
 
   return Alpha * max(absr,absi) + Beta * min(absr,absi);
 }
+// Fast approximate atan2(y,x)/pi, in half rotations (-1 to +1)
+// Odd minimax polynomial for atan on [0,1], max error about 2e-6 radians
+// Branch-free so loops calling it can be vectorized; returns 0 for (0,0) like atan2f()
+static inline float fast_atan2pif(float const y,float const x){
+  float const ax = fabsf(x);
+  float const ay = fabsf(y);
+  float const hi = ax > ay ? ax : ay;
+  float const lo = ax > ay ? ay : ax;
+  float const a = hi > 0 ? lo / hi : 0;
+  float const s = a * a;
+  float r = a * (0.99997726f * M_1_PIf + s * (-0.33262347f * M_1_PIf + s * (0.19354346f * M_1_PIf
+	    + s * (-0.11643287f * M_1_PIf + s * (0.05265332f * M_1_PIf + s * (-0.01172120f * M_1_PIf))))));
+  r = ay > ax ? 0.5f - r : r;
+  r = x < 0 ? 1.0f - r : r;
+  return copysignf(r,y);
+}
 
 // Result = a - b
 static inline void time_sub(struct timespec *result,struct timespec const *a, struct timespec const *b){
@@ -52,6 +52,7 @@ static float const DEFAULT_FM_DEEMPH_GAIN = 12.0; // +12 dB to give subjectively
 static float const DEFAULT_WFM_DEEMPH_GAIN = 0.0;
 #endif
 static int   const DEFAULT_BITRATE = 32000;       // Default Opus compressed bit rate
+static int   const DEFAULT_COMPLEXITY = 10;       // Opus encoder complexity, 0-10
 
 
 int demod_type_from_name(char const *name){
@@ -107,6 +108,7 @@ int set_defaults(struct channel *chan){
   chan->output.samprate = round_samprate(DEFAULT_LINEAR_SAMPRATE); // Don't trust even a compile constant
   chan->output.encoding = S16BE;
   chan->output.opus_bitrate = DEFAULT_BITRATE;
+  chan->output.opus_complexity = DEFAULT_COMPLEXITY;
   double r = remainder(Blocktime * chan->output.samprate * .001,1.0);
   if(r != 0){
     fprintf(stdout,"Warning: non-integral samples in %.3f ms block at sample rate %d Hz: remainder %g\n",
@@ -226,6 +228,7 @@ int loadpreset(struct channel *chan,dictionary const *table,char const *sname){
   chan->linear.agc = config_getboolean(table,sname,"agc",chan->linear.agc);
   chan->fm.threshold = config_getboolean(table,sname,"extend",chan->fm.threshold); // FM threshold extension
   chan->fm.threshold = config_getboolean(table,sname,"threshold-extend",chan->fm.threshold); // FM threshold extension
+  chan->fm.rds = config_getboolean(table,sname,"rds",chan->fm.rds); // RDS decoding (WFM only)
 
   {
     char const *cp = config_getstring(table,sname,"deemph-tc",NULL);
@@ -253,6 +256,11 @@ int loadpreset(struct channel *chan,dictionary const *table,char const *sname){
     chan->output.encoding = parse_encoding(cp);
   }
   chan->output.opus_bitrate = config_getint(table,sname,"bitrate",chan->output.opus_bitrate);
+  {
+    int const c = config_getint(table,sname,"complexity",chan->output.opus_complexity);
+    if(c >= 0 && c <= 10)
+      chan->output.opus_complexity = c;
+  }
 
   return 0;
 
@@ -27,6 +27,8 @@
 #include "iir.h"
 #include "morse.h"
 #include "status.h"
+#include "resample.h"
+#include "rtp_recv.h"
 #include "monitor.h"
 
 int Position; // auto-position streams
@@ -63,127 +65,79 @@ void *dataproc(void *arg){
   if(input_fd == -1)
     pthread_exit(NULL);
 
-  struct packet *pkt = NULL;
-
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1){
+    close(input_fd);
+    pthread_exit(NULL);
+  }
   realtime();
   // Main loop begins here
   while(!Terminate){
-    // Need a new packet buffer?
-    if(!pkt)
-      pkt = malloc(sizeof(*pkt));
-    // Zero these out to catch any uninitialized derefs
-    pkt->next = NULL;
-    pkt->data = NULL;
-    pkt->len = 0;
-
-    struct sockaddr_storage sender;
-    socklen_t socksize = sizeof(sender);
-    int size = recvfrom(input_fd,&pkt->content,sizeof(pkt->content),0,(struct sockaddr *)&sender,&socksize);
-    if(size == -1){
+    // Everything already queued on the socket in one call
+    int const n = rtp_recv(&receiver,input_fd);
+    if(n == -1){
       if(errno != EINTR){ // Happens routinely, e.g., when window resized
-	perror("recvfrom");
+	perror("recvmmsg");
 	usleep(1000);
       }
-      continue;  // Reuse current buffer
-    }
-    if(size <= RTP_MIN_SIZE)
-      continue; // Must be big enough for RTP header and at least some data
-
-    // Convert RTP header to host format
-    uint8_t const *dp = ntoh_rtp(&pkt->rtp,pkt->content);
-    pkt->data = dp;
-    pkt->len = size - (dp - pkt->content);
-    if(pkt->rtp.pad){
-      pkt->len -= dp[pkt->len-1];
-      pkt->rtp.pad = 0;
-    }
-    if(pkt->len <= 0)
-      continue; // Used to be an assert, but would be triggered by bogus packets
-
-    // Find appropriate session; create new one if necessary
-    struct session *sp = lookup_or_create_session(&sender,pkt->rtp.ssrc);
-    if(!sp){
-      fprintf(stderr,"No room!!\n");
       continue;
     }
-    if(!sp->init){
-      // status reception doesn't write below this point
-      if(Auto_position)
-	sp->pan = make_position(Position++);
-      else
-	sp->pan = 0;     // center by default
-      sp->gain = powf(10.,0.05 * Gain);    // Start with global default
-      sp->notch_enable = Notch;
-      sp->muted = Start_muted;
-      sp->dest = mcast_address_text;
-      sp->last_timestamp = pkt->rtp.timestamp;
-      sp->rtp_state.seq = pkt->rtp.seq;
-      sp->reset = true;
-      sp->init = true;
-
-      if(pthread_create(&sp->task,NULL,decode_task,sp) == -1){
-	perror("pthread_create");
-	close_session(&sp);
+    for(int i=0; i < n; i++){
+      struct rtp_packet const * const pkt = &receiver.pkt[i];
+      struct rtp_header const rtp = pkt->rtp;
+      uint8_t const *dp = pkt->data;
+      int const len = pkt->len;
+
+      // Find appropriate session; create new one if necessary
+      struct session *sp = lookup_or_create_session(&pkt->sender,rtp.ssrc);
+      if(!sp){
+	fprintf(stderr,"No room!!\n");
 	continue;
       }
-    }
-    // Insert onto queue sorted by sequence number, wake up thread
-    struct packet *q_prev = NULL;
-    struct packet *qe = NULL;
-
-    int qlen = 0;
-    const int maxq = 500; // 10 seconds
-    pthread_mutex_lock(&sp->qmutex);
-    for(qe = sp->queue;
-	qe != NULL && qlen < maxq && pkt->rtp.seq >= qe->rtp.seq;
-	q_prev = qe,qe = qe->next,qlen++)
-      ;
-
-    if(qlen >= maxq){
-      // Queue has grown huge, blow it away. Seems to happen when a macos laptop is asleep
-      struct packet *qnext;
-      for(qe = sp->queue; qe != NULL; qe = qnext){
-	qnext = qe->next;
-	FREE(qe);
+      if(!sp->init){
+	// status reception doesn't write below this point
+	if(Auto_position)
+	  sp->pan = make_position(Position++);
+	else
+	  sp->pan = 0;     // center by default
+	sp->gain = powf(10.,0.05 * Gain);    // Start with global default
+	sp->notch_enable = Notch;
+	sp->muted = Start_muted;
+	sp->dest = mcast_address_text;
+	sp->last_timestamp = rtp.timestamp;
+	sp->rtp_state.seq = rtp.seq;
+	sp->reset = true;
+	sp->init = true;
+
+	if(pthread_create(&sp->task,NULL,decode_task,sp) == -1){
+	  perror("pthread_create");
+	  close_session(&sp);
+	  continue;
+	}
       }
-      // queue now empty, can put new packet at head
-    }
-    if(qe)
-      sp->reseqs++;   // Not the last on the list
-    pkt->next = qe;
-    if(q_prev)
-      q_prev->next = pkt;
-    else
-      sp->queue = pkt; // Front of list
-    pkt = NULL;        // force new packet to be allocated
-    long long t = gps_time_ns();
-    if(t - sp->last_active > BILLION){
-      // Transition from idle to active
-      sp->last_start = t;
+      long long t = gps_time_ns();
+      if(t - sp->last_active > BILLION){
+	// Transition from idle to active
+	sp->last_start = t;
+      }
+      sp->last_active = t;
+      // Copy into the session's jitter ring by sequence number, wake up its thread
+      jitter_put(&sp->jitter,&rtp,dp,len);
     }
-    sp->last_active = t;
-    // wake up decoder thread
-    pthread_cond_signal(&sp->qcond);
-    pthread_mutex_unlock(&sp->qmutex);
   }
+  rtp_receiver_free(&receiver);
   return NULL;
 }
 void decode_task_cleanup(void *arg){
   struct session *sp = (struct session *)arg;
   assert(sp);
 
-  pthread_mutex_destroy(&sp->qmutex);
-  pthread_cond_destroy(&sp->qcond);
-
   if(sp->opus){
     opus_decoder_destroy(sp->opus);
     sp->opus = NULL;
   }
-  struct packet *pkt_next;
-  for(struct packet *pkt = sp->queue; pkt; pkt = pkt_next){
-    pkt_next = pkt->next;
-    FREE(pkt);
-  }
+  delete_resampler(sp->resampler);
+  sp->resampler = NULL;
 }
 
 // Per-session thread to decode incoming RTP packets
@@ -205,30 +159,23 @@ void *decode_task(void *arg){
 
   // Main loop; run until asked to quit
   while(!sp->terminate && !Terminate){
-    struct packet *pkt = NULL;
+    struct jitter_slot *pkt = NULL;
     // Wait for packet to appear on queue
-    pthread_mutex_lock(&sp->qmutex);
-    while(!sp->queue){
-      int64_t const increment = 100000000; // 100 ms
-      // pthread_cond_timedwait requires UTC clock time! Undefined behavior around a leap second...
-      struct timespec ts;
-      ns2ts(&ts,utc_time_ns() + increment);
-      int r = pthread_cond_timedwait(&sp->qcond,&sp->qmutex,&ts); // Wait 100 ms max so we pick up terminates
-      if(r != 0){
-	if(r == EINVAL)
-	  Invalids++;
-	pthread_mutex_unlock(&sp->qmutex);
-	goto endloop;// restart loop, checking terminate flags
-      }
-    }
-    // Peek at first packet on queue; is it in sequence?
-    if(sp->queue->rtp.seq != sp->rtp_state.seq){
+    int64_t const increment = 100000000; // 100 ms
+    // pthread_cond_timedwait requires UTC clock time! Undefined behavior around a leap second...
+    struct timespec ts;
+    ns2ts(&ts,utc_time_ns() + increment);
+    int const gap = jitter_wait(&sp->jitter,&ts); // Wait 100 ms max so we pick up terminates
+    if(gap < 0)
+      goto endloop; // restart loop, checking terminate flags
+
+    // Is the oldest packet in sequence?
+    if(gap > 0){
       // No. If we've got plenty in the playout buffer, sleep to allow some packet resequencing in the input thread.
       // Strictly speaking, we will resequence ourselves below with the RTP timestamp. But that works properly only with stateless
       // formats like PCM. Opus is stateful, so it's better to resequence input packets (using the RTP sequence #) when possible.
       float queue = (float)modsub(sp->wptr,Rptr,BUFFERSIZE) / DAC_samprate;
       if(queue > Latency + 0.1){ // 100 ms for scheduling latency?
-	pthread_mutex_unlock(&sp->qmutex);
 	struct timespec ss;
 	ns2ts(&ss,(int64_t)(1e9 * (queue - (Latency + 0.1))));
 	nanosleep(&ss,NULL);
@@ -236,10 +183,9 @@ void *decode_task(void *arg){
       }
       // else the playout queue is close to draining, accept out of sequence packet anyway
     }
-    pkt = sp->queue;
-    sp->queue = pkt->next;
-    pkt->next = NULL;
-    pthread_mutex_unlock(&sp->qmutex);
+    pkt = jitter_get(&sp->jitter,&ts); // Already there, doesn't wait
+    if(pkt == NULL)
+      goto endloop;
 
     sp->packets++; // Count all packets, regardless of type
     if((int16_t)(pkt->rtp.seq - sp->rtp_state.seq) > 0){ // Doesn't really handle resequencing
@@ -266,15 +212,14 @@ void *decode_task(void *arg){
     if(samprate != sp->samprate){
       // Reinit tone detectors whenever sample rate changes
       sp->samprate = samprate;
-      for(int j=0; j < N_tones; j++)
-	init_goertzel(&sp->tone_detector[j],PL_tones[j]/(float)samprate);
+      init_goertzel_bank(&sp->tone_detector,PL_tones,N_tones,samprate,true);
+      sp->tone_samples = 0;
       sp->notch_tone = 0; // force it to be re-detected at new sample rate
     }
     // Test for invalidity
     sp->channels = channels_from_pt(sp->type); // channels in packet (not portaudio output buffer)
     if(sp->samprate <= 0 || sp->channels <= 0 || sp->channels > 2)
       goto endloop;
-    int upsample = DAC_samprate / samprate; // Upsample lower PCM samprates to output rate (should be cleaner; what about decimation?)
     sp->bandwidth = samprate / 2000;    // in kHz allowing for Nyquist
 
     // decode Opus or PCM into bounce buffer
@@ -283,11 +228,13 @@ void *decode_task(void *arg){
     case OPUS:
       {
 	// Execute Opus decoder even when muted to keep its state updated
+	// Opus decodes directly to the output rate if it can; otherwise to 48 kHz for the resampler
+	int const opus_rate = (DAC_samprate == 8000 || DAC_samprate == 12000 || DAC_samprate == 16000
+			       || DAC_samprate == 24000) ? DAC_samprate : 48000;
 	if(!sp->opus){
 	  int error;
 
-	  // Decode Opus to the selected sample rate
-	  sp->opus = opus_decoder_create(DAC_samprate,Channels,&error);
+	  sp->opus = opus_decoder_create(opus_rate,Channels,&error);
 	  if(error != OPUS_OK)
 	    fprintf(stderr,"opus_decoder_create error %d\n",error);
 
@@ -295,14 +242,13 @@ void *decode_task(void *arg){
 	}
 	// Force Opus to decode to the local hardware settings, typically stereo @ 48 kHz
 	sp->channels = Channels;
-	sp->samprate = DAC_samprate;
-	upsample = 1;
+	sp->samprate = opus_rate;
 	// Opus RTP timestamps always referenced to 48 kHz
 	int const r0 = opus_packet_get_nb_samples(pkt->data,pkt->len,48000);
 	if(r0 == OPUS_INVALID_PACKET || r0 == OPUS_BAD_ARG)
 	  goto endloop;
 
-	int const r1 = opus_packet_get_nb_samples(pkt->data,pkt->len,DAC_samprate);
+	int const r1 = opus_packet_get_nb_samples(pkt->data,pkt->len,opus_rate);
 	if(r1 == OPUS_INVALID_PACKET || r1 == OPUS_BAD_ARG)
 	  goto endloop;
 
@@ -388,26 +334,18 @@ void *decode_task(void *arg){
     // Disable if display isn't active and autonotching is off
     // Fed audio that might be discontinuous or out of sequence, but it's a pain to fix
     if(sp->notch_enable) {
-      for(int i=0; i < sp->frame_size; i++){
-	float s;
-	if(sp->channels == 2)
-	  s = 0.5 * (bounce[2*i] + bounce[2*i+1]); // Mono sum
-	else // sp->channels == 1
-	  s = bounce[i];
-
-	for(int j = 0; j < N_tones; j++)
-	  update_goertzel(&sp->tone_detector[j],s);
-      }
+      update_goertzel_bank(&sp->tone_detector,bounce,sp->frame_size,sp->channels); // Mono sum if stereo
       sp->tone_samples += sp->frame_size;
       if(sp->tone_samples >= Tone_period * sp->samprate){
 	sp->tone_samples = 0;
 	int pl_tone_index = -1;
 	float strongest_tone_energy = 0;
 	float total_energy = 0;
+	float energies[N_tones];
+	output_goertzel_bank(&sp->tone_detector,energies);
 	for(int j=0; j < N_tones; j++){
-	  float energy = cnrmf(output_goertzel(&sp->tone_detector[j]));
+	  float const energy = energies[j];
 	  total_energy += energy;
-	  reset_goertzel(&sp->tone_detector[j]);
 	  if(energy > strongest_tone_energy){
 	    strongest_tone_energy = energy;
 	    pl_tone_index = j;
@@ -422,8 +360,7 @@ void *decode_task(void *arg){
       if(sp->current_tone != 0 && sp->notch_tone != sp->current_tone){
 	// New or changed tone
 	sp->notch_tone = sp->current_tone;
-	setIIRnotch(&sp->iir_right,sp->current_tone/sp->samprate);
-	setIIRnotch(&sp->iir_left,sp->current_tone/sp->samprate);
+	iir_notch(&sp->notch,0,sp->current_tone/sp->samprate,0.997);
       }
     } // sp->notch_enable
 
@@ -435,13 +372,14 @@ void *decode_task(void *arg){
     // Sequence number processing and write pointer updating
     if(sp->reset){
       reset_session(sp,pkt->rtp.timestamp); // Resets sp->wptr and last_timestamp
-    } else if(modsub(sp->wptr,Rptr,BUFFERSIZE) < 0){
+    } else if(modsub(sp->wptr,Rptr,BUFFERSIZE) < 2 * Callback_frames){
+      // Too close to what the mixer is playing (or already past it) to be staged safely
       sp->lates++;
       if(++consec_lates < 3 || Constant_delay)
 	goto endloop;
       // 3 or more consecutive lates triggers a reset, unless constant delay is selected
       reset_session(sp,pkt->rtp.timestamp);
-    } else if(modsub(sp->wptr,Rptr,BUFFERSIZE) > BUFFERSIZE/4){
+    } else if(modsub(sp->wptr,Rptr,BUFFERSIZE) > STAGE_FRAMES/2){
       sp->earlies++;
       if(++consec_earlies < 3)
 	goto endloop;
@@ -452,9 +390,11 @@ void *decode_task(void *arg){
 
     // Normal packet, relative adjustment to write pointer
     // Can difference in timestamps be negative? Cast it anyway
-    // Opus always counts timestamps at 48 kHz so this breaks when DAC_samprate is not 48 kHz
-    // For opus, sp->wptr += (int32_t)(pkt->rtp.timestamp - sp->last_timestamp) * DAC_samprate / 48000;
-    sp->wptr += (int32_t)(pkt->rtp.timestamp - sp->last_timestamp) * upsample;
+    // Opus always counts timestamps at 48 kHz
+    {
+      int const rtp_rate = encoding == OPUS ? 48000 : samprate;
+      sp->wptr += (int32_t)(pkt->rtp.timestamp - sp->last_timestamp) * (int64_t)DAC_samprate / rtp_rate;
+    }
     sp->wptr &= (BUFFERSIZE-1);
     sp->last_timestamp = pkt->rtp.timestamp;
 
@@ -465,87 +405,80 @@ void *decode_task(void *arg){
     if(sp->muted)
       goto endloop; // No more to do with this frame
 
-    if(Channels == 2){
-      /* Compute gains and delays for stereo imaging
-	 Extreme gain differences can make the source sound like it's inside an ear
-	 This can be uncomfortable in good headphones with extreme panning
-	 -6dB for each channel in the center
-	 when full to one side or the other, that channel is +6 dB and the other is -inf dB
-      */
-      float const left_gain = sp->gain * (1 - sp->pan)/2;
-      float const right_gain = sp->gain * (1 + sp->pan)/2;
-      /* Delay less favored channel 0 - 1.5 ms max (determined
-	 empirically) This is really what drives source localization
-	 in humans. The effect is so dramatic even with equal levels
-	 you have to remove one earphone to convince yourself that the
-	 levels really are the same!
-      */
-      int const left_delay = (sp->pan > 0) ? round(sp->pan * .0015 * DAC_samprate) : 0; // Delay left channel
-      int const right_delay = (sp->pan < 0) ? round(-sp->pan * .0015 * DAC_samprate) : 0; // Delay right channel
-
-      assert(left_delay >= 0 && right_delay >= 0);
-
-      // Mix bounce buffer into output buffer read by portaudio callback
-      // Simplified by mirror buffer wrap
-      int left_index = 2 * (sp->wptr + left_delay);
-      int right_index = 2 * (sp->wptr + right_delay) + 1;
-
-      for(int i=0; i < sp->frame_size; i++){
-	float left,right;
-	if(sp->channels == 1){
-	  // Mono input, put on both channels
-	  left = bounce[i];
-	  if(sp->notch_enable && sp->notch_tone > 0)
-	    left = applyIIRnotch(&sp->iir_left,left);
-	  right = left;
-	} else {
-	  // stereo input
-	  left = bounce[2*i];
-	  right = bounce[2*i+1];
-	  if(sp->notch_enable && sp->notch_tone > 0){
-	    left = applyIIRnotch(&sp->iir_left,left);
-	    right = applyIIRnotch(&sp->iir_right,right);
-	  }
-	}
-	if(!Voting || Best_session == sp){ // If voting, suppress all but best session
-	  // Not the cleanest way to upsample the sample rate, but it works
-	  for(int j=0; j < upsample; j++){
-	    Output_buffer[left_index] += left * left_gain;
-	    Output_buffer[right_index] += right * right_gain;
-	    left_index += 2;
-	    right_index += 2;
-	  }
-	  if(modsub(right_index/2,Wptr,BUFFERSIZE) > 0)
-	    Wptr = right_index / 2; // samples to frames; For verbose mode
-	}
+    if(sp->notch_enable && sp->notch_tone > 0)
+      iir_filter(&sp->notch,bounce,sp->frame_size,sp->channels);
+
+    if(sp->samprate != DAC_samprate){
+      // Convert to the output rate
+      if(sp->resampler == NULL || sp->resampler->in_rate != sp->samprate || sp->resampler->channels != sp->channels){
+	delete_resampler(sp->resampler);
+	sp->resampler = create_resampler(sp->samprate,DAC_samprate,sp->channels,Resample_quality);
+	if(sp->resampler == NULL)
+	  goto endloop; // Unsupported ratio
       }
-    } else { // Channels == 1, no panning
-      int64_t index = sp->wptr;
-      for(int i=0; i < sp->frame_size; i++){
-	float s;
-	if(sp->channels == 1){
-	  s = bounce[i];
-	} else {
-	  // Downmix to mono
-	  s = 0.5 * (bounce[2*i] + bounce[2*i+1]);
-	}
-	if(sp->notch_enable && sp->notch_tone > 0)
-	  s = applyIIRnotch(&sp->iir_left,s);
+      int const max_out = resample_max_out(sp->resampler,sp->frame_size);
+      float *resampled = malloc(sizeof(*resampled) * max_out * sp->channels);
+      if(resampled == NULL)
+	goto endloop; // bounce is freed there
+      sp->frame_size = resample(sp->resampler,bounce,sp->frame_size,resampled,max_out);
+      FREE(bounce);
+      bounce = resampled;
+    }
 
-	if(!Voting || Best_session == sp){ // If voting, suppress all but best session
-	  // Not the cleanest way to upsample the sample rate, but it works
-	  for(int j=0; j < upsample; j++){
-	    Output_buffer[index++] += s * sp->gain;
-	  }
-	  if(modsub(index,Wptr,BUFFERSIZE) > 0)
-	    Wptr = index; // For verbose mode
+    if(Voting && Best_session != sp)
+      goto endloop; // If voting, suppress all but best session
+
+    // Stage at the output rate and channel count; the mixer in pa_callback() applies gain and pan
+    if(sp->stage == NULL){
+      sp->stage = mirror_alloc(STAGE_FRAMES * Channels * sizeof(*sp->stage));
+      if(sp->stage == NULL)
+	goto endloop;
+      memset(sp->stage,0,STAGE_FRAMES * Channels * sizeof(*sp->stage));
+    }
+    if(!sp->mixed){
+      if(!mix_add(sp)){
+	Mix_overflows++;
+	goto endloop;
+      }
+      sp->mixed = true;
+    }
+    // Contiguous through the wrap, thanks to the mirror
+    float * const stage = sp->stage + Channels * (sp->wptr & (STAGE_FRAMES-1));
+    if(Channels == 2){
+      if(sp->channels == 1){
+	// Mono input, put on both channels
+	for(int i=0; i < sp->frame_size; i++){
+	  stage[2*i] += bounce[i];
+	  stage[2*i+1] += bounce[i];
 	}
+      } else {
+	for(int i=0; i < 2 * sp->frame_size; i++)
+	  stage[i] += bounce[i];
+      }
+    } else { // Channels == 1
+      if(sp->channels == 1){
+	for(int i=0; i < sp->frame_size; i++)
+	  stage[i] += bounce[i];
+      } else {
+	// Downmix to mono
+	for(int i=0; i < sp->frame_size; i++)
+	  stage[i] += 0.5 * (bounce[2*i] + bounce[2*i+1]);
       }
-    } // Channels == 1
+    }
+    {
+      unsigned int const end = (sp->wptr + sp->frame_size) & (BUFFERSIZE-1);
+      if(__atomic_load_n(&sp->staged,__ATOMIC_RELAXED) == 0 || modsub(end,sp->stage_end,BUFFERSIZE) > 0)
+	__atomic_store_n(&sp->stage_end,end,__ATOMIC_SEQ_CST);
+      // Tell the mixer there's something to play, after the samples and stage_end are in place
+      __atomic_fetch_add(&sp->staged,1,__ATOMIC_SEQ_CST);
+      if(modsub(end,Wptr,BUFFERSIZE) > 0)
+	Wptr = end; // For verbose mode
+    }
 
   endloop:;
     FREE(bounce);
-    FREE(pkt);
+    if(pkt != NULL)
+      jitter_release(&sp->jitter,pkt);
   } // !sp->terminate
   pthread_cleanup_pop(1);
   return NULL;
@@ -555,9 +488,11 @@ void reset_session(struct session * const sp,uint32_t timestamp){
   sp->resets++;
   if(sp->opus)
     opus_decoder_ctl(sp->opus,OPUS_RESET_STATE); // Reset decoder
+  if(sp->resampler != NULL)
+    reset_resampler(sp->resampler); // Don't smear audio from before the discontinuity into what follows
   sp->reset = false;
   sp->last_timestamp = timestamp;
-  sp->playout = Playout * DAC_samprate/1000;
+  sp->playout = max((int)(Playout * DAC_samprate/1000),2 * Callback_frames); // Not so close that every packet is late
   sp->wptr = (Rptr + sp->playout) & (BUFFERSIZE-1);
 }
 // Start output stream if it was off; reset idle timeout on output audio stream activity
@@ -27,6 +27,7 @@
 #include "iir.h"
 #include "morse.h"
 #include "status.h"
+#include "resample.h"
 #include "monitor.h"
 
 bool Auto_sort = false;
@@ -333,7 +334,11 @@ static void update_monitor_display(void){
     printwt("Playout %.0f ms, latency %d ms, queue %.3lf sec, D/A rate %'.3lf Hz,",Playout,Portaudio_delay,qd,rate);
     printwt(" (%+.3lf ppm),",1e6 * (rate / DAC_samprate - 1));
     // Time since last packet drop on any channel
-    printwt(" Error-free sec %'.1lf\n",(1e-9*(gps_time_ns() - Last_error_time)));
+    printwt(" Error-free sec %'.1lf,",(1e-9*(gps_time_ns() - Last_error_time)));
+    printwt(" underruns %'lu",Underruns);
+    if(Mix_overflows != 0)
+      printwt(", mixer full %'lu",Mix_overflows);
+    printwt("\n");
   }
   // Show channel statuses
   getyx(stdscr,y,x);
@@ -607,7 +612,7 @@ static void update_monitor_display(void){
   mvprintwt(y++,x,"%*s",width,"reseq");
   for(int session = First_session; session < Nsessions_copy; session++,y++){
     struct session const *sp = Sessions_copy[session];
-    mvprintwt(y,x,"%*lu",width,sp->reseqs);
+    mvprintwt(y,x,"%*llu",width,(unsigned long long)sp->jitter.reseqs);
   }
   x += width;
   y = row_save;
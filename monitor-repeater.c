@@ -27,6 +27,7 @@
 #include "iir.h"
 #include "morse.h"
 #include "status.h"
+#include "resample.h"
 #include "monitor.h"
 
 int64_t Repeater_tail;
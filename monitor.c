@@ -30,6 +30,8 @@
 #include "iir.h"
 #include "morse.h"
 #include "status.h"
+#include "resample.h"
+#include "rtp_recv.h"
 #include "monitor.h"
 
 // Could be (obscure) config file parameters
@@ -52,6 +54,7 @@ char const *Config_file;
 bool Quiet = false;                 // Disable curses
 bool Quiet_mode = false;            // Toggle screen activity after starting
 float Playout = 100;
+enum resample_quality Resample_quality = RESAMPLE_MEDIUM;
 bool Constant_delay = false;
 bool Start_muted = false;
 bool Auto_position = true;  // first will be in the center
@@ -70,6 +73,9 @@ float *Output_buffer;
 int Buffer_length; // Bytes left to play out, max BUFFERSIZE
 volatile unsigned int Rptr;   // callback thread read pointer, *frames*
 volatile unsigned int Wptr;   // For monitoring length of output queue
+volatile int Callback_frames;
+unsigned long Underruns;
+unsigned long Mix_overflows;
 uint64_t Audio_callbacks;
 unsigned long Audio_frames;
 volatile int64_t LastAudioTime;
@@ -86,6 +92,7 @@ PaTime Last_callback_time;
 int64_t Last_error_time;
 int Nsessions;
 struct session *Sessions[NSESSIONS];
+static struct session_table Session_table; // Sessions hashed on sender and SSRC so each packet needn't search them all
 bool Terminate;
 struct session *Best_session; // Session with highest SNR
 struct sockaddr_storage Metadata_dest_socket;
@@ -171,6 +178,16 @@ int main(int argc,char * const argv[]){
     Auto_sort = config_getboolean(Configtable,Display,"autosort",Auto_sort);
     Update_interval = config_getint(Configtable,Display,"update",Update_interval);
     Playout = config_getfloat(Configtable,Audio,"playout",Playout);
+    {
+      char const *q = config_getstring(Configtable,Audio,"resample",NULL);
+      if(q != NULL){
+	int const r = parse_resample_quality(q);
+	if(r >= 0)
+	  Resample_quality = r;
+	else
+	  fprintf(stderr,"Unknown resample quality %s; use low, medium or high\n",q);
+      }
+    }
     Repeater_tail = config_getfloat(Configtable,Repeater,"tail",Repeater_tail);
     Verbose = config_getboolean(Configtable,Display,"verbose",Verbose);
     char const *txon = config_getstring(Configtable,Radio,"txon",NULL);
@@ -363,6 +380,10 @@ int main(int argc,char * const argv[]){
   if(Repeater_tail != 0)
     pthread_create(&Repeater_thread,NULL,repeater_ctl,NULL); // Repeater mode active
 
+  if(session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stderr,"Can't allocate session table\n");
+    exit(EX_OSERR);
+  }
   // Spawn one thread per address
   // All have to succeed in resolving their targets or we'll exit
   // This allows a restart when started automatically from systemd before avahi is fully running
@@ -417,6 +438,50 @@ void vote(){
   pthread_mutex_unlock(&Sess_mutex);
 }
 
+// Update a session from one channel's status: a STATUS packet past its type byte, or a BULK_STATUS record
+static void update_status(struct sockaddr_storage const *sender,uint8_t const *buffer,int length){
+  // Extract just the SSRC to see if the session exists
+  // NB! Assumes same IP address *and port* for status and data
+  // This is only true for recent versions of radiod, after the switch to unconnected output sockets
+  // But older versions don't send status on the output channel anyway, so no problem
+  uint32_t ssrc = get_ssrc(buffer,length);
+  if(ssrc == 0xffffffff)
+    return; // Front end status, not a channel
+  struct session *sp = lookup_or_create_session(sender,ssrc);
+  if(!sp){
+    fprintf(stderr,"No room!!\n");
+    return;
+  }
+  if(sp->last_active == 0)
+    sp->last_active = gps_time_ns(); // Keep active time calc from blowing up before data packet arrives
+
+  // Decode directly into local copy, as not every parameter is updated in every status message
+  // Decoding into a temp copy and then memcpy would write zeroes into unsent parameters
+  decode_radio_status(&sp->frontend,&sp->chan,buffer,length);
+
+  char const *id = lookupid(sp->chan.tune.freq);
+  if(id)
+    strlcpy(sp->id,id,sizeof(sp->id));
+  else
+    sp->id[0] = '\0';
+
+  // Update SNR calculation (not sent explicitly)
+  float const noise_bandwidth = fabsf(sp->chan.filter.max_IF - sp->chan.filter.min_IF);
+  float sig_power = sp->chan.sig.bb_power - noise_bandwidth * sp->chan.sig.n0;
+  if(sig_power < 0)
+    sig_power = 0; // Avoid log(-x) = nan
+  float const sn0 = sig_power/sp->chan.sig.n0;
+  sp->snr = power2dB(sn0/noise_bandwidth);
+  vote();
+
+  int const type = sp->chan.output.rtp.type;
+  if(type >= 0 && type < 128){
+    // Don't overwrite existing
+    if(sp->chan.output.encoding != NO_ENCODING)
+      add_pt(type,sp->chan.output.samprate,sp->chan.output.channels,sp->chan.output.encoding); // Opus will get forced to stereo 48 kHz
+  }
+}
+
 // Receive status multicasts on output multicast groups, update local states
 void *statproc(void *arg){
   char const *mcast_address_text = (char *)arg;
@@ -442,48 +507,19 @@ void *statproc(void *arg){
     struct sockaddr_storage sender;
     socklen_t socksize = sizeof(sender);
     int length = recvfrom(status_fd,buffer,sizeof(buffer),0,(struct sockaddr *)&sender,&socksize);
-    if(buffer[0] != STATUS) // not status, ignore
+    if(length < 2 || (buffer[0] != STATUS && buffer[0] != BULK_STATUS)) // not status, ignore
       continue;
 
-    // Extract just the SSRC to see if the session exists
-    // NB! Assumes same IP address *and port* for status and data
-    // This is only true for recent versions of radiod, after the switch to unconnected output sockets
-    // But older versions don't send status on the output channel anyway, so no problem
-    uint32_t ssrc = get_ssrc(buffer+1,length-1);
-    struct session *sp = lookup_or_create_session(&sender,ssrc);
-    if(!sp){
-      fprintf(stderr,"No room!!\n");
+    if(buffer[0] == STATUS){
+      update_status(&sender,buffer+1,length-1);
       continue;
     }
-    if(sp->last_active == 0)
-      sp->last_active = gps_time_ns(); // Keep active time calc from blowing up before data packet arrives
-
-    // Decode directly into local copy, as not every parameter is updated in every status message
-    // Decoding into a temp copy and then memcpy would write zeroes into unsent parameters
-    decode_radio_status(&sp->frontend,&sp->chan,buffer+1,length-1);
-
-    char const *id = lookupid(sp->chan.tune.freq);
-    if(id)
-      strlcpy(sp->id,id,sizeof(sp->id));
-    else
-      sp->id[0] = '\0';
-
-    // Update SNR calculation (not sent explicitly)
-    float const noise_bandwidth = fabsf(sp->chan.filter.max_IF - sp->chan.filter.min_IF);
-    float sig_power = sp->chan.sig.bb_power - noise_bandwidth * sp->chan.sig.n0;
-    if(sig_power < 0)
-      sig_power = 0; // Avoid log(-x) = nan
-    float const sn0 = sig_power/sp->chan.sig.n0;
-    sp->snr = power2dB(sn0/noise_bandwidth);
-    vote();
-
-    int const type = sp->chan.output.rtp.type;
-    if(type >= 0 && type < 128){
-      // Don't overwrite existing
-      if(sp->chan.output.encoding != NO_ENCODING)
-	add_pt(type,sp->chan.output.samprate,sp->chan.output.channels,sp->chan.output.encoding); // Opus will get forced to stereo 48 kHz
-    }
-    pthread_mutex_unlock(&Sess_mutex);
+    // Records for many channels, in answer to a poll of all channels that asked for them (e.g., by control)
+    // A record with only changed fields still updates what we have; it's decoded onto the session's copy
+    int offset = 0;
+    int len;
+    while((len = next_bulk_record(buffer+1,length-1,&offset)) > 0)
+      update_status(&sender,buffer + 1 + offset - len,len);
   }
   return NULL;
 }
@@ -492,13 +528,17 @@ void *statproc(void *arg){
 
 struct session *lookup_or_create_session(const struct sockaddr_storage *sender,const uint32_t ssrc){
   pthread_mutex_lock(&Sess_mutex);
-  for(int i = 0; i < Nsessions; i++){
-    struct session * const sp = sptr(i);
-    if(sp && sp->ssrc == ssrc && address_match(sender,&sp->sender)){
+  {
+    struct session * const sp = session_lookup(&Session_table,sender,ssrc);
+    if(sp != NULL){
       pthread_mutex_unlock(&Sess_mutex);
       return sp;
     }
   }
+  if(Nsessions >= NSESSIONS){
+    pthread_mutex_unlock(&Sess_mutex);
+    return NULL;
+  }
   struct session * const sp = calloc(1,sizeof(*sp));
   if(sp == NULL){ // Shouldn't happen on modern machines!
     pthread_mutex_unlock(&Sess_mutex);
@@ -507,13 +547,13 @@ struct session *lookup_or_create_session(const struct sockaddr_storage *sender,c
 
   // Put at end of list
   Sessions[Nsessions++] = sp;
+  session_insert(&Session_table,sender,ssrc,sp);
   sp->chan.inuse = true;
   sp->init = false; // Wait for first RTP packet to set the rest up
   sp->ssrc = ssrc;
   memcpy(&sp->sender,sender,sizeof(sp->sender));
 
-  pthread_cond_init(&sp->qcond,NULL);
-  pthread_mutex_init(&sp->qmutex,NULL);
+  jitter_init(&sp->jitter);
   pthread_mutex_unlock(&Sess_mutex);
 
   return sp;
@@ -533,43 +573,47 @@ int close_session(struct session **p){
     vote();
     Best_session = NULL;
   }
+  session_remove(&Session_table,&sp->sender,sp->ssrc);
   // Remove from table
+  bool found = false;
   for(int i = 0; i < Nsessions; i++){
     if(Sessions[i] == sp){
       Nsessions--;
       memmove(&Sessions[i],&Sessions[i+1],(Nsessions-i) * sizeof(Sessions[0]));
-      if(sp->opus)
-	opus_decoder_destroy(sp->opus);
-      sp->opus = NULL;
-
-      pthread_mutex_lock(&sp->qmutex);
-      while(sp->queue != NULL){
-	struct packet *next = sp->queue->next;
-	free(sp->queue);
-	sp->queue = next;
-      }
-      pthread_cond_destroy(&sp->qcond);
-      pthread_mutex_destroy(&sp->qmutex);
-
-      struct frontend * const frontend = &sp->frontend;
-      FREE(frontend->description);
-
-      // Just in case anything was allocated for these arrays
-      struct channel * const chan = &sp->chan;
-      FREE(chan->filter.energies);
-      FREE(chan->spectrum.bin_data);
-      FREE(chan->status.command);
-
-      FREE(sp);
-      *p = NULL;
-      pthread_mutex_unlock(&Sess_mutex);
-      return 0;
+      found = true;
+      break;
     }
   }
-  // get here only if not found, which shouldn't happen
   pthread_mutex_unlock(&Sess_mutex);
-  assert(false);
-  return -1;
+  if(!found){
+    // get here only if not found, which shouldn't happen
+    assert(false);
+    return -1;
+  }
+  // Nobody else can find it now, so tear it down without the lock: mix_remove() may wait for the audio callback
+  if(sp->opus)
+    opus_decoder_destroy(sp->opus);
+  sp->opus = NULL;
+  if(sp->stage != NULL){
+    if(sp->mixed)
+      mix_remove(sp);
+    mirror_free((void **)&sp->stage,STAGE_FRAMES * Channels * sizeof(*sp->stage));
+  }
+
+  jitter_free(&sp->jitter);
+
+  struct frontend * const frontend = &sp->frontend;
+  FREE(frontend->description);
+
+  // Just in case anything was allocated for these arrays
+  struct channel * const chan = &sp->chan;
+  FREE(chan->filter.energies);
+  FREE(chan->spectrum.bin_data);
+  FREE(chan->status.command);
+
+  FREE(sp);
+  *p = NULL;
+  return 0;
 }
 
 // passed to atexit, invoked at exit
@@ -588,6 +632,82 @@ void cleanup(void){
   }
 }
 
+// Sessions with staged audio, summed by the audio callback
+// Entries are claimed and released with atomic compare-and-swap, never under a lock, since the callback can't block
+static struct session *Mix_table[MIX_MAX];
+static bool Mixing; // Callback is reading Mix_table
+
+// Called by a session's decode thread when it first stages audio
+// Returns false if the table is full
+bool mix_add(struct session *sp){
+  for(int i=0; i < MIX_MAX; i++){
+    struct session *expected = NULL;
+    if(__atomic_compare_exchange_n(&Mix_table[i],&expected,sp,false,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+      return true;
+  }
+  return false;
+}
+// Remove a session, then wait until the callback can't still be using it
+void mix_remove(struct session *sp){
+  for(int i=0; i < MIX_MAX; i++){
+    struct session *expected = sp;
+    if(__atomic_compare_exchange_n(&Mix_table[i],&expected,NULL,false,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+      break;
+  }
+  while(__atomic_load_n(&Mixing,__ATOMIC_SEQ_CST))
+    usleep(1000);
+}
+
+// Add one session's staged audio for output frames rptr to rptr+n, with its gain and pan,
+// then clear what can no longer be read
+static void mix_session(struct session *sp,float * restrict out,unsigned int rptr,int n,int max_delay){
+  unsigned int const staged = __atomic_load_n(&sp->staged,__ATOMIC_SEQ_CST);
+  if(staged == 0)
+    return; // Idle
+  unsigned int const end = __atomic_load_n(&sp->stage_end,__ATOMIC_SEQ_CST);
+  if(modsub(end,rptr,BUFFERSIZE) + max_delay <= 0){
+    // All played and cleared. Unless the decoder staged more meanwhile, skip it until it does
+    unsigned int expected = staged;
+    __atomic_compare_exchange_n(&sp->staged,&expected,0,false,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED);
+    return;
+  }
+  bool const play = !sp->muted && (!Voting || Best_session == sp);
+  if(Channels == 2){
+    if(play){
+      /* Compute gains and delays for stereo imaging
+	 Extreme gain differences can make the source sound like it's inside an ear
+	 This can be uncomfortable in good headphones with extreme panning
+	 -6dB for each channel in the center
+	 when full to one side or the other, that channel is +6 dB and the other is -inf dB
+      */
+      float const left_gain = sp->gain * (1 - sp->pan)/2;
+      float const right_gain = sp->gain * (1 + sp->pan)/2;
+      /* Delay less favored channel 0 - 1.5 ms max (determined
+	 empirically) This is really what drives source localization
+	 in humans. The effect is so dramatic even with equal levels
+	 you have to remove one earphone to convince yourself that the
+	 levels really are the same!
+      */
+      int const left_delay = (sp->pan > 0) ? min(max_delay,(int)round(sp->pan * .0015 * DAC_samprate)) : 0; // Delay left channel
+      int const right_delay = (sp->pan < 0) ? min(max_delay,(int)round(-sp->pan * .0015 * DAC_samprate)) : 0; // Delay right channel
+      // Contiguous through the wrap, thanks to the mirror
+      float const * restrict const left = sp->stage + 2 * ((rptr - left_delay) & (STAGE_FRAMES-1));
+      float const * restrict const right = sp->stage + 2 * ((rptr - right_delay) & (STAGE_FRAMES-1)) + 1;
+      for(int i=0; i < n; i++){
+	out[2*i] += left_gain * left[2*i];
+	out[2*i+1] += right_gain * right[2*i];
+      }
+    }
+  } else if(play){
+    float const * restrict const in = sp->stage + (rptr & (STAGE_FRAMES-1));
+    float const gain = sp->gain;
+    for(int i=0; i < n; i++)
+      out[i] += gain * in[i];
+  }
+  // Older than any delayed read from now on
+  memset(sp->stage + Channels * ((rptr - max_delay) & (STAGE_FRAMES-1)),0,Channels * n * sizeof(*sp->stage));
+}
+
 // Portaudio callback - transfer data (if any) to provided buffer
 int pa_callback(void const *inputBuffer, void *outputBuffer,
 		       unsigned long framesPerBuffer,
@@ -596,20 +716,35 @@ int pa_callback(void const *inputBuffer, void *outputBuffer,
 		       void *userData){
   Audio_callbacks++;
   Audio_frames += framesPerBuffer;
+  if(statusFlags & paOutputUnderflow)
+    Underruns++;
 
   if(!outputBuffer)
     return paAbort; // can this happen??
 
   Last_callback_time = timeInfo->currentTime;
-  assert(framesPerBuffer < BUFFERSIZE); // Make sure ring buffer is big enough
+  assert(framesPerBuffer < STAGE_FRAMES / 4); // Make sure ring buffers are big enough
+  Callback_frames = framesPerBuffer;
   // Delay within Portaudio in milliseconds
   Portaudio_delay = 1000. * (timeInfo->outputBufferDacTime - timeInfo->currentTime);
 
+  // Start with whatever was written directly to the output buffer (e.g., repeater ID)
   // Use mirror buffer to simplify wraparound. Count is in bytes = Channels * frames * sizeof(float)
   int const bytecount = Channels * framesPerBuffer * sizeof(*Output_buffer);
   memcpy(outputBuffer,&Output_buffer[Channels*Rptr],bytecount);
   // Zero what we just copied
   memset(&Output_buffer[Channels*Rptr],0,bytecount);
+
+  // Sum the sessions. Time is bounded by MIX_MAX, and idle sessions cost only a test
+  int const max_delay = ceil(.0015 * DAC_samprate);
+  __atomic_store_n(&Mixing,true,__ATOMIC_SEQ_CST);
+  for(int i=0; i < MIX_MAX; i++){
+    struct session * const sp = __atomic_load_n(&Mix_table[i],__ATOMIC_SEQ_CST);
+    if(sp != NULL)
+      mix_session(sp,outputBuffer,Rptr,framesPerBuffer,max_delay);
+  }
+  __atomic_store_n(&Mixing,false,__ATOMIC_SEQ_CST);
+
   Rptr += framesPerBuffer;
   Rptr &= (BUFFERSIZE-1);
   Buffer_length -= framesPerBuffer;
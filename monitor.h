@@ -3,6 +3,8 @@
 extern float const Latency; // chunk size for audio output callback
 extern float const Tone_period; // PL tone integration period
 #define NSESSIONS 1500
+#define STAGE_FRAMES (1<<17)  // Per-session staging ring, frames; power of 2 that divides BUFFERSIZE
+#define MIX_MAX 128           // Most sessions the mixer will sum at once, bounding its time in the callback
 
 #define N_tones 55
 extern float PL_tones[N_tones];
@@ -46,6 +48,7 @@ extern int64_t Quiet_ID_interval;
 extern int Dit_length;
 extern int Channels;
 extern float Hysteresis; // Voting hysteresis, dB
+extern enum resample_quality Resample_quality; // For streams not at DAC_samprate
 //extern float GoodEnoughSNR; // FM SNR considered "good enough to not be worth changing
 
 extern char const *Init;
@@ -57,6 +60,9 @@ extern float *Output_buffer;
 extern int Buffer_length; // Bytes left to play out, max BUFFERSIZE
 extern volatile unsigned int Rptr;   // callback thread read pointer, *frames*
 extern volatile unsigned int Wptr;   // For monitoring length of output queue
+extern volatile int Callback_frames; // Frames in the last audio callback
+extern unsigned long Underruns;      // Callbacks reporting an output underflow
+extern unsigned long Mix_overflows;  // Packets not played because the mixer table was full
 extern volatile bool PTT_state;      // For repeater transmitter
 extern uint64_t Audio_callbacks;
 extern unsigned long Audio_frames;
@@ -90,9 +96,7 @@ struct session {
   char const *dest;
 
   pthread_t task;           // Thread reading from queue and running decoder
-  struct packet *queue;     // Incoming RTP packets
-  pthread_mutex_t qmutex;   // Mutex protecting packet queue
-  pthread_cond_t qcond;     // Condition variable for arrival of new packet
+  struct jitter_ring jitter; // Incoming RTP packets, in sequence order
 
   struct rtp_state rtp_state; // Incoming RTP session state
   uint32_t ssrc;            // RTP Sending Source ID
@@ -100,6 +104,10 @@ struct session {
 
   uint32_t last_timestamp;  // Last timestamp seen
   unsigned int wptr;        // current write index into output PCM buffer, *frames*
+  float *stage;             // Mirrored ring of this session's audio at DAC_samprate with Channels, before gain and pan
+  unsigned int stage_end;   // One past the last frame staged, as an output buffer index
+  unsigned int staged;      // Bumped by the decoder after staging; cleared by the mixer once it's all played
+  bool mixed;               // In the mixer table; if it was full, the stage is kept and the next packet tries again
   int playout;              // Initial playout delay, frames
   long long last_active;    // GPS time last active with data traffic
   long long last_start;     // GPS time at last transition to active from idle
@@ -109,7 +117,7 @@ struct session {
   OpusDecoder *opus;        // Opus codec decoder handle, if needed
   int frame_size;
   int bandwidth;            // Audio bandwidth
-  struct goertzel tone_detector[N_tones];
+  struct goertzel_bank tone_detector;
   int tone_samples;
   float current_tone;       // Detected tone frequency
   float snr;                // Extracted from status message from radiod
@@ -125,7 +133,6 @@ struct session {
   unsigned long lates;
   unsigned long earlies;
   unsigned long resets;
-  unsigned long reseqs;
 
   bool terminate;            // Set to cause thread to terminate voluntarily
   bool muted;                // Do everything but send to output
@@ -134,8 +141,8 @@ struct session {
 
   char id[32];
   bool notch_enable;         // Enable PL removal notch
-  struct iir iir_left;       // State for PL removal filter
-  struct iir iir_right;
+  struct iir notch;          // PL removal filter, both channels
+  struct resampler *resampler; // Converts to DAC_samprate, when needed
   float notch_tone;
   struct channel chan;       // Partial copy of radiod's channel structure, filled in by status protocol
   struct frontend frontend;  // Partial copy of radiod's front end structure, ditto
@@ -154,6 +161,8 @@ void *statproc(void *arg);
 void *repeater_ctl(void *arg);
 char const *lookupid(double freq);
 bool kick_output();
+bool mix_add(struct session *sp);
+void mix_remove(struct session *sp);
 void vote();
 
 static inline int modsub(unsigned int const a, unsigned int const b, int const modulus){
@@ -15,9 +15,11 @@
 #include <ifaddrs.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <assert.h>
 
 #if defined(linux)
 #include <linux/if_packet.h>
+#include <linux/filter.h>
 #include <net/ethernet.h>
 #include <bsd/string.h>
 #endif
@@ -326,6 +328,83 @@ int listen_mcast(void const *s,char const *iface){
   return fd;
 }
 
+// Kernel-side selection of RTP streams on a socket from listen_mcast(), so a program that wants
+// a few of the channels on a busy group isn't woken up for all the others
+// A classic BPF socket filter accepts a packet only if its SSRC (or payload type) is in the set
+// Calling again replaces the set; the filter is never locked. count == 0 removes it
+// Packets already queued when the filter changes aren't affected, so callers must still check
+// Returns 0 on success, -1 with errno set on failure (ENOSYS where unsupported)
+#define RTP_FILTER_MAX 2000 // Two instructions each, within BPF_MAXINSNS
+
+#if defined(linux)
+// A UDP socket filter sees the packet starting at the UDP header
+#define UDP_HEADER_SIZE 8
+
+static int attach_rtp_filter(int fd,struct sock_filter const *load,int loadlen,uint32_t const *values,int count){
+  if(count == 0){
+    int const dummy = 0; // Ignored, but the kernel insists on an int
+    if(setsockopt(fd,SOL_SOCKET,SO_DETACH_FILTER,&dummy,sizeof(dummy)) != 0 && errno != ENOENT)
+      return -1;
+    return 0;
+  }
+  if(values == NULL || count < 0 || count > RTP_FILTER_MAX){
+    errno = EINVAL;
+    return -1;
+  }
+  int const len = loadlen + 2 * count + 1;
+  struct sock_filter *prog = calloc(len,sizeof(*prog));
+  if(prog == NULL)
+    return -1;
+  int n = 0;
+  for(int i=0; i < loadlen; i++)
+    prog[n++] = load[i];
+  for(int i=0; i < count; i++){
+    prog[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,values[i],0,1);
+    prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K,0xffffffff); // Accept whole packet
+  }
+  prog[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K,0); // Drop; also taken on a packet too short to load from
+  assert(n == len);
+  struct sock_fprog const fprog = { .len = len, .filter = prog };
+  int const r = setsockopt(fd,SOL_SOCKET,SO_ATTACH_FILTER,&fprog,sizeof(fprog));
+  FREE(prog);
+  return r;
+}
+#endif
+
+int set_ssrc_filter(int fd,uint32_t const *ssrcs,int count){
+#if defined(linux)
+  struct sock_filter const load[] = {
+    BPF_STMT(BPF_LD|BPF_W|BPF_ABS,UDP_HEADER_SIZE + 8), // SSRC, converted to host order by the load
+  };
+  return attach_rtp_filter(fd,load,sizeof(load)/sizeof(load[0]),ssrcs,count);
+#else
+  (void)fd; (void)ssrcs; (void)count;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+int set_pt_filter(int fd,uint8_t const *types,int count){
+#if defined(linux)
+  if(count < 0 || count > RTP_FILTER_MAX || (count > 0 && types == NULL)){
+    errno = EINVAL;
+    return -1;
+  }
+  uint32_t values[count > 0 ? count : 1];
+  for(int i=0; i < count; i++)
+    values[i] = types[i] & 0x7f;
+  struct sock_filter const load[] = {
+    BPF_STMT(BPF_LD|BPF_B|BPF_ABS,UDP_HEADER_SIZE + 1), // Marker and payload type
+    BPF_STMT(BPF_ALU|BPF_AND|BPF_K,0x7f),
+  };
+  return attach_rtp_filter(fd,load,sizeof(load)/sizeof(load[0]),values,count);
+#else
+  (void)fd; (void)types; (void)count;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 // Resolve a multicast target string in the form "name[:port][,iface]"
 // If "name" is not qualified (no periods) then .local will be appended by default
 // If :port is not specified, port field in result will be zero
@@ -492,6 +571,173 @@ int rtp_process(struct rtp_state * const state,struct rtp_header const * const r
   return time_step;
 }
 
+// Jitter ring between a receive thread and a decode thread
+void jitter_init(struct jitter_ring * const jr){
+  memset(jr,0,sizeof(*jr));
+  pthread_mutex_init(&jr->mutex,NULL);
+  pthread_cond_init(&jr->cond,NULL);
+}
+void jitter_free(struct jitter_ring * const jr){
+  if(jr == NULL)
+    return;
+  for(int i=0; i < JITTER_SLOTS; i++)
+    FREE(jr->slot[i].data);
+  pthread_mutex_destroy(&jr->mutex);
+  pthread_cond_destroy(&jr->cond);
+}
+
+// Copy a packet's header and payload into its slot and wake the decoder
+// Called only from the receive thread
+// Returns 0 if queued, -1 if dropped
+int jitter_put(struct jitter_ring * const jr,struct rtp_header const * const rtp,uint8_t const * const data,int const len){
+  if(jr == NULL || rtp == NULL || data == NULL || len <= 0)
+    return -1;
+
+  if(!jr->started){
+    __atomic_store_n(&jr->next_seq,rtp->seq,__ATOMIC_RELEASE);
+    jr->head = rtp->seq;
+    jr->started = true;
+  }
+  if((int16_t)(rtp->seq - __atomic_load_n(&jr->next_seq,__ATOMIC_ACQUIRE)) < 0){
+    // Already passed over; the decoder would discard it as an old dupe anyway
+    __atomic_fetch_add(&jr->drops,1,__ATOMIC_RELAXED);
+    return -1;
+  }
+  struct jitter_slot * const s = &jr->slot[rtp->seq & (JITTER_SLOTS-1)];
+  int state = __atomic_load_n(&s->state,__ATOMIC_ACQUIRE);
+  if(state == JITTER_FULL && s->rtp.seq != rtp->seq){
+    // Still holds a packet a multiple of JITTER_SLOTS older that the decoder never got to
+    // (it fell behind, or the sender restarted). Reclaim it unless the decoder takes it first
+    if(__atomic_compare_exchange_n(&s->state,&state,JITTER_EMPTY,false,__ATOMIC_ACQUIRE,__ATOMIC_ACQUIRE)){
+      __atomic_fetch_add(&jr->drops,1,__ATOMIC_RELAXED);
+      state = JITTER_EMPTY;
+    }
+  }
+  if(state != JITTER_EMPTY){
+    // Duplicate, or the decoder still holds the slot
+    __atomic_fetch_add(&jr->drops,1,__ATOMIC_RELAXED);
+    return -1;
+  }
+  // The decoder won't touch an empty slot, so it's ours to fill
+  if(s->size < len){
+    // Only until the slot has seen the largest packet in the stream
+    uint8_t * const p = realloc(s->data,len);
+    if(p == NULL){
+      __atomic_fetch_add(&jr->drops,1,__ATOMIC_RELAXED);
+      return -1;
+    }
+    s->data = p;
+    s->size = len;
+  }
+  memcpy(s->data,data,len);
+  s->len = len;
+  s->rtp = *rtp;
+  __atomic_store_n(&s->seq,rtp->seq,__ATOMIC_RELAXED); // Published by the store to state below
+  if((int16_t)(rtp->seq - jr->head) >= 0)
+    __atomic_store_n(&jr->head,(uint16_t)(rtp->seq + 1),__ATOMIC_RELEASE);
+  else
+    jr->reseqs++;
+  jr->packets++;
+
+  // Sequentially consistent with the decoder setting 'waiting' before its last look,
+  // so either it sees this packet or we see it waiting
+  __atomic_store_n(&s->state,JITTER_FULL,__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&jr->waiting,__ATOMIC_SEQ_CST)){
+    pthread_mutex_lock(&jr->mutex);
+    pthread_cond_signal(&jr->cond);
+    pthread_mutex_unlock(&jr->mutex);
+  }
+  return 0;
+}
+
+// Decoder side: find the oldest packet present, optionally claiming it
+// Returns its offset from next_seq, or -1 if the ring is empty
+static int jitter_scan(struct jitter_ring * const jr,struct jitter_slot ** const claimed){
+  uint16_t const expected = __atomic_load_n(&jr->next_seq,__ATOMIC_RELAXED);
+  uint16_t next = expected;
+  uint16_t const head = __atomic_load_n(&jr->head,__ATOMIC_ACQUIRE);
+  int n = (int16_t)(head - next);
+  if(n > JITTER_SLOTS){
+    // Anything older has been, or will be, overwritten
+    next = head - JITTER_SLOTS;
+    n = JITTER_SLOTS;
+  }
+  for(int k=0; k < n; k++){
+    uint16_t const seq = next + k;
+    struct jitter_slot * const s = &jr->slot[seq & (JITTER_SLOTS-1)];
+    // Look without taking the slot: even a moment in JITTER_BUSY would make jitter_put() drop
+    // a packet arriving for it. A slot left over from an earlier pass around the ring is skipped
+    // here and reclaimed (and counted as a drop) by jitter_put() when its slot is next used
+    if(__atomic_load_n(&s->state,__ATOMIC_ACQUIRE) != JITTER_FULL || __atomic_load_n(&s->seq,__ATOMIC_RELAXED) != seq)
+      continue;
+    if(claimed != NULL){
+      int state = JITTER_FULL;
+      if(!__atomic_compare_exchange_n(&s->state,&state,JITTER_BUSY,false,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+	continue;
+      if(s->rtp.seq != seq){
+	// The receive thread overran the ring and refilled the slot after we looked. Put it back
+	__atomic_store_n(&s->state,JITTER_FULL,__ATOMIC_RELEASE);
+	continue;
+      }
+      *claimed = s;
+      __atomic_store_n(&jr->next_seq,(uint16_t)(seq + 1),__ATOMIC_RELEASE);
+    }
+    return (uint16_t)(seq - expected);
+  }
+  return -1;
+}
+
+// Sleep until the receive thread queues something or abstime (CLOCK_REALTIME) passes
+// Returns the jitter_scan() result
+static int jitter_sleep(struct jitter_ring * const jr,struct jitter_slot ** const claimed,struct timespec const * const abstime){
+  int r;
+  while((r = jitter_scan(jr,claimed)) < 0){
+    pthread_mutex_lock(&jr->mutex);
+    __atomic_store_n(&jr->waiting,true,__ATOMIC_SEQ_CST);
+    r = jitter_scan(jr,claimed); // Last look before sleeping
+    int ret = 0;
+    if(r < 0)
+      ret = pthread_cond_timedwait(&jr->cond,&jr->mutex,abstime);
+    __atomic_store_n(&jr->waiting,false,__ATOMIC_RELAXED);
+    pthread_mutex_unlock(&jr->mutex);
+    assert(ret != EINVAL);
+    if(r >= 0 || ret == ETIMEDOUT)
+      break;
+  }
+  return r;
+}
+
+// Wait for the oldest packet in the ring, skipping gaps
+// Returns NULL if nothing arrives by abstime (CLOCK_REALTIME)
+// The slot belongs to the caller until passed to jitter_release()
+struct jitter_slot *jitter_get(struct jitter_ring * const jr,struct timespec const * const abstime){
+  struct jitter_slot *s = NULL;
+  if(jitter_sleep(jr,&s,abstime) < 0)
+    return NULL;
+  return s;
+}
+
+// Take the oldest packet in the ring without waiting; NULL if it's empty
+// For consumers that are scheduled when packets arrive rather than sleeping on the ring
+struct jitter_slot *jitter_poll(struct jitter_ring * const jr){
+  struct jitter_slot *s = NULL;
+  if(jitter_scan(jr,&s) < 0)
+    return NULL;
+  return s;
+}
+
+// Wait for a packet without taking it, for decoders that would rather wait out a gap
+// Returns 0 if the next packet in sequence is present, the size of the gap before
+// the oldest packet present, or -1 if nothing arrives by abstime
+int jitter_wait(struct jitter_ring * const jr,struct timespec const * const abstime){
+  return jitter_sleep(jr,NULL,abstime);
+}
+
+void jitter_release(struct jitter_ring * const jr,struct jitter_slot * const s){
+  (void)jr;
+  __atomic_store_n(&s->state,JITTER_EMPTY,__ATOMIC_RELEASE);
+}
+
 // Convert binary sockaddr structure (v4 or v6 or unix) to printable numeric string
 char *formataddr(char *result,int size,void const *s){
   struct sockaddr const *sa = (struct sockaddr *)s;
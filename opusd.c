@@ -4,6 +4,8 @@
 
 // Major rewrite Nov 2020 for multithreaded encoding with one Opus encoder per thread
 // Makes better use of multicore CPUs under heavy load (like encoding the entire 2m band at once)
+// Sessions are now encoded by a fixed pool of worker threads (one per core by default) taking sessions
+// with new input from a ready queue, instead of one mostly idle thread per session
 // Copyright Jan 2018-2023 Phil Karn, KA9Q
 
 #define _GNU_SOURCE 1
@@ -30,28 +32,40 @@
 #include <sched.h>
 #include <sysexits.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 
 #include "misc.h"
 #include "multicast.h"
+#include "rtp_recv.h"
 #include "status.h"
 #include "iir.h"
 #include "avahi.h"
 
 #define BUFFERSIZE 16384  // Big enough for 120 ms @ 48 kHz stereo (11,520 16-bit samples)
+#define IDLE_TIMEOUT 10   // Seconds without input before a session is closed
+#define SEND_BATCH 32     // Opus packets per sendmmsg()
+#define OPUS_MAXPKT 8192  // RTP header + one Opus packet, 120 ms at well over the highest useful bit rate
+#define STATS_INTERVAL 60 // Seconds between encoder pool statistics with -v
 
 struct session {
   struct session *prev;       // Linked list pointers
   struct session *next;
   int type;                 // input RTP type (10,11)
 
-  struct sockaddr sender;
+  struct sockaddr_storage sender;
   char addr[NI_MAXHOST];    // RTP Sender IP address
   char port[NI_MAXSERV];    // RTP Sender source port
 
-  pthread_t thread;
-  pthread_mutex_t qmutex;
-  pthread_cond_t qcond;
-  struct packet *queue;
+  struct jitter_ring jitter; // Packets from the input thread, in sequence order
+  // Protected by Ready_mutex
+  bool scheduled;           // On the ready queue, being encoded, or held by a worker with its packets still unsent
+  bool more;                // Input arrived while scheduled
+  struct session *ready_next;
+  int64_t ready_time;       // When put on the ready queue
+
+  // Input thread only
+  int64_t last_active;
+  uint64_t batch;           // Last receive batch with packets for this session
 
   struct rtp_state rtp_state_in; // RTP input state
   int samprate; // PCM sample rate Hz
@@ -60,6 +74,7 @@ struct session {
   bool silence;              // Currently suppressing silence
 
   float audio_buffer[BUFFERSIZE];      // Buffer to accumulate PCM until enough for Opus frame
+  int audio_read_index;           // Index of the next sample to encode
   int audio_write_index;          // Index of next sample to write into audio_buffer
 
   struct rtp_state rtp_state_out; // RTP output state
@@ -73,6 +88,33 @@ struct session {
 };
 
 
+struct pool_stats {
+  uint64_t runs;            // Sessions taken from the ready queue
+  uint64_t wait_ns;         // Total time sessions sat on the ready queue
+  uint64_t busy_ns;
+  uint64_t frames;          // Opus frames encoded
+  uint64_t encode_ns;
+  uint64_t max_encode_ns;
+  uint64_t packets;         // Opus packets sent
+  uint64_t sends;           // sendmmsg() calls
+  uint64_t send_errors;     // Packets dropped by the non-blocking output socket
+};
+
+// One encoder pool thread, with its batch of Opus packets waiting to be sent
+// A session with packets in the batch stays scheduled, and so on this worker, until they're sent;
+// otherwise another worker could send its newer packets first
+struct worker {
+  pthread_t thread;
+  int nout;
+  struct mmsghdr msgs[SEND_BATCH];
+  struct iovec iov[SEND_BATCH];
+  uint8_t out[SEND_BATCH][OPUS_MAXPKT];
+  struct session *owner[SEND_BATCH]; // Session of each packet in the batch
+  struct session *held[SEND_BATCH];  // Sessions kept scheduled until the batch is sent
+  int nheld;
+  struct pool_stats stats;  // Written only by the worker
+};
+
 float const SCALE = 1./INT16_MAX;
 
 // Command line params
@@ -89,6 +131,7 @@ const float Corner_freq = 300; // Hz - corner frequency in de-emphasis integrato
 const float LF_gain = 4;       // == 12 dB; empirical to make equal subjective voice loudness with flat FM
                                // Will make PL tone louder by this amount until we implement a filter
 const float Latency = 0.02;    // chunk size for audio output callback
+int Nworkers;                  // Encoder pool size, default one per core
 
 // Global variables
 pthread_t Status_thread;
@@ -100,18 +143,26 @@ int Input_fd = -1;            // Multicast receive socket
 int Output_fd = -1;           // Multicast receive socket
 struct session *Sessions;
 pthread_mutex_t Session_protect = PTHREAD_MUTEX_INITIALIZER;
+struct session_table Session_table; // Protected by Session_protect
 uint64_t Output_packets;
+struct worker *Workers;
+pthread_mutex_t Ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Ready_cond = PTHREAD_COND_INITIALIZER;
+struct session *Ready_head;    // Sessions with new input, oldest first
+struct session *Ready_tail;
 char const *Name;
 char const *Output;
 char const *Input;
 
 void closedown(int);
-struct session *lookup_session(const struct sockaddr *,uint32_t);
-struct session *create_session(void);
+struct session *lookup_session(void const *,uint32_t);
+struct session *create_session(void const *,uint32_t);
 int close_session(struct session **);
-int send_samples(struct session *sp);
-void *input(void *arg);
+int send_samples(struct worker *w,struct session *sp);
 void *encode(void *arg);
+static void flush_output(struct worker *w);
+static void close_idle_sessions(int64_t now);
+static void print_stats(int64_t now);
 
 struct option Options[] =
   {
@@ -134,12 +185,13 @@ struct option Options[] =
    {"tos", required_argument, NULL, 'p'},
    {"iptos", required_argument, NULL, 'p'},
    {"ip-tos", required_argument, NULL, 'p'},
+   {"workers", required_argument, NULL, 'w'},
    {"version", no_argument, NULL, 'V'},
    {NULL, 0, NULL, 0},
 
   };
 
-char const Optstring[] = "A:B:I:N:R:T:fo:vxp:V";
+char const Optstring[] = "A:B:I:N:R:T:fo:vxp:w:V";
 
 struct sockaddr_storage PCM_in_socket;
 struct sockaddr_storage Metadata_in_socket;
@@ -151,6 +203,7 @@ int main(int argc,char * const argv[]){
 
   setlocale(LC_ALL,getenv("LANG"));
 
+  Nworkers = sysconf(_SC_NPROCESSORS_ONLN);
   int c;
   while((c = getopt_long(argc,argv,Optstring,Options,NULL)) != -1){
     switch(c){
@@ -187,6 +240,9 @@ int main(int argc,char * const argv[]){
     case 'x':
       Discontinuous = true;
       break;
+    case 'w':
+      Nworkers = strtol(optarg,NULL,0);
+      break;
     case 'l':
       Application = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
       break;
@@ -200,7 +256,7 @@ int main(int argc,char * const argv[]){
       fprintf(stderr,"Usage: %s [-V|--version] [-l |--lowdelay|--low-delay |-s | --speech | --voice] \
 [-x|--discontinuous] [-v|--verbose] [-f|--fec] [-p|--iptos|--tos|--ip-tos tos|] \
 [-o|--bitrate|--bit-rate bitrate] [-B|--blocktime|--block-time --blocktime] [-N|--name name] \
-[-T|--ttl ttl] [-A|--iface iface] [-I|--pcm-in input_mcast_address ] \
+[-T|--ttl ttl] [-A|--iface iface] [-I|--pcm-in input_mcast_address ] [-w|--workers workers] \
 -R|--opus-out output_mcast_address\n",argv[0]);
       exit(EX_USAGE);
     }
@@ -216,6 +272,8 @@ int main(int argc,char * const argv[]){
   }
   if(Opus_bitrate < 500)
     Opus_bitrate *= 1000; // Assume it was given in kb/s
+  if(Nworkers < 1)
+    Nworkers = 1;
 
   if(!Output){
     fprintf(stderr,"Must specify --opus-out\n");
@@ -279,9 +337,24 @@ int main(int argc,char * const argv[]){
 
   realtime();
 
+  // Start the encoder pool; the workers inherit our scheduling
+  Workers = calloc(Nworkers,sizeof(*Workers));
+  assert(Workers != NULL);
+  for(int i=0; i < Nworkers; i++){
+    if(pthread_create(&Workers[i].thread,NULL,encode,&Workers[i]) != 0){
+      perror("pthread_create");
+      exit(EX_OSERR);
+    }
+  }
   // Loop forever processing and dispatching incoming PCM and status packets
-
-  struct packet *pkt = NULL;
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1 || session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(EX_OSERR);
+  }
+  uint64_t batch = 0;
+  int64_t next_idle_check = gps_time_ns() + BILLION;
+  int64_t next_stats = gps_time_ns() + STATS_INTERVAL * BILLION;
   while(true){
     struct pollfd fds[2];
     fds[0].fd = Input_fd;
@@ -290,11 +363,21 @@ int main(int argc,char * const argv[]){
     fds[1].fd = Status_fd;
     fds[1].events = POLLIN;
     fds[1].revents = 0;
-    int n = poll(fds,2,-1); // Wait indefinitely for either stat or pcm data
+    int n = poll(fds,2,1000); // Wake up at least once a second to age out idle sessions
     if(n < 0)
       break; // Error of some kind
+
+    int64_t const now = gps_time_ns();
+    if(now >= next_idle_check){
+      close_idle_sessions(now);
+      next_idle_check = now + BILLION;
+    }
+    if(Verbose && now >= next_stats){
+      print_stats(now);
+      next_stats = now + STATS_INTERVAL * BILLION;
+    }
     if(n == 0)
-      continue; // Possible with 0 timeout?
+      continue; // Timeout
 
     if(fds[1].revents & POLLIN){
       // Simply copy status on output
@@ -306,253 +389,231 @@ int main(int argc,char * const argv[]){
 	perror("status sendto");
     }
     if(fds[0].revents & POLLIN){
-      // Process incoming RTP packets, demux to per-SSRC thread
-      // Need a new packet buffer?
-      if(!pkt)
-	pkt = malloc(sizeof(*pkt));
-      // Zero these out to catch any uninitialized derefs
-      pkt->next = NULL;
-      pkt->data = NULL;
-      pkt->len = 0;
-
-      struct sockaddr_storage sender;
-      socklen_t socksize = sizeof(sender);
-      int size = recvfrom(Input_fd,&pkt->content,sizeof(pkt->content),0,(struct sockaddr *)&sender,&socksize);
-
-      if(size == -1){
+      // Process incoming RTP packets, demux to per-SSRC jitter rings
+      int const n = rtp_recv(&receiver,Input_fd);
+      if(n == -1){
 	if(errno != EINTR){ // Happens routinely, e.g., when window resized
-	  perror("recvfrom");
+	  perror("recvmmsg");
 	  usleep(1000);
 	}
-	continue;  // Reuse current buffer
+	continue;
       }
-      if(size <= RTP_MIN_SIZE)
-	continue; // Must be big enough for RTP header and at least some data
-
-      // Extract and convert RTP header to host format
-      uint8_t const *dp = ntoh_rtp(&pkt->rtp,pkt->content);
-      pkt->data = dp;
-      pkt->len = size - (dp - pkt->content);
-      if(pkt->rtp.pad){
-	pkt->len -= dp[pkt->len-1];
-	pkt->rtp.pad = 0;
+      batch++;
+      struct session *touched[RTP_BATCH];
+      int ntouched = 0;
+      for(int i=0; i < n; i++){
+	struct rtp_packet const * const pkt = &receiver.pkt[i];
+
+	// Find appropriate session; create new one if necessary
+	struct session *sp = lookup_session(&pkt->sender,pkt->rtp.ssrc);
+	if(!sp){
+	  // Not found
+	  int const samprate = samprate_from_pt(pkt->rtp.type);
+	  if(samprate == 0)
+	    continue; // Unknown sample rate
+	  int const channels = channels_from_pt(pkt->rtp.type);
+	  if(channels == 0)
+	    continue; // Unknown channels
+
+	  sp = create_session(&pkt->sender,pkt->rtp.ssrc);
+	  assert(sp != NULL);
+	  // Initialize
+	  getnameinfo((struct sockaddr *)&pkt->sender,sizeof(pkt->sender),sp->addr,sizeof(sp->addr),
+		      sp->port,sizeof(sp->port),NI_NOFQDN|NI_DGRAM);
+	  sp->rtp_state_in.seq = pkt->rtp.seq; // Can cause a spurious drop indication if # pcm pkts != # opus pkts
+	  sp->rtp_state_in.timestamp = pkt->rtp.timestamp;
+	  sp->samprate = samprate;
+	  sp->channels = channels;
+	  // The encoder is created by the first worker to run the session
+	}
+	// Copy into the session's jitter ring
+	if(jitter_put(&sp->jitter,&pkt->rtp,pkt->data,pkt->len) == 0 && sp->batch != batch){
+	  sp->batch = batch;
+	  touched[ntouched++] = sp;
+	}
+	sp->last_active = now;
       }
-      if(pkt->len <= 0)
-	continue; // Used to be an assert, but would be triggered by bogus packets
-
-      // Find appropriate session; create new one if necessary
-      struct session *sp = lookup_session((const struct sockaddr *)&sender,pkt->rtp.ssrc);
-      if(!sp){
-	// Not found
-	int const samprate = samprate_from_pt(pkt->rtp.type);
-	if(samprate == 0)
-	  continue; // Unknown sample rate
-	int const channels = channels_from_pt(pkt->rtp.type);
-	if(channels == 0)
-	  continue; // Unknown channels
-
-	sp = create_session();
-	assert(sp != NULL);
-	// Initialize
-	getnameinfo((struct sockaddr *)&sender,sizeof(sender),sp->addr,sizeof(sp->addr),
-		    sp->port,sizeof(sp->port),NI_NOFQDN|NI_DGRAM);
-	memcpy(&sp->sender,&sender,sizeof(struct sockaddr));
-	sp->rtp_state_out.ssrc = sp->rtp_state_in.ssrc = pkt->rtp.ssrc;
-	sp->rtp_state_in.seq = pkt->rtp.seq; // Can cause a spurious drop indication if # pcm pkts != # opus pkts
-	sp->rtp_state_in.timestamp = pkt->rtp.timestamp;
-	sp->samprate = samprate;
-	sp->channels = channels;
-
-	// Span per-SSRC thread, each with its own instance of opus encoder
-	if(pthread_create(&sp->thread,NULL,encode,sp) == -1){
-	  perror("pthread_create");
-	  close_session(&sp);
+      // Queue the sessions with new input that aren't already queued or being encoded
+      int queued = 0;
+      pthread_mutex_lock(&Ready_mutex);
+      for(int i=0; i < ntouched; i++){
+	struct session * const sp = touched[i];
+	if(sp->scheduled){
+	  sp->more = true; // Its worker will find the new packets, or queue it again
 	  continue;
 	}
-      }
-
-      // Insert onto queue sorted by sequence number, wake up thread
-      struct packet *q_prev = NULL;
-      struct packet *qe = NULL;
-      { // Mutex-protected segment
-	pthread_mutex_lock(&sp->qmutex);
-	for(qe = sp->queue; qe && pkt->rtp.seq >= qe->rtp.seq; q_prev = qe,qe = qe->next)
-	  ;
-
-	pkt->next = qe;
-	if(q_prev)
-	  q_prev->next = pkt;
+	sp->scheduled = true;
+	sp->ready_time = now;
+	sp->ready_next = NULL;
+	if(Ready_tail != NULL)
+	  Ready_tail->ready_next = sp;
 	else
-	  sp->queue = pkt; // Front of list
-	pkt = NULL;        // force new packet to be allocated
-	// wake up decoder thread
-	pthread_cond_signal(&sp->qcond);
-	pthread_mutex_unlock(&sp->qmutex);
+	  Ready_head = sp;
+	Ready_tail = sp;
+	queued++;
       }
+      if(queued == 1)
+	pthread_cond_signal(&Ready_cond);
+      else if(queued > 1)
+	pthread_cond_broadcast(&Ready_cond);
+      pthread_mutex_unlock(&Ready_mutex);
     }
   }
 }
 
-// Per-SSRC thread - does actual Opus encoding
-// Warning! do not use "continue" within the loop as this will cause a memory leak.
-// Jump to "endloop" instead
-void *encode(void *arg){
-  struct session * sp = (struct session *)arg;
-  assert(sp != NULL);
-  {
-    char threadname[16];
-    snprintf(threadname,sizeof(threadname),"op enc %u",sp->rtp_state_out.ssrc);
-    pthread_setname(threadname);
-  }
-  // We will exit after 10 sec of idleness so detach ourselves to ensure resource recovery
-  // Not doing this caused a nasty memory leak
-  pthread_detach(pthread_self());
-
+static OpusEncoder *create_encoder(int samprate,int channels){
   int error = 0;
-  sp->opus = opus_encoder_create(sp->samprate,sp->channels,Application,&error);
-  assert(error == OPUS_OK && sp);
+  OpusEncoder * const opus = opus_encoder_create(samprate,channels,Application,&error);
+  assert(error == OPUS_OK && opus);
 
-  error = opus_encoder_ctl(sp->opus,OPUS_SET_DTX(Discontinuous));
+  error = opus_encoder_ctl(opus,OPUS_SET_DTX(Discontinuous));
   assert(error == OPUS_OK);
 
-  error = opus_encoder_ctl(sp->opus,OPUS_SET_BITRATE(Opus_bitrate));
+  error = opus_encoder_ctl(opus,OPUS_SET_BITRATE(Opus_bitrate));
   assert(error == OPUS_OK);
 
   if(Fec_enable){
-    error = opus_encoder_ctl(sp->opus,OPUS_SET_INBAND_FEC(1));
+    error = opus_encoder_ctl(opus,OPUS_SET_INBAND_FEC(1));
     assert(error == OPUS_OK);
-    error = opus_encoder_ctl(sp->opus,OPUS_SET_PACKET_LOSS_PERC(Fec_enable));
+    error = opus_encoder_ctl(opus,OPUS_SET_PACKET_LOSS_PERC(Fec_enable));
     assert(error == OPUS_OK);
   }
 
 #if 0 // Is this even necessary?
       // Always seems to return error -5 even when OK??
-  error = opus_encoder_ctl(sp->opus,OPUS_FRAMESIZE_ARG,Opus_blocktime);
+  error = opus_encoder_ctl(opus,OPUS_FRAMESIZE_ARG,Opus_blocktime);
   assert(1 || error == OPUS_OK);
 #endif
+  return opus;
+}
 
-  while(true){
-    struct packet *pkt = NULL;
-    {
-      struct timespec waittime;
-      clock_gettime(CLOCK_REALTIME,&waittime);
-      waittime.tv_sec += 10;      // wait 10 seconds for a new packet
-      { // Mutex-protected segment
-	pthread_mutex_lock(&sp->qmutex);
-	while(!sp->queue){      // Wait for packet to appear on queue
-	  int ret = pthread_cond_timedwait(&sp->qcond,&sp->qmutex,&waittime);
-	  assert(ret != EINVAL);
-	  if(ret == ETIMEDOUT){
-	    // Idle timeout after 10 sec; close session and terminate thread
-	    pthread_mutex_unlock(&sp->qmutex);
-	    close_session(&sp);
-	    return NULL; // exit thread
-	  }
-	}
-	pkt = sp->queue;
-	sp->queue = pkt->next;
-	pkt->next = NULL;
-	pthread_mutex_unlock(&sp->qmutex);
-      } // End of mutex protected segment
-    }
+// Convert one PCM packet into the session's audio buffer, then encode and queue whatever Opus frames are ready
+static void encode_packet(struct worker * const w,struct session * const sp,struct jitter_slot * const pkt){
+  sp->packets++; // Count all packets, regardless of type
+  int const frame_size = pkt->len / (sizeof(int16_t) * sp->channels); // PCM sample times
+  if(frame_size <= 0)
+    goto endloop; // garbled packet?
 
-    sp->packets++; // Count all packets, regardless of type
-    int const frame_size = pkt->len / (sizeof(int16_t) * sp->channels); // PCM sample times
-    if(frame_size <= 0)
-      goto endloop; // garbled packet?
+  int const samples_skipped = rtp_process(&sp->rtp_state_in,&pkt->rtp,frame_size);
+  if(samples_skipped < 0)
+    goto endloop; // Old dupe
 
-    int const samples_skipped = rtp_process(&sp->rtp_state_in,&pkt->rtp,frame_size);
-    if(samples_skipped < 0)
-      goto endloop; // Old dupe
+  if(sp->type != pkt->rtp.type){ // Handle transitions both ways
+    sp->type = pkt->rtp.type;
+  }
+  if(sp->channels != channels_from_pt(pkt->rtp.type) || sp->samprate != samprate_from_pt(pkt->rtp.type)){
+    // channels or sample rate changed; Re-create encoder
+    sp->channels = channels_from_pt(pkt->rtp.type);
+    sp->samprate = samprate_from_pt(pkt->rtp.type);
+    opus_encoder_destroy(sp->opus);
+    sp->opus = create_encoder(sp->samprate,sp->channels);
+    sp->audio_read_index = sp->audio_write_index = 0;
+  }
 
-    if(sp->type != pkt->rtp.type){ // Handle transitions both ways
-      sp->type = pkt->rtp.type;
-    }
-    if(sp->channels != channels_from_pt(pkt->rtp.type) || sp->samprate != samprate_from_pt(pkt->rtp.type)){
-      // channels or sample rate changed; Re-create encoder
-      sp->channels = channels_from_pt(pkt->rtp.type);
-      sp->samprate = samprate_from_pt(pkt->rtp.type);
-      opus_encoder_destroy(sp->opus);
-      int error = 0;
-      sp->opus = opus_encoder_create(sp->samprate,sp->channels,Application,&error);
-      assert(error == OPUS_OK && sp);
-
-      error = opus_encoder_ctl(sp->opus,OPUS_SET_DTX(Discontinuous));
-      assert(error == OPUS_OK);
-
-      error = opus_encoder_ctl(sp->opus,OPUS_SET_BITRATE(Opus_bitrate));
-      assert(error == OPUS_OK);
-
-      if(Fec_enable){
-	error = opus_encoder_ctl(sp->opus,OPUS_SET_INBAND_FEC(1));
-	assert(error == OPUS_OK);
-	error = opus_encoder_ctl(sp->opus,OPUS_SET_PACKET_LOSS_PERC(Fec_enable));
-	assert(error == OPUS_OK);
-      }
+  if(pkt->rtp.marker || samples_skipped > 4 * 48000 * Opus_blocktime){ // Opus works on 48 kHz virtual samples
+    // reset encoder state after 4 seconds of skip or a RTP marker bit
+    opus_encoder_ctl(sp->opus,OPUS_RESET_STATE);
+    sp->silence = true;
+  }
+  if(sp->audio_write_index + frame_size * sp->channels > BUFFERSIZE){
+    // Move what's left to the front; happens only every few frames
+    int const remaining = sp->audio_write_index - sp->audio_read_index;
+    memmove(sp->audio_buffer,&sp->audio_buffer[sp->audio_read_index],remaining * sizeof(sp->audio_buffer[0]));
+    sp->audio_read_index = 0;
+    sp->audio_write_index = remaining;
+    if(sp->audio_write_index + frame_size * sp->channels > BUFFERSIZE)
+      goto endloop; // Bigger than any Opus frame; shouldn't happen
+  }
+  int16_t const *samples = (int16_t *)pkt->data;
+  float *audio = &sp->audio_buffer[sp->audio_write_index];
+  for(int i=0; i < frame_size * sp->channels; i++)
+    audio[i] = SCALE * (int16_t)ntohs(samples[i]);
+  sp->audio_write_index += frame_size * sp->channels;
 
-#if 0 // Is this even necessary?
-      // Always seems to return error -5 even when OK??
-      error = opus_encoder_ctl(sp->opus,OPUS_FRAMESIZE_ARG,Opus_blocktime);
-      assert(1 || error == OPUS_OK);
-#endif
-    }
+ endloop:;
+  jitter_release(&sp->jitter,pkt);
 
-    if(pkt->rtp.marker || samples_skipped > 4 * 48000 * Opus_blocktime){ // Opus works on 48 kHz virtual samples
-      // reset encoder state after 4 seconds of skip or a RTP marker bit
-      opus_encoder_ctl(sp->opus,OPUS_RESET_STATE);
-      sp->silence = true;
+  // send however many opus frames we can
+  send_samples(w,sp);
+}
+
+// Encoder pool thread: take sessions with new input off the ready queue and encode everything they have
+// Only one worker runs a session at a time, so each jitter ring still has a single consumer
+void *encode(void *arg){
+  struct worker * const w = arg;
+  assert(w != NULL);
+  {
+    char threadname[16];
+    snprintf(threadname,sizeof(threadname),"opus enc %d",(int)(w - Workers));
+    pthread_setname(threadname);
+  }
+  while(true){
+    pthread_mutex_lock(&Ready_mutex);
+    while(Ready_head == NULL){
+      if(w->nout > 0){
+	// Send what we have before going idle
+	pthread_mutex_unlock(&Ready_mutex);
+	flush_output(w);
+	pthread_mutex_lock(&Ready_mutex);
+	continue;
+      }
+      pthread_cond_wait(&Ready_cond,&Ready_mutex);
     }
-    int16_t const *samples = (int16_t *)pkt->data;
-
-    for(int i=0; i < frame_size;i++){
-      float left = SCALE * (int16_t)ntohs(*samples++);
-      sp->audio_buffer[sp->audio_write_index++] = left;
-      if(sp->channels == 2){
-	float right = SCALE * (int16_t)ntohs(*samples++);
-	sp->audio_buffer[sp->audio_write_index++] = right;
+    struct session * const sp = Ready_head;
+    Ready_head = sp->ready_next;
+    if(Ready_head == NULL)
+      Ready_tail = NULL;
+    sp->more = false; // We'll see anything already in the jitter ring
+    pthread_mutex_unlock(&Ready_mutex);
+
+    int64_t const start = gps_time_ns();
+    w->stats.runs++;
+    w->stats.wait_ns += start - sp->ready_time;
+    if(sp->opus == NULL)
+      sp->opus = create_encoder(sp->samprate,sp->channels);
+
+    while(true){
+      struct jitter_slot *pkt = jitter_poll(&sp->jitter);
+      if(pkt == NULL){
+	// Last look under the lock: anything the input thread put before it saw us still scheduled is visible now
+	pthread_mutex_lock(&Ready_mutex);
+	pkt = jitter_poll(&sp->jitter);
+	if(pkt == NULL){
+	  bool unsent = false;
+	  for(int i=0; i < w->nout && !unsent; i++)
+	    unsent = w->owner[i] == sp;
+	  if(unsent)
+	    w->held[w->nheld++] = sp; // Released by flush_output()
+	  else
+	    sp->scheduled = false; // From here on another worker may take it, or the input thread close it
+	}
+	pthread_mutex_unlock(&Ready_mutex);
+	if(pkt == NULL)
+	  break;
       }
+      encode_packet(w,sp,pkt);
     }
-  endloop:;
-    FREE(pkt);
-
-    // send however many opus frames we can
-    send_samples(sp);
+    w->stats.busy_ns += gps_time_ns() - start;
   }
+  return NULL;
 }
 
-struct session *lookup_session(struct sockaddr const * const sender,const uint32_t ssrc){
-  struct session *sp;
+struct session *lookup_session(void const * const sender,const uint32_t ssrc){
   pthread_mutex_lock(&Session_protect);
-  for(sp = Sessions; sp != NULL; sp = sp->next){
-    if(sp->rtp_state_in.ssrc == ssrc
-       && address_match(&sp->sender,sender)){
-      // Found it
-      if(sp->prev != NULL){
-	// Not at top of list; move it there
-	if(sp->next != NULL)
-	  sp->next->prev = sp->prev;
-
-	sp->prev->next = sp->next;
-	sp->prev = NULL;
-	sp->next = Sessions;
-	Sessions->prev = sp;
-	Sessions = sp;
-      }
-      break;
-    }
-  }
+  struct session * const sp = session_lookup(&Session_table,sender,ssrc);
   pthread_mutex_unlock(&Session_protect);
   return sp;
 }
 // Create a new session, partly initialize
-struct session *create_session(void){
+struct session *create_session(void const * const sender,const uint32_t ssrc){
 
   struct session * const sp = calloc(1,sizeof(*sp));
   assert(sp != NULL); // Shouldn't happen on modern machines!
 
   // Initialize entry
-  pthread_mutex_init(&sp->qmutex,NULL);
-  pthread_cond_init(&sp->qcond,NULL);
+  memcpy(&sp->sender,sender,sizeof(sp->sender));
+  sp->rtp_state_out.ssrc = sp->rtp_state_in.ssrc = ssrc;
+  jitter_init(&sp->jitter);
 
   // Put at head of list
   pthread_mutex_lock(&Session_protect);
@@ -561,6 +622,7 @@ struct session *create_session(void){
   if(sp->next != NULL)
     sp->next->prev = sp;
   Sessions = sp;
+  session_insert(&Session_table,&sp->sender,ssrc,sp);
   pthread_mutex_unlock(&Session_protect);
   return sp;
 }
@@ -577,15 +639,6 @@ int close_session(struct session ** p){
     sp->opus = NULL;
   }
 
-  // packet queue should be empty, but just in case
-  pthread_mutex_lock(&sp->qmutex);
-  while(sp->queue){
-    struct packet *pkt = sp->queue->next;
-    FREE(sp->queue);
-    sp->queue = pkt;
-  }
-  pthread_mutex_unlock(&sp->qmutex);
-  pthread_mutex_destroy(&sp->qmutex);
 
   // Remove from linked list of sessions
   pthread_mutex_lock(&Session_protect);
@@ -595,7 +648,9 @@ int close_session(struct session ** p){
     sp->prev->next = sp->next;
   else
     Sessions = sp->next;
+  session_remove(&Session_table,&sp->sender,sp->rtp_state_in.ssrc);
   pthread_mutex_unlock(&Session_protect);
+  jitter_free(&sp->jitter);
   FREE(sp);
   *p = NULL;
   return 0;
@@ -614,13 +669,13 @@ void closedown(int s){
   pthread_mutex_destroy(&Session_protect);
   exit(EX_OK);
 }
-// Encode and send one or more Opus frames when we have enough
-int send_samples(struct session * const sp){
-  assert(sp != NULL);
+// Encode one or more Opus frames when we have enough, adding them to the worker's batch to be sent
+int send_samples(struct worker * const w,struct session * const sp){
+  assert(w != NULL && sp != NULL);
 
   int pcm_samples_written = 0;
   while(true){
-    float const ms_in_buffer = 1000.0 * sp->audio_write_index / (sp->channels * sp->samprate);
+    float const ms_in_buffer = 1000.0 * (sp->audio_write_index - sp->audio_read_index) / (sp->channels * sp->samprate);
     if(ms_in_buffer < Opus_blocktime)
       break; // Less than minimum allowable Opus block size; wait
 
@@ -663,22 +718,29 @@ int send_samples(struct session * const sp){
     } else
       rtp.marker = false;
 
-    uint8_t output_buffer[PKTSIZE]; // to hold RTP header + Opus-encoded frame
+    uint8_t * const output_buffer = w->out[w->nout]; // to hold RTP header + Opus-encoded frame
     uint8_t * const opus_write_pointer = hton_rtp(output_buffer,&rtp);
     int packet_bytes_written = opus_write_pointer - output_buffer;
 
+    int64_t const start = gps_time_ns();
     int const opus_output_bytes = opus_encode_float(sp->opus,
-						    sp->audio_buffer,
+						    &sp->audio_buffer[sp->audio_read_index],
 						    frame_size,  // Number of uncompressed *stereo* samples per frame
 						    opus_write_pointer,
-						    sizeof(output_buffer) - packet_bytes_written); // Max # bytes in compressed output buffer
+						    OPUS_MAXPKT - packet_bytes_written); // Max # bytes in compressed output buffer
+    int64_t const t = gps_time_ns() - start;
+    w->stats.frames++;
+    w->stats.encode_ns += t;
+    if(t > w->stats.max_encode_ns)
+      w->stats.max_encode_ns = t;
     packet_bytes_written += opus_output_bytes;
 
-    if(!Discontinuous || opus_output_bytes > 2){
-      // ship it
-      if(sendto(Output_fd,output_buffer,packet_bytes_written,0,(struct sockaddr *)&Opus_out_socket,sizeof(struct sockaddr)) < 0)
-	return -1;
-      Output_packets++; // all sessions
+    if(opus_output_bytes > 0 && (!Discontinuous || opus_output_bytes > 2)){
+      // ship it with the rest of the batch
+      w->iov[w->nout].iov_len = packet_bytes_written;
+      w->owner[w->nout] = sp;
+      if(++w->nout == SEND_BATCH)
+	flush_output(w);
       sp->rtp_state_out.seq++; // Increment only if packet is sent
       sp->rtp_state_out.bytes += opus_output_bytes;
       sp->rtp_state_out.packets++;
@@ -686,11 +748,132 @@ int send_samples(struct session * const sp){
       sp->silence = true;
 
     sp->rtp_state_out.timestamp += frame_size * 48000 / sp->samprate; // Always increase timestamp by virtual 48k sample rate
-    const int remaining_bytes = sizeof(sp->audio_buffer[0]) * (sp->audio_write_index - sp->channels * frame_size);
-    assert(remaining_bytes >= 0);
-    memmove(sp->audio_buffer,&sp->audio_buffer[sp->channels * frame_size],remaining_bytes);
-    sp->audio_write_index -= frame_size * sp->channels;
+    sp->audio_read_index += frame_size * sp->channels;
+    assert(sp->audio_read_index <= sp->audio_write_index);
+    if(sp->audio_read_index == sp->audio_write_index)
+      sp->audio_read_index = sp->audio_write_index = 0; // Usually, since packets are normally one Opus frame
     pcm_samples_written += frame_size * sp->channels;
   }
   return pcm_samples_written;
 }
+
+// Send the worker's batch of Opus packets, then release the sessions held for it
+static void flush_output(struct worker * const w){
+  if(w->nout == 0)
+    return;
+  int sent = 0;
+#ifdef __linux__
+  while(sent < w->nout){
+    for(int i=sent; i < w->nout; i++){
+      w->iov[i].iov_base = w->out[i];
+      memset(&w->msgs[i].msg_hdr,0,sizeof(w->msgs[i].msg_hdr));
+      w->msgs[i].msg_hdr.msg_name = &Opus_out_socket;
+      w->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr);
+      w->msgs[i].msg_hdr.msg_iov = &w->iov[i];
+      w->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int const r = sendmmsg(Output_fd,&w->msgs[sent],w->nout - sent,0);
+    w->stats.sends++;
+    if(r <= 0){
+      // Socket is non-blocking, so just drop the rest instead of holding up real time
+      w->stats.send_errors += w->nout - sent;
+      break;
+    }
+    sent += r;
+  }
+#else
+  for(int i=0; i < w->nout; i++){
+    w->stats.sends++;
+    if(sendto(Output_fd,w->out[i],w->iov[i].iov_len,0,(struct sockaddr *)&Opus_out_socket,sizeof(struct sockaddr)) < 0)
+      w->stats.send_errors++;
+    else
+      sent++;
+  }
+#endif
+  w->stats.packets += sent;
+  __atomic_fetch_add(&Output_packets,sent,__ATOMIC_RELAXED); // all sessions
+  w->nout = 0;
+
+  if(w->nheld == 0)
+    return;
+  int64_t const now = gps_time_ns();
+  int queued = 0;
+  pthread_mutex_lock(&Ready_mutex);
+  for(int i=0; i < w->nheld; i++){
+    struct session * const sp = w->held[i];
+    if(!sp->more){
+      sp->scheduled = false;
+      continue;
+    }
+    // The input thread skipped it while we held it; queue it again, still scheduled
+    sp->ready_time = now;
+    sp->ready_next = NULL;
+    if(Ready_tail != NULL)
+      Ready_tail->ready_next = sp;
+    else
+      Ready_head = sp;
+    Ready_tail = sp;
+    queued++;
+  }
+  if(queued == 1)
+    pthread_cond_signal(&Ready_cond);
+  else if(queued > 1)
+    pthread_cond_broadcast(&Ready_cond);
+  pthread_mutex_unlock(&Ready_mutex);
+  w->nheld = 0;
+}
+
+// Close sessions that have had no input for IDLE_TIMEOUT seconds
+// Only the input thread creates and closes sessions, and a worker never touches one that isn't scheduled
+static void close_idle_sessions(int64_t const now){
+  struct session *next;
+  for(struct session *sp = Sessions; sp != NULL; sp = next){
+    next = sp->next;
+    if(now - sp->last_active < IDLE_TIMEOUT * BILLION)
+      continue;
+    pthread_mutex_lock(&Ready_mutex);
+    bool const busy = sp->scheduled;
+    pthread_mutex_unlock(&Ready_mutex);
+    if(!busy)
+      close_session(&sp);
+  }
+}
+
+// Encoder pool statistics since the last call
+// Worker counters are read without locking; they're only statistics
+static void print_stats(int64_t const now){
+  static struct pool_stats last;
+  static int64_t last_time;
+  struct pool_stats total;
+  memset(&total,0,sizeof(total));
+  for(int i=0; i < Nworkers; i++){
+    struct pool_stats const * const w = &Workers[i].stats;
+    total.runs += w->runs;
+    total.wait_ns += w->wait_ns;
+    total.busy_ns += w->busy_ns;
+    total.frames += w->frames;
+    total.encode_ns += w->encode_ns;
+    total.packets += w->packets;
+    total.sends += w->sends;
+    total.send_errors += w->send_errors;
+    if(w->max_encode_ns > total.max_encode_ns)
+      total.max_encode_ns = w->max_encode_ns;
+  }
+  int nsessions = 0;
+  for(struct session const *sp = Sessions; sp != NULL; sp = sp->next)
+    nsessions++;
+
+  if(last_time != 0){
+    uint64_t const frames = total.frames - last.frames;
+    uint64_t const runs = total.runs - last.runs;
+    fprintf(stderr,"%s: %d sessions, %d workers %.1f%% busy; %'llu frames, encode %.3f ms mean, %.3f ms max; %'llu runs, queue wait %.3f ms mean; %'llu packets in %'llu sends, %'llu dropped\n",
+	    App_path,nsessions,Nworkers,
+	    100.0 * (total.busy_ns - last.busy_ns) / ((double)(now - last_time) * Nworkers),
+	    (unsigned long long)frames,frames > 0 ? 1e-6 * (total.encode_ns - last.encode_ns) / frames : 0.0,1e-6 * total.max_encode_ns,
+	    (unsigned long long)runs,runs > 0 ? 1e-6 * (total.wait_ns - last.wait_ns) / runs : 0.0,
+	    (unsigned long long)(total.packets - last.packets),(unsigned long long)(total.sends - last.sends),
+	    (unsigned long long)(total.send_errors - last.send_errors));
+  }
+  last = total;
+  last_time = now;
+}
@@ -16,23 +16,16 @@
 #include <getopt.h>
 #include <sysexits.h>
 
-#include "osc.h"
 #include "filter.h"
 #include "misc.h"
 #include "multicast.h"
+#include "rtp_recv.h"
 #include "ax25.h"
+#include "afsk.h"
 #include "status.h"
 #include "avahi.h"
 
-struct hdlc {
-  uint8_t frame[16384];
-  int frame_bits;
-  int flag_seen;
-  int last_bits;
-};
-static int hdlc_process(struct hdlc *hp,int bit);
-
-// Needs to be redone with common RTP receiver module
+// One per input stream, found by SSRC in Session_table; Session lists them all
 struct session {
   struct session *next; 
   
@@ -43,14 +36,13 @@ struct session {
 
   pthread_t decode_thread;
   unsigned int decoded_packets;
-  struct hdlc hdlc;
+  struct afsk afsk;
 };
 
 // Config constants
 #define MAX_MCAST 20          // Maximum number of multicast addresses
 static float const SCALE = 1./32768;
 static int const AL = 960; // 20 ms @ 48 kHz = 1x 20 ms blocks = 24 bit times @ 1200 bps
-static int const AM = 961;
 static float Bitrate = 1200;
 
 // Command line params
@@ -72,6 +64,7 @@ static int Status_fd = -1;
 static int Status_out_fd = -1; // Not used yet
 #endif
 static struct session *Session;
+static struct session_table Session_table; // Keyed on SSRC alone
 static pthread_mutex_t Output_mutex = PTHREAD_MUTEX_INITIALIZER;
 struct sockaddr_storage Status_dest_address;
 struct sockaddr_storage Status_input_source_address;
@@ -85,6 +78,7 @@ static int close_session(struct session *sp);
 #endif
 static void *input(void *arg);
 static void *decode_task(void *arg);
+static void output_frame(void *arg,uint8_t const *frame,int bytes);
 static void printtime(FILE *fp);
 
 static struct option Options[] =
@@ -324,10 +318,12 @@ int main(int argc,char *argv[]){
 // audio input thread
 // Receive audio multicasts, multiplex into sessions
 static void *input(void *arg){
-
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1 || session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    return NULL;
+  }
   while(true){
-    struct rtp_header rtp_hdr;
-    struct sockaddr sender;
 
     // Wait for traffic to arrive
     fd_set fdset = Fdset_template;
@@ -341,86 +337,75 @@ static void *input(void *arg){
       if(Input_fd[fd_index] == -1 || !FD_ISSET(Input_fd[fd_index],&fdset))
 	continue;
 
-      uint8_t buffer[PKTSIZE];
-      socklen_t socksize = sizeof(sender);
-      int size = recvfrom(Input_fd[fd_index],buffer,sizeof(buffer),0,&sender,&socksize);
-      if(size == -1){
+      int const n = rtp_recv(&receiver,Input_fd[fd_index]);
+      if(n == -1){
 	if(errno != EINTR){ // Happens routinely
-	  perror("recvfrom");
+	  perror("recvmmsg");
 	  usleep(1000); // avoid tight loop
 	}
 	continue;
       }
-      if(size < RTP_MIN_SIZE)
-	continue; // Too small to be valid RTP
-
-      // Extract RTP header
-      uint8_t const *dp = buffer;
-      dp = ntoh_rtp(&rtp_hdr,dp);
-      size -= dp - buffer;
-      
-      if(rtp_hdr.pad){
-	// Remove padding
-	size -= dp[size-1];
-	rtp_hdr.pad = 0;
-      }
-      if(size < 0)
-	continue; // garbled RTP header?
-      
-      // Should distinguish between these with different filter balances
-      if(channels_from_pt(rtp_hdr.type) != 1)
-	continue; // Only mono PCM for now
+      for(int i=0; i < n; i++){
+	struct rtp_packet const * const pkt = &receiver.pkt[i];
+	struct rtp_header const rtp_hdr = pkt->rtp;
+	uint8_t const *dp = pkt->data;
+	int const size = pkt->len;
+
+	// Should distinguish between these with different filter balances
+	if(channels_from_pt(rtp_hdr.type) != 1)
+	  continue; // Only mono PCM for now
       
-      struct session *sp = lookup_session(rtp_hdr.ssrc);
-      if(sp == NULL){
-	// Not found
-	if((sp = create_session(rtp_hdr.ssrc)) == NULL){
-	  printtime(stdout);
-	  fprintf(stdout," No room for new session ssrc %u\n",rtp_hdr.ssrc);
-	  fflush(stdout);
-	  continue;
-	}
-	sp->rtp_state_out.ssrc = sp->rtp_state_in.ssrc = rtp_hdr.ssrc;
-	// Extract sample rate (what it if later changes??)
-	sp->samprate = samprate_from_pt(rtp_hdr.type);
-	int fildes[2];
-	if(pipe(fildes) != 0){
-	  if(Verbose)
-	    perror("pipe() failed");
-	  continue;
+	struct session *sp = lookup_session(rtp_hdr.ssrc);
+	if(sp == NULL){
+	  // Not found
+	  if((sp = create_session(rtp_hdr.ssrc)) == NULL){
+	    printtime(stdout);
+	    fprintf(stdout," No room for new session ssrc %u\n",rtp_hdr.ssrc);
+	    fflush(stdout);
+	    continue;
+	  }
+	  sp->rtp_state_out.ssrc = sp->rtp_state_in.ssrc = rtp_hdr.ssrc;
+	  // Extract sample rate (what it if later changes??)
+	  sp->samprate = samprate_from_pt(rtp_hdr.type);
+	  int fildes[2];
+	  if(pipe(fildes) != 0){
+	    if(Verbose)
+	      perror("pipe() failed");
+	    continue;
+	  }
+	  sp->read_fd = fildes[0]; sp->write_fd = fildes[1];
+
+	  pthread_create(&sp->decode_thread,NULL,decode_task,sp); // One decode thread per stream
+	  if(Verbose){
+	    printtime(stdout);
+	    fprintf(stdout," New session from %s, ssrc %u\n",formatsock(&pkt->sender),sp->rtp_state_in.ssrc);
+	    fflush(stdout);
+	  }
 	}
-	sp->read_fd = fildes[0]; sp->write_fd = fildes[1];
+	int const sample_count = size / sizeof(int16_t); // 16-bit sample count
+	int skipped_samples = rtp_process(&sp->rtp_state_in,&rtp_hdr,sample_count);
+	if(rtp_hdr.marker)
+	  skipped_samples = 0; // Ignore samples skipped before mark
 
-	pthread_create(&sp->decode_thread,NULL,decode_task,sp); // One decode thread per stream
-	if(Verbose){
+	if(Verbose && skipped_samples != 0){
 	  printtime(stdout);
-	  fprintf(stdout," New session from %s, ssrc %u\n",formatsock(&sender),sp->rtp_state_in.ssrc);
-	  fflush(stdout);
+	  fprintf(stdout," skipped samples %d\n",skipped_samples); fflush(stdout);
 	}
+	if(skipped_samples < 0)
+	  continue;	// Drop probable duplicate(s)
+
+	if(skipped_samples > 0){
+	  // Don't worry too much about skipped samples right now
+	  // There's no FEC, and enough are probably dropped that sync wouldn't be maintained anyway
+	  int max_skip = min(skipped_samples,1920); // Pad only a short interruption, max
+	  int16_t zeroes[max_skip];
+	  memset(zeroes,0,sizeof(zeroes));
+	  if(write(sp->write_fd,zeroes,sizeof(zeroes)) != sizeof(zeroes))
+	    perror("write zeroes");
+	}
+	if(write(sp->write_fd,dp,sample_count * sizeof(int16_t)) != sample_count * sizeof(int16_t))
+	  perror("write samples");
       }
-      int const sample_count = size / sizeof(int16_t); // 16-bit sample count
-      int skipped_samples = rtp_process(&sp->rtp_state_in,&rtp_hdr,sample_count);
-      if(rtp_hdr.marker)
-	skipped_samples = 0; // Ignore samples skipped before mark
-
-      if(Verbose && skipped_samples != 0){
-	printtime(stdout);
-	fprintf(stdout," skipped samples %d\n",skipped_samples); fflush(stdout);
-      }
-      if(skipped_samples < 0)
-	continue;	// Drop probable duplicate(s)
-
-      if(skipped_samples > 0){
-	// Don't worry too much about skipped samples right now
-	// There's no FEC, and enough are probably dropped that sync wouldn't be maintained anyway
-	int max_skip = min(skipped_samples,1920); // Pad only a short interruption, max
-	int16_t zeroes[max_skip];
-	memset(zeroes,0,sizeof(zeroes));
-	if(write(sp->write_fd,zeroes,sizeof(zeroes)) != sizeof(zeroes))
-	  perror("write zeroes");
-      }
-      if(write(sp->write_fd,dp,sample_count * sizeof(int16_t)) != sample_count * sizeof(int16_t))
-	perror("write samples");
     }
   }
   return NULL; // Never gets here
@@ -430,13 +415,7 @@ static void *input(void *arg){
 
 // Find existing session in table, if it exists
 static struct session *lookup_session(const uint32_t ssrc){
-  struct session *sp;
-  for(sp = Session; sp != NULL; sp = sp->next){
-    if(sp->rtp_state_in.ssrc == ssrc)
-      // Found it
-      return sp;
-  }
-  return NULL;
+  return session_lookup(&Session_table,NULL,ssrc);
 }
 
 // Create a new session, partly initialize
@@ -448,9 +427,10 @@ static struct session *create_session(uint32_t ssrc){
   
   sp->rtp_state_in.ssrc = ssrc;
 
-  // Put at head of bucket chain
+  // Put at head of the list of all sessions; Session_table finds it by SSRC
   sp->next = Session;
   Session = sp;
+  session_insert(&Session_table,NULL,ssrc,sp);
   return sp;
 }
 
@@ -482,43 +462,18 @@ const float space_tone = 2200;
 
 // AFSK demod
 static void *decode_task(void *arg){
-  float const twist = mark_tone/space_tone; // Scale back upper tone from FM demod
-
   pthread_setname("afsk");
   struct session *sp = (struct session *)arg;
   assert(sp != NULL);
 
-  struct filter_in filter_in;
-  create_filter_input(&filter_in,AL,AM,REAL);
-  struct filter_out filter_out;
-  create_filter_output(&filter_out,&filter_in,NULL,AL,COMPLEX);
-  const float filter_low = min(mark_tone,space_tone) - Bitrate/4;
-  const float filter_high = max(mark_tone,space_tone) + Bitrate/4;
-  set_filter(&filter_out,filter_low/sp->samprate,filter_high/sp->samprate,3.0); // Creates analytic, band-limited signal
-
-  // Tone replica generators (-1200 and -2200 Hz)
-  struct osc mark;
-  memset(&mark,0,sizeof(mark));
-  set_osc(&mark,-mark_tone/sp->samprate, 0.0);
-  
-  struct osc space;
-  memset(&space,0,sizeof(space));
-  set_osc(&space,-space_tone/sp->samprate, 0.0);  
-    
-  int samppbit = sp->samprate / Bitrate;
-
-  // Tone integrators
-  int symphase = 0;
-  float complex mark_accum = 0; // On-time
-  float complex space_accum = 0;
-  float complex mark_offset_accum = 0; // Straddles previous zero crossing
-  float complex space_offset_accum = 0;
-  float last_val = 0;  // Last on-time symbol
-  float mid_val = 0;   // Last zero crossing symbol
-
+  if(afsk_init(&sp->afsk,sp->samprate,Bitrate,mark_tone,space_tone,output_frame,sp) != 0){
+    fprintf(stderr,"ssrc %u: can't create AFSK demodulator\n",sp->rtp_state_in.ssrc);
+    return NULL;
+  }
   FILE *fp = fdopen(sp->read_fd,"r");
   if(fp == NULL){
     perror("fdopen");
+    afsk_free(&sp->afsk);
     return NULL;
   }
 
@@ -543,141 +498,47 @@ static void *decode_task(void *arg){
       if(!nonzero)
 	pad = 5; // flush filters with 5 blocks of padding
     }
-
-    assert(filter_in.ilen == AL);
-    assert(filter_out.olen == AL);
-    for(int n=0; n < AL; n++){
-      if(put_rfilter(&filter_in,ntohs(samples[n]) * SCALE) == 0)
-	continue;
-      execute_filter_output(&filter_out,0);    // Shouldn't block
-      for(int n=0; n<filter_out.olen; n++){
-	// Spin down by mark and space frequencies, accumulate each in boxcar (comb) filters
-	// Mark and space each have in-phase and offset integrators for timing recovery
-	float complex s;
-	s = filter_out.output.c[n] * step_osc(&mark);
-	mark_accum += s;
-	mark_offset_accum += s;
-	
-	s = filter_out.output.c[n] * step_osc(&space);
-	space_accum += s;
-	space_offset_accum += s;
-	
-	if(++symphase == samppbit/2){
-	  // Finish offset integrator and reset
-	  mid_val = cnrmf(mark_offset_accum) - twist * cnrmf(space_offset_accum);
-	  mark_offset_accum = space_offset_accum = 0;
-	}
-	if(symphase < samppbit)
-	  continue;
-	
-	// Finished whole bit
-	float const cur_val = cnrmf(mark_accum) - twist * cnrmf(space_accum);
-	mark_accum = space_accum = 0;
-	
-	if(cur_val * last_val >= 0){ // cur_val and last_val have same sign; no transition
-	  // No transition == NRZI one
-	  symphase = 0;
-	  hdlc_process(&sp->hdlc,1); // Frame can't end with 1-bit, so don't check return
-	} else {	// transition occurred --> NRZI zero
-	  symphase = ((cur_val - last_val) * mid_val) > 0 ? +1 : -1;	// Gardner-style clock adjust
-	  int const bytes = hdlc_process(&sp->hdlc,0);
-	  if(Verbose && bytes < 0){
-	    // Lock output to prevent intermingled output
-	    pthread_mutex_lock(&Output_mutex);
-	    printtime(stdout);
-	    fprintf(stdout," ssrc %u CRC fail\n",sp->rtp_state_in.ssrc);
-	    fflush(stdout);
-	    pthread_mutex_unlock(&Output_mutex);
-	  } else if(bytes > 0){ // Valid frame
-	    if(Verbose){
-	      pthread_mutex_lock(&Output_mutex);
-	      printtime(stdout);
-	      fprintf(stdout," ssrc %u packet %d len %d:\n",sp->rtp_state_in.ssrc,sp->decoded_packets++,bytes);
-	      dump_frame(stdout,sp->hdlc.frame,bytes);
-	      fflush(stdout);
-	      pthread_mutex_unlock(&Output_mutex);
-	    } // Verbose
-	    struct rtp_header rtp_hdr;
-	    memset(&rtp_hdr,0,sizeof(rtp_hdr));
-	    rtp_hdr.version = 2;
-	    rtp_hdr.type = AX25_pt;
-	    rtp_hdr.seq = sp->rtp_state_out.seq++;
-	    // RTP timestamp??
-	    rtp_hdr.timestamp = sp->rtp_state_out.timestamp;
-	    sp->rtp_state_out.timestamp += bytes;
-	    rtp_hdr.ssrc = sp->rtp_state_out.ssrc;
-	    
-	    int const plen = bytes + 76 + 10; // Max RTP header is 76 bytes; allow a little slack
-	    uint8_t packet[plen],*dp;
-	    dp = packet;
-	    dp = hton_rtp(dp,&rtp_hdr);
-	    memcpy(dp,sp->hdlc.frame,bytes);
-	    sp->hdlc.frame_bits = 0;
-	    dp += bytes;
-	    send(Output_fd,packet,dp - packet,0); // Check return code?
-	    sp->rtp_state_out.packets++;
-	    sp->rtp_state_out.bytes += bytes;
-	  } // if(bytes > 0
-	}
-	last_val = cur_val;
-      }
-    }
+    float audio[AL];
+    ntohs_float(audio,samples,AL,SCALE);
+    afsk_process(&sp->afsk,audio,AL);
   }
+  afsk_free(&sp->afsk);
   return NULL;
 }
 
-// Process incoming HDLC bit
-// Return nonzero byte count if there's a complete valid frame
-// Caller recovers frame (including 2-byte CRC) in hp->frame, must set hp->frame_bits = 0 when done
-static int hdlc_process(struct hdlc *hp,int bit){
-  bit &= 1;
-
-  hp->last_bits <<= 1; // Note last_bits is big-endian, HDLC bytes are actually little-endian
-  hp->last_bits |= bit;
-  
-  if((hp->last_bits & 0xff) == 0x7e){
-    // 01111110 - Flag
-    int const bytes = (hp->frame_bits - 7) >> 3; // Don't count leading 7 bits of flag
-    if(hp->flag_seen && bytes > 2){
-      hp->frame_bits = 0;
-      if(crc_good(hp->frame,bytes)){
-	return bytes; // Caller must set frame_bits to 0 when done
-      } else
-	return -1;
-    }
-    hp->frame_bits = 0;
-    hp->flag_seen = 1;
-    return 0;
-  }
-  if(!hp->flag_seen)
-    return 0; // Nothing more to do until there's a flag
- 
-  if((hp->last_bits & 0x7f) == 0x7f){
-    // .1111111 - 7 consecutive 1's - abort
-    hp->frame_bits = 0;
-    hp->flag_seen = 0; // Do nothing else until we see a flag again
-    return 0;
-  } else if((hp->last_bits & 0x3f) == 0x3e){
-    // ..111110 - drop stuffed zero
-    return 0;
-  }
-  // Add bit to frame
-  if(hp->frame_bits > sizeof(hp->frame) << 3){
-    // Too long; abort
-    hp->frame_bits = 0;
-    hp->flag_seen = 0;
-    return 0;
-  }
-  // Clear each new byte
-  if((hp->frame_bits & 7) == 0)
-    hp->frame[hp->frame_bits >> 3] = 0;
-
-  // Write bit in little-endian order
-  hp->frame[hp->frame_bits >> 3] |= bit << (hp->frame_bits & 7);
-  hp->frame_bits++;
-
-  return 0;
+// Called by the demodulator with each good frame, once even if several slicers decoded it
+static void output_frame(void *arg,uint8_t const *frame,int bytes){
+  struct session * const sp = arg;
+  if(Verbose){
+    // Lock output to prevent intermingled output
+    pthread_mutex_lock(&Output_mutex);
+    printtime(stdout);
+    fprintf(stdout," ssrc %u packet %d len %d:\n",sp->rtp_state_in.ssrc,sp->decoded_packets++,bytes);
+    dump_frame(stdout,(uint8_t *)frame,bytes);
+    fflush(stdout);
+    pthread_mutex_unlock(&Output_mutex);
+  } // Verbose
+  struct rtp_header rtp_hdr;
+  memset(&rtp_hdr,0,sizeof(rtp_hdr));
+  rtp_hdr.version = 2;
+  rtp_hdr.type = AX25_pt;
+  rtp_hdr.seq = sp->rtp_state_out.seq++;
+  // RTP timestamp??
+  rtp_hdr.timestamp = sp->rtp_state_out.timestamp;
+  sp->rtp_state_out.timestamp += bytes;
+  rtp_hdr.ssrc = sp->rtp_state_out.ssrc;
+
+  int const plen = bytes + 76 + 10; // Max RTP header is 76 bytes; allow a little slack
+  uint8_t packet[plen],*dp;
+  dp = packet;
+  dp = hton_rtp(dp,&rtp_hdr);
+  memcpy(dp,frame,bytes);
+  dp += bytes;
+  send(Output_fd,packet,dp - packet,0); // Check return code?
+  sp->rtp_state_out.packets++;
+  sp->rtp_state_out.bytes += bytes;
 }
+
 void printtime(FILE *fp){
   char result[1024];
   format_gpstime(result,sizeof(result),gps_time_ns());
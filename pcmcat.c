@@ -21,12 +21,13 @@
 
 #include "misc.h"
 #include "multicast.h"
+#include "rtp_recv.h"
 
 struct pcmstream {
   uint32_t ssrc;            // RTP Sending Source ID
   int type;                 // RTP type (10,11,20)
   
-  struct sockaddr sender;
+  struct sockaddr_storage sender;
   char addr[NI_MAXHOST];    // RTP Sender IP address
   char port[NI_MAXSERV];    // RTP Sender source port
   int framesize;            // Bytes per timestamp increment
@@ -47,7 +48,7 @@ static int Input_fd = -1;
 static struct pcmstream Pcmstream;
 static uint32_t Ssrc; // Requested SSRC
 
-static int init(struct pcmstream *pc,struct rtp_header const *rtp,struct sockaddr const *sender);
+static int init(struct pcmstream *pc,struct rtp_header const *rtp,void const *sender);
 
 int main(int argc,char *argv[]){
   App_path = argv[0];
@@ -91,129 +92,128 @@ int main(int argc,char *argv[]){
 	    Mcast_address_text);
     exit(EX_USAGE);
   }
-
+  // Have the kernel drop the other channels on the group
+  if(Ssrc != 0 && set_ssrc_filter(Input_fd,&Ssrc,1) != 0 && Verbose)
+    perror("set_ssrc_filter");
 
   // audio input thread
   // Receive audio multicasts, multiplex into sessions, send to output
   // What do we do if we get different streams?? think about this
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(EX_OSERR);
+  }
   while(true){
-    struct sockaddr sender;
-    socklen_t socksize = sizeof(sender);
-    uint8_t buffer[PKTSIZE];
     // Gets all packets to multicast destination address, regardless of sender IP, sender port, dest port, ssrc
-    int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&sender,&socksize);
-    if(size == -1){
+    int const n = rtp_recv(&receiver,Input_fd);
+    if(n == -1){
       if(errno != EINTR){ // Happens routinely
-	perror("recvmsg");
+	perror("recvmmsg");
 	usleep(1000);
       }
       continue;
     }
-    if(size < RTP_MIN_SIZE)
-      continue; // Too small to be valid RTP
-
-    struct rtp_header rtp;
-    uint8_t const *dp = ntoh_rtp(&rtp,buffer);
-
-    size -= dp - buffer;
-    if(rtp.pad){
-      // Remove padding
-      size -= dp[size-1];
-      rtp.pad = 0;
-    }
-    if(size <= 0)
-      continue;
-
-    if(rtp.ssrc == 0 || (Ssrc != 0 && rtp.ssrc != Ssrc))
-       continue; // Ignore unwanted or invalid SSRCs
-
-    if(Pcmstream.ssrc == 0){
-      // First packet on stream, initialize
-      init(&Pcmstream,&rtp,&sender);
+    for(int i=0; i < n; i++){
+      struct rtp_header const rtp = receiver.pkt[i].rtp;
+      struct sockaddr_storage const * const sender = &receiver.pkt[i].sender;
+      uint8_t const *dp = receiver.pkt[i].data;
+      int const size = receiver.pkt[i].len;
+
+      if(rtp.ssrc == 0 || (Ssrc != 0 && rtp.ssrc != Ssrc))
+	 continue; // Ignore unwanted or invalid SSRCs
+
+      if(Pcmstream.ssrc == 0){
+	// First packet on stream, initialize
+	init(&Pcmstream,&rtp,sender);
+	// Now locked to this stream, so the rest needn't be delivered at all
+	if(Ssrc == 0 && set_ssrc_filter(Input_fd,&Pcmstream.ssrc,1) != 0 && Verbose)
+	  perror("set_ssrc_filter");
       
-      if(!Quiet){
-	fprintf(stderr,"New session from %u@%s:%s, payload type %d\n",
-		Pcmstream.ssrc,
-		Pcmstream.addr,
-		Pcmstream.port,
-		rtp.type);
-      }
-    } else if(rtp.ssrc != Pcmstream.ssrc)
-      continue; // unwanted SSRC, ignore
-
-    if(!address_match(&sender,&Pcmstream.sender) || getportnumber(&Pcmstream.sender) != getportnumber(&sender)){
-      // Source changed, the sender restarted
-      init(&Pcmstream,&rtp,&sender);
-      if(!Quiet){
-	fprintf(stderr,"Session restart from %u@%s:%s\n",
-		Pcmstream.ssrc,
-		Pcmstream.addr,
-		Pcmstream.port);
+	if(!Quiet){
+	  fprintf(stderr,"New session from %u@%s:%s, payload type %d\n",
+		  Pcmstream.ssrc,
+		  Pcmstream.addr,
+		  Pcmstream.port,
+		  rtp.type);
+	}
+      } else if(rtp.ssrc != Pcmstream.ssrc)
+	continue; // unwanted SSRC, ignore
+
+      if(!address_match(sender,&Pcmstream.sender) || getportnumber(&Pcmstream.sender) != getportnumber(sender)){
+	// Source changed, the sender restarted
+	init(&Pcmstream,&rtp,sender);
+	if(!Quiet){
+	  fprintf(stderr,"Session restart from %u@%s:%s\n",
+		  Pcmstream.ssrc,
+		  Pcmstream.addr,
+		  Pcmstream.port);
+	}
       }
-    }
-    if(!rtp.marker){
-      // Change in sequence number from last RTP packet
-      int seq_change = (int16_t)(rtp.seq - Pcmstream.last_header.seq);
-
-      if(seq_change == 1){
-	// Normal case: next expected packet in sequence
-	if(rtp.timestamp != Pcmstream.last_header.timestamp){
-	  // There's no marker, this packet is in sequence after the last one, we now know bytes per timestamp count
-	  int new_framesize = Pcmstream.last_size / (int32_t)(rtp.timestamp - Pcmstream.last_header.timestamp);
-	  if(new_framesize != Pcmstream.framesize){
-	    Pcmstream.framesize = new_framesize;
-	    if(!Quiet){
-	      fprintf(stderr,"%d bytes/Timestamp count\n",Pcmstream.framesize);
+      if(!rtp.marker){
+	// Change in sequence number from last RTP packet
+	int seq_change = (int16_t)(rtp.seq - Pcmstream.last_header.seq);
+
+	if(seq_change == 1){
+	  // Normal case: next expected packet in sequence
+	  if(rtp.timestamp != Pcmstream.last_header.timestamp){
+	    // There's no marker, this packet is in sequence after the last one, we now know bytes per timestamp count
+	    int new_framesize = Pcmstream.last_size / (int32_t)(rtp.timestamp - Pcmstream.last_header.timestamp);
+	    if(new_framesize != Pcmstream.framesize){
+	      Pcmstream.framesize = new_framesize;
+	      if(!Quiet){
+		fprintf(stderr,"%d bytes/Timestamp count\n",Pcmstream.framesize);
+	      }
 	    }
 	  }
+	} else if(seq_change > 1){
+	  // Something got dropped. Emit some padding if it's not too much and we know the framesize
+	  // This will get invoked on the first packet, but nothing will happen because Pcmstream.framesize == 0
+	  int time_step = (int32_t)(rtp.timestamp - Pcmstream.last_header.timestamp) - Pcmstream.last_size;
+	  if(!Quiet && Pcmstream.framesize != 0)
+	    fprintf(stderr,"dropped packet, expected seq %d, got seq %d, lost %d frames\n",
+		    (int16_t)(Pcmstream.last_header.seq+1),rtp.seq,
+		    time_step);
+
+	  if(Pcmstream.framesize != 0 && time_step >= 0 && time_step < 48000){  // arbitrary, make this a parameter
+	    char zeroes[Pcmstream.framesize * time_step];
+	    memset(zeroes,0,sizeof(zeroes));
+	    fwrite(zeroes,1,sizeof(zeroes),stdout);
+	  }
+	} else {
+	  // Else drop duplicate or old out of sequence - should buffer these under user control
+	  if(!Quiet)
+	    fprintf(stderr,"Discarding old packet, expected seq %d, got seq %d, timestamp %ul, size %d bytes, %d frames\n",
+		    (int16_t)(Pcmstream.last_header.seq+1), rtp.seq, rtp.timestamp, size,size*Pcmstream.last_size);
+	  goto done;
 	}
-      } else if(seq_change > 1){
-	// Something got dropped. Emit some padding if it's not too much and we know the framesize
-	// This will get invoked on the first packet, but nothing will happen because Pcmstream.framesize == 0
-	int time_step = (int32_t)(rtp.timestamp - Pcmstream.last_header.timestamp) - Pcmstream.last_size;
-	if(!Quiet && Pcmstream.framesize != 0)
-	  fprintf(stderr,"dropped packet, expected seq %d, got seq %d, lost %d frames\n",
-		  (int16_t)(Pcmstream.last_header.seq+1),rtp.seq,
-		  time_step);
-
-	if(Pcmstream.framesize != 0 && time_step >= 0 && time_step < 48000){  // arbitrary, make this a parameter
-	  char zeroes[Pcmstream.framesize * time_step];
-	  memset(zeroes,0,sizeof(zeroes));
-	  fwrite(zeroes,1,sizeof(zeroes),stdout);
-	}
-      } else {
-	// Else drop duplicate or old out of sequence - should buffer these under user control
-	if(!Quiet)
-	  fprintf(stderr,"Discarding old packet, expected seq %d, got seq %d, timestamp %ul, size %d bytes, %d frames\n",
-		  (int16_t)(Pcmstream.last_header.seq+1), rtp.seq, rtp.timestamp, size,size*Pcmstream.last_size);
-	goto done;
       }
-    }
-    if(Byteswap){
-      // Byte swap incoming buffer
-      int16_t *sdp = (int16_t *)dp;
-      if(!Quiet){
-	if(size & 1){
-	  fprintf(stderr,"size %d not even!\n",size);
+      if(Byteswap){
+	// Byte swap incoming buffer
+	int16_t *sdp = (int16_t *)dp;
+	if(!Quiet){
+	  if(size & 1){
+	    fprintf(stderr,"size %d not even!\n",size);
+	  }
 	}
-      }
-      int sampcount = size / 2;
-
-      for(int i=0; i < sampcount; i++)
-	sdp[i] = ntohs(sdp[i]);
-      fwrite(sdp,sizeof(*sdp),sampcount,stdout);
-    } else
-      fwrite(dp,size,1,stdout);
-
-    fflush(stdout);
-  done:;
-    Pcmstream.bytes_received += size;
-    Pcmstream.last_header = rtp;
-    Pcmstream.last_size = size;
+	int sampcount = size / 2;
+
+	for(int k=0; k < sampcount; k++)
+	  sdp[k] = ntohs(sdp[k]);
+	fwrite(sdp,sizeof(*sdp),sampcount,stdout);
+      } else
+	fwrite(dp,size,1,stdout);
+
+      fflush(stdout);
+    done:;
+      Pcmstream.bytes_received += size;
+      Pcmstream.last_header = rtp;
+      Pcmstream.last_size = size;
+    }
   }
   exit(0); // Not reached
 }
-static int init(struct pcmstream *pc,struct rtp_header const *rtp,struct sockaddr const *sender){
+static int init(struct pcmstream *pc,struct rtp_header const *rtp,void const *sender){
   // First packet on stream, initialize
   pc->ssrc = rtp->ssrc;
   pc->type = rtp->type;
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <string.h>
+#include <pthread.h>
 #if defined(linux)
 #include <bsd/string.h>
 #include <byteswap.h>
@@ -12,6 +13,7 @@
 #define bswap_16(value) ((((value) & 0xff) << 8) | ((value) >> 8)) // hopefully gets optimized
 #endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <locale.h>
@@ -24,10 +26,17 @@
 #include "misc.h"
 #include "attr.h"
 #include "multicast.h"
-
-// size of stdio buffer for disk I/O
-// This should be large to minimize write calls, but how big?
-#define BUFFERSIZE (1<<20)
+#include "rtp_recv.h"
+
+// Disk I/O is done by writer threads so a slow disk or file server can't stall packet reception
+// The receive thread byte swaps samples into file-aligned blocks and queues each one as it fills;
+// each session belongs to one writer, which writes its blocks in order with pwrite()
+#define WRITE_BLOCK (128*1024)   // Bytes per block; a multiple of DIRECT_ALIGN
+#define DIRECT_ALIGN 4096        // Offset and length alignment for O_DIRECT
+#define HEADER_INTERVAL 10       // Seconds between .wav header updates, so a crash leaves a usable file
+#define PREALLOC_TIME 60         // Seconds of audio to fallocate() at a time
+#define STATS_INTERVAL 60        // Seconds between writer statistics with -v
+#define MAX_WRITERS 16
 
 // Simplified .wav file header
 // http://soundfile.sapp.org/doc/WaveFormat/
@@ -78,7 +87,7 @@ struct wav {
 struct session {
   struct session *prev;
   struct session *next;
-  struct sockaddr sender;      // Sender's IP address and source port
+  struct sockaddr_storage sender; // Sender's IP address and source port
 
   char filename[PATH_MAX];
   struct wav header;
@@ -90,9 +99,18 @@ struct session {
   int channels;                // 1 (PCM_MONO) or 2 (PCM_STEREO)
   unsigned int samprate;       // implicitly 48 kHz in PCM
 
-  FILE *fp;                    // File being recorded
-  void *iobuffer;              // Big buffer to reduce write rate
+  int fd;                      // File being recorded
+  bool direct;                 // Opened with O_DIRECT
+  int writer;                  // Writer thread handling this file
+  off_t offset;                // File position of the next sample
+  struct block *current;       // Block being filled
   int64_t last_active;         // gps time of last activity
+  int64_t last_header;         // gps time of last .wav header update
+  uint64_t dropped;            // Packets lost because the write queue was full
+  off_t expected;              // Final file size if known, for preallocation
+
+  // Owned by the writer thread
+  off_t allocated;             // fallocate()d so far
 
   bool substantial_file;       // At least one substantial segment has been seen
   int64_t current_segment_samples; // total samples in this segment without skips in timestamp
@@ -117,13 +135,56 @@ static uint32_t CenterFrequency=1115000;
 
 static int Input_fd;
 static struct session *Sessions;
+static struct session_table Session_table;
 static int64_t Timeout = 20; // 20 seconds max idle time before file close
+static volatile sig_atomic_t Terminate;
+
+// Unit of work for a writer: a block of a file, or (data == NULL) closing it
+struct block {
+  struct block *next;
+  struct session *sp;
+  off_t offset;                // File offset of data[0], a multiple of WRITE_BLOCK
+  int lo;                      // Range of data[] to write
+  int hi;
+  uint8_t *data;               // WRITE_BLOCK bytes, DIRECT_ALIGN aligned
+};
+
+static struct writer {
+  pthread_t thread;
+  pthread_cond_t cond;
+  struct block *head;
+  struct block *tail;
+} Writers[MAX_WRITERS];
+static int Nwriters = 1;
+static int Next_writer;
+static bool Direct;            // Open files with O_DIRECT
+static int64_t Queue_limit = 256LL << 20; // Bytes in blocks being filled or waiting to be written
+static bool Writers_exit;
+
+// Everything below, and the writer queues, protected by Write_mutex
+static pthread_mutex_t Write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct block *Free_blocks;
+static struct {
+  int64_t queued;              // Bytes of blocks in use
+  int64_t max_queued;
+  uint64_t writes;
+  uint64_t bytes;
+  int64_t write_ns;            // Total time in pwrite()
+  int64_t max_write_ns;
+  uint64_t errors;
+  uint64_t dropped;            // Packets lost because the queue was full
+} Stats;
 
 static void closedown(int a);
 static void input_loop(void);
 static void cleanup(void);
-static struct session *create_session(struct rtp_header const *, struct sockaddr const *sender);
+static struct session *create_session(struct rtp_header const *,void const *sender);
 static int close_file(struct session **spp);
+static void *writer(void *);
+static void finish_file(struct session *);
+static bool write_samples(struct session *,int16_t const *,int);
+static void queue_header(struct session *,bool final);
+static void print_stats(void);
 
 static struct option Options[] = {
   {"channels", required_argument, NULL, 'c'},
@@ -139,10 +200,13 @@ static struct option Options[] = {
   {"lengthlimit", required_argument, NULL, 'L'},
   {"limit", required_argument, NULL, 'L'},
   {"frequency", required_argument, NULL, 'f'},
+  {"direct", no_argument, NULL, 'D'},
+  {"queue", required_argument, NULL, 'Q'},
+  {"writers", required_argument, NULL, 'w'},
   {"version", no_argument, NULL, 'V'},
   {NULL, no_argument, NULL, 0},
 };
-static char Optstring[] = "c:d:l:m:r:st:vL:f:V";
+static char Optstring[] = "c:d:l:m:r:st:vL:f:DQ:w:V";
 
 int main(int argc,char *argv[]){
   App_path = argv[0];
@@ -189,11 +253,24 @@ int main(int argc,char *argv[]){
     case 'f':
        CenterFrequency = strtoul(optarg,NULL,0);
       break;
+    case 'D':
+      Direct = true;
+      break;
+    case 'Q':
+      Queue_limit = strtoll(optarg,NULL,0) << 20; // Megabytes
+      break;
+    case 'w':
+      Nwriters = strtol(optarg,NULL,0);
+      if(Nwriters < 1 || Nwriters > MAX_WRITERS){
+	fprintf(stderr,"Writers %d invalid, using 1\n",Nwriters);
+	Nwriters = 1;
+      }
+      break;
     case 'V':
       VERSION();
       exit(EX_OK);
     default:
-      fprintf(stderr,"Usage: %s [-c 1|2] [-s] [-d directory] [-l locale] [-L maxtime] [-t timeout] [-v] [-m sec] [-f freq] PCM_multicast_address\n",argv[0]);
+      fprintf(stderr,"Usage: %s [-c 1|2] [-s] [-d directory] [-l locale] [-L maxtime] [-t timeout] [-v] [-m sec] [-f freq] [-w writers] [-Q queue_MB] [-D] PCM_multicast_address\n",argv[0]);
       exit(EX_USAGE);
       break;
     }
@@ -235,28 +312,40 @@ int main(int argc,char *argv[]){
   signal(SIGTERM,closedown);
   signal(SIGPIPE,SIG_IGN);
 
+  // Writers block signals so they're taken by the receive thread
+  {
+    sigset_t set,old;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK,&set,&old);
+    for(int i=0; i < Nwriters; i++){
+      pthread_cond_init(&Writers[i].cond,NULL);
+      pthread_create(&Writers[i].thread,NULL,writer,&Writers[i]);
+    }
+    pthread_sigmask(SIG_SETMASK,&old,NULL);
+  }
   atexit(cleanup);
 
-  input_loop(); // Doesn't return
+  input_loop(); // Returns only on a signal or error
 
   exit(EX_OK);
 }
 
+// Just stop the receive loop; files are closed and the writers drained by cleanup() on exit
 static void closedown(int a){
-  if(Verbose)
-    fprintf(stderr,"%s: caught signal %d: %s\n",App_path,a,strsignal(a));
-
-  cleanup();
-  exit(EX_OK);  // Will call cleanup()
+  (void)a;
+  Terminate = 1;
 }
 
 // Read from RTP network socket, assemble blocks of samples
 static void input_loop(){
-
-  struct sockaddr sender;
-  while(true){
-    int64_t current_time = gps_time_ns();
-
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1 || session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(EX_OSERR);
+  }
+  int64_t next_scan = 0;
+  int64_t next_stats = gps_time_ns() + STATS_INTERVAL * BILLION;
+  while(!Terminate){
     // Receive data
     struct pollfd pfd[1];
     pfd[0].fd = Input_fd;
@@ -264,94 +353,77 @@ static void input_loop(){
     pfd[0].revents = 0;
     int const n = poll(pfd,sizeof(pfd)/sizeof(pfd[0]),1000); // Wait 1 sec max so we can scan active session list
     if(n < 0)
-      break; // error of some kind
+      break; // error of some kind, or a signal
+    int64_t const current_time = gps_time_ns();
     if(pfd[0].revents & (POLLIN|POLLPRI)){
-      uint8_t buffer[PKTSIZE];
-      socklen_t socksize = sizeof(sender);
-      int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&sender,&socksize);
-      if(size <= 0){    // ??
-	perror("recvfrom");
+      int const count = rtp_recv(&receiver,Input_fd);
+      if(count < 0){    // ??
+	perror("recvmmsg");
 	break; // Some sort of error, quit
       }
-      if(size < RTP_MIN_SIZE)
-	continue; // Too small for RTP, ignore
-
-      struct rtp_header rtp;
-      uint8_t const * const dp = ntoh_rtp(&rtp,buffer);
-      if(rtp.pad){
-	// Remove padding
-	size -= dp[size-1];
-	rtp.pad = 0;
-      }
-      if(size <= 0)
-	continue; // Bogus RTP header
-
-      int16_t const * const samples = (int16_t *)dp;
-      size -= (dp - buffer);
-
-      struct session *sp;
-      for(sp = Sessions;sp != NULL;sp=sp->next){
-	if(sp->ssrc == rtp.ssrc
-	   && rtp.type == sp->type
-	   && address_match(&sp->sender,&sender)
-	   && getportnumber(&sp->sender) == getportnumber(&sender))
-	  break;
-      }
-      if(sp == NULL){ // Not found; create new one
-	// Repeat this each time we create a session to ensure we're in the right directory.
-	// This might have failed on earlier attempts should we start before the fs is successfully mounted
-	if(strlen(Recordings) > 0 && chdir(Recordings) != 0){
-	  fprintf(stderr,"Can't change to directory %s: %s, exiting\n",Recordings,strerror(errno));
-	  exit(EX_CANTCREAT);
+      for(int i=0; i < count; i++){
+	struct rtp_packet const * const pkt = &receiver.pkt[i];
+	int16_t const * const samples = (int16_t *)pkt->data;
+
+	struct session *sp = session_lookup(&Session_table,&pkt->sender,pkt->rtp.ssrc);
+	if(sp != NULL && sp->type != pkt->rtp.type)
+	  close_file(&sp); // Payload type changed; start a new file
+	if(sp == NULL){ // Not found; create new one
+	  // Repeat this each time we create a session to ensure we're in the right directory.
+	  // This might have failed on earlier attempts should we start before the fs is successfully mounted
+	  if(strlen(Recordings) > 0 && chdir(Recordings) != 0){
+	    fprintf(stderr,"Can't change to directory %s: %s, exiting\n",Recordings,strerror(errno));
+	    exit(EX_CANTCREAT);
+	  }
+	  sp = create_session(&pkt->rtp,&pkt->sender);
 	}
-	sp = create_session(&rtp,&sender);
-      }
-      if(sp == NULL || sp->fp == NULL)
+	if(sp == NULL)
 #if 1
-	// Let systemd restart us after a delay instead of rapidly filling the log with, e.g., disk full errors
-	exit(EX_CANTCREAT);
+	  // Let systemd restart us after a delay instead of rapidly filling the log with, e.g., disk full errors
+	  exit(EX_CANTCREAT);
 #else
-	continue; // Couldn't create new session
+	  continue; // Couldn't create new session
 #endif
 
-      // A "sample" is a single audio sample, usually 16 bits.
-      // A "frame" is the same as a sample for mono. It's two audio samples for stereo
-      int const samp_count = size / sizeof(*samples); // number of individual audio samples (not frames)
-      int const frame_count = samp_count / sp->channels; // 1 every sample period (e.g., 4 for stereo 16-bit)
-      off_t const offset = rtp_process(&sp->rtp_state,&rtp,frame_count); // rtp timestamps refer to frames
-
-      // The seek offset relative to the current position in the file is the signed (modular) difference between
-      // the actual and expected RTP timestamps. This should automatically handle
-      // 32-bit RTP timestamp wraps, which occur every ~1 days at 48 kHz and only 6 hr @ 192 kHz
-      // Should I limit the range on this?
-      if(offset != 0){
-	fseeko(sp->fp,offset * sizeof(*samples) * sp->channels,SEEK_CUR); // offset is in bytes
-	if(offset > 0)
+	// A "sample" is a single audio sample, usually 16 bits.
+	// A "frame" is the same as a sample for mono. It's two audio samples for stereo
+	int const samp_count = pkt->len / sizeof(*samples); // number of individual audio samples (not frames)
+	int const frame_count = samp_count / sp->channels; // 1 every sample period (e.g., 4 for stereo 16-bit)
+	int const offset = rtp_process(&sp->rtp_state,&pkt->rtp,frame_count); // rtp timestamps refer to frames
+	if(offset < 0)
+	  continue; // Duplicate or late, and the file has already moved past it
+
+	// The file position moves ahead by the signed (modular) difference between
+	// the actual and expected RTP timestamps. This should automatically handle
+	// 32-bit RTP timestamp wraps, which occur every ~1 days at 48 kHz and only 6 hr @ 192 kHz
+	// Should I limit the range on this?
+	if(offset > 0){
+	  sp->offset += (off_t)offset * sizeof(*samples) * sp->channels; // Skipped space is left as a hole
 	  sp->current_segment_samples = 0;
-      }
-      sp->total_file_samples += samp_count + offset;
-      sp->current_segment_samples += samp_count;
-      sp->samples_written += samp_count;
-      if(sp->current_segment_samples >= SubstantialFileTime * sp->samprate)
-	sp->substantial_file = true;
-
-      // Flip endianness from big-endian on network to little endian wanted by .wav
-      // byteswap.h is linux-specific; need to find a portable way to get the machine instructions
-      uint16_t wbuffer[samp_count];
-      for(int n = 0; n < samp_count; n++)
-	wbuffer[n] = bswap_16((uint16_t)samples[n]);
-      fwrite(wbuffer,sizeof(*wbuffer),samp_count,sp->fp);
-      sp->last_active = gps_time_ns();
-
-      if(sp->samples_remaining > 0 && (sp->samples_remaining -= samp_count) <= 0){
-	cleanup(); // Close all files
-	exit(EX_OK);
+	}
+	sp->total_file_samples += samp_count + offset;
+	sp->current_segment_samples += samp_count;
+	sp->samples_written += samp_count;
+	if(sp->current_segment_samples >= SubstantialFileTime * sp->samprate)
+	  sp->substantial_file = true;
+
+	write_samples(sp,samples,samp_count);
+	sp->last_active = current_time;
+	if(sp->substantial_file && current_time - sp->last_header >= HEADER_INTERVAL * BILLION)
+	  queue_header(sp,false);
+
+	if(sp->samples_remaining > 0 && (sp->samples_remaining -= samp_count) <= 0){
+	  cleanup(); // Close all files
+	  exit(EX_OK);
+	}
       }
     } // end of packet processing
 
-    // Walk through list, close idle sessions
-    // should we do this on every packet? seems inefficient
-    // Could be in a separate thread, but that creates synchronization issues
+    if(current_time < next_scan)
+      continue;
+    next_scan = current_time + BILLION;
+
+    // Walk through list once a second, close idle sessions
     struct session *next;
     for(struct session *sp = Sessions;sp != NULL; sp = next){
       next = sp->next; // save in case sp is closed
@@ -361,10 +433,22 @@ static void input_loop(){
 	// Close idle session
       }
     }
+    if(Verbose && current_time >= next_stats){
+      next_stats = current_time + STATS_INTERVAL * BILLION;
+      print_stats();
+    }
   }
 }
 
+// Close all files, then wait for the writers to finish them
 static void cleanup(void){
+  static bool done;
+  if(done)
+    return;
+  done = true;
+  if(Verbose && Terminate)
+    fprintf(stderr,"%s: caught signal, closing files\n",App_path);
+
   while(Sessions){
     // Flush and close each write stream
     // Be anal-retentive about freeing and clearing stuff even though we're about to exit
@@ -372,8 +456,226 @@ static void cleanup(void){
     close_file(&Sessions); // Sessions will be NULL
     Sessions = next_s;
   }
+  pthread_mutex_lock(&Write_mutex);
+  Writers_exit = true;
+  for(int i=0; i < Nwriters; i++)
+    pthread_cond_signal(&Writers[i].cond);
+  pthread_mutex_unlock(&Write_mutex);
+  for(int i=0; i < Nwriters; i++)
+    pthread_join(Writers[i].thread,NULL);
+  if(Verbose)
+    print_stats();
+}
+
+static void print_stats(void){
+  pthread_mutex_lock(&Write_mutex);
+  fprintf(stdout,"queued %'lld bytes (max %'lld), %'llu writes %'llu bytes, write latency mean %.1f ms max %.1f ms, %llu errors, %llu packets dropped\n",
+	  (long long)Stats.queued,(long long)Stats.max_queued,
+	  (unsigned long long)Stats.writes,(unsigned long long)Stats.bytes,
+	  Stats.writes > 0 ? 1e-6 * Stats.write_ns / Stats.writes : 0.0,1e-6 * Stats.max_write_ns,
+	  (unsigned long long)Stats.errors,(unsigned long long)Stats.dropped);
+  pthread_mutex_unlock(&Write_mutex);
+}
+
+// Get an empty block. Returns NULL if the queue is full, unless force
+static struct block *get_block(bool force){
+  pthread_mutex_lock(&Write_mutex);
+  if(!force && Stats.queued + WRITE_BLOCK > Queue_limit){
+    pthread_mutex_unlock(&Write_mutex);
+    return NULL;
+  }
+  struct block *b = Free_blocks;
+  if(b != NULL)
+    Free_blocks = b->next;
+  Stats.queued += WRITE_BLOCK;
+  if(Stats.queued > Stats.max_queued)
+    Stats.max_queued = Stats.queued;
+  pthread_mutex_unlock(&Write_mutex);
+
+  if(b == NULL){
+    b = calloc(1,sizeof(*b));
+    if(b != NULL && (b->data = aligned_alloc(DIRECT_ALIGN,WRITE_BLOCK)) == NULL)
+      FREE(b);
+    if(b == NULL){
+      pthread_mutex_lock(&Write_mutex);
+      Stats.queued -= WRITE_BLOCK;
+      pthread_mutex_unlock(&Write_mutex);
+      return NULL;
+    }
+  }
+  b->next = NULL;
+  memset(b->data,0,WRITE_BLOCK); // Gaps within a block are written as silence
+  return b;
+}
+
+// Hand a block to the session's writer
+static void queue_block(struct session *sp,struct block *b){
+  b->sp = sp;
+  b->next = NULL;
+  struct writer * const w = &Writers[sp->writer];
+  pthread_mutex_lock(&Write_mutex);
+  if(w->tail != NULL)
+    w->tail->next = b;
+  else
+    w->head = b;
+  w->tail = b;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&Write_mutex);
+}
+
+static void flush_block(struct session *sp){
+  if(sp->current == NULL)
+    return;
+  queue_block(sp,sp->current);
+  sp->current = NULL;
+}
+
+// Byte swap samples into the session's blocks at the current file position
+// Returns false if some couldn't be queued; their space is skipped so what follows stays in place
+static bool write_samples(struct session *sp,int16_t const *samples,int count){
+  bool ok = true;
+  while(count > 0){
+    off_t const base = sp->offset - sp->offset % WRITE_BLOCK;
+    if(sp->current != NULL && sp->current->offset != base)
+      flush_block(sp); // Moved past it
+    if(sp->current == NULL && (sp->current = get_block(false)) != NULL){
+      sp->current->offset = base;
+      sp->current->lo = sp->current->hi = sp->offset - base;
+    }
+    int const start = sp->offset - base;
+    int const n = min(count,(int)((WRITE_BLOCK - start) / sizeof(*samples)));
+    struct block * const b = sp->current;
+    if(b != NULL){
+      // Flip endianness from big-endian on network to little endian wanted by .wav
+      // byteswap.h is linux-specific; need to find a portable way to get the machine instructions
+      uint16_t * const out = (uint16_t *)(b->data + start);
+      for(int k = 0; k < n; k++)
+	out[k] = bswap_16((uint16_t)samples[k]);
+      b->hi = start + n * sizeof(*samples);
+      if(b->hi == WRITE_BLOCK)
+	flush_block(sp);
+    } else
+      ok = false;
+    sp->offset += n * sizeof(*samples);
+    samples += n;
+    count -= n;
+  }
+  if(!ok){
+    sp->dropped++;
+    pthread_mutex_lock(&Write_mutex);
+    Stats.dropped++;
+    pthread_mutex_unlock(&Write_mutex);
+  }
+  return ok;
+}
+
+// Queue a .wav header update with the sizes so far, after what's already been queued
+static void queue_header(struct session *sp,bool final){
+  flush_block(sp);
+  sp->last_header = gps_time_ns();
+  sp->header.ChunkSize = sp->offset - 8;
+  sp->header.Subchunk2Size = sp->offset - sizeof(sp->header);
+  if(final){
+    // write end time into the auxi chunk
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME,&now);
+    struct tm const * const tm = gmtime(&now.tv_sec);
+    sp->header.StopYear=tm->tm_year+1900;
+    sp->header.StopMon=tm->tm_mon+1;
+    sp->header.StopDOW=tm->tm_wday;
+    sp->header.StopDay=tm->tm_mday;
+    sp->header.StopHour=tm->tm_hour;
+    sp->header.StopMinute=tm->tm_min;
+    sp->header.StopSecond=tm->tm_sec;
+    sp->header.StopMillis=(int16_t)(now.tv_nsec / 1000000);
+  }
+  struct block * const b = get_block(final); // Periodic updates can wait if the queue is full
+  if(b == NULL)
+    return;
+  b->offset = 0;
+  b->lo = 0;
+  b->hi = sizeof(sp->header);
+  memcpy(b->data,&sp->header,sizeof(sp->header));
+  queue_block(sp,b);
+}
+
+#ifdef O_DIRECT
+static void set_direct(int fd,bool on){
+  int const flags = fcntl(fd,F_GETFL);
+  fcntl(fd,F_SETFL,on ? flags | O_DIRECT : flags & ~O_DIRECT);
+}
+#endif
+
+// Writer thread: write each session's blocks in the order queued, then close its file
+static void *writer(void *arg){
+  struct writer * const w = arg;
+  pthread_setname("pcmrec-write");
+
+  pthread_mutex_lock(&Write_mutex);
+  while(true){
+    while(w->head == NULL && !Writers_exit)
+      pthread_cond_wait(&w->cond,&Write_mutex);
+    struct block *b = w->head;
+    if(b == NULL)
+      break; // Told to exit and nothing left
+    w->head = b->next;
+    if(w->head == NULL)
+      w->tail = NULL;
+    pthread_mutex_unlock(&Write_mutex);
+
+    struct session * const sp = b->sp;
+    if(b->data == NULL){
+      // Close
+      finish_file(sp);
+      FREE(b);
+      pthread_mutex_lock(&Write_mutex);
+      continue;
+    }
+    off_t const offset = b->offset + b->lo;
+    int const len = b->hi - b->lo;
+#ifdef __linux__
+    if(offset + len > sp->allocated){
+      // Reserve space ahead so the file is contiguous and a full disk shows up early
+      off_t const chunk = (off_t)PREALLOC_TIME * sp->samprate * sp->channels * sizeof(int16_t);
+      off_t const want = max(offset + len,sp->expected > 0 ? sp->expected : offset + len + chunk);
+      // Failure (e.g., not supported) isn't an error; it's tried again a chunk later
+      fallocate(sp->fd,FALLOC_FL_KEEP_SIZE,sp->allocated,want - sp->allocated);
+      sp->allocated = want;
+    }
+#endif
+    bool const unaligned = sp->direct && (offset % DIRECT_ALIGN != 0 || len % DIRECT_ALIGN != 0);
+#ifdef O_DIRECT
+    if(unaligned)
+      set_direct(sp->fd,false); // Header updates and the ends of files
+#endif
+    int64_t const start = gps_time_ns();
+    ssize_t const r = pwrite(sp->fd,b->data + b->lo,len,offset);
+    int64_t const t = gps_time_ns() - start;
+#ifdef O_DIRECT
+    if(unaligned)
+      set_direct(sp->fd,true);
+#endif
+    if(r != len)
+      fprintf(stderr,"write %s: %s\n",sp->filename,r < 0 ? strerror(errno) : "short write");
+
+    pthread_mutex_lock(&Write_mutex);
+    Stats.writes++;
+    if(r > 0)
+      Stats.bytes += r;
+    if(r != len)
+      Stats.errors++;
+    Stats.write_ns += t;
+    if(t > Stats.max_write_ns)
+      Stats.max_write_ns = t;
+    Stats.queued -= WRITE_BLOCK;
+    b->next = Free_blocks;
+    Free_blocks = b;
+  }
+  pthread_mutex_unlock(&Write_mutex);
+  return NULL;
 }
-static struct session *create_session(struct rtp_header const *rtp,struct sockaddr const *sender){
+
+static struct session *create_session(struct rtp_header const *rtp,void const *sender){
 
   struct session *sp = calloc(1,sizeof(*sp));
   if(sp == NULL)
@@ -391,6 +693,8 @@ static struct session *create_session(struct rtp_header const *rtp,struct sockad
     return NULL;
   }
   sp->samples_remaining = sp->samprate * FileLengthLimit * Channels; // If file is being limited in length
+  if(sp->samples_remaining > 0)
+    sp->expected = sizeof(sp->header) + sp->samples_remaining * (off_t)sizeof(int16_t);
   // Create file
   // Should we append to existing files instead? If we try this, watch out for timestamp wraparound
   struct timespec now;
@@ -398,23 +702,26 @@ static struct session *create_session(struct rtp_header const *rtp,struct sockad
   struct tm const * const tm = gmtime(&now.tv_sec);
   // yyyy-mm-dd-hh:mm:ss so it will sort properly
 
-  sp->fp = NULL;
+  sp->fd = -1;
   if(Subdirs){
     // Create directory path
     char dir[PATH_MAX];
     snprintf(dir,sizeof(dir),"%u",sp->ssrc);
     if(mkdir(dir,0777) == -1 && errno != EEXIST){
       fprintf(stderr,"can't create directory %s: %s\n",dir,strerror(errno));
+      FREE(sp);
       return NULL;
     }
     snprintf(dir,sizeof(dir),"%u/%d",sp->ssrc,tm->tm_year+1900);
     if(mkdir(dir,0777) == -1 && errno != EEXIST){
       fprintf(stderr,"can't create directory %s: %s\n",dir,strerror(errno));
+      FREE(sp);
       return NULL;
     }
     snprintf(dir,sizeof(dir),"%u/%d/%d",sp->ssrc,tm->tm_year+1900,tm->tm_mon+1);
     if(mkdir(dir,0777) == -1 && errno != EEXIST){
       fprintf(stderr,"can't create directory %s: %s\n",dir,strerror(errno));
+      FREE(sp);
       return NULL;
     }
     snprintf(dir,sizeof(dir),"%u/%d/%d/%d",sp->ssrc,tm->tm_year+1900,tm->tm_mon+1,tm->tm_mday);
@@ -448,8 +755,22 @@ static struct session *create_session(struct rtp_header const *rtp,struct sockad
 	     tm->tm_sec,
 	     (int)(now.tv_nsec / 100000000));
   }
-  sp->fp = fopen(sp->filename,"w+");
-  if(sp->fp == NULL){
+  int flags = O_RDWR|O_CREAT|O_TRUNC;
+#ifdef O_DIRECT
+  if(Direct)
+    flags |= O_DIRECT;
+#endif
+  sp->fd = open(sp->filename,flags,0666);
+#ifdef O_DIRECT
+  if(sp->fd == -1 && Direct && errno == EINVAL){
+    // Not supported by this file system (e.g., tmpfs)
+    fprintf(stderr,"%s: O_DIRECT not supported, turning it off\n",sp->filename);
+    Direct = false;
+    sp->fd = open(sp->filename,O_RDWR|O_CREAT|O_TRUNC,0666);
+  }
+  sp->direct = Direct;
+#endif
+  if(sp->fd == -1){
     fprintf(stderr,"can't create/write file %s: %s\n",sp->filename,strerror(errno));
     FREE(sp);
     return NULL;
@@ -463,15 +784,13 @@ static struct session *create_session(struct rtp_header const *rtp,struct sockad
     sp->next->prev = sp;
 
   Sessions = sp;
+  session_insert(&Session_table,&sp->sender,sp->ssrc,sp);
 
   if(Verbose)
     fprintf(stdout,"creating %s\n",sp->filename);
 
-  sp->iobuffer = malloc(BUFFERSIZE);
-  setbuffer(sp->fp,sp->iobuffer,BUFFERSIZE);
-
-  int const fd = fileno(sp->fp);
-  fcntl(fd,F_SETFL,O_NONBLOCK); // Let's see if this keeps us from losing data
+  sp->writer = Next_writer++ % Nwriters;
+  int const fd = sp->fd;
 
   attrprintf(fd,"samplerate","%lu",(unsigned long)sp->samprate);
   attrprintf(fd,"channels","%d",sp->channels);
@@ -508,8 +827,15 @@ static struct session *create_session(struct rtp_header const *rtp,struct sockad
   sp->header.CenterFrequency=CenterFrequency;
   memset(sp->header.AuxUknown, 0, 128);
 
-  fwrite(&sp->header,sizeof(sp->header),1,sp->fp);
-  fflush(sp->fp); // get at least the header out there
+  // The header starts the first block; the samples follow it
+  sp->current = get_block(true);
+  assert(sp->current != NULL); // Malloc failures are rare
+  sp->current->offset = 0;
+  sp->current->lo = 0;
+  sp->current->hi = sizeof(sp->header);
+  memcpy(sp->current->data,&sp->header,sizeof(sp->header));
+  sp->offset = sizeof(sp->header);
+  sp->last_header = gps_time_ns();
 
   char sender_text[NI_MAXHOST];
   // Don't wait for an inverse resolve that might cause us to lose data
@@ -521,45 +847,53 @@ static struct session *create_session(struct rtp_header const *rtp,struct sockad
   return sp;
 }
 
-// Close a session, update .wav header, remove from session table
-// If the file is not "substantial", just delete it
+// Close a session: queue the final .wav header update and the close, remove from session table
+// The writer finishes the file and frees the session
 static int close_file(struct session **spp){
   struct session *sp = *spp;
 
-  if(sp->substantial_file){ // Don't bother for non-substantial files
+  if(sp->substantial_file) // Don't bother for non-substantial files
+    queue_header(sp,true);
+  else
+    flush_block(sp);
+
+  session_remove(&Session_table,&sp->sender,sp->ssrc);
+  if(sp->prev)
+    sp->prev->next = sp->next;
+  else
+    Sessions = sp->next;
+  if(sp->next)
+    sp->next->prev = sp->prev;
+
+  struct block * const b = calloc(1,sizeof(*b)); // data == NULL means close
+  assert(b != NULL);
+  queue_block(sp,b);
+  *spp = NULL;
+  return 0;
+}
+
+// Called by the session's writer after all its blocks are written
+// If the file is not "substantial", just delete it
+static void finish_file(struct session *sp){
+  if(sp->substantial_file){
     if(Verbose){
       fprintf(stdout,"closing %s %'.1f/%'.1f sec\n",sp->filename,
             (float)sp->samples_written / (sp->samprate * Channels),
             (float)sp->total_file_samples / (sp->samprate *Channels));
     }
-    // Get final file size, write .wav header with sizes
-    fflush(sp->fp);
-    struct stat statbuf;
-    if(fstat(fileno(sp->fp),&statbuf) != 0){
-      printf("fstat(%d) [%s] failed! %s\n",fileno(sp->fp),sp->filename,strerror(errno));
-      abort();
-    }
-    sp->header.ChunkSize = statbuf.st_size - 8;
-    sp->header.Subchunk2Size = statbuf.st_size - sizeof(sp->header);
-
-    // write end time into the auxi chunk
-    struct timespec now;
-    clock_gettime(CLOCK_REALTIME,&now);
-    struct tm const * const tm = gmtime(&now.tv_sec);
-    sp->header.StopYear=tm->tm_year+1900;
-    sp->header.StopMon=tm->tm_mon+1;
-    sp->header.StopDOW=tm->tm_wday;
-    sp->header.StopDay=tm->tm_mday;
-    sp->header.StopHour=tm->tm_hour;
-    sp->header.StopMinute=tm->tm_min;
-    sp->header.StopSecond=tm->tm_sec;
-    sp->header.StopMillis=(int16_t)(now.tv_nsec / 1000000);
-
-    rewind(sp->fp);
-    fwrite(&sp->header,sizeof(sp->header),1,sp->fp);
-    fflush(sp->fp);
-    if(Verbose && (sp->rtp_state.dupes != 0 || sp->rtp_state.drops != 0))
-      printf("file %s dupes %llu drops %llu\n",sp->filename,(long long unsigned)sp->rtp_state.dupes,(long long unsigned)sp->rtp_state.drops);
+    // Size as the header says, even if the end was lost
+    if(ftruncate(sp->fd,sp->offset) != 0)
+      fprintf(stderr,"ftruncate %s: %s\n",sp->filename,strerror(errno));
+#ifdef __linux__
+    // Give back blocks fallocate()d past the end with FALLOC_FL_KEEP_SIZE; they don't count in the size,
+    // so the truncate may leave them allocated
+    if(sp->allocated > sp->offset
+       && fallocate(sp->fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,sp->offset,sp->allocated - sp->offset) != 0)
+      fprintf(stderr,"fallocate %s: %s\n",sp->filename,strerror(errno));
+#endif
+    if(Verbose && (sp->rtp_state.dupes != 0 || sp->rtp_state.drops != 0 || sp->dropped != 0))
+      printf("file %s dupes %llu drops %llu queue full %llu\n",sp->filename,(long long unsigned)sp->rtp_state.dupes,(long long unsigned)sp->rtp_state.drops,
+	     (long long unsigned)sp->dropped);
   } else {
     unlink(sp->filename);
     if(Verbose)
@@ -567,16 +901,7 @@ static int close_file(struct session **spp){
             (float)sp->samples_written / (sp->samprate * Channels),
             (float)sp->total_file_samples / (sp->samprate * Channels));
   }
-  fclose(sp->fp);
-  sp->fp = NULL;
-  FREE(sp->iobuffer);
-  if(sp->prev)
-    sp->prev->next = sp->next;
-  else
-    Sessions = sp->next;
-  if(sp->next)
-    sp->next->prev = sp->prev;
+  close(sp->fd);
+  sp->fd = -1;
   FREE(sp);
-  
-  return 0;
 }
@@ -24,6 +24,7 @@
 
 #include "misc.h"
 #include "multicast.h"
+#include "rtp_recv.h"
 #include "status.h"
 #include "iir.h"
 
@@ -32,7 +33,7 @@ struct session {
   struct session *next; 
   int type;                 // input RTP type (10,11)
   
-  struct sockaddr sender;
+  struct sockaddr_storage sender;
   char addr[NI_MAXHOST];    // RTP Sender IP address
   char port[NI_MAXSERV];    // RTP Sender source port
 
@@ -61,13 +62,14 @@ int Status_out_fd = -1;       // Writing to radio status
 int Input_fd = -1;            // Multicast receive socket
 struct session *Sessions;
 pthread_mutex_t Session_protect = PTHREAD_MUTEX_INITIALIZER;
+struct session_table Session_table; // Protected by Session_protect
 char const *Command;
 char const *Input;
 char const *Status;
 
 void closedown(int);
-struct session *lookup_session(const struct sockaddr *,uint32_t,int);
-struct session *create_session(void);
+struct session *lookup_session(void const *,uint32_t);
+struct session *create_session(void const *,uint32_t);
 int close_session(struct session *);
 int send_samples(struct session *sp);
 void *status(void *);
@@ -167,107 +169,91 @@ int main(int argc,char * const argv[]){
 
   // Loop forever processing and dispatching incoming PCM packets
   // Process incoming RTP packets, demux to per-SSRC thread
-  struct packet *pkt = NULL;
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1 || session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(EX_OSERR);
+  }
   while(true){
-    // Need a new packet buffer?
-    if(!pkt)
-      pkt = malloc(sizeof(*pkt));
-    // Zero these out to catch any uninitialized derefs
-    pkt->next = NULL;
-    pkt->data = NULL;
-    pkt->len = 0;
-    
-    struct sockaddr_storage sender;
-    socklen_t socksize = sizeof(sender);
-    int size = recvfrom(Input_fd,&pkt->content,sizeof(pkt->content),0,(struct sockaddr *)&sender,&socksize);
-    
-    if(size == -1){
+    int const n = rtp_recv(&receiver,Input_fd);
+    if(n == -1){
       if(errno != EINTR){ // Happens routinely, e.g., when window resized
-	perror("recvfrom");
+	perror("recvmmsg");
 	usleep(1000);
       }
-      continue;  // Reuse current buffer
-    }
-    if(size <= RTP_MIN_SIZE)
-      continue; // Must be big enough for RTP header and at least some data
-    
-    // Extract and convert RTP header to host format
-    uint8_t const *dp = ntoh_rtp(&pkt->rtp,pkt->content);
-    pkt->data = dp;
-    pkt->len = size - (dp - pkt->content);
-    if(pkt->rtp.pad){
-      pkt->len -= dp[pkt->len-1];
-      pkt->rtp.pad = 0;
+      continue;
     }
-    if(pkt->len <= 0)
-      continue; // Used to be an assert, but would be triggered by bogus packets
-    
-    // Find appropriate session; create new one if necessary
-    struct session *sp = lookup_session((const struct sockaddr *)&sender,pkt->rtp.ssrc,pkt->rtp.type);
-    if(!sp){
-      // Not found; create new session
-      sp = create_session();
-      assert(sp != NULL);
-      // Initialize
-      getnameinfo((struct sockaddr *)&sender,sizeof(sender),sp->addr,sizeof(sp->addr),
-		    sp->port,sizeof(sp->port),NI_NOFQDN|NI_DGRAM);
-      memcpy(&sp->sender,&sender,sizeof(struct sockaddr));
-      sp->rtp_state.ssrc = pkt->rtp.ssrc;
-      sp->rtp_state.seq = pkt->rtp.seq; // Can cause a spurious drop indication if # pcm pkts != # opus pkts
-      sp->rtp_state.timestamp = pkt->rtp.timestamp;
-      sp->type = pkt->rtp.type;
-
-      // Spawn per-SSRC command
-      // Command needs to be a macro-substituted string with params:
-      // Channels
-      // sample rate
-      // sending IP address & port
-      
-      char command_line[4096]; // I think that's the longest shell command
-      int const samprate = samprate_from_pt(sp->type);
-      int const channels = channels_from_pt(sp->type);
-
-      snprintf(command_line,sizeof(command_line),"%s %s:%s %d %d %d %d",
-	       Command,sp->addr,sp->port,sp->rtp_state.ssrc,sp->type,samprate,channels);
-      fprintf(stderr,"New session, %s\n",command_line);
+    for(int i=0; i < n; i++){
+      struct rtp_packet const * const pkt = &receiver.pkt[i];
 
-      if((sp->pipe = popen(command_line,"w")) == NULL){
-	fprintf(stderr,"popen(%s) failed: %s\n",command_line,strerror(errno));
+      // Find appropriate session; create new one if necessary
+      struct session *sp = lookup_session(&pkt->sender,pkt->rtp.ssrc);
+      if(sp != NULL && sp->type != pkt->rtp.type){
+	// The command was started for the old payload type; start over
 	close_session(sp);
-	continue;
+	sp = NULL;
       }
-    }
-    sp->packets++; // Count all packets, regardless of type
-    sp->last_active = gps_time_ns(); // for reaping long-idle sessions
-
-    int const channels = channels_from_pt(sp->type);
-    int const frame_size = pkt->len / (sizeof(int16_t) * channels); // PCM sample times
-    if(frame_size <= 0)
-      goto endloop; // garbled packet?
-
-    int const samples_skipped = rtp_process(&sp->rtp_state,&pkt->rtp,frame_size);
-    if(samples_skipped < 0)
-      goto endloop; // Old dupe
-
-    if(samples_skipped){
-      if(samples_skipped < 4 * 48000){ // 4 sec @ 48kHz is arbitrary
-	sp->dropped_samples += samples_skipped;
-	int const padding = 2 * channels * samples_skipped;
+      if(!sp){
+	// Not found; create new session
+	sp = create_session(&pkt->sender,pkt->rtp.ssrc);
+	assert(sp != NULL);
+	// Initialize
+	getnameinfo((struct sockaddr *)&pkt->sender,sizeof(pkt->sender),sp->addr,sizeof(sp->addr),
+		    sp->port,sizeof(sp->port),NI_NOFQDN|NI_DGRAM);
+	sp->rtp_state.seq = pkt->rtp.seq; // Can cause a spurious drop indication if # pcm pkts != # opus pkts
+	sp->rtp_state.timestamp = pkt->rtp.timestamp;
+	sp->type = pkt->rtp.type;
+
+	// Spawn per-SSRC command
+	// Command needs to be a macro-substituted string with params:
+	// Channels
+	// sample rate
+	// sending IP address & port
+      
+	char command_line[4096]; // I think that's the longest shell command
+	int const samprate = samprate_from_pt(sp->type);
+	int const channels = channels_from_pt(sp->type);
+
+	snprintf(command_line,sizeof(command_line),"%s %s:%s %d %d %d %d",
+		 Command,sp->addr,sp->port,sp->rtp_state.ssrc,sp->type,samprate,channels);
+	fprintf(stderr,"New session, %s\n",command_line);
+
+	if((sp->pipe = popen(command_line,"w")) == NULL){
+	  fprintf(stderr,"popen(%s) failed: %s\n",command_line,strerror(errno));
+	  close_session(sp);
+	  continue;
+	}
+      }
+      sp->packets++; // Count all packets, regardless of type
+      sp->last_active = gps_time_ns(); // for reaping long-idle sessions
+
+      int const channels = channels_from_pt(sp->type);
+      int const frame_size = pkt->len / (sizeof(int16_t) * channels); // PCM sample times
+      if(frame_size <= 0)
+	continue; // garbled packet?
+
+      int const samples_skipped = rtp_process(&sp->rtp_state,&pkt->rtp,frame_size);
+      if(samples_skipped < 0)
+	continue; // Old dupe
+
+      if(samples_skipped){
+	if(samples_skipped < 4 * 48000){ // 4 sec @ 48kHz is arbitrary
+	  sp->dropped_samples += samples_skipped;
+	  int const padding = 2 * channels * samples_skipped;
 	
-	for(int i=0; i < padding; i++)
-	  fputc(0,sp->pipe);
-      } else {
-	sp->resets++;
+	  for(int k=0; k < padding; k++)
+	    fputc(0,sp->pipe);
+	} else {
+	  sp->resets++;
+	}
+      }
+      // raw copy, probably in network byte order
+      if(fwrite(pkt->data,1,pkt->len,sp->pipe) != pkt->len){
+	// Error to pipe
+	close_session(sp);
+	sp = NULL;
       }
     }
-    // raw copy, probably in network byte order
-    if(fwrite(pkt->data,1,pkt->len,sp->pipe) != pkt->len){
-      // Error to pipe
-      close_session(sp);
-      sp = NULL;
-    }
-  endloop:;
-    FREE(pkt);
   }
 }
 
@@ -308,76 +294,48 @@ void * status(void *p){
       continue;
 
     // Announce ourselves in response to commands
-    if((enum pkt_type)buffer[0] == STATUS){
+    // A BULK_STATUS packet answers a poll of all channels that asked for one (e.g., by control)
+    // with a record per channel, each laid out like a STATUS packet
+    enum pkt_type const cr = buffer[0];
+    int offset = 0;
+    int len = length - 1;
+    while(cr == STATUS || (cr == BULK_STATUS && (len = next_bulk_record(buffer+1,length-1,&offset)) > 0)){
       // Parse radio status for PCM output socket
-      uint8_t const *cp = buffer+1;
-
-      while(cp - buffer < length){
-	enum status_type const type = *cp++;
-	
-	if(type == EOL)
-	  break;
-	
-	unsigned int optlen = *cp++;
-	if(optlen & 0x80){
-	  // length is >= 128 bytes; fetch actual length from next N bytes, where N is low 7 bits of optlen
-	  int length_of_length = optlen & 0x7f;
-	  optlen = 0;
-	  while(length_of_length > 0){
-	    optlen <<= 8;
-	    optlen |= *cp++;
-	    length_of_length--;
+      uint8_t const * const record = cr == STATUS ? buffer + 1 : buffer + 1 + offset - len;
+      // Should probably extract sample rate too, though we get it from the RTP payload type
+      struct sockaddr_storage dest_temp;
+      memset(&dest_temp,0,sizeof(dest_temp));
+      if(get_dest_socket(&dest_temp,record,len) == 0
+	 && !(address_match(&dest_temp,&PCM_dest_address)
+	      && getportnumber(&dest_temp) == getportnumber(&PCM_dest_address))){
+	// new or changed PCM multicast group
+	if(Verbose)
+	  fprintf(stderr,"Listening for PCM on %s\n",formatsock(&dest_temp));
+
+	int const fd = listen_mcast(&dest_temp,NULL); // Port address already in place
+	if(fd == -1){
+	  if(Verbose){
+	    fprintf(stderr,"Multicast listen on %s failed\n",formatsock(&dest_temp));
 	  }
+	} else {
+	  pthread_mutex_lock(&Input_ready_mutex);
+	  if(Input_fd != -1)
+	    close(Input_fd);
+	  Input_fd = fd;
+	  memcpy(&PCM_dest_address,&dest_temp,sizeof(dest_temp));
+	  pthread_cond_broadcast(&Input_ready_cond);
+	  pthread_mutex_unlock(&Input_ready_mutex);
+
+	  // Cancel timeouts and polls
+	  struct timeval timeout;
+	  timeout.tv_sec = 0;
+	  timeout.tv_usec = 0;
+	  setsockopt(Status_fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
 	}
-	if(cp - buffer + optlen > length)
-	  break;
-
-	// Should probably extract sample rate too, though we get it from the RTP payload type
-	switch(type){
-	case EOL:
-	  goto done;
-	case OUTPUT_DATA_DEST_SOCKET:
-	  {
-	    struct sockaddr_storage dest_temp;
-	    memset(&dest_temp,0,sizeof(dest_temp));
-	    decode_socket(&dest_temp,cp,optlen);
-	    if(address_match(&dest_temp,&PCM_dest_address)
-	       && getportnumber(&dest_temp) == getportnumber(&PCM_dest_address))
-	      break; // nothing changed
-
-	    // new or changed PCM multicast group
-	    if(Verbose)
-	      fprintf(stderr,"Listening for PCM on %s\n",formatsock(&dest_temp));
-
-	    int const fd = listen_mcast(&dest_temp,NULL); // Port address already in place
-	    if(fd == -1){
-	      if(Verbose){
-		fprintf(stderr,"Multicast listen on %s failed\n",formatsock(&dest_temp));
-	      }
-	      break;
-	    }
-	    pthread_mutex_lock(&Input_ready_mutex);
-	    if(Input_fd != -1)
-	      close(Input_fd);
-	    Input_fd = fd;
-	    memcpy(&PCM_dest_address,&dest_temp,sizeof(dest_temp));
-	    pthread_cond_broadcast(&Input_ready_cond);
-	    pthread_mutex_unlock(&Input_ready_mutex);
-	    
-	    // Cancel timeouts and polls
-	    struct timeval timeout;
-	    timeout.tv_sec = 0;
-	    timeout.tv_usec = 0;
-	    setsockopt(Status_fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
-	  }
-	  break;
-	default:  // Ignore all others for now
-	  break;
-	}
-	cp += optlen;
       }
+      if(cr == STATUS)
+	break;
     }
-    done:;
   }
   return NULL;
 }
@@ -385,35 +343,20 @@ void * status(void *p){
 
 
 
-struct session *lookup_session(const struct sockaddr * const sender,const uint32_t ssrc,int type){
-  struct session *sp;
+struct session *lookup_session(void const * const sender,const uint32_t ssrc){
   pthread_mutex_lock(&Session_protect);
-  for(sp = Sessions; sp != NULL; sp = sp->next){
-    if(sp->rtp_state.ssrc == ssrc && address_match(&sp->sender,sender) && sp->type == type){
-      // Found it
-      if(sp->prev != NULL){
-	// Not at top of list; move it there
-	if(sp->next != NULL)
-	  sp->next->prev = sp->prev;
-
-	sp->prev->next = sp->next;
-	sp->prev = NULL;
-	sp->next = Sessions;
-	Sessions->prev = sp;
-	Sessions = sp;
-      }
-      break;
-    }
-  }
+  struct session * const sp = session_lookup(&Session_table,sender,ssrc);
   pthread_mutex_unlock(&Session_protect);
   return sp;
 }
 // Create a new session, partly initialize
-struct session *create_session(void){
+struct session *create_session(void const * const sender,const uint32_t ssrc){
 
   struct session * const sp = calloc(1,sizeof(*sp));
   assert(sp != NULL); // Shouldn't happen on modern machines!
   
+  memcpy(&sp->sender,sender,sizeof(sp->sender));
+  sp->rtp_state.ssrc = ssrc;
   // Initialize entry
 
   // Put at head of list
@@ -423,6 +366,7 @@ struct session *create_session(void){
   if(sp->next != NULL)
     sp->next->prev = sp;
   Sessions = sp;
+  session_insert(&Session_table,&sp->sender,ssrc,sp);
   pthread_mutex_unlock(&Session_protect);
   return sp;
 }
@@ -438,8 +382,10 @@ int close_session(struct session *sp){
     sp->prev->next = sp->next;
   else
     Sessions = sp->next;
+  session_remove(&Session_table,&sp->sender,sp->rtp_state.ssrc);
   pthread_mutex_unlock(&Session_protect);
-  pclose(sp->pipe);
+  if(sp->pipe != NULL)
+    pclose(sp->pipe);
   FREE(sp);
   return 0;
 }
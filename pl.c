@@ -19,7 +19,8 @@
 #include "filter.h"
 #include "misc.h"
 #include "multicast.h"
-#include "osc.h"
+#include "rtp_recv.h"
+#include "iir.h"
 
 // Global config variables
 #define MAX_MCAST 20          // Maximum number of multicast addresses
@@ -85,13 +86,14 @@ static char DTMF_matrix[4][4] = {   // indexed by [low][high]
 // Global variables
 static int Nfds;
 static struct session *Sessions;
+static struct session_table Session_table;
 
 struct session {
   struct session *prev;       // Linked list pointers
   struct session *next; 
   int type;                 // input RTP type (10,11)
   
-  struct sockaddr sender;
+  struct sockaddr_storage sender;
   char addr[NI_MAXHOST];    // RTP Sender IP address
   char port[NI_MAXSERV];    // RTP Sender source port
 
@@ -101,16 +103,13 @@ struct session {
   int pl_blocksize;
   int dtmf_blocksize;
 
-  complex float pl_integrators[N_tones];
-  struct osc pl_osc[N_tones];
+  struct goertzel_bank pl_tones; // All PL tones, at PL_samprate
   float strongest_tone_energy;
   int strongest_tone_index;
 
   float dtmf_tot_energy;
-  complex float dtmf_low_integrators[4];
-  complex float dtmf_high_integrators[4];  
-  struct osc dtmf_low_osc[4];
-  struct osc dtmf_high_osc[4];
+  struct goertzel_bank dtmf_low_tones;
+  struct goertzel_bank dtmf_high_tones;
 
   int pl_audio_count;          // Number of samples integrated so far
   int dtmf_audio_count;        // Number of samples integrated so far
@@ -123,12 +122,11 @@ struct session {
 };
 
 static void closedown(int);
-static struct session *lookup_session(const struct sockaddr *,uint32_t);
-static struct session *create_session(struct sockaddr const *r,uint32_t,uint16_t,uint32_t);
+static struct session *create_session(void const *,uint32_t,uint16_t,uint32_t);
 static int close_session(struct session *);
-static float process_pl(struct session *sp,complex float samp);
+static float process_pl(struct session *sp,complex float const *samp,int n);
 #if 0
-static char process_dtmf(struct session *sp,complex float samp);
+static char process_dtmf(struct session *sp,float const *samp,int n);
 #endif
 
 static struct option Options[] =
@@ -188,6 +186,11 @@ int main(int argc,char * const argv[]){
     exit(1);
   }
 
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1 || session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stdout,"Can't allocate receive buffers\n");
+    exit(1);
+  }
   // Set up multicast input, create mask for select()
   fd_set fdset_template; // Mask for select()
   FD_ZERO(&fdset_template);
@@ -224,149 +227,123 @@ int main(int argc,char * const argv[]){
       if(input_fd[fd_index] == -1 || !FD_ISSET(input_fd[fd_index],&fdset)) continue;
 
       // Receive PCM in RTP/UDP/IP
-      struct sockaddr sender;
-      uint8_t buffer[PKTSIZE];
-      socklen_t socksize = sizeof(sender);
-      int size = recvfrom(input_fd[fd_index],buffer,sizeof(buffer),0,&sender,&socksize);
-      if(size == -1){
+      int const n = rtp_recv(&receiver,input_fd[fd_index]);
+      if(n == -1){
 	if(errno != EINTR){ // Happens routinely
-	  perror("recvfrom");
+	  perror("recvmmsg");
 	  usleep(1000);
 	}
 	continue;
       }
-      if(size <= RTP_MIN_SIZE){
-	usleep(500); // Avoid tight loop
-	continue; // Too small to be valid RTP
-      }
-      // RTP header to host format
-      struct rtp_header rtp_hdr;
-      uint8_t const *dp = ntoh_rtp(&rtp_hdr,buffer);
-      size -= (dp - buffer);
-      if(rtp_hdr.pad){
-	// Remove padding
-	size -= dp[size-1];
-	rtp_hdr.pad = 0;
-      }
-      if(size <= 0) continue; // Bogus RTP header?
+      for(int i=0; i < n; i++){
+	struct rtp_packet const * const pkt = &receiver.pkt[i];
+	struct rtp_header const rtp_hdr = pkt->rtp;
+	uint8_t const *dp = pkt->data;
+	int const size = pkt->len;
+
+	// Detect and handle stereo?
+	int const samprate = samprate_from_pt(rtp_hdr.type);
+	if(samprate == 0)	continue;
       
-      // Detect and handle stereo?
-      int const samprate = samprate_from_pt(rtp_hdr.type);
-      if(samprate == 0)	continue;
-      
-      struct session *sp = lookup_session(&sender,rtp_hdr.ssrc);
-      if(sp == NULL){
-	sp = create_session(&sender,rtp_hdr.ssrc,rtp_hdr.seq,rtp_hdr.timestamp);
+	struct session *sp = session_lookup(&Session_table,&pkt->sender,rtp_hdr.ssrc);
 	if(sp == NULL){
-	  fprintf(stdout,"No room!!\n");
-	  continue;
-	}
-	fprintf(stdout,"new ssrc %u, samprate %'d Hz\n",rtp_hdr.ssrc,samprate);
-	sp->type = rtp_hdr.type;
-	sp->samprate = samprate;
-
-	// Set up input side of audio baseband filter
-	// 4800 samples @ 24 kHz = 200 ms
-	int const Filter_block = roundf(Filter_time * sp->samprate);
-	create_filter_input(&sp->filter_in,Filter_block,Filter_block+1,REAL);
-
-	// Set up PL tone detector
-	sp->pl_blocksize = PL_samprate / PL_blockrate;
-	// Set up PL tone steps and phasors
-	for(int n=0; n < N_tones; n++){
-	  sp->pl_integrators[n] = 0;
-	  set_osc(&sp->pl_osc[n],(PL_tones[n] - PL_Shift)/PL_samprate,0);
-	}
+	  sp = create_session(&pkt->sender,rtp_hdr.ssrc,rtp_hdr.seq,rtp_hdr.timestamp);
+	  if(sp == NULL){
+	    fprintf(stdout,"No room!!\n");
+	    continue;
+	  }
+	  fprintf(stdout,"new ssrc %u, samprate %'d Hz\n",rtp_hdr.ssrc,samprate);
+	  sp->type = rtp_hdr.type;
+	  sp->samprate = samprate;
+
+	  // Set up input side of audio baseband filter
+	  // 4800 samples @ 24 kHz = 200 ms
+	  int const Filter_block = roundf(Filter_time * sp->samprate);
+	  create_filter_input(&sp->filter_in,Filter_block,Filter_block+1,REAL,FFT_SHORT);
+
+	  // Set up PL tone detector
+	  sp->pl_blocksize = PL_samprate / PL_blockrate;
+	  // Set up PL tone detectors, on the filter output shifted down by PL_Shift
+	  {
+	    float shifted[N_tones];
+	    for(int n=0; n < N_tones; n++)
+	      shifted[n] = PL_tones[n] - PL_Shift;
+	    init_goertzel_bank(&sp->pl_tones,shifted,N_tones,PL_samprate,false);
+	  }
 
-	//  200 ms @ 1500 Hz = 300 samples x 2 = 600 point FFT, 2.5 Hz bins, rotate by 10 hz increments
-	int pl_Filter_block = roundf(PL_samprate * Filter_time);
-	create_filter_output(&sp->pl_filter_out,&sp->filter_in,NULL,pl_Filter_block,COMPLEX);
-	// Pass 50-300 Hz
-	// Kaiser beta = 11; kaiser alpha = 11/pi = 3.5; first null @ sqrt(1+alpha^2) = 3.64 bins * 5 Hz = 18.2 Hz
-	set_filter(&sp->pl_filter_out,(50. - PL_Shift)/PL_samprate,(300. - PL_Shift)/PL_samprate,Kaiser_beta);
-      }
-      int sampcount = size / sizeof(int16_t);
-      int const samples_skipped = rtp_process(&sp->rtp_state_in,&rtp_hdr,sampcount);
-      if(samples_skipped < 0) continue;
+	  //  200 ms @ 1500 Hz = 300 samples x 2 = 600 point FFT, 2.5 Hz bins, rotate by 10 hz increments
+	  int pl_Filter_block = roundf(PL_samprate * Filter_time);
+	  create_filter_output(&sp->pl_filter_out,&sp->filter_in,NULL,pl_Filter_block,COMPLEX);
+	  // Pass 50-300 Hz
+	  // Kaiser beta = 11; kaiser alpha = 11/pi = 3.5; first null @ sqrt(1+alpha^2) = 3.64 bins * 5 Hz = 18.2 Hz
+	  set_filter(&sp->pl_filter_out,(50. - PL_Shift)/PL_samprate,(300. - PL_Shift)/PL_samprate,Kaiser_beta);
+	}
+	int sampcount = size / sizeof(int16_t);
+	int const samples_skipped = rtp_process(&sp->rtp_state_in,&rtp_hdr,sampcount);
+	if(samples_skipped < 0) continue;
 
       
-      int16_t const *sampp = (int16_t *)dp;
-      while(sampcount-- > 0){
-	// For each sample, run the local oscillators and integrators
-	float const samp = SCALE16 * (int16_t)ntohs(*sampp++);
-	if(put_rfilter(&sp->filter_in,samp) == 0)
-	  continue;
-
-	int const Rotate = 2 * (PL_Shift * Filter_time);
-	execute_filter_output(&sp->pl_filter_out,Rotate);
-	// Process for PL tone
-	for(int n=0; n < sp->pl_filter_out.olen; n++){
-	  float const pl_tone = process_pl(sp,sp->pl_filter_out.output.c[n]);
-	  if(pl_tone > 0){
+	int16_t const *sampp = (int16_t *)dp;
+	while(sampcount-- > 0){
+	  // For each sample, run the local oscillators and integrators
+	  float const samp = SCALE16 * (int16_t)ntohs(*sampp++);
+	  if(put_rfilter(&sp->filter_in,samp) == 0)
+	    continue;
+
+	  int const Rotate = 2 * (PL_Shift * Filter_time);
+	  execute_filter_output(&sp->pl_filter_out,Rotate);
+	  // Process for PL tone, one integration interval at a time
+	  for(int n=0; n < sp->pl_filter_out.olen; ){
+	    int const chunk = min(sp->pl_filter_out.olen - n,sp->pl_blocksize - sp->pl_audio_count);
+	    float const pl_tone = process_pl(sp,sp->pl_filter_out.output.c + n,chunk);
+	    n += chunk;
+	    if(pl_tone > 0){
 #if 0
-	    printf("ssrc %u: PL %.1f Hz\n",sp->rtp_state_in.ssrc,pl_tone);
+	      printf("ssrc %u: PL %.1f Hz\n",sp->rtp_state_in.ssrc,pl_tone);
 #endif
-	    sp->current_pl_tone = pl_tone;
+	      sp->current_pl_tone = pl_tone;
+	    }
 	  }
 	}
-      }
 #if 0
 	
-      char const dtmf_digit = process_dtmf(sp,samp);
-      if(dtmf_digit == -1)
-	continue;
-      if(dtmf_digit != sp->current_dtmf_digit){
+	char const dtmf_digit = process_dtmf(sp,samp);
+	if(dtmf_digit == -1)
+	  continue;
+	if(dtmf_digit != sp->current_dtmf_digit){
 #if 0
-	printf("ssrc %u: DTMF %c\n",sp->rtp_state_in.ssrc,dtmf_digit);
+	  printf("ssrc %u: DTMF %c\n",sp->rtp_state_in.ssrc,dtmf_digit);
 #endif
-	sp->current_dtmf_digit = dtmf_digit;
-      }
+	  sp->current_dtmf_digit = dtmf_digit;
+	}
 #endif
-    }
-  }
-}
-
-static struct session *lookup_session(const struct sockaddr *sender,const uint32_t ssrc){
-  struct session *sp;
-  for(sp = Sessions; sp != NULL; sp = sp->next){
-    if(sp->rtp_state_in.ssrc == ssrc && address_match(&sp->sender,sender)){
-      // Found it
-      if(sp->prev != NULL){
-	// Not at top of bucket chain; move it there
-	if(sp->next != NULL)
-	  sp->next->prev = sp->prev;
-
-	sp->prev->next = sp->next;
-	sp->prev = NULL;
-	sp->next = Sessions;
-	Sessions = sp;
       }
-      return sp;
     }
   }
-  return NULL;
 }
+
 // Create a new session, partly initialize
-static struct session *create_session(struct sockaddr const *sender,uint32_t ssrc,uint16_t seq,uint32_t timestamp){
+static struct session *create_session(void const *sender,uint32_t ssrc,uint16_t seq,uint32_t timestamp){
   struct session *sp;
 
   if((sp = calloc(1,sizeof(*sp))) == NULL)
     return NULL; // Shouldn't happen on modern machines!
   
   // Initialize entry
-  getnameinfo((struct sockaddr *)sender,sizeof(*sender),sp->addr,sizeof(sp->addr),
+  memcpy(&sp->sender,sender,sizeof(sp->sender));
+  getnameinfo((struct sockaddr *)&sp->sender,sizeof(sp->sender),sp->addr,sizeof(sp->addr),
 	      sp->port,sizeof(sp->port),NI_NOFQDN|NI_DGRAM);
 
-  memcpy(&sp->sender,sender,sizeof(struct sockaddr));
   sp->rtp_state_in.ssrc = ssrc;
   sp->rtp_state_in.seq = seq;
   sp->rtp_state_in.timestamp = timestamp;
 
-  // Put at head of bucket chain
+  // Put at head of list
   sp->next = Sessions;
   if(sp->next != NULL)
     sp->next->prev = sp;
   Sessions = sp;
+  session_insert(&Session_table,&sp->sender,ssrc,sp);
   return sp;
 }
 
@@ -381,6 +358,7 @@ static int close_session(struct session *sp){
     sp->prev->next = sp->next;
   else
     Sessions = sp->next;
+  session_remove(&Session_table,&sp->sender,sp->rtp_state_in.ssrc);
   FREE(sp);
   return 0;
 }
@@ -392,12 +370,12 @@ static void closedown(int s){
 }
 
 // Look for PL tone after each integration interval
-static float process_pl(struct session * const sp,complex float const samp){
-
-  for(int n=0; n < N_tones; n++)
-    sp->pl_integrators[n] += conjf(samp) * step_osc(&sp->pl_osc[n]);
-
-  if(++sp->pl_audio_count < sp->pl_blocksize)
+// n must not run past the end of the interval
+static float process_pl(struct session * const sp,complex float const *samp,int const n){
+  assert(sp->pl_audio_count + n <= sp->pl_blocksize);
+  update_goertzel_bank_complex(&sp->pl_tones,samp,n);
+  sp->pl_audio_count += n;
+  if(sp->pl_audio_count < sp->pl_blocksize)
     return -1; // Not done integrating
 
   sp->pl_audio_count = 0;
@@ -406,13 +384,14 @@ static float process_pl(struct session * const sp,complex float const samp){
   // Should calculate this analytically from specified minimum tone deviation (500 Hz?) and audio path gain
   sp->strongest_tone_energy = 0.005 * sp->pl_blocksize; // mininum tone energy in block
   sp->strongest_tone_index = -1;
+  float energies[N_tones];
+  output_goertzel_bank(&sp->pl_tones,energies);
   for(int n=0; n < N_tones; n++){
-    float const energy = cnrmf(sp->pl_integrators[n]);
+    float const energy = energies[n];
     if(energy > sp->strongest_tone_energy){
       sp->strongest_tone_energy = energy;
       sp->strongest_tone_index = n;
     }
-    sp->pl_integrators[n] = 0;
   }
   if(sp->strongest_tone_index == -1)
     return 0; // No tone found
@@ -423,13 +402,14 @@ static float process_pl(struct session * const sp,complex float const samp){
 
 #if 0
 // Look for DTMF digit after each integration interval
-static char process_dtmf(struct session *sp,complex float samp){
-  sp->dtmf_tot_energy += samp * samp;
-  for(int n=0; n < 4; n++){
-    sp->dtmf_low_integrators[n] += conjf(samp) * step_osc(&sp->dtmf_low_osc[n]);
-    sp->dtmf_high_integrators[n] += conjf(samp) * step_osc(&sp->dtmf_high_osc[n]);
-  }
-  if(++sp->dtmf_audio_count < sp->dtmf_blocksize)
+// Banks set up with init_goertzel_bank(&sp->dtmf_low_tones,DTMF_low_tones,4,sp->samprate,false), etc
+static char process_dtmf(struct session *sp,float const *samp,int const n){
+  for(int i=0; i < n; i++)
+    sp->dtmf_tot_energy += samp[i] * samp[i];
+  update_goertzel_bank(&sp->dtmf_low_tones,samp,n,1);
+  update_goertzel_bank(&sp->dtmf_high_tones,samp,n,1);
+  sp->dtmf_audio_count += n;
+  if(sp->dtmf_audio_count < sp->dtmf_blocksize)
     return -1;
 
   sp->dtmf_audio_count = 0;
@@ -440,9 +420,10 @@ static char process_dtmf(struct session *sp,complex float samp){
   float low_tone_energy = 0; // Set this to a minimum threshold
   {
     float total_energy = 0;
+    float energies[4];
+    output_goertzel_bank(&sp->dtmf_low_tones,energies);
     for(int n=0; n < 4; n++){
-      float const energy = cnrmf(sp->dtmf_low_integrators[n]);
-      sp->dtmf_low_integrators[n] = 0;
+      float const energy = energies[n];
       total_energy += energy;
       if(energy >= low_tone_energy){
 	low_tone_energy = energy;
@@ -458,9 +439,10 @@ static char process_dtmf(struct session *sp,complex float samp){
   float high_tone_energy = 0; // Set this to a minimum threshold
   {
     float total_energy = 0;
+    float energies[4];
+    output_goertzel_bank(&sp->dtmf_high_tones,energies);
     for(int n=0; n < 4; n++){
-      float const energy = cnrmf(sp->dtmf_high_integrators[n]);
-      sp->dtmf_high_integrators[n] = 0;
+      float const energy = energies[n];
       total_energy += energy;
       if(energy >= high_tone_energy){
 	high_tone_energy = energy;
@@ -188,6 +188,7 @@ int main(int argc,char *argv[]){
       // Ignore invalid packets, non-status packets, packets re other SSRCs and packets not in response to our polls
       // Should we insist on the same command tag, or accept any "recent" status packet, e.g., triggered by the control program?
       // This is needed because an initial delay in joining multicast groups produces a burst of buffered responses; investigate this
+      // A poll of one SSRC is always answered with a STATUS packet; BULK_STATUS only answers polls of all channels
     } while(length < 2 || (enum pkt_type)buffer[0] != STATUS || Ssrc != get_ssrc(buffer+1,length-1) || tag != get_tag(buffer+1,length-1));
 
     if(Verbose > 1){
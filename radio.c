@@ -105,7 +105,7 @@ static const float N0_smooth = .001; // exponential smoothing rate for (noisy) b
 static float estimate_noise(struct channel *chan,int shift){
   struct filter_out *slave = &chan->filter.out;
   if(chan->filter.energies == NULL)
-    chan->filter.energies = calloc(sizeof(float),slave->bins);
+    chan->filter.energies = calloc(sizeof(float),slave->points);
 
   float * const energies = chan->filter.energies;
   struct filter_in const * const master = slave->master;
@@ -123,11 +123,11 @@ static float estimate_noise(struct channel *chan,int shift){
   }
 #endif
 
-  int mbin = shift - slave->bins/2;
+  int mbin = shift - slave->points/2;
   float min_bin_energy = INFINITY;
   if(master->in_type == REAL){
     // Only half as many bins as with complex input
-    for(int i=0; i < slave->bins; i++){
+    for(int i=0; i < slave->points; i++){
       int n = abs(mbin); // Doesn't really handle the mirror well
       if(n < master->bins){
 	if(energies[i] == 0)
@@ -145,7 +145,7 @@ static float estimate_noise(struct channel *chan,int shift){
     if(mbin < 0)
       mbin += master->bins; // starting in negative frequencies
 
-    for(int i=0; i < slave->bins; i++){
+    for(int i=0; i < slave->points; i++){
       if(mbin >= 0 && mbin < master->bins){
 	if(energies[i] == 0)
 	  energies[i] = cnrmf(fdomain[mbin]); // Quick startup
@@ -241,13 +241,11 @@ int close_chan(struct channel *chan){
   }
   pthread_mutex_lock(&chan->status.lock);
   FREE(chan->status.command);
+  FREE(chan->status.bulk_last);
   FREE(chan->filter.energies);
   FREE(chan->spectrum.bin_data);
   delete_filter_output(&chan->filter.out);
-  if(chan->output.opus != NULL){
-    opus_encoder_destroy(chan->output.opus);
-    chan->output.opus = NULL;
-  }
+  close_opus(chan);
   pthread_mutex_unlock(&chan->status.lock);
   pthread_mutex_lock(&Channel_list_mutex);
   if(chan->inuse){
@@ -514,6 +512,7 @@ int downconvert(struct channel *chan){
       restart_needed = decode_radio_commands(chan,chan->status.command,chan->status.length);
       send_radio_status((struct sockaddr *)&Metadata_dest_socket,&Frontend,chan); // Send status in response
       chan->status.global_timer = 0; // Just sent one
+      chan->status.bulk = false; // so a pending bulk packet will go out on the timer
       // Also send to output stream
       send_radio_status((struct sockaddr *)&chan->status.dest_socket,&Frontend,chan);
       chan->status.output_timer = chan->status.output_interval; // Reload
@@ -521,7 +520,10 @@ int downconvert(struct channel *chan){
       reset_radio_status(chan); // After both are sent
     } else if(chan->status.global_timer != 0 && --chan->status.global_timer <= 0){
       // Delayed status request, used mainly by all-channel polls to avoid big bursts
-      send_radio_status((struct sockaddr *)&Metadata_dest_socket,&Frontend,chan); // Send status in response
+      if(chan->status.bulk)
+	send_bulk_status(&Frontend,chan);
+      else
+	send_radio_status((struct sockaddr *)&Metadata_dest_socket,&Frontend,chan); // Send status in response
       chan->status.global_timer = 0; // to make sure
       reset_radio_status(chan);
     } else if(chan->status.output_interval != 0 && chan->status.output_timer > 0){
@@ -576,8 +578,9 @@ int downconvert(struct channel *chan){
   // Yet we rely on the wait inside execute_filter_output for timing
   // When not debugging, just delay a blocktime and issue an error before returning
   complex float * const buffer = chan->filter.out.output.c; // Working output time-domain buffer (if any)
+  float * const rbuffer = chan->filter.out.output.r; // Real output buffer (linear mono on an FFT bin)
   // set fine tuning frequency & phase. Do before execute_filter blocks (can't remember why)
-  if(buffer != NULL){ // No output time-domain buffer in spectrum mode
+  if(buffer != NULL || rbuffer != NULL){ // No output time-domain buffer in spectrum mode
     // avoid them both being 0 at startup; init chan->filter.remainder as NAN
     if(remainder != chan->filter.remainder){
       set_osc(&chan->fine,remainder/chan->output.samprate,chan->tune.doppler_rate/(chan->output.samprate * chan->output.samprate));
@@ -594,6 +597,9 @@ int downconvert(struct channel *chan){
     }
     chan->fine.phasor *= chan->filter.phase_adjust;
   }
+  // Real output can't be fine tuned in the time domain; the filter applies just the block phase
+  if(rbuffer != NULL)
+    chan->filter.out.phasor = chan->fine.phasor;
   execute_filter_output(&chan->filter.out,-shift); // block until new data frame
   chan->status.blocks_since_poll++;
   float level_normalize = scale_voltage_out2FS(&Frontend);
@@ -607,6 +613,19 @@ int downconvert(struct channel *chan){
     energy /= N;
     chan->sig.bb_power = energy;
     chan->sig.bb_energy += energy; // Added once per block
+  } else if(rbuffer != NULL){
+    // The filter produces sqrt(2) * Re(y) from a complex front end, Re(y)/sqrt(2) from a real one
+    // Scale to Re(y) as the complex path would give
+    const int N = chan->filter.out.olen;
+    float const scale = level_normalize * (Frontend.in.in_type == REAL ? M_SQRT2 : M_SQRT1_2);
+    float energy = 0;
+    for(int n=0; n < N; n++){
+      rbuffer[n] *= scale;
+      energy += rbuffer[n] * rbuffer[n];
+    }
+    energy *= 2.0f / N; // Re(y) has, on average, half the power of y
+    chan->sig.bb_power = energy;
+    chan->sig.bb_energy += energy; // Added once per block
   }
   chan->filter.bin_shift = shift; // We need this in any case (not really?)
 
@@ -21,6 +21,7 @@
 #include "status.h"
 #include "filter.h"
 #include "iir.h"
+#include "rds.h"
 
 // The four demodulator types
 enum demod_type {
@@ -105,6 +106,33 @@ struct frontend {
 
 extern struct frontend Frontend; // Only one per radio instance
 
+// Opus encoding is done by a pool of encoder threads (audio.c) so its cost doesn't land on the demod threads
+// Each channel hands its blocks of PCM to the pool through its own ring: the channel's demod thread is the only
+// producer, and the encoder thread holding the channel at the moment the only consumer
+#define OPUS_RING 8          // Blocks (calls to send_output); 160 ms at the default Blocktime
+#define OPUS_TIME_BINS 16    // Encode time histogram; bin 0 < 1 us, bin i from 2^(i-1) to 2^i us, last bin also longer
+
+struct opus_block {
+  int64_t queued;            // gps_time_ns() when handed off
+  uint32_t timestamp;        // RTP timestamp of the first sample
+  bool marker;               // First block after silence
+  int type;                  // RTP payload type when queued; it can change before the block is encoded
+  int samprate;
+  int channels;
+  int frames;
+  float *pcm;                // Interleaved
+};
+
+struct opus_ring {
+  struct opus_block block[OPUS_RING];
+  int size;                  // Floats allocated for each block
+  unsigned int head;         // Next block to fill; written only by the demod thread
+  unsigned int tail;         // Next block to encode; written only by the encoder thread holding the channel
+  // Protected by the pool mutex
+  bool scheduled;            // On the ready queue, or held by an encoder thread
+  struct channel *ready_next;
+};
+
 // Channel state block; there can be many of these
 // This is primarily for radiod, but it is also used by 'control' and 'monitor' to shadow
 // radiod's state, encoded for network transmission by send_radio_status and decoded by decode_radio_status().
@@ -181,6 +209,7 @@ struct channel {
     struct goertzel tone_detect; // PL tone detector state
     float tone_deviation;    // Measured deviation of tone
     bool threshold;          // Threshold extension
+    bool rds;                // Decode RDS on WFM channels (settable)
     float squelch_open;      // squelch open threshold, power ratio
     float squelch_close;     // squelch close threshold
     int squelch_tail;        // Frames to hold open after loss of SNR
@@ -190,6 +219,8 @@ struct channel {
                              // tc = 1 / (2 * M_PI * 300.) = 530.5e-6 sec for NBFM (300 Hz corner freq)
   } fm;
 
+  struct rds rds;             // RDS decoder state and results, WFM only
+
   // Used by spectrum analysis only
   // Coherent bin bandwidth = block rate in Hz
   // Coherent bin spacing = block rate * 1 - ((M-1)/(L+M-1))
@@ -221,9 +252,17 @@ struct channel {
     uint64_t samples;
     bool pacing;     // Pace output packets
     enum encoding encoding;
-    OpusEncoder *opus;
+    OpusEncoder *opus;       // Used only by the thread encoding the channel: see struct opus_ring
     int opus_channels;
     int opus_bitrate;
+    int opus_complexity;     // 0-10 (settable)
+    int opus_complexity_now; // In use; lowered automatically when encoding falls behind
+    int opus_fast;           // Consecutive blocks encoded well within Blocktime, toward raising it back
+    int64_t opus_cut_time;   // When it was last lowered
+    bool opus_silent;        // Last packet suppressed by DTX
+    struct opus_ring *opus_ring; // Allocated on the first block when the encoder pool is in use
+    uint64_t opus_drops;     // Blocks dropped because the ring was full
+    uint64_t opus_time[OPUS_TIME_BINS]; // Encode time histogram
   } output;
 
   struct {
@@ -238,6 +277,11 @@ struct channel {
     struct sockaddr_storage dest_socket; // Local status output; same IP as output.dest_socket but different port
     uint8_t *command;          // Incoming command
     int length;
+    bool bulk;                 // Answer the pending poll of all channels with a bulk record
+    bool bulk_keyframe;        // A complete one
+    unsigned int bulk_count;   // Bulk records sent
+    uint8_t *bulk_last;        // Complete status TLVs behind the last bulk record, the baseline for the next
+    int bulk_last_len;
   } status;
 
   struct {
@@ -266,6 +310,7 @@ extern int Output_fd;
 extern struct sockaddr_storage Metadata_dest_socket; // Socket for main metadata
 extern int Verbose;
 extern float Blocktime; // Common to all receiver slices. NB! Milliseconds, not seconds
+extern int N_encoder_threads; // Opus encoder pool; 0 encodes in the demod threads
 
 // Channel initialization & manipulation
 struct channel *create_chan(uint32_t ssrc);
@@ -298,10 +343,15 @@ void *demod_linear(void *);
 void *demod_spectrum(void *);
 
 int send_output(struct channel * restrict ,const float * restrict,int,bool);
+void close_opus(struct channel *chan);
 int send_radio_status(struct sockaddr const *,struct frontend const *, struct channel *);
+int send_bulk_status(struct frontend const *,struct channel *);
+int poll_all_status(int format);
+int send_frontend_status(struct sockaddr const *,struct frontend const *);
 int reset_radio_status(struct channel *chan);
 bool decode_radio_commands(struct channel *chan,uint8_t const *buffer,int length);
 int decode_radio_status(struct frontend *frontend,struct channel *channel,uint8_t const *buffer,int length);
+int encode_radio_field(uint8_t **bp,enum status_type type,struct frontend const *frontend,struct channel const *chan);
 
 int round_samprate(int x);
 #endif
@@ -34,16 +34,41 @@
 extern dictionary const *Preset_table;
 static int encode_radio_status(struct frontend const *frontend,struct channel const *chan,uint8_t *packet, int len);
 
+// Bulk status, asked for by a poll of all channels carrying BULK_FORMAT
+// Each channel's demod thread adds its record when its turn in the stagger comes. Records are packed
+// into BULK_STATUS datagrams, each sent when the next record won't fit, when every channel in the poll
+// has reported, or after BULK_HOLD if some never do (e.g., one got a command or went away)
+#define BULK_MTU 1400        // Stay within an Ethernet MTU; records are never split, so a bigger one goes alone
+#define BULK_KEYFRAME 10     // Every 10th record from a channel has all its fields
+#define BULK_STAGGER 16      // Channels reporting per block; a record is much smaller than a STATUS packet
+#define BULK_HOLD (BILLION/10)
+
+static pthread_mutex_t Bulk_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t Bulk_packet[PKTSIZE];
+static int Bulk_length;      // Including the type byte; 0 when empty
+static int64_t Bulk_first;   // When the first record went in
+static int Bulk_pending;     // Channels polled that haven't reported
+
+static void flush_bulk_status(void);
+
 // Radio status reception and transmission thread
 void *radio_status(void *arg){
   pthread_setname("radio stat");
-
+  {
+    // Wake up now and then to send a bulk status packet that's been waiting too long
+    struct timeval tv = { .tv_sec = 0, .tv_usec = BULK_HOLD / 1000 };
+    setsockopt(Ctl_fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+  }
   while(true){
     // Command from user
     uint8_t buffer[PKTSIZE];
     int const length = recv(Ctl_fd,buffer,sizeof(buffer),0);
+    pthread_mutex_lock(&Bulk_mutex);
+    if(Bulk_length > 0 && gps_time_ns() - Bulk_first >= BULK_HOLD)
+      flush_bulk_status();
+    pthread_mutex_unlock(&Bulk_mutex);
     if(length <= 0 || (enum pkt_type)buffer[0] != CMD)
-      continue; // short packet, or a response; ignore
+      continue; // short packet, timeout, or a response; ignore
 
     // for a specific ssrc?
     uint32_t ssrc = get_ssrc(buffer+1,length-1);
@@ -52,13 +77,21 @@ void *radio_status(void *arg){
       // Ignore; reserved for dynamic channel template
       break;
     case 0xffffffff:
-      // Ask all threads to dump their status in a staggered manner
-      for(int i=0; i < Channel_list_length; i++){
-	struct channel *chan = &Channel_list[i];
-	pthread_mutex_lock(&chan->status.lock);
-	if(chan->inuse && chan->output.rtp.ssrc != 0xffffffff && chan->output.rtp.ssrc != 0)
-	  chan->status.global_timer = (i >> 1) + 1; // two at a time
-	pthread_mutex_unlock(&chan->status.lock);
+      {
+	// Pollers that understand bulk status say so
+	int format = 0;
+	uint8_t const *cp = buffer + 1;
+	uint8_t const * const end = buffer + length;
+	enum status_type type;
+	uint8_t const *value;
+	int optlen,len;
+	while((len = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+	  if(type == BULK_FORMAT)
+	    format = decode_int(value,optlen);
+	  cp += len;
+	}
+	send_frontend_status((struct sockaddr *)&Metadata_dest_socket,&Frontend);
+	poll_all_status(format);
       }
       break;
     default:
@@ -111,6 +144,173 @@ int send_radio_status(struct sockaddr const *sock,struct frontend const *fronten
   sendto(Output_fd,packet,len,0,sock,sizeof(struct sockaddr));
   return 0;
 }
+// Status of the front end and of radiod as a whole, sent once in reply to a poll of all channels
+// It carries OUTPUT_SSRC 0xffffffff so it can't be taken for a channel, and holds what would otherwise
+// be repeated in every channel's status, such as the FFT worker queue waits
+int send_frontend_status(struct sockaddr const *sock,struct frontend const *frontend){
+  uint8_t packet[PKTSIZE];
+  uint8_t *bp = packet;
+  *bp++ = STATUS;
+  encode_int32(&bp,OUTPUT_SSRC,0xffffffff);
+  if(strlen(frontend->description) > 0)
+    encode_string(&bp,DESCRIPTION,frontend->description,strlen(frontend->description));
+  encode_int64(&bp,GPS_TIME,frontend->timestamp != 0 ? frontend->timestamp : gps_time_ns());
+  encode_radio_field(&bp,INPUT_SAMPLES,frontend,NULL);
+  encode_radio_field(&bp,INPUT_SAMPRATE,frontend,NULL);
+  encode_radio_field(&bp,FE_ISREAL,frontend,NULL);
+  encode_int32(&bp,FILTER_BLOCKSIZE,frontend->in.ilen);
+  encode_int32(&bp,FILTER_FIR_LENGTH,frontend->in.impulse_length);
+  for(enum fft_class c = 0; c < N_FFT_CLASSES; c++){
+    struct fft_stats stats;
+    if(get_fft_stats(&stats,c) == 0 && stats.jobs > 0){
+      float hist[FFT_WAIT_BINS];
+      for(int i=0; i < FFT_WAIT_BINS; i++)
+	hist[i] = stats.hist[i];
+      encode_vector(&bp,c == FFT_SHORT ? FFT_WAIT_SHORT : FFT_WAIT_BULK,hist,FFT_WAIT_BINS);
+    }
+  }
+  encode_eol(&bp);
+  sendto(Output_fd,packet,bp - packet,0,sock,sizeof(struct sockaddr));
+  return 0;
+}
+
+// Ask all channel threads to send their status in a staggered manner, in BULK_STATUS packets if format != 0
+// (2 = every field, as for a new poller) or else a STATUS packet per channel. Returns the number of channels polled
+int poll_all_status(int format){
+  int n = 0;
+  for(int i=0; i < Channel_list_length; i++){
+    struct channel *chan = &Channel_list[i];
+    pthread_mutex_lock(&chan->status.lock);
+    if(chan->inuse && chan->output.rtp.ssrc != 0xffffffff && chan->output.rtp.ssrc != 0){
+      chan->status.bulk = format != 0;
+      if(format != 0){
+	chan->status.global_timer = (n / BULK_STAGGER) + 1;
+	if(format == 2)
+	  chan->status.bulk_keyframe = true;
+      } else
+	chan->status.global_timer = (i >> 1) + 1; // two at a time
+      n++;
+    }
+    pthread_mutex_unlock(&chan->status.lock);
+  }
+  if(format != 0){
+    pthread_mutex_lock(&Bulk_mutex);
+    Bulk_pending = n;
+    pthread_mutex_unlock(&Bulk_mutex);
+  }
+  return n;
+}
+
+// Send what's in the bulk status packet. Caller holds Bulk_mutex
+static void flush_bulk_status(void){
+  if(Bulk_length > 0)
+    sendto(Output_fd,Bulk_packet,Bulk_length,0,(struct sockaddr *)&Metadata_dest_socket,sizeof(struct sockaddr));
+  Bulk_length = 0;
+}
+
+// Build a channel's bulk record from its complete status TLVs (tlv, len): OUTPUT_SSRC, BULK_FORMAT, then
+// every TLV that isn't byte for byte the same as in the channel's last record, or all of them in a keyframe
+// The complete TLVs become the baseline for the next record
+// A changed-fields record can't say that a field went away (e.g., the OPUS_* items after a change of
+// encoding, or TP1 turning NaN), so the record is a keyframe whenever the set of types differs from the baseline
+static int bulk_record(struct channel *chan,uint8_t const *tlv,int len,uint8_t *record){
+  bool keyframe = chan->status.bulk_last == NULL || chan->status.bulk_keyframe
+    || chan->status.bulk_count % BULK_KEYFRAME == 0;
+
+  // Where each type was in the baseline
+  int last[256];
+  if(!keyframe){
+    memset(last,0xff,sizeof(last)); // -1
+    uint8_t const *cp = chan->status.bulk_last;
+    uint8_t const * const end = cp + chan->status.bulk_last_len;
+    enum status_type type;
+    uint8_t const *value;
+    int optlen,n;
+    int nlast = 0;
+    while((n = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+      if(last[type & 0xff] < 0)
+	nlast++;
+      last[type & 0xff] = cp - chan->status.bulk_last;
+      cp += n;
+    }
+    // Same types as the baseline? Each type found must be in it, and all of them must be found
+    bool found[256];
+    memset(found,0,sizeof(found));
+    int nfound = 0;
+    cp = tlv;
+    while(!keyframe && (n = tlv_parse(cp,tlv + len - cp,&type,&value,&optlen)) > 0){
+      if(last[type & 0xff] < 0)
+	keyframe = true; // New
+      else if(!found[type & 0xff]){
+	found[type & 0xff] = true;
+	nfound++;
+      }
+      cp += n;
+    }
+    if(nfound != nlast)
+      keyframe = true; // Something went away
+  }
+  uint8_t *bp = record;
+  encode_int32(&bp,OUTPUT_SSRC,chan->output.rtp.ssrc);
+  encode_byte(&bp,BULK_FORMAT,keyframe ? 2 : 1);
+  {
+    uint8_t const *cp = tlv;
+    uint8_t const * const end = tlv + len;
+    enum status_type type;
+    uint8_t const *value;
+    int optlen,n;
+    while((n = tlv_parse(cp,end - cp,&type,&value,&optlen)) > 0){
+      if(type != OUTPUT_SSRC){
+	int const i = keyframe ? -1 : last[type & 0xff];
+	if(i < 0 || i + n > chan->status.bulk_last_len || memcmp(chan->status.bulk_last + i,cp,n) != 0){
+	  memcpy(bp,cp,n);
+	  bp += n;
+	}
+      }
+      cp += n;
+    }
+  }
+  encode_eol(&bp);
+
+  if(chan->status.bulk_last_len < len || chan->status.bulk_last == NULL){
+    FREE(chan->status.bulk_last);
+    chan->status.bulk_last = malloc(len);
+  }
+  if(chan->status.bulk_last != NULL)
+    memcpy(chan->status.bulk_last,tlv,len);
+  chan->status.bulk_last_len = chan->status.bulk_last != NULL ? len : 0;
+  chan->status.bulk_count++;
+  chan->status.bulk_keyframe = false;
+  return bp - record;
+}
+
+// Add this channel's record to the bulk status packet in response to a poll of all channels
+// Called by the channel's demod thread in place of send_radio_status()
+int send_bulk_status(struct frontend const *frontend,struct channel *chan){
+  uint8_t packet[PKTSIZE];
+  uint8_t record[PKTSIZE];
+  chan->status.packets_out++;
+  int const len = encode_radio_status(frontend,chan,packet,sizeof(packet));
+  int const rlen = bulk_record(chan,packet + 1,len - 1,record); // Skip the STATUS byte
+  chan->status.bulk = false;
+
+  pthread_mutex_lock(&Bulk_mutex);
+  if(Bulk_length > 0 && Bulk_length + rlen > BULK_MTU)
+    flush_bulk_status();
+  if(Bulk_length == 0){
+    Bulk_packet[Bulk_length++] = BULK_STATUS;
+    Bulk_first = gps_time_ns();
+  }
+  memcpy(Bulk_packet + Bulk_length,record,rlen);
+  Bulk_length += rlen;
+  if(--Bulk_pending <= 0 || Bulk_length >= BULK_MTU){
+    Bulk_pending = max(Bulk_pending,0);
+    flush_bulk_status();
+  }
+  pthread_mutex_unlock(&Bulk_mutex);
+  return 0;
+}
+
 int reset_radio_status(struct channel *chan){
   // Reset integrators
   chan->sig.bb_energy = 0;
@@ -287,6 +487,9 @@ bool decode_radio_commands(struct channel *chan,uint8_t const *buffer,int length
     case THRESH_EXTEND:
       chan->fm.threshold = decode_bool(cp,optlen);
       break;
+    case RDS_ENABLE:
+      chan->fm.rds = decode_bool(cp,optlen);
+      break;
     case HEADROOM: // dB -> voltage, always negative dB
       {
 	float const f = decode_float(cp,optlen);
@@ -409,7 +612,15 @@ bool decode_radio_commands(struct channel *chan,uint8_t const *buffer,int length
 	  chan->output.rtp.type = pt_from_info(chan->output.samprate,chan->output.channels,chan->output.encoding);
 	}
       }
-
+      break;
+    case OPUS_COMPLEXITY:
+      {
+	// Takes effect on the next block; the encoder thread reads it without locking
+	int const x = decode_int(cp,optlen);
+	if(x >= 0 && x <= 10)
+	  chan->output.opus_complexity = x;
+      }
+      break;
     default:
       break;
     }
@@ -448,9 +659,9 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
   *bp++ = STATUS; // 0 = status, 1 = command
 
   // parameters valid in all modes
-  encode_int32(&bp,OUTPUT_SSRC,chan->output.rtp.ssrc); // Now used as channel ID, so present in all modes
-  encode_int32(&bp,COMMAND_TAG,chan->status.tag); // at top to make it easier to spot in dumps
-  encode_int64(&bp,CMD_CNT,chan->status.packets_in); // integer
+  encode_radio_field(&bp,OUTPUT_SSRC,frontend,chan); // Now used as channel ID, so present in all modes
+  encode_radio_field(&bp,COMMAND_TAG,frontend,chan); // at top to make it easier to spot in dumps
+  encode_radio_field(&bp,CMD_CNT,frontend,chan); // integer
   if(strlen(frontend->description) > 0)
     encode_string(&bp,DESCRIPTION,frontend->description,strlen(frontend->description));
 
@@ -462,27 +673,27 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
   else
     encode_int64(&bp,GPS_TIME,gps_time_ns());
 
-  encode_int64(&bp,INPUT_SAMPLES,frontend->samples);
-  encode_int32(&bp,INPUT_SAMPRATE,frontend->samprate); // integer Hz
-  encode_int32(&bp,FE_ISREAL,frontend->isreal ? true : false);
+  encode_radio_field(&bp,INPUT_SAMPLES,frontend,chan);
+  encode_radio_field(&bp,INPUT_SAMPRATE,frontend,chan); // integer Hz
+  encode_radio_field(&bp,FE_ISREAL,frontend,chan);
   encode_double(&bp,CALIBRATE,frontend->calibrate);
-  encode_double(&bp,RF_GAIN,frontend->rf_gain);
-  encode_double(&bp,RF_ATTEN,frontend->rf_atten);
-  encode_int32(&bp,LNA_GAIN,frontend->lna_gain);
-  encode_int32(&bp,MIXER_GAIN,frontend->mixer_gain);
-  encode_int32(&bp,IF_GAIN,frontend->if_gain);
-  encode_float(&bp,FE_LOW_EDGE,frontend->min_IF);
-  encode_float(&bp,FE_HIGH_EDGE,frontend->max_IF);
-  encode_int32(&bp,AD_BITS_PER_SAMPLE,frontend->bitspersample);
+  encode_radio_field(&bp,RF_GAIN,frontend,chan);
+  encode_radio_field(&bp,RF_ATTEN,frontend,chan);
+  encode_radio_field(&bp,LNA_GAIN,frontend,chan);
+  encode_radio_field(&bp,MIXER_GAIN,frontend,chan);
+  encode_radio_field(&bp,IF_GAIN,frontend,chan);
+  encode_radio_field(&bp,FE_LOW_EDGE,frontend,chan);
+  encode_radio_field(&bp,FE_HIGH_EDGE,frontend,chan);
+  encode_radio_field(&bp,AD_BITS_PER_SAMPLE,frontend,chan);
 
   // Tuning
-  encode_double(&bp,RADIO_FREQUENCY,chan->tune.freq); // Hz
-  encode_double(&bp,FIRST_LO_FREQUENCY,frontend->frequency); // Hz
-  encode_double(&bp,SECOND_LO_FREQUENCY,chan->tune.second_LO); // Hz
+  encode_radio_field(&bp,RADIO_FREQUENCY,frontend,chan); // Hz
+  encode_radio_field(&bp,FIRST_LO_FREQUENCY,frontend,chan); // Hz
+  encode_radio_field(&bp,SECOND_LO_FREQUENCY,frontend,chan); // Hz
 
   encode_int32(&bp,FILTER_BLOCKSIZE,frontend->in.ilen);
   encode_int32(&bp,FILTER_FIR_LENGTH,frontend->in.impulse_length);
-  encode_int32(&bp,FILTER_DROPS,chan->filter.out.block_drops);  // count
+  encode_radio_field(&bp,FILTER_DROPS,frontend,chan);  // count
 
   // Adjust for A/D width
   // Level is absolute relative to A/D saturation, so +3dB for real vs complex
@@ -495,38 +706,34 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
       level *= 2;
     encode_float(&bp,IF_POWER,power2dB(level));
   }
-  encode_int64(&bp,AD_OVER,frontend->overranges);
-  encode_int64(&bp,SAMPLES_SINCE_OVER,frontend->samp_since_over);
-  encode_float(&bp,NOISE_DENSITY,power2dB(chan->sig.n0));
+  encode_radio_field(&bp,AD_OVER,frontend,chan);
+  encode_radio_field(&bp,SAMPLES_SINCE_OVER,frontend,chan);
+  encode_radio_field(&bp,NOISE_DENSITY,frontend,chan);
 
   // Modulation mode
-  encode_byte(&bp,DEMOD_TYPE,chan->demod_type);
-  {
-    int len = strlen(chan->preset);
-    if(len > 0 && len < sizeof(chan->preset))
-      encode_string(&bp,PRESET,chan->preset,len);
-  }
+  encode_radio_field(&bp,DEMOD_TYPE,frontend,chan);
+  encode_radio_field(&bp,PRESET,frontend,chan);
   // Mode-specific params
   switch(chan->demod_type){
   case LINEAR_DEMOD:
-    encode_byte(&bp,PLL_ENABLE,chan->linear.pll); // bool
+    encode_radio_field(&bp,PLL_ENABLE,frontend,chan); // bool
     if(chan->linear.pll){
-      encode_float(&bp,FREQ_OFFSET,chan->sig.foffset);     // Hz; used differently in linear and fm
-      encode_byte(&bp,PLL_LOCK,chan->linear.pll_lock); // bool
-      encode_byte(&bp,PLL_SQUARE,chan->linear.square); //bool
-      encode_float(&bp,PLL_PHASE,chan->linear.cphase); // radians
-      encode_float(&bp,PLL_BW,chan->linear.loop_bw);   // hz
-      encode_int64(&bp,PLL_WRAPS,chan->linear.rotations); // count of complete 360-deg rotations of PLL phase
+      encode_radio_field(&bp,FREQ_OFFSET,frontend,chan);     // Hz; used differently in linear and fm
+      encode_radio_field(&bp,PLL_LOCK,frontend,chan); // bool
+      encode_radio_field(&bp,PLL_SQUARE,frontend,chan); //bool
+      encode_radio_field(&bp,PLL_PHASE,frontend,chan); // radians
+      encode_radio_field(&bp,PLL_BW,frontend,chan);   // hz
+      encode_radio_field(&bp,PLL_WRAPS,frontend,chan); // count of complete 360-deg rotations of PLL phase
       // Relevant only when squelches are active
-      encode_float(&bp,SQUELCH_OPEN,power2dB(chan->fm.squelch_open));
-      encode_float(&bp,SQUELCH_CLOSE,power2dB(chan->fm.squelch_close));
+      encode_radio_field(&bp,SQUELCH_OPEN,frontend,chan);
+      encode_radio_field(&bp,SQUELCH_CLOSE,frontend,chan);
     }
-    encode_byte(&bp,ENVELOPE,chan->linear.env); // bool
-    encode_double(&bp,SHIFT_FREQUENCY,chan->tune.shift); // Hz
-    encode_byte(&bp,AGC_ENABLE,chan->linear.agc); // bool
+    encode_radio_field(&bp,ENVELOPE,frontend,chan); // bool
+    encode_radio_field(&bp,SHIFT_FREQUENCY,frontend,chan); // Hz
+    encode_radio_field(&bp,AGC_ENABLE,frontend,chan); // bool
     if(chan->linear.agc){
       encode_float(&bp,AGC_HANGTIME,chan->linear.hangtime*(.001 * Blocktime)); // samples -> sec
-      encode_float(&bp,AGC_THRESHOLD,voltage2dB(chan->linear.threshold)); // amplitude -> dB
+      encode_radio_field(&bp,AGC_THRESHOLD,frontend,chan); // amplitude -> dB
       encode_float(&bp,AGC_RECOVERY_RATE,voltage2dB(chan->linear.recovery_rate)/(.001*Blocktime)); // amplitude/block -> dB/sec
     }
 #if 0
@@ -535,23 +742,39 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
     break;
   case FM_DEMOD:
     if(chan->fm.tone_freq != 0){
-      encode_float(&bp,PL_TONE,chan->fm.tone_freq);
-      encode_float(&bp,PL_DEVIATION,chan->fm.tone_deviation);
+      encode_radio_field(&bp,PL_TONE,frontend,chan);
+      encode_radio_field(&bp,PL_DEVIATION,frontend,chan);
     }
   case WFM_DEMOD:  // Note fall-through from FM_DEMOD
     // Relevant only when squelches are active
-    encode_float(&bp,FREQ_OFFSET,chan->sig.foffset);     // Hz; used differently in linear and fm
-    encode_float(&bp,SQUELCH_OPEN,power2dB(chan->fm.squelch_open));
-    encode_float(&bp,SQUELCH_CLOSE,power2dB(chan->fm.squelch_close));
-    encode_byte(&bp,THRESH_EXTEND,chan->fm.threshold);
-    encode_float(&bp,PEAK_DEVIATION,chan->fm.pdeviation); // Hz
+    encode_radio_field(&bp,FREQ_OFFSET,frontend,chan);     // Hz; used differently in linear and fm
+    encode_radio_field(&bp,SQUELCH_OPEN,frontend,chan);
+    encode_radio_field(&bp,SQUELCH_CLOSE,frontend,chan);
+    encode_radio_field(&bp,THRESH_EXTEND,frontend,chan);
+    encode_radio_field(&bp,PEAK_DEVIATION,frontend,chan); // Hz
     encode_float(&bp,DEEMPH_TC,-1.0/(logf(chan->fm.rate) * chan->output.samprate));
     encode_float(&bp,DEEMPH_GAIN,voltage2dB(chan->fm.gain));
+    if(chan->demod_type == WFM_DEMOD){
+      encode_radio_field(&bp,RDS_ENABLE,frontend,chan);
+      if(chan->fm.rds && chan->rds.pi != 0){
+	encode_radio_field(&bp,RDS_PI,frontend,chan);
+	// Copy first; the demod thread may update them at any time
+	char text[sizeof(chan->rds.rt)];
+	memcpy(text,chan->rds.ps,sizeof(chan->rds.ps));
+	text[sizeof(chan->rds.ps)-1] = '\0';
+	if(strlen(text) > 0)
+	  encode_string(&bp,RDS_PS,text,strlen(text));
+	memcpy(text,chan->rds.rt,sizeof(chan->rds.rt));
+	text[sizeof(chan->rds.rt)-1] = '\0';
+	if(strlen(text) > 0)
+	  encode_string(&bp,RDS_RT,text,strlen(text));
+      }
+    }
     break;
   case SPECT_DEMOD:
     {
-      encode_float(&bp,NONCOHERENT_BIN_BW,chan->spectrum.bin_bw); // Hz
-      encode_int(&bp,BIN_COUNT,chan->spectrum.bin_count);
+      encode_radio_field(&bp,NONCOHERENT_BIN_BW,frontend,chan); // Hz
+      encode_radio_field(&bp,BIN_COUNT,frontend,chan);
       // encode bin data here? maybe change this, it can be a lot
       // Also need to unwrap this, frequency data is dc....max positive max negative...least negative
       if(chan->spectrum.bin_data != NULL){
@@ -568,11 +791,11 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
   }
   // Lots of stuff not relevant in spectrum analysis mode
   if(chan->demod_type != SPECT_DEMOD){
-    encode_float(&bp,LOW_EDGE,chan->filter.min_IF); // Hz
-    encode_float(&bp,HIGH_EDGE,chan->filter.max_IF); // Hz
-    encode_int32(&bp,OUTPUT_SAMPRATE,chan->output.samprate); // Hz
-    encode_int64(&bp,OUTPUT_DATA_PACKETS,chan->output.rtp.packets);
-    encode_float(&bp,KAISER_BETA,chan->filter.kaiser_beta); // Dimensionless
+    encode_radio_field(&bp,LOW_EDGE,frontend,chan); // Hz
+    encode_radio_field(&bp,HIGH_EDGE,frontend,chan); // Hz
+    encode_radio_field(&bp,OUTPUT_SAMPRATE,frontend,chan); // Hz
+    encode_radio_field(&bp,OUTPUT_DATA_PACKETS,frontend,chan);
+    encode_radio_field(&bp,KAISER_BETA,frontend,chan); // Dimensionless
 
     // BASEBAND_POWER is now the average since last poll
     if(chan->status.blocks_since_poll > 0){
@@ -586,14 +809,14 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
 	encode_float(&bp,GAIN,power2dB(gain));
       }
     }
-    encode_int64(&bp,OUTPUT_SAMPLES,chan->output.samples);
-    encode_float(&bp,HEADROOM,voltage2dB(chan->output.headroom)); // amplitude -> dB
+    encode_radio_field(&bp,OUTPUT_SAMPLES,frontend,chan);
+    encode_radio_field(&bp,HEADROOM,frontend,chan); // amplitude -> dB
     // Doppler info
-    encode_double(&bp,DOPPLER_FREQUENCY,chan->tune.doppler); // Hz
-    encode_double(&bp,DOPPLER_FREQUENCY_RATE,chan->tune.doppler_rate); // Hz
-    encode_int32(&bp,OUTPUT_CHANNELS,chan->output.channels);
+    encode_radio_field(&bp,DOPPLER_FREQUENCY,frontend,chan); // Hz
+    encode_radio_field(&bp,DOPPLER_FREQUENCY_RATE,frontend,chan); // Hz
+    encode_radio_field(&bp,OUTPUT_CHANNELS,frontend,chan);
     if(!isnan(chan->sig.snr))
-      encode_float(&bp,DEMOD_SNR,power2dB(chan->sig.snr)); // abs ratio -> dB
+      encode_radio_field(&bp,DEMOD_SNR,frontend,chan); // abs ratio -> dB
 
     // Source address we're using to send data
     // Get the local socket for the output stream
@@ -604,21 +827,31 @@ static int encode_radio_status(struct frontend const *frontend,struct channel co
       socklen_t len = sizeof(chan->output.source_socket);
       getsockname(Output_fd,(struct sockaddr *)&chan->output.source_socket,&len);
     }
-    encode_socket(&bp,OUTPUT_DATA_SOURCE_SOCKET,&chan->output.source_socket);
+    encode_radio_field(&bp,OUTPUT_DATA_SOURCE_SOCKET,frontend,chan);
     // Where we're sending PCM output
-    encode_socket(&bp,OUTPUT_DATA_DEST_SOCKET,&chan->output.dest_socket);
+    encode_radio_field(&bp,OUTPUT_DATA_DEST_SOCKET,frontend,chan);
     encode_int32(&bp,OUTPUT_TTL,Mcast_ttl);
-    encode_int64(&bp,OUTPUT_METADATA_PACKETS,chan->status.packets_out);
-    encode_byte(&bp,RTP_PT,chan->output.rtp.type);
-    encode_int32(&bp,STATUS_INTERVAL,chan->status.output_interval);
-    encode_int(&bp,OUTPUT_ENCODING,chan->output.encoding);
+    encode_radio_field(&bp,OUTPUT_METADATA_PACKETS,frontend,chan);
+    encode_radio_field(&bp,RTP_PT,frontend,chan);
+    encode_radio_field(&bp,STATUS_INTERVAL,frontend,chan);
+    encode_radio_field(&bp,OUTPUT_ENCODING,frontend,chan);
+    if(chan->output.encoding == OPUS){
+      encode_radio_field(&bp,OPUS_COMPLEXITY,frontend,chan);
+      encode_radio_field(&bp,OPUS_COMPLEXITY_NOW,frontend,chan);
+      encode_radio_field(&bp,OPUS_DROPS,frontend,chan);
+      // Written by the encoder thread without locking; they're only statistics
+      float hist[OPUS_TIME_BINS];
+      for(int i=0; i < OPUS_TIME_BINS; i++)
+	hist[i] = chan->output.opus_time[i];
+      encode_vector(&bp,OPUS_ENCODE_TIME,hist,OPUS_TIME_BINS);
+    }
   }
   // Don't send test points unless they're in use
   if(!isnan(chan->tp1))
-    encode_float(&bp,TP1,chan->tp1);
+    encode_radio_field(&bp,TP1,frontend,chan);
   if(!isnan(chan->tp2))
-    encode_float(&bp,TP2,chan->tp2);
-  encode_int64(&bp,BLOCKS_SINCE_POLL,chan->status.blocks_since_poll);
+    encode_radio_field(&bp,TP2,frontend,chan);
+  encode_radio_field(&bp,BLOCKS_SINCE_POLL,frontend,chan);
 
   encode_eol(&bp);
 
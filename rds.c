@@ -0,0 +1,222 @@
+// Radio Data System (RDS/RBDS) decoder for ka9q-radio's wfm demodulator
+// Input is the 57 kHz subcarrier spun to 0 Hz by a slave of the wfm composite filter
+// Decodes the program ID (PI), program service name (PS) and radiotext (RT)
+// Copyright 2024, Phil Karn, KA9Q
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+#include "misc.h"
+#include "rds.h"
+
+// Smoothing constants, per sample at RDS_SAMPRATE
+static float const Carrier_alpha = 0.002; // ~25 ms carrier phase time constant
+static float const Timing_alpha = 0.002;  // ~0.5 sec symbol timing time constant (each phase updated once per bit)
+static int const Max_bad_blocks = 20;     // Consecutive bad blocks before dropping sync
+
+// Offset words added to the check bits of blocks A, B, C, C' and D (IEC 62106 annex A)
+static uint16_t const Offsets[] = { 0x0fc, 0x198, 0x168, 0x350, 0x1b4 };
+static int const Offset_block[] = { 0, 1, 2, 2, 3 };
+
+static void rds_bit(struct rds *rds,bool bit);
+static void decode_group(struct rds *rds);
+
+void rds_init(struct rds *rds){
+  assert(rds != NULL);
+  memset(rds,0,sizeof(*rds));
+  rds->ref = 1;
+  rds->rt_ab = -1;
+  memset(rds->ps_work,' ',sizeof(rds->ps_work));
+  memset(rds->rt_work,' ',sizeof(rds->rt_work));
+}
+
+// Process n complex samples at RDS_SAMPRATE
+// The subcarrier is DSB-SC (BPSK) carrying biphase symbols, so squaring the signal
+// gives a clean carrier at twice its phase. The 180 degree ambiguity is removed by the differential coding
+void rds_process(struct rds *rds,complex float const *samples,int n){
+  assert(rds != NULL && samples != NULL);
+  for(int i=0; i < n; i++){
+    complex float const s = samples[i];
+    rds->carrier2 += Carrier_alpha * (s * s - rds->carrier2);
+    complex float ref = csqrtf(rds->carrier2);
+    if(crealf(ref * conjf(rds->ref)) < 0)
+      ref = -ref; // Keep the reference from flipping sign at the csqrtf branch cut
+    rds->ref = ref;
+
+    int const phase = rds->phase;
+    rds->history[phase] = crealf(s * conjf(ref));
+
+    // Biphase matched filter over the last bit time: first half minus second half
+    float y = 0;
+    for(int k=1; k <= RDS_SPB/2; k++)
+      y += rds->history[(phase + k) % RDS_SPB];
+    for(int k=RDS_SPB/2+1; k <= RDS_SPB; k++)
+      y -= rds->history[(phase + k) % RDS_SPB];
+
+    // The matched filter output is strongest when aligned with the bit boundaries
+    rds->energy[phase] += Timing_alpha * (y * y - rds->energy[phase]);
+    if(phase == rds->strobe){
+      bool const b = y > 0;
+      rds_bit(rds,b ^ rds->last_bit); // Undo differential encoding
+      rds->last_bit = b;
+    }
+    if(++rds->phase == RDS_SPB){
+      rds->phase = 0;
+      // Pick the strongest timing phase for the next bit
+      int best = 0;
+      for(int k=1; k < RDS_SPB; k++)
+	if(rds->energy[k] > rds->energy[best])
+	  best = k;
+      rds->strobe = best;
+    }
+  }
+}
+
+// Check bits for a 16-bit information word, generator x^10 + x^8 + x^7 + x^5 + x^4 + x^3 + 1
+static unsigned int checkword(unsigned int info){
+  uint32_t r = (info & 0xffff) << 10;
+  for(int i=25; i >= 10; i--){
+    if(r & (1UL << i))
+      r ^= 0x5b9UL << (i - 10);
+  }
+  return r & 0x3ff;
+}
+
+// Return block index (0-3 = A-D) if the 26-bit register holds a valid block, otherwise -1
+static int block_type(uint32_t reg){
+  unsigned int const offset = (checkword(reg >> 10) ^ reg) & 0x3ff;
+  for(int i=0; i < (int)(sizeof(Offsets)/sizeof(Offsets[0])); i++){
+    if(offset == Offsets[i])
+      return Offset_block[i];
+  }
+  return -1;
+}
+
+static void rds_bit(struct rds *rds,bool bit){
+  rds->reg = ((rds->reg << 1) | bit) & 0x3ffffff;
+  if(rds->bitcount < 26)
+    rds->bitcount++;
+
+  if(rds->synced){
+    if(rds->bitcount < 26)
+      return;
+    rds->bitcount = 0;
+    int const expect = (rds->block + 1) & 3;
+    rds->block = expect;
+    if(block_type(rds->reg) == expect){
+      rds->bad_blocks = 0;
+      rds->group[expect] = rds->reg >> 10;
+      rds->group_ok |= 1 << expect;
+    } else if(++rds->bad_blocks >= Max_bad_blocks){
+      rds->synced = false;
+      rds->group_ok = 0;
+      return;
+    }
+    if(expect == 3){
+      decode_group(rds);
+      rds->group_ok = 0;
+    }
+    return;
+  }
+  // Search for two valid blocks in sequence, one block time apart
+  int const b = block_type(rds->reg);
+  if(b < 0)
+    return;
+  if(rds->bitcount == 26 && b == ((rds->block + 1) & 3)){
+    rds->synced = true;
+    rds->bad_blocks = 0;
+    rds->group_ok = 0;
+  }
+  rds->bitcount = 0;
+  rds->block = b;
+  if(rds->synced && b != 3){
+    rds->group[b] = rds->reg >> 10;
+    rds->group_ok |= 1 << b;
+  }
+}
+
+// Copy text to a published, null-terminated string, replacing unprintables and trimming trailing blanks
+static void publish(char *out,char const *in,int len){
+  for(int i=0; i < len; i++)
+    out[i] = (in[i] >= 0x20 && in[i] < 0x7f) ? in[i] : ' ';
+  while(len > 0 && out[len-1] == ' ')
+    len--;
+  out[len] = '\0';
+}
+
+// Publish the radiotext once every segment up to the end (or a carriage return) has arrived
+static void update_rt(struct rds *rds,int seglen){
+  int const total = 16 * seglen;
+  int end = total;
+  char const *cr = memchr(rds->rt_work,'\r',total);
+  if(cr != NULL)
+    end = cr - rds->rt_work;
+  int const segments = (end + seglen - 1) / seglen;
+  uint32_t const needed = segments >= 32 ? 0xffffffff : (1UL << segments) - 1;
+  if((rds->rt_mask & needed) == needed)
+    publish(rds->rt,rds->rt_work,end);
+}
+
+static void decode_group(struct rds *rds){
+  unsigned int const ok = rds->group_ok;
+  uint16_t const * const g = rds->group;
+
+  if(ok & 1)
+    rds->pi = g[0];
+  if(!(ok & 2))
+    return; // Block B carries the group type
+  rds->groups++;
+
+  int const type = g[1] >> 12;
+  bool const version_b = (g[1] >> 11) & 1;
+  if(version_b && (ok & 4))
+    rds->pi = g[2]; // Block C' repeats the PI
+
+  switch(type){
+  case 0: // Basic tuning and switching: program service name, 2 characters per group
+    if(ok & 8){
+      int const addr = g[1] & 3;
+      rds->ps_work[2*addr] = g[3] >> 8;
+      rds->ps_work[2*addr+1] = g[3];
+      rds->ps_mask |= 1 << addr;
+      if(rds->ps_mask == 0xf){
+	publish(rds->ps,rds->ps_work,sizeof(rds->ps_work));
+	rds->ps_mask = 0;
+      }
+    }
+    break;
+  case 2: // Radiotext, 4 characters per 2A group or 2 per 2B group
+    {
+      int const ab = (g[1] >> 4) & 1;
+      if(ab != rds->rt_ab){
+	// Text A/B flag change means a new message
+	rds->rt_ab = ab;
+	memset(rds->rt_work,' ',sizeof(rds->rt_work));
+	rds->rt_mask = 0;
+      }
+      int const addr = g[1] & 0xf;
+      if(!version_b){
+	if((ok & 0xc) != 0xc)
+	  break;
+	rds->rt_work[4*addr] = g[2] >> 8;
+	rds->rt_work[4*addr+1] = g[2];
+	rds->rt_work[4*addr+2] = g[3] >> 8;
+	rds->rt_work[4*addr+3] = g[3];
+	rds->rt_mask |= 1 << addr;
+	update_rt(rds,4);
+      } else {
+	if(!(ok & 8))
+	  break;
+	rds->rt_work[2*addr] = g[3] >> 8;
+	rds->rt_work[2*addr+1] = g[3];
+	rds->rt_mask |= 1 << addr;
+	update_rt(rds,2);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,51 @@
+// Radio Data System (RDS/RBDS) decoder for ka9q-radio's wfm demodulator
+// Copyright 2024, Phil Karn, KA9Q
+#ifndef _RDS_H
+#define _RDS_H 1
+#include <complex.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The RDS subcarrier is 3x the 19 kHz pilot; the bit rate is 1/48 of the pilot
+#define RDS_CARRIER 57000.
+#define RDS_BITRATE 1187.5
+#define RDS_SAMPRATE 19000 // Input sample rate, complex baseband centered on 57 kHz
+#define RDS_SPB 16         // Samples per data bit at RDS_SAMPRATE
+
+struct rds {
+  // Demodulator state
+  complex float carrier2;  // Smoothed square of the BPSK subcarrier
+  complex float ref;       // Carrier phase reference, sign-continuous square root of carrier2
+  float history[RDS_SPB];  // Last data bit's worth of coherently demodulated samples
+  float energy[RDS_SPB];   // Smoothed biphase matched filter energy at each sample phase
+  int phase;               // Sample index within the current bit, 0 to RDS_SPB-1
+  int strobe;              // Sample phase at which bits are decided
+  bool last_bit;           // Previous channel bit, for differential decoding
+
+  // Block synchronizer
+  uint32_t reg;            // Last 26 data bits received
+  int bitcount;            // Bits since last block boundary when synchronized, or since last candidate when not
+  int block;               // Index of the last block found (0-3 = A-D)
+  bool synced;
+  int bad_blocks;          // Consecutive blocks failing the check
+  uint16_t group[4];       // Blocks A-D of the group being assembled
+  unsigned group_ok;       // Bit mask of group[] entries that passed the check
+
+  // Text being assembled
+  char ps_work[8];
+  unsigned ps_mask;        // Segments of ps_work received
+  char rt_work[64];
+  uint32_t rt_mask;        // Segments of rt_work received
+  int rt_ab;               // Radiotext A/B flag; a change means clear the display
+
+  // Published results, read by the status thread
+  uint16_t pi;             // Program identification, 0 until decoded
+  char ps[9];              // Program service name, null terminated
+  char rt[65];             // Radiotext, null terminated
+  uint64_t groups;         // Count of groups decoded
+};
+
+void rds_init(struct rds *rds);
+void rds_process(struct rds *rds,complex float const *samples,int n);
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "misc.h"
 #include "multicast.h"
+#include "rtp_recv.h"
 #include "status.h"
 #include "filter.h"
 #include "iir.h"
@@ -31,19 +32,20 @@ struct session {
   struct session *prev;       // Linked list pointers
   struct session *next; 
   
-  struct sockaddr sender;
+  struct sockaddr_storage sender;
   char addr[NI_MAXHOST];    // RTP Sender IP address
   char port[NI_MAXSERV];    // RTP Sender source port
 
   pthread_t thread;
-  pthread_mutex_t qmutex;
-  pthread_cond_t qcond;
-  struct packet *queue;
+  struct jitter_ring jitter; // Packets from the input thread, in sequence order
  
   struct rtp_state rtp_state_in; // RTP input state
   struct rtp_state rtp_state_out; // RTP output state
 
   uint64_t packets;
+  double cpu;                // Decode thread CPU seconds at last report
+  uint64_t report_packets;   // Packets at last report
+  long long report_time;     // Time of last report, ns
 };
 
 
@@ -73,11 +75,12 @@ static char const *Status;
 static char const *Name = "rds";
 static struct session *Audio;
 static pthread_mutex_t Audio_protect = PTHREAD_MUTEX_INITIALIZER;
+static struct session_table Session_table; // Protected by Audio_protect
 static uint64_t Output_packets;
 
 void closedown(int);
-struct session *lookup_session(const struct sockaddr *,uint32_t);
-struct session *create_session(void);
+struct session *lookup_session(void const *,uint32_t);
+struct session *create_session(void const *,uint32_t);
 int close_session(struct session *);
 int send_samples(struct session *sp);
 void *input(void *arg);
@@ -200,6 +203,10 @@ int main(int argc,char * const argv[]){
     exit(1);
   }
 
+  if(session_table_init(&Session_table,SESSION_TABLE_BITS) == -1){
+    fprintf(stderr,"Can't allocate session table\n");
+    exit(1);
+  }
   // Set up to receive PCM in RTP/UDP/IP
   pthread_t input_thread;
   if(Input_fd != -1)
@@ -235,49 +242,33 @@ int main(int argc,char * const argv[]){
     // Parse entries
     {
       enum pkt_type const cr = buffer[0];
-      if(cr != STATUS)
+      if(cr != STATUS && cr != BULK_STATUS)
 	continue;
-      uint8_t *cp = buffer+1;
-
-      while(cp - buffer < length){
-	enum status_type type = *cp++;
-	
-	if(type == EOL)
-	  break;
-	
-	unsigned int optlen = *cp++;
-	if(cp - buffer + optlen > length)
-	  break;
-	
+      // A BULK_STATUS packet answers a poll of all channels that asked for one (e.g., by control)
+      // with a record per channel, each laid out like a STATUS packet
+      int offset = 0;
+      int len = length - 1;
+      while(cr == STATUS || (len = next_bulk_record(buffer+1,length-1,&offset)) > 0){
+	uint8_t const * const record = cr == STATUS ? buffer + 1 : buffer + 1 + offset - len;
 	// Should probably extract sample rate too, instead of assuming 48 kHz
-	switch(type){
-	case EOL:
-	  goto done;
-	case OUTPUT_DATA_DEST_SOCKET:
-	  decode_socket(&PCM_dest_address,cp,optlen);
-	  if(Input_fd == -1){
-	    if(Verbose)
-	      fprintf(stderr,"Listening for PCM on %s\n",formatsock(&PCM_dest_address));
-
-	    Input_fd = listen_mcast(&PCM_dest_address,NULL);
-	    if(Input_fd != -1)
-	      pthread_create(&input_thread,NULL,input,cp);
-	  }
-	  break;
-	default:  // Ignore all others for now
-	  break;
+	if(get_dest_socket(&PCM_dest_address,record,len) == 0 && Input_fd == -1){
+	  if(Verbose)
+	    fprintf(stderr,"Listening for PCM on %s\n",formatsock(&PCM_dest_address));
+
+	  Input_fd = listen_mcast(&PCM_dest_address,NULL);
+	  if(Input_fd != -1)
+	    pthread_create(&input_thread,NULL,input,(void *)formatsock(&PCM_dest_address));
 	}
-	cp += optlen;
+	if(cr == STATUS)
+	  break;
       }
-    done:;
     }
   }
 }
 
 // There's one of these threads per input multicast group, possibly with many SSRCs
 // Process incoming RTP packets, demux to per-SSRC thread
-// Warning: the input() thread allocates memory for packet buffers and passes them to the decode() thread
-// The decode thread must free these buffers to avoid a memory leak
+// Packets are copied into each session's preallocated jitter ring for its decode() thread
 void *input(void *arg){
   char const *mcast_address_text = (char *)arg;
   
@@ -287,88 +278,80 @@ void *input(void *arg){
     pthread_setname(pname);
   }
 
+  struct rtp_receiver receiver;
+  if(rtp_receiver_init(&receiver,0) == -1){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    return NULL;
+  }
   // Main loop begins here
-  struct packet *pkt = NULL;
   while(true){
-    // Need a new packet buffer?
-    if(!pkt)
-      pkt = malloc(sizeof(*pkt));
-    // Zero these out to catch any uninitialized derefs
-    pkt->next = NULL;
-    pkt->data = NULL;
-    pkt->len = 0;
-    
-    struct sockaddr_storage sender;
-    socklen_t socksize = sizeof(sender);
-    int size = recvfrom(Input_fd,&pkt->content,sizeof(pkt->content),0,(struct sockaddr *)&sender,&socksize);
-    
-    if(size == -1){
+    int const n = rtp_recv(&receiver,Input_fd);
+    if(n == -1){
       if(errno != EINTR){ // Happens routinely, e.g., when window resized
-	perror("recvfrom");
+	perror("recvmmsg");
 	usleep(1000);
       }
-      continue;  // Reuse current buffer
-    }
-    if(size <= RTP_MIN_SIZE)
-      continue; // Must be big enough for RTP header and at least some data
-    
-    // Extract and convert RTP header to host format
-    uint8_t const *dp = ntoh_rtp(&pkt->rtp,pkt->content);
-    pkt->data = dp;
-    pkt->len = size - (dp - pkt->content);
-    if(pkt->rtp.pad){
-      pkt->len -= dp[pkt->len-1];
-      pkt->rtp.pad = 0;
+      continue;
     }
-    if(pkt->len <= 0)
-      continue; // Used to be an assert, but would be triggered by bogus packets
-    
-    // Find appropriate session; create new one if necessary
-    struct session *sp = lookup_session((const struct sockaddr *)&sender,pkt->rtp.ssrc);
-    if(!sp){
-      // Not found
-      sp = create_session();
-      assert(sp != NULL);
-      // Initialize
-      getnameinfo((struct sockaddr *)&sender,sizeof(sender),sp->addr,sizeof(sp->addr),
+    for(int i=0; i < n; i++){
+      struct rtp_packet const * const pkt = &receiver.pkt[i];
+
+      // Find appropriate session; create new one if necessary
+      struct session *sp = lookup_session(&pkt->sender,pkt->rtp.ssrc);
+      if(!sp){
+	// Not found
+	sp = create_session(&pkt->sender,pkt->rtp.ssrc);
+	assert(sp != NULL);
+	// Initialize
+	getnameinfo((struct sockaddr *)&pkt->sender,sizeof(pkt->sender),sp->addr,sizeof(sp->addr),
 		    sp->port,sizeof(sp->port),NI_NOFQDN|NI_DGRAM);
-      memcpy(&sp->sender,&sender,sizeof(struct sockaddr));
-      sp->rtp_state_out.ssrc = sp->rtp_state_in.ssrc = pkt->rtp.ssrc;
-      sp->rtp_state_in.seq = pkt->rtp.seq;
-      sp->rtp_state_in.timestamp = pkt->rtp.timestamp;
-
-      // Span per-SSRC thread
-      if(pthread_create(&sp->thread,NULL,decode,sp) == -1){
-	perror("pthread_create");
-	close_session(sp);
-	continue;
+	sp->rtp_state_in.seq = pkt->rtp.seq;
+	sp->rtp_state_in.timestamp = pkt->rtp.timestamp;
+
+	// Span per-SSRC thread
+	if(pthread_create(&sp->thread,NULL,decode,sp) == -1){
+	  perror("pthread_create");
+	  close_session(sp);
+	  continue;
+	}
       }
-    }
-    
-    // Insert onto queue sorted by sequence number, wake up thread
-    struct packet *q_prev = NULL;
-    struct packet *qe = NULL;
-    { // Mutex-protected segment
-      pthread_mutex_lock(&sp->qmutex);
-      for(qe = sp->queue; qe && pkt->rtp.seq >= qe->rtp.seq; q_prev = qe,qe = qe->next)
-	;
-      
-      pkt->next = qe;
-      if(q_prev)
-	q_prev->next = pkt;
-      else
-	sp->queue = pkt; // Front of list
-      pkt = NULL;        // force new packet to be allocated
-      // wake up decoder thread
-      pthread_cond_signal(&sp->qcond);
-      pthread_mutex_unlock(&sp->qmutex);
+      // Copy into the session's jitter ring and wake up its thread
+      jitter_put(&sp->jitter,&pkt->rtp,pkt->data,pkt->len);
     }
   }      
 }
 
 
+// With -v, report packets handled per second and per second of decode thread CPU time
+static void report_rate(struct session * const sp){
+  if(!Verbose)
+    return;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  long long const now = ts2ns(&ts);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+  double const cpu = 1e-9 * ts2ns(&ts);
+  if(sp->report_time == 0){
+    sp->report_time = now;
+    sp->report_packets = sp->packets;
+    sp->cpu = cpu;
+    return;
+  }
+  if(now - sp->report_time < 10 * BILLION)
+    return;
+  uint64_t const packets = sp->packets - sp->report_packets;
+  double const elapsed = 1e-9 * (now - sp->report_time);
+  double const used = cpu - sp->cpu;
+  fprintf(stderr,"ssrc %u: %.1f packets/s, %.0f packets/s per core, %llu dropped by jitter ring\n",
+	  sp->rtp_state_in.ssrc,packets / elapsed,used > 0 ? packets / used : 0,
+	  (unsigned long long)sp->jitter.drops);
+  sp->report_time = now;
+  sp->report_packets = sp->packets;
+  sp->cpu = cpu;
+}
+
 // Per-SSRC thread - does actual decoding
-// Warning! do not use "continue" within the loop as this will cause a memory leak.
+// Warning! do not use "continue" within the loop as the packet's jitter ring slot would never be released.
 // Jump to "endloop" instead
 void *decode(void *arg){
   struct session * const sp = (struct session *)arg;
@@ -395,7 +378,7 @@ void *decode(void *arg){
 
   // Baseband signal 50 Hz - 15 kHz contains mono (L+R) signal
   struct filter_in baseband;
-  create_filter_input(&baseband,L,M,REAL);
+  create_filter_input(&baseband,L,M,REAL,FFT_SHORT);
   // Baseband filters, decimate from 384 Khz to 48 KHz
 
   // Narrow filter at 19 kHz for stereo pilot
@@ -422,30 +405,18 @@ void *decode(void *arg){
   }
 
   while(true){
-    struct packet *pkt = NULL;
-
+    struct jitter_slot *pkt = NULL;
     {
       struct timespec waittime;
       clock_gettime(CLOCK_REALTIME,&waittime);
       // wait 10 seconds for a new packet
       waittime.tv_sec += 10; // 10 seconds in the future
-      { // Mutex-protected segment
-	pthread_mutex_lock(&sp->qmutex);
-	while(!sp->queue){      // Wait for packet to appear on queue
-	  int ret = pthread_cond_timedwait(&sp->qcond,&sp->qmutex,&waittime);
-	  assert(ret != EINVAL);
-	  if(ret == ETIMEDOUT){
-	    // Idle timeout after 10 sec; close session and terminate thread
-	    pthread_mutex_unlock(&sp->qmutex);
-	    close_session(sp); 
-	    return NULL; // exit thread
-	  }
-	}
-	pkt = sp->queue;
-	sp->queue = pkt->next;
-	pkt->next = NULL;
-	pthread_mutex_unlock(&sp->qmutex);
-      } // End of mutex protected segment
+      pkt = jitter_get(&sp->jitter,&waittime);
+      if(pkt == NULL){
+	// Idle timeout after 10 sec; close session and terminate thread
+	close_session(sp);
+	return NULL; // exit thread
+      }
     }
     sp->packets++; // Count all packets, regardless of type
       
@@ -463,12 +434,17 @@ void *decode(void *arg){
     if(samples_skipped < 0)
       goto endloop; // Old dupe
     
-    int16_t const * const samples = (int16_t *)pkt->data;
+    int16_t const *samples = (int16_t *)pkt->data;
     
-    for(int i=0; i<frame_size; i++){
-      float const s = SCALE * (int16_t)ntohs(samples[i]);
-      if(put_rfilter(&baseband,s) == 0)
-	continue;
+    // Convert straight into the filter input, one filter block at a time
+    for(int remaining = frame_size; remaining > 0; ){
+      int const chunk = min(remaining,baseband.ilen - baseband.wcnt);
+      ntohs_float(baseband.input_write_pointer.r,samples,chunk,SCALE);
+      write_rfilter(&baseband,NULL,chunk);
+      samples += chunk;
+      remaining -= chunk;
+      if(baseband.wcnt != 0)
+	continue; // Filter input block not yet full
       // Filter input buffer full
       // Decimate to audio sample rate, do stereo processing
 
@@ -511,42 +487,27 @@ void *decode(void *arg){
       }
     }
   endloop:;
-    FREE(pkt);
+    jitter_release(&sp->jitter,pkt);
+    report_rate(sp);
   }
 }
 
-struct session *lookup_session(const struct sockaddr * const sender,const uint32_t ssrc){
-  struct session *sp;
+struct session *lookup_session(void const * const sender,const uint32_t ssrc){
   pthread_mutex_lock(&Audio_protect);
-  for(sp = Audio; sp != NULL; sp = sp->next){
-    if(sp->rtp_state_in.ssrc == ssrc && address_match(&sp->sender,sender)){
-      // Found it
-      if(sp->prev != NULL){
-	// Not at top of list; move it there
-	if(sp->next != NULL)
-	  sp->next->prev = sp->prev;
-
-	sp->prev->next = sp->next;
-	sp->prev = NULL;
-	sp->next = Audio;
-	Audio->prev = sp;
-	Audio = sp;
-      }
-      break;
-    }
-  }
+  struct session * const sp = session_lookup(&Session_table,sender,ssrc);
   pthread_mutex_unlock(&Audio_protect);
   return sp;
 }
 // Create a new session, partly initialize
-struct session *create_session(void){
+struct session *create_session(void const * const sender,const uint32_t ssrc){
 
   struct session * const sp = calloc(1,sizeof(*sp));
   assert(sp != NULL); // Shouldn't happen on modern machines!
   
   // Initialize entry
-  pthread_mutex_init(&sp->qmutex,NULL);
-  pthread_cond_init(&sp->qcond,NULL);
+  memcpy(&sp->sender,sender,sizeof(sp->sender));
+  sp->rtp_state_out.ssrc = sp->rtp_state_in.ssrc = ssrc;
+  jitter_init(&sp->jitter);
 
   // Put at head of list
   pthread_mutex_lock(&Audio_protect);
@@ -555,6 +516,7 @@ struct session *create_session(void){
   if(sp->next != NULL)
     sp->next->prev = sp;
   Audio = sp;
+  session_insert(&Session_table,&sp->sender,ssrc,sp);
   pthread_mutex_unlock(&Audio_protect);
   return sp;
 }
@@ -562,18 +524,6 @@ struct session *create_session(void){
 int close_session(struct session *sp){
   assert(sp != NULL);
   
-  // packet queue should be empty, but just in case
-  pthread_mutex_lock(&sp->qmutex);
-  while(sp->queue){
-    struct packet *pkt = sp->queue->next;
-    FREE(sp->queue);
-    sp->queue = pkt;
-  }
-  pthread_mutex_unlock(&sp->qmutex);
-  pthread_mutex_destroy(&sp->qmutex);
-  pthread_cond_destroy(&sp->qcond);
-  
-
   // Remove from linked list of sessions
   pthread_mutex_lock(&Audio_protect);
   if(sp->next != NULL)
@@ -582,7 +532,9 @@ int close_session(struct session *sp){
     sp->prev->next = sp->next;
   else
     Audio = sp->next;
+  session_remove(&Session_table,&sp->sender,sp->rtp_state_in.ssrc);
   pthread_mutex_unlock(&Audio_protect);
+  jitter_free(&sp->jitter);
   FREE(sp);
   return 0;
 }
@@ -0,0 +1,172 @@
+// Polyphase sample rate converter for arbitrary rational ratios
+// The ratio is reduced to up/down; a Kaiser-windowed sinc lowpass designed at up times the input rate
+// is split into 'up' phases, and each output is one phase's dot product with the most recent inputs.
+// Only the products that contribute to an output are computed, and the inner loop vectorizes
+// Copyright 2024, Phil Karn, KA9Q
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "misc.h"
+#include "filter.h"
+#include "resample.h"
+
+static struct {
+  int taps;
+  float atten; // Stopband attenuation, dB
+} const Quality[] = {
+  [RESAMPLE_LOW] = { 16, 50 },
+  [RESAMPLE_MEDIUM] = { 32, 75 },
+  [RESAMPLE_HIGH] = { 64, 95 },
+};
+
+static int gcd(int a,int b){
+  while(b != 0){
+    int const t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+struct resampler *create_resampler(int in_rate,int out_rate,int channels,enum resample_quality quality){
+  if(in_rate <= 0 || out_rate <= 0 || channels < 1 || channels > RESAMPLE_MAX_CHANNELS
+     || quality < RESAMPLE_LOW || quality > RESAMPLE_HIGH)
+    return NULL;
+
+  int const g = gcd(in_rate,out_rate);
+  int const up = out_rate / g;
+  int const down = in_rate / g;
+  if(up > RESAMPLE_MAX_PHASES)
+    return NULL; // Unreasonable ratio, e.g., 47999 -> 48000
+
+  struct resampler * const r = calloc(1,sizeof(*r));
+  if(r == NULL)
+    return NULL;
+  r->in_rate = in_rate;
+  r->out_rate = out_rate;
+  r->up = up;
+  r->down = down;
+  r->channels = channels;
+  // When decimating, lengthen the filter so the transition band stays the same
+  // fraction of the (lower) output rate
+  int const spread = (down + up - 1) / up;
+  r->taps = (Quality[quality].taps * spread + 7) & ~7;
+
+  // Kaiser's formulas: the transition width for the given attenuation and length,
+  // centered on the lower Nyquist rate so everything above it is in the stopband
+  float const atten = Quality[quality].atten;
+  float const beta = 0.1102 * (atten - 8.7);
+  float const transition = in_rate * (atten - 8) / (2.285 * 2 * M_PI * r->taps); // Hz
+  float const cutoff = min(in_rate,out_rate) / 2.0 - transition / 2;
+  float const fc = cutoff / ((double)up * in_rate); // Cycles/sample at the interpolated rate
+
+  int const N = up * r->taps;
+  float *h = malloc(N * sizeof(*h));
+  r->coeffs = malloc(N * sizeof(*r->coeffs));
+  if(h == NULL || r->coeffs == NULL){
+    FREE(h);
+    delete_resampler(r);
+    return NULL;
+  }
+  make_kaiser(h,N,beta);
+  double sum = 0;
+  for(int k=0; k < N; k++){
+    double const t = k - (N - 1) / 2.0;
+    double const x = 2 * fc * t;
+    h[k] *= 2 * fc * (t == 0 ? 1 : sin(M_PI * x) / (M_PI * x));
+    sum += h[k];
+  }
+  // Unity gain through each phase; zero stuffing otherwise loses a factor of 'up'
+  float const gain = up / sum;
+  for(int p=0; p < up; p++)
+    for(int j=0; j < r->taps; j++)
+      r->coeffs[p * r->taps + r->taps - 1 - j] = gain * h[p + j * up];
+  FREE(h);
+
+  for(int ch=0; ch < channels; ch++){
+    r->buf[ch] = calloc(r->taps - 1 + RESAMPLE_CHUNK,sizeof(*r->buf[ch]));
+    if(r->buf[ch] == NULL){
+      delete_resampler(r);
+      return NULL;
+    }
+  }
+  return r;
+}
+
+void delete_resampler(struct resampler *r){
+  if(r == NULL)
+    return;
+  for(int ch=0; ch < RESAMPLE_MAX_CHANNELS; ch++)
+    FREE(r->buf[ch]);
+  FREE(r->coeffs);
+  FREE(r);
+}
+
+// Clear history, e.g., after a gap in the input
+void reset_resampler(struct resampler *r){
+  assert(r != NULL);
+  for(int ch=0; ch < r->channels; ch++)
+    memset(r->buf[ch],0,(r->taps - 1) * sizeof(*r->buf[ch]));
+  r->phase = 0;
+  r->next = 0;
+}
+
+// Convert in_frames of interleaved input to interleaved output; returns output frames
+// Any output beyond max_out (see resample_max_out()) is lost
+int resample(struct resampler * restrict r,float const * restrict in,int in_frames,float * restrict out,int max_out){
+  assert(r != NULL);
+  int const channels = r->channels;
+  int const taps = r->taps;
+  int produced = 0;
+
+  while(in_frames > 0){
+    int const chunk = min(in_frames,RESAMPLE_CHUNK);
+    for(int ch=0; ch < channels; ch++){
+      float * const b = r->buf[ch] + taps - 1;
+      for(int i=0; i < chunk; i++)
+	b[i] = in[i * channels + ch];
+    }
+    while(r->next < chunk){
+      if(produced < max_out){
+	float const * restrict const c = r->coeffs + r->phase * taps;
+	for(int ch=0; ch < channels; ch++){
+	  float const * restrict const x = r->buf[ch] + r->next;
+	  float sum = 0;
+	  for(int j=0; j < taps; j++)
+	    sum += c[j] * x[j];
+	  out[produced * channels + ch] = sum;
+	}
+	produced++;
+      }
+      r->phase += r->down;
+      while(r->phase >= r->up){
+	r->phase -= r->up;
+	r->next++;
+      }
+    }
+    // Keep the end of the chunk as history for the next
+    for(int ch=0; ch < channels; ch++)
+      memmove(r->buf[ch],r->buf[ch] + chunk,(taps - 1) * sizeof(*r->buf[ch]));
+    r->next -= chunk;
+    in += chunk * channels;
+    in_frames -= chunk;
+  }
+  return produced;
+}
+
+// "low", "medium" or "high"; -1 if not recognized
+int parse_resample_quality(char const *s){
+  if(s == NULL)
+    return -1;
+  if(strcasecmp(s,"low") == 0)
+    return RESAMPLE_LOW;
+  if(strcasecmp(s,"medium") == 0)
+    return RESAMPLE_MEDIUM;
+  if(strcasecmp(s,"high") == 0)
+    return RESAMPLE_HIGH;
+  return -1;
+}
@@ -0,0 +1,42 @@
+// Polyphase sample rate converter for arbitrary rational ratios
+// Copyright 2024, Phil Karn, KA9Q
+#ifndef _RESAMPLE_H
+#define _RESAMPLE_H 1
+#include <stdbool.h>
+
+#define RESAMPLE_MAX_CHANNELS 2
+#define RESAMPLE_MAX_PHASES 4096 // Largest interpolation factor after reducing the ratio
+#define RESAMPLE_CHUNK 1024      // Input frames converted per pass
+
+// Trade CPU for alias rejection
+enum resample_quality {
+  RESAMPLE_LOW = 0,    // 16 taps per phase, about 50 dB stopband
+  RESAMPLE_MEDIUM,     // 32 taps per phase, about 75 dB
+  RESAMPLE_HIGH,       // 64 taps per phase, about 95 dB
+};
+
+struct resampler {
+  int in_rate;
+  int out_rate;
+  int up;          // Interpolation factor, out_rate/gcd
+  int down;        // Decimation factor, in_rate/gcd
+  int channels;
+  int taps;        // Filter taps per phase, a multiple of 8
+  float *coeffs;   // [up][taps]; each phase time-reversed so it's a straight dot product with the input
+  float *buf[RESAMPLE_MAX_CHANNELS]; // Last taps-1 input samples, then the chunk being converted
+  int phase;       // Position of the next output between input samples, in units of 1/up
+  int next;        // Input sample (relative to the current chunk) that the next output ends on
+};
+
+struct resampler *create_resampler(int in_rate,int out_rate,int channels,enum resample_quality quality);
+void delete_resampler(struct resampler *);
+void reset_resampler(struct resampler *);
+int resample(struct resampler * restrict,float const * restrict in,int in_frames,float * restrict out,int max_out);
+int parse_resample_quality(char const *);
+
+// Upper bound on output frames for in_frames of input
+static inline int resample_max_out(struct resampler const *r,int in_frames){
+  return (int)(((long long)in_frames * r->up + r->down - 1) / r->down) + 1;
+}
+
+#endif
@@ -0,0 +1,221 @@
+// Shared RTP receive path for the programs that consume radiod's multicast streams
+// One recvmmsg() reads everything already queued on the socket (up to RTP_BATCH datagrams)
+// into buffers allocated once, instead of one recvfrom() per datagram into a fresh 64 KB packet.
+// The headers of the whole batch are then parsed together, and each program finds its session
+// for a packet in a hash table rather than walking its session list
+// Copyright 2024, Phil Karn, KA9Q
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "misc.h"
+#include "multicast.h"
+#include "rtp_recv.h"
+
+// Slack after the last buffer so ntoh_rtp() can look at a bogus CSRC count or extension header
+// in a runt without running off the slab; such packets are then discarded by the length check
+#define SLAB_SLACK 128
+
+int rtp_receiver_init(struct rtp_receiver *rr,int bufsize){
+  assert(rr != NULL);
+  memset(rr,0,sizeof(*rr));
+  if(bufsize <= 0)
+    bufsize = RTP_BUFSIZE;
+  rr->bufsize = (bufsize + 63) & ~63; // Keep each buffer cache line aligned
+  rr->slab = aligned_alloc(64,(size_t)RTP_BATCH * rr->bufsize + SLAB_SLACK);
+  if(rr->slab == NULL)
+    return -1;
+  return 0;
+}
+
+void rtp_receiver_free(struct rtp_receiver *rr){
+  if(rr == NULL)
+    return;
+  FREE(rr->slab);
+}
+
+// Block until at least one datagram arrives on fd, then take whatever else is already waiting
+// Returns the number of valid RTP packets now in rr->pkt[], which may be 0 if every datagram
+// was bogus, or -1 on error with errno set. EINTR is routine
+int rtp_recv(struct rtp_receiver *rr,int fd){
+  assert(rr != NULL && rr->slab != NULL);
+  int size[RTP_BATCH];
+  int n = 0;
+#ifdef __linux__
+  struct iovec iov[RTP_BATCH];
+  struct mmsghdr msgs[RTP_BATCH];
+  for(int i=0; i < RTP_BATCH; i++){
+    iov[i].iov_base = rr->slab + (size_t)i * rr->bufsize;
+    iov[i].iov_len = rr->bufsize;
+    memset(&msgs[i],0,sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_name = &rr->pkt[i].sender;
+    msgs[i].msg_hdr.msg_namelen = sizeof(rr->pkt[i].sender);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  n = recvmmsg(fd,msgs,RTP_BATCH,MSG_WAITFORONE,NULL);
+  if(n <= 0)
+    return n;
+  for(int i=0; i < n; i++){
+    size[i] = msgs[i].msg_len;
+    if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      size[i] = -1;
+  }
+#else
+  // No recvmmsg(); block for one, then drain the socket without blocking
+  while(n < RTP_BATCH){
+    socklen_t socksize = sizeof(rr->pkt[n].sender);
+    int const r = recvfrom(fd,rr->slab + (size_t)n * rr->bufsize,rr->bufsize,n == 0 ? 0 : MSG_DONTWAIT,
+			   (struct sockaddr *)&rr->pkt[n].sender,&socksize);
+    if(r == -1){
+      if(n == 0)
+	return -1;
+      break; // EAGAIN: nothing else waiting
+    }
+    size[n++] = r >= rr->bufsize ? -1 : r; // Can't tell a full buffer from a truncated datagram, so treat it as one
+  }
+#endif
+  rr->calls++;
+  rr->datagrams += n;
+
+  // Parse the batch, compacting the good ones to the front
+  int good = 0;
+  for(int i=0; i < n; i++){
+    if(size[i] < 0){
+      rr->truncated++;
+      continue;
+    }
+    if(size[i] <= RTP_MIN_SIZE){
+      rr->runts++;
+      continue; // Must be big enough for RTP header and at least some data
+    }
+    uint8_t const * const buffer = rr->slab + (size_t)i * rr->bufsize;
+    struct rtp_packet * const pkt = &rr->pkt[good];
+    if(good != i)
+      memcpy(&pkt->sender,&rr->pkt[i].sender,sizeof(pkt->sender));
+    uint8_t const * const dp = ntoh_rtp(&pkt->rtp,buffer);
+    int len = size[i] - (dp - buffer);
+    if(pkt->rtp.pad && len > 0){
+      len -= dp[len-1];
+      pkt->rtp.pad = 0;
+    }
+    if(len <= 0){
+      rr->runts++;
+      continue; // Bogus header
+    }
+    pkt->data = dp;
+    pkt->len = len;
+    good++;
+  }
+  rr->packets += good;
+  return good;
+}
+
+// Sender address and port folded together with the SSRC, then Fibonacci hashed;
+// the top bits are the best mixed
+static unsigned int hash(struct session_table const *t,struct sockaddr const *sender,uint32_t ssrc){
+  uint32_t h = ssrc;
+  if(sender != NULL){
+    switch(sender->sa_family){
+    case AF_INET:
+      {
+	struct sockaddr_in const *sin = (struct sockaddr_in *)sender;
+	h ^= sin->sin_addr.s_addr ^ sin->sin_port;
+      }
+      break;
+    case AF_INET6:
+      {
+	struct sockaddr_in6 const *sin6 = (struct sockaddr_in6 *)sender;
+	uint32_t a[4];
+	memcpy(a,&sin6->sin6_addr,sizeof(a));
+	h ^= a[0] ^ a[1] ^ a[2] ^ a[3] ^ sin6->sin6_port;
+      }
+      break;
+    }
+  }
+  h *= 0x9e3779b1;
+  return h >> (32 - t->bits);
+}
+
+static bool key_match(struct session_entry const *e,struct sockaddr const *sender,uint32_t ssrc){
+  if(e->ssrc != ssrc)
+    return false;
+  if(sender == NULL)
+    return e->sender.ss_family == AF_UNSPEC;
+  return address_match(&e->sender,sender) && getportnumber(&e->sender) == getportnumber(sender);
+}
+
+int session_table_init(struct session_table *t,int bits){
+  assert(t != NULL && bits > 0 && bits < 24);
+  t->bits = bits;
+  t->count = 0;
+  t->bucket = calloc((size_t)1 << bits,sizeof(*t->bucket));
+  return t->bucket == NULL ? -1 : 0;
+}
+
+void session_table_free(struct session_table *t){
+  if(t == NULL || t->bucket == NULL)
+    return;
+  for(int i=0; i < (1 << t->bits); i++){
+    struct session_entry *next;
+    for(struct session_entry *e = t->bucket[i]; e != NULL; e = next){
+      next = e->next;
+      FREE(e);
+    }
+  }
+  FREE(t->bucket);
+  t->count = 0;
+}
+
+// A NULL sender keys on the SSRC alone
+void *session_lookup(struct session_table const *t,void const *sender,uint32_t ssrc){
+  assert(t != NULL);
+  for(struct session_entry const *e = t->bucket[hash(t,sender,ssrc)]; e != NULL; e = e->next)
+    if(key_match(e,sender,ssrc))
+      return e->session;
+  return NULL;
+}
+
+// Returns -1 if the key is already present, or out of memory
+int session_insert(struct session_table *t,void const *sender,uint32_t ssrc,void *session){
+  assert(t != NULL);
+  unsigned int const h = hash(t,sender,ssrc);
+  for(struct session_entry const *e = t->bucket[h]; e != NULL; e = e->next)
+    if(key_match(e,sender,ssrc))
+      return -1;
+
+  struct session_entry * const e = calloc(1,sizeof(*e));
+  if(e == NULL)
+    return -1;
+  if(sender != NULL){
+    struct sockaddr const *sa = sender;
+    memcpy(&e->sender,sender,sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+  }
+  e->ssrc = ssrc;
+  e->session = session;
+  e->next = t->bucket[h];
+  t->bucket[h] = e;
+  t->count++;
+  return 0;
+}
+
+// Returns the session that was removed, or NULL if not present
+void *session_remove(struct session_table *t,void const *sender,uint32_t ssrc){
+  assert(t != NULL);
+  for(struct session_entry **ep = &t->bucket[hash(t,sender,ssrc)]; *ep != NULL; ep = &(*ep)->next){
+    struct session_entry *e = *ep;
+    if(key_match(e,sender,ssrc)){
+      *ep = e->next;
+      void * const session = e->session;
+      FREE(e);
+      t->count--;
+      return session;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,62 @@
+// Shared RTP receive path for the programs that consume radiod's multicast streams
+// Datagrams are read in batches with recvmmsg() into a preallocated slab, their RTP headers
+// parsed, and sessions found through a hash table on sender address and SSRC
+// Copyright 2024, Phil Karn, KA9Q
+#ifndef _RTP_RECV_H
+#define _RTP_RECV_H 1
+#include <stdint.h>
+#include <sys/socket.h>
+#include "multicast.h"
+
+#define RTP_BATCH 64       // Datagrams per system call
+#define RTP_BUFSIZE 9216   // Per-datagram buffer: any IP packet on an Ethernet with jumbo frames; larger ones are dropped
+
+// One received RTP packet; valid until the next rtp_recv() on the same receiver
+struct rtp_packet {
+  struct sockaddr_storage sender;
+  struct rtp_header rtp;   // In host byte order, with pad cleared
+  uint8_t const *data;     // Payload, padding removed
+  int len;                 // Always > 0
+};
+
+struct rtp_receiver {
+  int bufsize;
+  uint8_t *slab;           // RTP_BATCH buffers of bufsize bytes
+  struct rtp_packet pkt[RTP_BATCH];
+  // Statistics
+  uint64_t calls;          // System calls that returned data
+  uint64_t datagrams;
+  uint64_t packets;        // Valid RTP packets returned
+  uint64_t runts;          // Too short, or nothing left after padding
+  uint64_t truncated;      // Bigger than bufsize
+};
+
+int rtp_receiver_init(struct rtp_receiver *,int bufsize);
+void rtp_receiver_free(struct rtp_receiver *);
+int rtp_recv(struct rtp_receiver *,int fd);
+
+// Sessions keyed on sender (address and port) and SSRC, mapped to each program's own session structure
+// A NULL sender keys on the SSRC alone. Not locked; programs that create or close sessions
+// in more than one thread hold their session list lock around these
+struct session_entry {
+  struct session_entry *next;
+  struct sockaddr_storage sender;
+  uint32_t ssrc;
+  void *session;
+};
+
+#define SESSION_TABLE_BITS 10 // Default 1024 buckets, for up to a few thousand sessions
+
+struct session_table {
+  int bits;                // log2 of bucket count
+  int count;
+  struct session_entry **bucket;
+};
+
+int session_table_init(struct session_table *,int bits);
+void session_table_free(struct session_table *);
+void *session_lookup(struct session_table const *,void const *sender,uint32_t ssrc);
+int session_insert(struct session_table *,void const *sender,uint32_t ssrc,void *session);
+void *session_remove(struct session_table *,void const *sender,uint32_t ssrc);
+
+#endif
@@ -216,13 +216,7 @@ char *decode_string(uint8_t const *cp,int optlen){
 // Works for byte, short/int16_t, long/int32_t, long long/int64_t
 // If used for signed values, must be cast
 uint64_t decode_int64(uint8_t const *cp,int len){
-  uint64_t result = 0;
-  // cp now points to beginning of abbreviated int
-  // Byte swap as we accumulate
-  while(len-- > 0)
-    result = (result << 8) | *cp++;
-
-  return result;
+  return tlv_int(cp,len);
 }
 uint32_t decode_int32(uint8_t const *cp,int len){
   return decode_int64(cp,len) & UINT32_MAX;
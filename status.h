@@ -4,15 +4,19 @@
 #ifndef _STATUS_H
 #define _STATUS_H 1
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdint.h>
 #include <sys/time.h>
 #include <stdbool.h>
 
 // Type field, first byte in command/status packets
+// A BULK_STATUS packet carries records for many channels, each a TLV list ending in EOL as in a STATUS packet
+// Each starts with OUTPUT_SSRC and BULK_FORMAT; see next_bulk_record()
 enum pkt_type {
   STATUS = 0,
   CMD,
+  BULK_STATUS,
 };
 
 // I try not to delete or rearrange these entries since that makes the different programs incompatible
@@ -154,8 +158,71 @@ enum status_type {
   OUTPUT_ENCODING,    // Output data encoding (see enum encoding in multicast.h)
   SAMPLES_SINCE_OVER, // Samples since last A/D overrange
   PLL_WRAPS,          // Count of complete linear mode PLL rotations 
+  FFT_WAIT_SHORT,     // Vector: histogram of FFT worker queue waits for short (channel) jobs, log2 microsecond bins
+  FFT_WAIT_BULK,      // Vector: same for bulk (front end) jobs
+  RDS_ENABLE,         // RDS decoding enable (WFM only)
+  RDS_PI,             // RDS program identification code (WFM only)
+  RDS_PS,             // RDS program service name, char string (WFM only)
+  RDS_RT,             // RDS radiotext, char string (WFM only)
+  OPUS_COMPLEXITY,    // Opus encoder complexity 0-10 (settable)
+  OPUS_COMPLEXITY_NOW, // Complexity in use, lowered automatically when the encoders fall behind
+  OPUS_ENCODE_TIME,   // Vector: histogram of Opus encode times, log2 microsecond bins
+  OPUS_DROPS,         // Opus blocks dropped because the encoder pool fell behind
+  BULK_FORMAT,        // In a poll of all channels: 1 asks for BULK_STATUS, 2 also for keyframes
+                      // In a BULK_STATUS record: 1 = only the fields changed since the channel's last record, 2 = keyframe (all fields)
 };
 
+// Parse the TLV at cp, with length bytes left: its type, and where its value starts and how long it is
+// Returns the length of the whole TLV, or 0 at EOL or if it runs off the end
+static inline int tlv_parse(uint8_t const *cp,int length,enum status_type *type,uint8_t const **value,int *optlen){
+  uint8_t const * const start = cp;
+  uint8_t const * const end = cp + length;
+  if(length < 2 || (*type = *cp++) == EOL)
+    return 0;
+  unsigned int len = *cp++;
+  if(len & 0x80){
+    // length is >= 128 bytes; fetch actual length from next N bytes, where N is low 7 bits of optlen
+    int length_of_length = len & 0x7f;
+    if(length_of_length > 4)
+      return 0;
+    len = 0;
+    while(length_of_length > 0){
+      if(cp >= end)
+	return 0;
+      len <<= 8;
+      len |= *cp++;
+      length_of_length--;
+    }
+  }
+  if(len > (unsigned int)(end - cp))
+    return 0;
+  *value = cp;
+  *optlen = len;
+  return cp + len - start;
+}
+
+// A TLV integer value: len bytes, big endian with leading zeroes dropped. Also the bits of a float or double
+// In line for the table-driven decoder in decode_status.c; decode_int64() is the same thing out of line
+static inline uint64_t tlv_int(uint8_t const *cp,int len){
+  // Floats, doubles and SSRCs usually go out at full width; load and swap them in one go
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if(len == 8){
+    uint64_t x;
+    memcpy(&x,cp,sizeof(x));
+    return __builtin_bswap64(x);
+  }
+  if(len == 4){
+    uint32_t x;
+    memcpy(&x,cp,sizeof(x));
+    return __builtin_bswap32(x);
+  }
+#endif
+  uint64_t result = 0;
+  while(len-- > 0)
+    result = (result << 8) | *cp++;
+  return result;
+}
+
 int encode_string(uint8_t **bp,enum status_type type,void const *buf,unsigned int buflen);
 int encode_eol(uint8_t **buf);
 int encode_byte(uint8_t **buf,enum status_type type,uint8_t x);
@@ -182,6 +249,9 @@ struct sockaddr *decode_local_socket(void *,uint8_t const *,int);
 char *decode_string(uint8_t const *,int);
 uint32_t get_ssrc(uint8_t const *buffer,int length);
 uint32_t get_tag(uint8_t const *buffer,int length);
+int get_dest_socket(void *sock,uint8_t const *buffer,int length);
+int next_bulk_record(uint8_t const *buffer,int length,int *offset);
+int get_bulk_format(uint8_t const *buffer,int length);
 
 void dump_metadata(FILE *,uint8_t const *,int,bool);
 
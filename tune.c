@@ -24,8 +24,10 @@
 #include "misc.h"
 #include "multicast.h"
 #include "status.h"
+#include "radio.h"
 
 int Mcast_ttl = 1;
+struct sockaddr_storage Metadata_dest_socket;
 int IP_tos = 0;
 const char *App_path;
 int Verbose;
@@ -183,18 +185,19 @@ int main(int argc,char *argv[]){
     Low = High;
     High = temp;
   }
-  uint32_t received_tag = 0;
-  double received_freq = INFINITY;
-  uint32_t received_ssrc = 0;
-  int received_agc_enable = -1;
-  float received_gain = INFINITY;
-  char *preset = NULL;
-  float noise_density = INFINITY;
-  float baseband_level = INFINITY;
-  float low_edge = INFINITY;
-  float high_edge = INFINITY;
-  enum encoding received_encoding = NO_ENCODING;
-  int samprate = 0;
+  // Shadow of the channel, filled in by its status
+  // Fields radiod doesn't always send start out NAN so we can tell
+  struct frontend frontend;
+  memset(&frontend,0,sizeof(frontend));
+  struct channel channel;
+  memset(&channel,0,sizeof(channel));
+  channel.tune.freq = NAN;
+  channel.output.gain = NAN;
+  channel.sig.bb_power = NAN;
+  channel.sig.n0 = NAN;
+  channel.filter.min_IF = NAN;
+  channel.filter.max_IF = NAN;
+  channel.output.encoding = NO_ENCODING;
 
   uint32_t sent_tag = 0;
   while(true){
@@ -267,99 +270,47 @@ int main(int argc,char *argv[]){
       continue; // ignore non-response; go back and receive again
 
     // Process response
-    while(cp - response_buffer < length){
-      enum status_type type = *cp++;
-      if(type == EOL)
-	break;
-      unsigned int optlen = *cp++;
-      if(cp - response_buffer + optlen > length)
-	break; // Invalid length
-      switch(type){
-      default:
-	break;
-      case COMMAND_TAG:
-	received_tag = decode_int32(cp,optlen);
-	break;
-      case RADIO_FREQUENCY:
-	received_freq = decode_double(cp,optlen);
-	break;
-      case OUTPUT_SSRC:
-	received_ssrc = decode_int32(cp,optlen);
-	break;
-      case AGC_ENABLE:
-	received_agc_enable = decode_bool(cp,optlen);
-	break;
-      case GAIN:
-	received_gain = decode_float(cp,optlen);
-	break;
-      case PRESET:
-	FREE(preset); // Unlikely, but just in case
-	preset = decode_string(cp,optlen);
-	break;
-      case LOW_EDGE:
-	low_edge = decode_float(cp,optlen);
-	break;
-      case HIGH_EDGE:
-	high_edge = decode_float(cp,optlen);
-	break;
-      case NOISE_DENSITY:
-	noise_density = decode_float(cp,optlen);
-	break;
-      case BASEBAND_POWER:
-	baseband_level = decode_float(cp,optlen);
-	break;
-      case OUTPUT_SAMPRATE:
-	samprate = decode_int(cp,optlen);
-	break;
-      case OUTPUT_ENCODING:
-	received_encoding = decode_int(cp,optlen);
-	break;
-      }
-      cp += optlen;
-    }
-    if(received_ssrc == Ssrc && received_tag == sent_tag)
+    decode_radio_status(&frontend,&channel,response_buffer+1,length-1);
+    if(channel.output.rtp.ssrc == Ssrc && channel.status.tag == sent_tag)
       break; // For us; we're done
     if(Verbose)
-      fprintf(stdout,"Not for us: ssrc %'u, tag %'u\n",(int)received_ssrc,(int)received_tag);
+      fprintf(stdout,"Not for us: ssrc %'u, tag %'u\n",(int)channel.output.rtp.ssrc,(int)channel.status.tag);
   }
 
   // Show responses unless quiet
   if(!Quiet){
     printf("SSRC %'u\n",Ssrc);
-    if(strlen(preset) > 0)
-      printf("Preset %s\n",preset);
-    FREE(preset);
-    if(samprate != 0)
-      printf("Sample rate %'d Hz\n",samprate);
+    if(strlen(channel.preset) > 0)
+      printf("Preset %s\n",channel.preset);
+    if(channel.output.samprate != 0)
+      printf("Sample rate %'d Hz\n",channel.output.samprate);
 
-    if(received_encoding != NO_ENCODING)
-      printf("Encoding %s\n",encoding_string(received_encoding));
+    if(channel.output.encoding != NO_ENCODING)
+      printf("Encoding %s\n",encoding_string(channel.output.encoding));
 
-    if(received_freq != INFINITY)
-      printf("Frequency %'.3lf Hz\n",received_freq);
+    if(!isnan(channel.tune.freq))
+      printf("Frequency %'.3lf Hz\n",channel.tune.freq);
 
-    if(received_agc_enable != -1)
-      printf("AGC %s\n",received_agc_enable ? "on" : "off");
+    if(channel.demod_type == LINEAR_DEMOD) // AGC only in linear mode
+      printf("AGC %s\n",channel.linear.agc ? "on" : "off");
 
-    if(received_gain != INFINITY)
-      printf("Gain %.1f dB\n",received_gain);
+    if(!isnan(channel.output.gain))
+      printf("Gain %.1f dB\n",voltage2dB(channel.output.gain));
 
-    if(baseband_level != INFINITY)
-      printf("Baseband power %.1f dB\n",baseband_level);
+    if(!isnan(channel.sig.bb_power))
+      printf("Baseband power %.1f dB\n",power2dB(channel.sig.bb_power));
 
-    if(low_edge != INFINITY && high_edge != INFINITY)
+    float const low_edge = channel.filter.min_IF;
+    float const high_edge = channel.filter.max_IF;
+    if(!isnan(low_edge) && !isnan(high_edge))
       printf("Passband %'.1f Hz to %'.1f Hz (%.1f dB-Hz)\n",low_edge,high_edge,10*log10(fabsf(high_edge - low_edge)));
 
-    if(noise_density != INFINITY)
-      printf("N0 %.1f dB/Hz\n",noise_density);
-
-    if(baseband_level != INFINITY &&
-       low_edge != INFINITY &&
-       high_edge != INFINITY &&
-       noise_density != INFINITY){
+    if(!isnan(channel.sig.n0))
+      printf("N0 %.1f dB/Hz\n",power2dB(channel.sig.n0));
 
-      float noise_power = dB2power(noise_density) * fabsf(high_edge - low_edge);
-      float signal_plus_noise_power = dB2power(baseband_level);
+    if(!isnan(channel.sig.bb_power) && !isnan(low_edge) && !isnan(high_edge) && !isnan(channel.sig.n0)){
+      float noise_power = channel.sig.n0 * fabsf(high_edge - low_edge);
+      float signal_plus_noise_power = channel.sig.bb_power;
 
       printf("SNR %.1f dB\n",power2dB(signal_plus_noise_power / noise_power - 1));
     }
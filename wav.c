@@ -0,0 +1,124 @@
+// 16-bit PCM .wav file writing shared by the recorders (wd-record, jt-decoded)
+// Each RTP payload is byte swapped a block at a time and written with one fwrite(), and gaps
+// past the end of the file are filled from a block of zeroes, instead of a pair of fputc() per sample
+// Copyright 2024, Phil Karn, KA9Q
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "misc.h"
+#include "wav.h"
+
+// size of stdio buffer for disk I/O
+// This should be large to minimize write calls, but how big?
+#define BUFFERSIZE (1<<16)
+#define CONVERT_CHUNK 4096 // Samples byte swapped per fwrite()
+
+static uint8_t const Zeroes[BUFFERSIZE];
+
+// Start a .wav file on an open descriptor, writing a header with temporary sizes at the current position
+// The file isn't truncated, so a recorder that's killed and rapidly restarted in the same cycle picks up where it left off
+int wav_open(struct wav_file *wf,int fd,unsigned int samprate,int channels){
+  assert(wf != NULL);
+  memset(wf,0,sizeof(*wf));
+  wf->fp = fdopen(fd,"w+");
+  if(wf->fp == NULL)
+    return -1;
+  wf->channels = channels;
+  wf->iobuffer = malloc(BUFFERSIZE);
+  if(wf->iobuffer != NULL)
+    setbuffer(wf->fp,wf->iobuffer,BUFFERSIZE);
+  struct stat statbuf;
+  if(fstat(fd,&statbuf) == 0)
+    wf->end = statbuf.st_size;
+  wf->pos = lseek(fd,0,SEEK_CUR);
+  if(wf->pos < 0)
+    wf->pos = 0;
+
+  // Write .wav header, skipping size fields
+  memcpy(wf->header.ChunkID,"RIFF", 4);
+  wf->header.ChunkSize = 0xffffffff; // Temporary
+  memcpy(wf->header.Format,"WAVE",4);
+  memcpy(wf->header.Subchunk1ID,"fmt ",4);
+  wf->header.Subchunk1Size = 16;
+  wf->header.AudioFormat = 1;
+  wf->header.NumChannels = channels;
+  wf->header.SampleRate = samprate;
+
+  wf->header.ByteRate = samprate * channels * 16/8;
+  wf->header.BlockAlign = channels * 16/8;
+  wf->header.BitsPerSample = 16;
+  memcpy(wf->header.SubChunk2ID,"data",4);
+  wf->header.Subchunk2Size = 0xffffffff; // Temporary
+  fwrite(&wf->header,sizeof(wf->header),1,wf->fp);
+  fflush(wf->fp); // get at least the header out there
+  wf->pos += sizeof(wf->header);
+  if(wf->pos > wf->end)
+    wf->end = wf->pos;
+  return 0;
+}
+
+// Move frame_offset frames from the current position (the difference between the actual and expected RTP timestamps),
+// then write count 16-bit big-endian samples from an RTP payload in the little-endian order of a .wav file
+// Skipping past the end of the file leaves zeroes, as seeking there and writing would
+int wav_write(struct wav_file *wf,int32_t frame_offset,void const *samples,int count){
+  assert(wf != NULL && wf->fp != NULL);
+  off_t target = wf->pos + (off_t)frame_offset * wf->channels * sizeof(int16_t);
+  if(target < 0)
+    target = wf->pos; // Can't seek there
+  if(target > wf->end){
+    if(wf->pos != wf->end && fseeko(wf->fp,wf->end,SEEK_SET) != 0)
+      return -1;
+    for(off_t gap = target - wf->end; gap > 0;){
+      size_t const n = gap < (off_t)sizeof(Zeroes) ? (size_t)gap : sizeof(Zeroes);
+      if(fwrite(Zeroes,1,n,wf->fp) != n)
+	return -1;
+      gap -= n;
+    }
+  } else if(target != wf->pos && fseeko(wf->fp,target,SEEK_SET) != 0)
+    return -1;
+  wf->pos = target;
+
+  // Swapping each pair of bytes works on either host byte order; the compiler vectorizes it
+  uint8_t const *in = samples;
+  while(count > 0){
+    int const n = count < CONVERT_CHUNK ? count : CONVERT_CHUNK;
+    uint8_t out[CONVERT_CHUNK * sizeof(int16_t)] __attribute__((aligned(64)));
+    for(int i=0; i < n; i++){
+      out[2*i] = in[2*i+1];
+      out[2*i+1] = in[2*i];
+    }
+    if(fwrite(out,sizeof(int16_t),n,wf->fp) != (size_t)n)
+      return -1;
+    in += n * sizeof(int16_t);
+    count -= n;
+    wf->pos += n * sizeof(int16_t);
+  }
+  if(wf->pos > wf->end)
+    wf->end = wf->pos;
+  return 0;
+}
+
+// Write the final sizes into the header and close the file
+int wav_close(struct wav_file *wf){
+  assert(wf != NULL);
+  if(wf->fp == NULL)
+    return -1;
+  // Get final file size, write .wav header with sizes
+  fflush(wf->fp);
+  struct stat statbuf;
+  fstat(fileno(wf->fp),&statbuf);
+  wf->header.ChunkSize = statbuf.st_size - 8;
+  wf->header.Subchunk2Size = statbuf.st_size - sizeof(wf->header);
+  rewind(wf->fp);
+  fwrite(&wf->header,sizeof(wf->header),1,wf->fp);
+  fflush(wf->fp);
+  int const r = fclose(wf->fp);
+  wf->fp = NULL;
+  FREE(wf->iobuffer);
+  return r;
+}
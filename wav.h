@@ -0,0 +1,42 @@
+// 16-bit PCM .wav file writing shared by the recorders (wd-record, jt-decoded)
+// Copyright 2024, Phil Karn, KA9Q
+#ifndef _WAV_H
+#define _WAV_H 1
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Simplified .wav file header
+// http://soundfile.sapp.org/doc/WaveFormat/
+struct wav {
+  char ChunkID[4];
+  int32_t ChunkSize;
+  char Format[4];
+
+  char Subchunk1ID[4];
+  int32_t Subchunk1Size;
+  int16_t AudioFormat;
+  int16_t NumChannels;
+  int32_t SampleRate;
+  int32_t ByteRate;
+  int16_t BlockAlign;
+  int16_t BitsPerSample;
+
+  char SubChunk2ID[4];
+  int32_t Subchunk2Size;
+};
+
+struct wav_file {
+  FILE *fp;
+  struct wav header;
+  int channels;
+  off_t pos;           // File offset of the next write
+  off_t end;           // File size so far
+  void *iobuffer;
+};
+
+int wav_open(struct wav_file *,int fd,unsigned int samprate,int channels);
+int wav_write(struct wav_file *,int32_t frame_offset,void const *samples,int count);
+int wav_close(struct wav_file *);
+
+#endif
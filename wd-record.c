@@ -41,40 +41,16 @@ char const * wd_record_version = "This is wd-record version 0.3 which recovers f
 #include "misc.h"
 #include "attr.h"
 #include "multicast.h"
-
-// size of stdio buffer for disk I/O
-// This should be large to minimize write calls, but how big?
-#define BUFFERSIZE (1<<16)
-
-// Simplified .wav file header
-// http://soundfile.sapp.org/doc/WaveFormat/
-struct wav {
-  char ChunkID[4];
-  int32_t ChunkSize;
-  char Format[4];
-
-  char Subchunk1ID[4];
-  int32_t Subchunk1Size;
-  int16_t AudioFormat;
-  int16_t NumChannels;
-  int32_t SampleRate;
-  int32_t ByteRate;
-  int16_t BlockAlign;
-  int16_t BitsPerSample;
-
-  char SubChunk2ID[4];
-  int32_t Subchunk2Size;
-};
+#include "rtp_recv.h"
+#include "wav.h"
 
 // One for each session being recorded
 struct session {
   struct session *prev;
   struct session *next;
-  struct sockaddr sender;   // Sender's IP address and source port
+  struct sockaddr_storage sender; // Sender's IP address and source port
 
   char filename[PATH_MAX];
-  struct wav header;
-
   uint32_t ssrc;               // RTP stream source ID
   struct rtp_state rtp_state;
   
@@ -82,8 +58,7 @@ struct session {
   int channels;                // 1 (PCM_MONO) or 2 (PCM_STEREO)
   unsigned int samprate;
 
-  FILE *fp;                    // File being recorded
-  void *iobuffer;              // Big buffer to reduce write rate
+  struct wav_file wav;         // File being recorded
 
   int64_t SamplesWritten;
   int64_t TotalFileSamples;
@@ -103,7 +78,7 @@ char PCM_mcast_address_text[256];
 char const *Recordings = ".";
 char const *Wsprd_command = "wsprd -a %s/%u -o 2 -f %.6lf -w -d %s";
 
-struct sockaddr Sender;
+struct sockaddr_storage Sender;
 struct sockaddr Input_mcast_sockaddr;
 int Input_fd;
 struct session *Sessions;
@@ -188,6 +163,9 @@ int main(int argc,char *argv[]){
     fprintf(stderr,"Can't set up PCM input from %s, exiting\n",PCM_mcast_address_text);
     exit(1);
   }
+  // Have the kernel drop the other channels on the group
+  if(set_ssrc_filter(Input_fd,&Ssrc,1) != 0 && verbosity)
+    perror("set_ssrc_filter");
   int const n = 1 << 20; // 1 MB
   if(setsockopt(Input_fd,SOL_SOCKET,SO_RCVBUF,&n,sizeof(n)) == -1)
     perror("setsockopt");
@@ -273,6 +251,11 @@ void input_loop(){
 
    test_calculateAbsoluteDifference();
    // exit (0);
+    struct rtp_receiver receiver;
+    if(rtp_receiver_init(&receiver,0) == -1){
+        fprintf(stderr, "input_loop(): ERROR: can't allocate receive buffers\n");
+        exit(1);
+    }
 
     while ( loop_count > 0 ) {        /// In effect this is a forever() loop
         --loop_count;
@@ -323,192 +306,165 @@ void input_loop(){
             if ( verbosity > 3 ) {
                 fprintf(stderr, "input_loop(): FD_ISSET() => %d\n", FD_ISSET(Input_fd,&fdset));
             }
-            uint8_t buffer[PKTSIZE];
-            socklen_t socksize = sizeof(Sender);
-            int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&Sender,&socksize);
-            if(size <= 0){ 
-                perror("recvfrom");
+            int const count = rtp_recv(&receiver,Input_fd);
+            if(count < 0){ 
+                perror("recvmmsg");
                 usleep(50000);
                 if(verbosity > 0) {
-                    fprintf(stderr, "wd-record->input_loop(): ERROR: recvfrom() => %d\n", size);
+                    fprintf(stderr, "wd-record->input_loop(): ERROR: rtp_recv() => %d\n", count);
                 }
                 continue;
             }
-
-            if(size < RTP_MIN_SIZE) {
-                if(verbosity > 0) {
-                    fprintf(stderr, "wd-record->input_loop(): ERROR: recvfrom() => %d which is < RTP_MIN_SIZE %d\n", size, RTP_MIN_SIZE);
-                }
-                continue; 
-            }
-
-            struct rtp_header  rtp;
-            uint8_t const     *dp = ntoh_rtp(&rtp,buffer);
+            for(int i = 0; i < count; i++) {
+                // Header already in host format, padding removed and runts discarded
+                struct rtp_packet const * const pkt = &receiver.pkt[i];
+                struct rtp_header rtp = pkt->rtp;
+                uint8_t const *dp = pkt->data;
+                int const size = pkt->len;
  
-            if(rtp.ssrc != Ssrc) {
-                if(verbosity > 3) {
-                    fprintf(stderr, "input_loop(): discard data from rtp.ssrc %8d != Ssrc %8d\n", rtp.ssrc, Ssrc);
+                if(rtp.ssrc != Ssrc) {
+                    if(verbosity > 3) {
+                        fprintf(stderr, "input_loop(): discard data from rtp.ssrc %8d != Ssrc %8d\n", rtp.ssrc, Ssrc);
+                    }
+                    ++loop_count;   // So we process loop_count buffers of the SSRC packet stream
+                    continue;       // We are only processing one SSRC
                 }
-                ++loop_count;   // So we process loop_count buffers of the SSRC packet stream
-                continue;       // We are only processing one SSRC
-            }
-            if(verbosity > 2) {
-                fprintf(stderr, "input_loop(): got a %d byte buffer of SSRC %d data\n", size, Ssrc);
-            }
-
-            if(rtp.pad){
-                // Remove padding
-                size -= dp[size-1];
-                rtp.pad = 0;
-            }
-
-            if(size <= 0) {
-                if(verbosity > 0) {
-                    fprintf(stderr, "wd-record->input_loop(): ERROR: rtp buffer size is invalid value %d which is <= 0\n", size);
+                if(verbosity > 2) {
+                    fprintf(stderr, "input_loop(): got a %d byte buffer of SSRC %d data\n", size, Ssrc);
                 }
-                continue; // Bogus RTP header
-            }
-            if( verbosity > 2 ) {
-                fprintf(stderr, "input_loop(): rtp buffer size = %d\n",  size );
-            } 
-
-            // Find the first session which wants the SSRC or if none in found create a new session 
-            struct session *sp;
-            for( sp = Sessions; sp != NULL; sp=sp->next)  {
-                if(    sp->ssrc == rtp.ssrc
-                    && rtp.type == sp->type
-                    && address_match( &sp->sender, &Sender )) {
-                    if ( verbosity > 2 ) {
-                        fprintf(stderr, "input_loop(): found an exisiting session for SSRD %d\n", sp->ssrc);
+                memcpy(&Sender,&pkt->sender,sizeof(Sender));
+
+                // Find the first session which wants the SSRC or if none in found create a new session 
+                struct session *sp;
+                for( sp = Sessions; sp != NULL; sp=sp->next)  {
+                    if(    sp->ssrc == rtp.ssrc
+                        && rtp.type == sp->type
+                        && address_match( &sp->sender, &Sender )) {
+                        if ( verbosity > 2 ) {
+                            fprintf(stderr, "input_loop(): found an exisiting session for SSRD %d\n", sp->ssrc);
+                        }
+                        break;
                     }
-                    break;
                 }
-            }
  
-            int sample_offset_in_current_wav_file = -1;
-            if ( sp != NULL ) {
-                // We have already opened a wav file.  Make sure the samples in this RTP packet are for that file
-                if ( Searching_for_first_minute == 1 ) {
-                     if ( verbosity > 2 ) {
-                        fprintf(stderr, "input_loop(): Got RTP packet with timestamp rtp.timestamp=%u while searching for first second 0\n", rtp.timestamp);
+                int sample_offset_in_current_wav_file = -1;
+                if ( sp != NULL ) {
+                    // We have already opened a wav file.  Make sure the samples in this RTP packet are for that file
+                    if ( Searching_for_first_minute == 1 ) {
+                         if ( verbosity > 2 ) {
+                            fprintf(stderr, "input_loop(): Got RTP packet with timestamp rtp.timestamp=%u while searching for first second 0\n", rtp.timestamp);
+                        }
+                    } else {
+                        sample_offset_in_current_wav_file = calculateAbsoluteDifference( rtp.timestamp, sp->first_sample_number );
+                        if ( sample_offset_in_current_wav_file < 0 ) {
+                            if ( verbosity > 1 ) {
+                                fprintf(stderr, "input_loop(): WARNING: RTP packet with timestamp rtp.timestamp=%u which is less than the timestamp=%u of the first sample of the current wav file. Open new wav file.\n", rtp.timestamp, sp->first_sample_number);
+                            }
+                            close_session(&sp);
+                            sp = NULL;
+                            Searching_for_first_minute = 1;
+                            continue;
+                        }
+                        int      samples_per_minute =  sp->samprate * 60;
+                        uint32_t sample_number_of_first_sample_of_next_wav_file = sp->first_sample_number + samples_per_minute;
+                        if ( sample_offset_in_current_wav_file >= samples_per_minute ) {
+                            int sample_offset_in_next_wav_file = sample_offset_in_current_wav_file - samples_per_minute;
+                            if ( verbosity > 2 ) {
+                                fprintf(stderr, "input_loop(): after writing %7lld samples to wav file which should have %d samples in it, closing wav file because this new rtp packet is for offset %d in the next wav file.  rtp.timestamp=%u >= sample_number_of_first_sample_in_current_wav_file=%u\n",
+                                        (long long)sp->SamplesWritten, samples_per_minute, sample_offset_in_next_wav_file, rtp.timestamp, sample_number_of_first_sample_in_current_wav_file );
+                            }
+                            close_session(&sp);
+                            sp = NULL;
+                            sample_number_of_first_sample_in_current_wav_file = sample_number_of_first_sample_of_next_wav_file;
+                            sample_offset_in_current_wav_file = sample_offset_in_next_wav_file;
+                        }
                     }
-                } else {
-                    sample_offset_in_current_wav_file = calculateAbsoluteDifference( rtp.timestamp, sp->first_sample_number );
-                    if ( sample_offset_in_current_wav_file < 0 ) {
-                        if ( verbosity > 1 ) {
-                            fprintf(stderr, "input_loop(): WARNING: RTP packet with timestamp rtp.timestamp=%u which is less than the timestamp=%u of the first sample of the current wav file. Open new wav file.\n", rtp.timestamp, sp->first_sample_number);
+                }
+                if ( sp == NULL ) {
+                    // Open new session for new 1 minute wav fle
+                    if ( ( Searching_for_first_minute == 0 ) &&  ( current_second != 0 ) ) {
+                        if ( verbosity > 0 ) {
+                            fprintf(stderr, "wd-record->input_loop(): ERROR: opening new file at second %d, not expected second 0. The RX-888 sample rate is wrong or this server's NTP time is wrong.  Flushing RTP packets until the next second zero\n", current_second);
                         }
-                        close_session(&sp);
-                        sp = NULL;
                         Searching_for_first_minute = 1;
                         continue;
                     }
-                    int      samples_per_minute =  sp->samprate * 60;
-                    uint32_t sample_number_of_first_sample_of_next_wav_file = sp->first_sample_number + samples_per_minute;
-                    if ( sample_offset_in_current_wav_file >= samples_per_minute ) {
-                        int sample_offset_in_next_wav_file = sample_offset_in_current_wav_file - samples_per_minute;
-                        if ( verbosity > 2 ) {
-                            fprintf(stderr, "input_loop(): after writing %7lld samples to wav file which should have %d samples in it, closing wav file because this new rtp packet is for offset %d in the next wav file.  rtp.timestamp=%u >= sample_number_of_first_sample_in_current_wav_file=%u\n",
-                                    (long long)sp->SamplesWritten, samples_per_minute, sample_offset_in_next_wav_file, rtp.timestamp, sample_number_of_first_sample_in_current_wav_file );
+                    sp = create_session(&rtp, current_epoch, rtp.ssrc );	
+                    if ( sp == NULL ) {
+                        if ( verbosity > 0 ) {
+                            fprintf(stderr, "wd-record->input_loop(): ERROR: failed to open new wav file\n");
                         }
-                        close_session(&sp);
-                        sp = NULL;
-                        sample_number_of_first_sample_in_current_wav_file = sample_number_of_first_sample_of_next_wav_file;
-                        sample_offset_in_current_wav_file = sample_offset_in_next_wav_file;
-                    }
-                }
-            }
-            if ( sp == NULL ) {
-                // Open new session for new 1 minute wav fle
-                if ( ( Searching_for_first_minute == 0 ) &&  ( current_second != 0 ) ) {
-                    if ( verbosity > 0 ) {
-                        fprintf(stderr, "wd-record->input_loop(): ERROR: opening new file at second %d, not expected second 0. The RX-888 sample rate is wrong or this server's NTP time is wrong.  Flushing RTP packets until the next second zero\n", current_second);
+                        exit(1);
+                    }   
+                    sp->first_sample_number = sample_number_of_first_sample_in_current_wav_file;
+                    if ( verbosity > 2 ) { 
+                        fprintf(stderr, "input_loop(): opened new wav file for samples starting at sample #%u which is at wav file offset %d\n", sp->first_sample_number, sample_offset_in_current_wav_file );
                     }
-                    Searching_for_first_minute = 1;
-                    continue;
                 }
-                sp = create_session(&rtp, current_epoch, rtp.ssrc );	
-                if ( sp == NULL ) {
-                    if ( verbosity > 0 ) {
-                        fprintf(stderr, "wd-record->input_loop(): ERROR: failed to open new wav file\n");
-                    }
-                    exit(1);
-                }   
-                sp->first_sample_number = sample_number_of_first_sample_in_current_wav_file;
-                if ( verbosity > 2 ) { 
-                    fprintf(stderr, "input_loop(): opened new wav file for samples starting at sample #%u which is at wav file offset %d\n", sp->first_sample_number, sample_offset_in_current_wav_file );
-                }
-            }
 
-            if ( Searching_for_first_minute == 1 ) {
-                // We are waiting for the transition from second 59 to second 0 before starting to write data
-                if ( verbosity > 2 ) {
-                    fprintf(stderr, "input_loop(): searching for first data received in second 0\n");
-                }
-                if ( last_data_second != 59 ) {
-                    // The current second is 0-58, so toss the data
+                if ( Searching_for_first_minute == 1 ) {
+                    // We are waiting for the transition from second 59 to second 0 before starting to write data
                     if ( verbosity > 2 ) {
-                        fprintf(stderr, "input_loop(): tossing data during second %2d while searching for first data received in second 0\n", current_second);
+                        fprintf(stderr, "input_loop(): searching for first data received in second 0\n");
                     }
-                    last_data_second = current_second;
-                } else {
-                    // Last data second was second 59
-                    if ( current_second == 59 ) {
-                        // This is the second or more packet received during second 59
+                    if ( last_data_second != 59 ) {
+                        // The current second is 0-58, so toss the data
                         if ( verbosity > 2 ) {
-                            fprintf(stderr, "input_loop(): tossing the second or more data packet during second %2d while searching for first data received in second 0\n", current_second);
+                            fprintf(stderr, "input_loop(): tossing data during second %2d while searching for first data received in second 0\n", current_second);
                         }
+                        last_data_second = current_second;
                     } else {
-                        if ( current_second != 0 ) {
-                            // We appear to have missed receiving data during second 0, which would surprise me.
+                        // Last data second was second 59
+                        if ( current_second == 59 ) {
+                            // This is the second or more packet received during second 59
                             if ( verbosity > 2 ) {
-                                fprintf(stderr, "input_loop(): ERROR: unexpected transition from second %2d to second %d while missing data during second 0. Start searching for next second 0\n", last_data_second, current_second);
+                                fprintf(stderr, "input_loop(): tossing the second or more data packet during second %2d while searching for first data received in second 0\n", current_second);
                             }
-                            Searching_for_first_minute = 1;
-                            continue;
                         } else {
-                            sp->first_sample_number = rtp.timestamp;
-                            if ( verbosity > 2 ) {
-                                fprintf(stderr, "input_loop(): found first data after transition from second 59 to second 0, so sp->first_sample_number=%u.  Record to this wav file until we receive a pkt with timestamp >= %u\n", 
-                                        sp->first_sample_number, sp->first_sample_number + ( sp->samprate * 60 ) );
+                            if ( current_second != 0 ) {
+                                // We appear to have missed receiving data during second 0, which would surprise me.
+                                if ( verbosity > 2 ) {
+                                    fprintf(stderr, "input_loop(): ERROR: unexpected transition from second %2d to second %d while missing data during second 0. Start searching for next second 0\n", last_data_second, current_second);
+                                }
+                                Searching_for_first_minute = 1;
+                                continue;
+                            } else {
+                                sp->first_sample_number = rtp.timestamp;
+                                if ( verbosity > 2 ) {
+                                    fprintf(stderr, "input_loop(): found first data after transition from second 59 to second 0, so sp->first_sample_number=%u.  Record to this wav file until we receive a pkt with timestamp >= %u\n", 
+                                            sp->first_sample_number, sp->first_sample_number + ( sp->samprate * 60 ) );
+                                }
+                                Searching_for_first_minute = 0;
                             }
-                            Searching_for_first_minute = 0;
                         }
                     }
                 }
-            }
 
-            if ( Searching_for_first_minute == 1 ) {
-                // We are waiting for the transition from second 59 to second 0 before starting to write data
-                if ( verbosity > 2 ) {
-                    fprintf(stderr, "input_loop(): dumping data packet.  Search for the next one\n");
-                }
-            } else {
-                if ( verbosity > 2 ) {
-                    fprintf(stderr, "input_loop(): recording data packet to wav file\n");
-                }
-                // A "sample" is a single audio sample, usually 16 bits.
-                // A "frame" is the same as a sample for mono. It's two audio samples for stereo
-                int16_t const * const samples = (int16_t *)dp;
-                size -= (dp - buffer);
-                int const samp_count = size / sizeof(*samples); // number of individual audio samples (not frames)
-                int const frame_count = samp_count / sp->channels; // 1 every sample period (e.g., 4 for stereo 16-bit)
-                off_t const offset = rtp_process(&sp->rtp_state,&rtp,frame_count); // rtp timestamps refer to frames
-
-                // The seek offset relative to the current position in the file is the signed (modular) difference between
-                // the actual and expected RTP timestamps. This should automatically handle
-                // 32-bit RTP timestamp wraps, which occur every ~1 days at 48 kHz and only 6 hr @ 192 kHz
-                // Should I limit the range on this?
-                if(offset)
-                    fseeko(sp->fp,offset * sizeof(*samples) * sp->channels,SEEK_CUR); // offset is in bytes
-
-                sp->TotalFileSamples += samp_count + offset;
-                sp->SamplesWritten += samp_count;
-
-                // Packet samples are in big-endian order; write to .wav file in little-endian order
-                for(int n = 0; n < samp_count; n++){
-                    fputc(samples[n] >> 8,sp->fp);
-                    fputc(samples[n],sp->fp);
+                if ( Searching_for_first_minute == 1 ) {
+                    // We are waiting for the transition from second 59 to second 0 before starting to write data
+                    if ( verbosity > 2 ) {
+                        fprintf(stderr, "input_loop(): dumping data packet.  Search for the next one\n");
+                    }
+                } else {
+                    if ( verbosity > 2 ) {
+                        fprintf(stderr, "input_loop(): recording data packet to wav file\n");
+                    }
+                    // A "sample" is a single audio sample, usually 16 bits.
+                    // A "frame" is the same as a sample for mono. It's two audio samples for stereo
+                    int16_t const * const samples = (int16_t *)dp;
+                    int const samp_count = size / sizeof(*samples); // number of individual audio samples (not frames)
+                    int const frame_count = samp_count / sp->channels; // 1 every sample period (e.g., 4 for stereo 16-bit)
+                    off_t const offset = rtp_process(&sp->rtp_state,&rtp,frame_count); // rtp timestamps refer to frames
+
+                    // The seek offset relative to the current position in the file is the signed (modular) difference between
+                    // the actual and expected RTP timestamps. This should automatically handle
+                    // 32-bit RTP timestamp wraps, which occur every ~1 days at 48 kHz and only 6 hr @ 192 kHz
+                    // Should I limit the range on this?
+                    sp->TotalFileSamples += samp_count + offset;
+                    sp->SamplesWritten += samp_count;
+
+                    // Packet samples are in big-endian order; wav_write() puts them in little-endian order
+                    wav_write(&sp->wav,(int32_t)offset,samples,samp_count);
                 }
             }
         } // end of packet processing
@@ -520,10 +476,7 @@ void cleanup(void){
     // Flush and close each write stream
     // Be anal-retentive about freeing and clearing stuff even though we're about to exit
     struct session * const next_s = Sessions->next;
-    fflush(Sessions->fp);
-    fclose(Sessions->fp);
-    Sessions->fp = NULL;
-    FREE(Sessions->iobuffer);
+    wav_close(&Sessions->wav);
     FREE(Sessions);
     Sessions = next_s;
   }
@@ -593,12 +546,17 @@ struct session *create_session(
     }
     // Use fdopen on a file descriptor instead of fopen(,"w+") to avoid the implicit truncation
     // This allows testing where we're killed and rapidly restarted in the same cycle
-    sp->fp = fdopen(fd,"w+");
+    if(wav_open(&sp->wav,fd,sp->samprate,sp->channels) == -1){
+        if ( verbosity > 0 ) {
+            fprintf(stderr,"wd-record->create_session(): ERROR: can't open stream on %s: %s\n",sp->filename,strerror(errno));
+        }
+        FREE(sp);
+        exit(1);
+    }
     if( verbosity > 2) {
         fprintf(stderr,"create_session(): creating %s with sample rate of %d\n",sp->filename, sp->samprate);
     }
 
-    assert(sp->fp != NULL);
     // file create succeded, now put us at top of list
     sp->prev = NULL;
     sp->next = Sessions;
@@ -608,9 +566,6 @@ struct session *create_session(
 
     Sessions = sp;
 
-    sp->iobuffer = malloc(BUFFERSIZE);
-    setbuffer(sp->fp,sp->iobuffer,BUFFERSIZE);
-
     fcntl(fd,F_SETFL,O_NONBLOCK); // Let's see if this keeps us from losing data
 
     attrprintf(fd,"samplerate","%lu",(unsigned long)sp->samprate);
@@ -618,24 +573,6 @@ struct session *create_session(
     attrprintf(fd,"ssrc","%u",rtp->ssrc);
     attrprintf(fd,"sampleformat","s16le");
 
-    // Write .wav header, skipping size fields
-    memcpy(sp->header.ChunkID,"RIFF", 4);
-    sp->header.ChunkSize = 0xffffffff; // Temporary
-    memcpy(sp->header.Format,"WAVE",4);
-    memcpy(sp->header.Subchunk1ID,"fmt ",4);
-    sp->header.Subchunk1Size = 16;
-    sp->header.AudioFormat = 1;
-    sp->header.NumChannels = sp->channels;
-    sp->header.SampleRate = sp->samprate;
-
-    sp->header.ByteRate = sp->samprate * sp->channels * 16/8;
-    sp->header.BlockAlign = sp->channels * 16/8;
-    sp->header.BitsPerSample = 16;
-    memcpy(sp->header.SubChunk2ID,"data",4);
-    sp->header.Subchunk2Size = 0xffffffff; // Temporary
-    fwrite(&sp->header,sizeof(sp->header),1,sp->fp);
-    fflush(sp->fp); // get at least the header out there
-
     char sender_text[NI_MAXHOST];
     // Don't wait for an inverse resolve that might cause us to lose data
     getnameinfo((struct sockaddr *)&Sender,sizeof(Sender),sender_text,sizeof(sender_text),NULL,0,NI_NOFQDN|NI_DGRAM|NI_NUMERICHOST);
@@ -658,10 +595,8 @@ void flush_session(struct session **p){
 	   (float)sp->SamplesWritten / sp->samprate,
 	   (float)sp->TotalFileSamples / sp->samprate);
   
-  if(sp->fp != NULL){
-    // Get final file size, write .wav header with sizes
-    fflush(sp->fp);
-  }
+  if(sp->wav.fp != NULL)
+    fflush(sp->wav.fp);
   return;
 }
  
@@ -677,20 +612,8 @@ void close_session(struct session **p){
 	   (float)sp->SamplesWritten / sp->samprate,
 	   (float)sp->TotalFileSamples / sp->samprate);
   
-  if(sp->fp != NULL){
-    // Get final file size, write .wav header with sizes
-    fflush(sp->fp);
-    struct stat statbuf;
-    fstat(fileno(sp->fp),&statbuf);
-    sp->header.ChunkSize = statbuf.st_size - 8;
-    sp->header.Subchunk2Size = statbuf.st_size - sizeof(sp->header);
-    rewind(sp->fp);
-    fwrite(&sp->header,sizeof(sp->header),1,sp->fp);
-    fflush(sp->fp);
-    fclose(sp->fp);
-    sp->fp = NULL;
-  }
-  FREE(sp->iobuffer);
+  if(sp->wav.fp != NULL)
+    wav_close(&sp->wav); // Writes final sizes into the .wav header
   if(sp->prev)
     sp->prev->next = sp->next;
   else
@@ -54,8 +54,10 @@ void *demod_wfm(void *arg){
   struct filter_out mono;
   struct filter_out lminusr;
   struct filter_out pilot;
+  struct filter_out rds_filter;
+  int rds_L = 0; // RDS filter output length; 0 if not created
 
-  float phase_memory = 0;  // Demodulator input phase memory
+  complex float phase_memory = 0;  // Demodulator input memory (last IF sample of previous block)
 
   // NB: this is the sample rate from the FM demodulator, which is much faster than the actual audio output sample rate
   // forced to be fast enough for 200 kHz broadcast channel
@@ -80,7 +82,7 @@ void *demod_wfm(void *arg){
   const int audio_L = roundf(Audio_samprate * Blocktime * .001);
 
   // Composite signal 50 Hz - 15 kHz contains mono (L+R) signal
-  create_filter_input(&composite,composite_L,composite_M,REAL);
+  create_filter_input(&composite,composite_L,composite_M,REAL,FFT_SHORT);
 
   assert(composite.ilen == chan->filter.out.olen);
 
@@ -104,6 +106,18 @@ void *demod_wfm(void *arg){
 
   set_filter(&lminusr,-15000./Audio_samprate, 15000./Audio_samprate, chan->filter.kaiser_beta);
 
+  // RDS on a DSBSC subcarrier at 57 kHz (3x pilot), extends +/- 2.4 kHz
+  // Decimated to 19 kHz, 16 samples per RDS bit. Always created so it can be turned on while running,
+  // but only executed when enabled. Skipped if the block time doesn't give an integral output length
+  rds_L = roundf(RDS_SAMPRATE * Blocktime * .001);
+  if((long)rds_L * Composite_samprate != (long)RDS_SAMPRATE * composite_L)
+    rds_L = 0;
+  if(rds_L > 0){
+    create_filter_output(&rds_filter,&composite,NULL,rds_L,COMPLEX);
+    set_filter(&rds_filter,-2400./RDS_SAMPRATE,2400./RDS_SAMPRATE,chan->filter.kaiser_beta);
+  }
+  rds_init(&chan->rds);
+
   // The asserts should be valid for clean sample rates multiples of 50/100 Hz (20/10 ms)
   // If not, then a mop-up oscillator has to be provided
   int pilot_shift;
@@ -116,8 +130,13 @@ void *demod_wfm(void *arg){
   compute_tuning(composite_N,composite_M,Composite_samprate,&subc_shift,&subc_remainder,38000.);
   assert((subc_shift % 4) == 0 && subc_remainder == 0);
 
-  complex float stereo_deemph = 0;
-  float mono_deemph = 0;
+  int rds_shift;
+  double rds_remainder;
+  compute_tuning(composite_N,composite_M,Composite_samprate,&rds_shift,&rds_remainder,RDS_CARRIER);
+  assert((rds_shift % 4) == 0 && rds_remainder == 0);
+
+  struct iir stereo_deemph = {0}; // L and R, interleaved
+  struct iir mono_deemph = {0};
 
   realtime();
 
@@ -171,13 +190,8 @@ void *demod_wfm(void *arg){
       continue;
     }
     // Actual FM chanulation
-    for(int n=0; n < composite_L; n++){
-      // Although deviation can be zero, argf() is defined as returning 0, not NAN
-      float np = M_1_PIf * cargf(buffer[n]); // -1 to +1
-      float x = np - phase_memory;
-      phase_memory = np;
-      composite.input_write_pointer.r[n] = x > 1 ? x - 2 : x < -1 ? x + 2 : x; // reduce difference to -1 to +1
-    } // for(int n=0; n < composite_L; n++){
+    // Output is -1 to +1 (half rotations); zero-amplitude samples give 0, not NAN
+    fm_discriminate(composite.input_write_pointer.r,buffer,composite_L,&phase_memory);
     if(squelch_state == squelch_state_max){
       // Squelch fully open; look at deviation peaks
       float peak_positive_deviation = 0;
@@ -206,8 +220,13 @@ void *demod_wfm(void *arg){
       chan->fm.pdeviation = max(peak_positive_deviation,-peak_negative_deviation);
     }
     // Filter & decimate to audio output sample rate
-    execute_filter_input(&composite);  // Composite at 384 kHz
+    // write_rfilter advances the input write pointer past the block just demodulated
+    write_rfilter(&composite,NULL,composite_L);  // Composite at 384 kHz
     execute_filter_output(&mono,0);    // L+R composite at 48 kHz
+    if(chan->fm.rds && rds_L > 0){
+      execute_filter_output(&rds_filter,rds_shift); // 57 kHz subcarrier spun to 0 Hz, 19 kHz rate
+      rds_process(&chan->rds,rds_filter.output.c,rds_L);
+    }
     // Compute audio output level
     // Constant gain used by FM only; automatically adjusted by AGC in linear modes
     // We do this in the loop because headroom and BW can change
@@ -244,11 +263,14 @@ void *demod_wfm(void *arg){
 	// demultiplex: 2L = (L+R) + (L-R); 2R = (L+R) - (L-R)
 	// L+R = mono.output.r[n]; L-R = subc_info
 	// real(s) = L, imag(s) = R
-	float complex s = mono.output.r[n] + subc_info + I * (mono.output.r[n] - subc_info);
-	if(chan->fm.rate != 0)
-	  s = stereo_deemph += chan->fm.rate * (chan->fm.gain * s - stereo_deemph);
-
-	stereo_buffer[n] = s * chan->output.gain;
+	stereo_buffer[n] = mono.output.r[n] + subc_info + I * (mono.output.r[n] - subc_info);
+      }
+      if(chan->fm.rate != 0){
+	iir_lowpass1(&stereo_deemph,0,chan->fm.rate,chan->fm.gain);
+	iir_filter(&stereo_deemph,(float *)stereo_buffer,audio_L,2);
+      }
+      for(int n = 0; n < audio_L; n++){
+	stereo_buffer[n] *= chan->output.gain;
 	output_level += cnrmf(stereo_buffer[n]);
       }
       output_level /= (2 * audio_L); // Halve power to get level per channel
@@ -261,11 +283,10 @@ void *demod_wfm(void *arg){
       float output_level = 0;
       if(chan->fm.rate != 0){
 	// Apply deemphasis
-	for(int n=0; n < audio_L; n++){
-	  float s = mono_deemph += chan->fm.rate * (chan->fm.gain * mono.output.r[n] - mono_deemph);
-	  mono.output.r[n] = s;
-	  output_level += s * s;
-	}
+	iir_lowpass1(&mono_deemph,0,chan->fm.rate,chan->fm.gain);
+	iir_filter(&mono_deemph,mono.output.r,audio_L,1);
+	for(int n=0; n < audio_L; n++)
+	  output_level += mono.output.r[n] * mono.output.r[n];
       } else {
 	for(int n=0; n < audio_L; n++){
 	  float s = mono.output.r[n] *= chan->output.gain;
@@ -287,6 +308,8 @@ void *demod_wfm(void *arg){
   delete_filter_output(&mono);
   delete_filter_output(&lminusr);
   delete_filter_output(&pilot);
+  if(rds_L > 0)
+    delete_filter_output(&rds_filter);
   delete_filter_input(&composite);
 
   return NULL;